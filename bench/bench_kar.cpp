@@ -0,0 +1,943 @@
+/**
+ * KAR 基准套件
+ *
+ * 覆盖：
+ * - CRC32 各引擎的吞吐（4 KB / 1 MB 缓冲区）
+ * - 按文件大小分类的 pack / unpack / verify 吞吐：small / medium / large / deep / mixed，
+ *   分类与大小范围同 scripts/generate_test_data.py（数据由本程序按固定种子生成）；
+ *   另有 skewed：少量大文件混在大量小文件中
+ * - 热缓存与冷缓存（冷缓存：写回脏页后逐文件 POSIX_FADV_DONTNEED，无需 root；
+ *   非 Linux 平台逐文件设置 F_NOCACHE，尽力而为）
+ * - 线程数扩展（默认 1, 2, 4, 8, 16 中不超过 CPU 核数的值，以及 CPU 核数），
+ *   结束时列出各用例相对 1 线程的加速比与并行效率
+ * - 调度器微基准 sched/steal 与 sched/queue：同一组倾斜任务（大量 4 KB CRC 任务夹少量 8 MB 任务）
+ *   分别交给工作窃取线程池与单个加锁队列的线程池
+ *
+ * 每个用例重复 --repeat 次，取耗时中位数计算 MB/s（1 MB = 2^20 字节）与 files/s；
+ * 单条目延迟为相邻条目完成回调的间隔（全部重复合并后取 p50 / p99）；
+ * 峰值 RSS 为本次用例期间的 VmHWM（每个用例前经 /proc/self/clear_refs 复位）；
+ * 非 Linux 平台为 getrusage 的 ru_maxrss（进程启动以来的峰值，无法复位）。
+ *
+ * 结果写为 JSON，每个用例一行；--baseline 与旧结果逐用例对比，
+ * 吞吐下降超过 --threshold 百分比时列出并返回 1。
+ *
+ * 使用方法
+ * # 编译并运行（从项目根目录），结果写到 bench_results.json
+ * make bench
+ * # 只跑部分用例，与基准对比
+ * ./bench_kar --filter pack/small --threads 1,4 --baseline old.json
+ */
+
+#include "../src/archiver.hpp"
+#include "../src/stage_stats.hpp"
+#include "../src/thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../include/crc32.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr double kMB = 1024.0 * 1024.0;
+
+// 防止编译器把结果优化掉
+volatile uint32_t g_sink = 0;
+
+// ============================================
+// 命令行选项
+// ============================================
+
+struct BenchOptions {
+  std::string json = "bench_results.json"; // "-" 表示标准输出
+  std::string baseline;                    // 空表示不对比
+  double threshold = 10;                   // 吞吐回退阈值（百分比）
+  std::vector<std::string> filters;        // 用例名包含任一子串时运行
+  std::vector<unsigned> threads;           // 空表示默认列表
+  unsigned repeat = 3;
+  double scale = 1.0;                      // 文件数量倍数
+  fs::path work_dir = "bench_tmp";
+  fs::path data_dir;                       // 非空时追加 custom 数据集
+  bool cold = true;
+  bool adaptive = true;                    // 追加自适应并发用例
+  bool keep = false;                       // 保留生成的数据
+  CpuAffinity affinity = CpuAffinity::None;
+};
+
+void print_usage(const char *prog) {
+  std::cout
+      << "Usage: " << prog << " [options]\n"
+      << "\nOptions:\n"
+      << "  --json FILE       结果文件（默认 bench_results.json，- 为标准输出）\n"
+      << "  --baseline FILE   与旧结果对比，吞吐回退超过阈值时返回 1\n"
+      << "  --threshold PCT   回退阈值百分比（默认 10）\n"
+      << "  --filter STR      只运行名称包含 STR 的用例（可重复）\n"
+      << "  --threads LIST    线程数列表，如 1,2,8（默认 1,2,4,8,16 中不超过 CPU 核数者与 CPU 核数）\n"
+      << "  --affinity MODE   工作线程的 CPU 绑定：none | compact | scatter（默认 none）\n"
+      << "  --repeat N        每个用例的重复次数（默认 3）\n"
+      << "  --scale F         文件数量倍数（默认 1，约 90 MB）\n"
+      << "  --data DIR        追加一个现有目录作为 custom 数据集\n"
+      << "  --work-dir DIR    生成数据与归档的目录（默认 bench_tmp）\n"
+      << "  --no-cold         跳过冷缓存用例\n"
+      << "  --no-adaptive     跳过自适应并发用例（tauto：线程上限为列表中的最大值）\n"
+      << "  --keep            结束后保留生成的数据\n";
+}
+
+std::vector<unsigned> parse_thread_list(const std::string &list) {
+  std::vector<unsigned> threads;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    const unsigned n = static_cast<unsigned>(std::stoul(item));
+    if (n == 0) {
+      throw std::invalid_argument("--threads values must be positive");
+    }
+    threads.push_back(n);
+  }
+  return threads;
+}
+
+BenchOptions parse_args(int argc, char *argv[]) {
+  BenchOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    auto next_value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        throw std::invalid_argument(arg + " requires a value");
+      }
+      return argv[++i];
+    };
+    if (arg == "--json") {
+      options.json = next_value();
+    } else if (arg == "--baseline") {
+      options.baseline = next_value();
+    } else if (arg == "--threshold") {
+      options.threshold = std::stod(next_value());
+    } else if (arg == "--filter") {
+      options.filters.push_back(next_value());
+    } else if (arg == "--threads") {
+      options.threads = parse_thread_list(next_value());
+    } else if (arg == "--affinity") {
+      options.affinity = parse_cpu_affinity(next_value());
+    } else if (arg == "--repeat") {
+      options.repeat =
+          std::max(1u, static_cast<unsigned>(std::stoul(next_value())));
+    } else if (arg == "--scale") {
+      options.scale = std::stod(next_value());
+    } else if (arg == "--data") {
+      options.data_dir = next_value();
+    } else if (arg == "--work-dir") {
+      options.work_dir = next_value();
+    } else if (arg == "--no-cold") {
+      options.cold = false;
+    } else if (arg == "--no-adaptive") {
+      options.adaptive = false;
+    } else if (arg == "--keep") {
+      options.keep = true;
+    } else if (arg == "--help" || arg == "-h") {
+      print_usage(argv[0]);
+      std::exit(0);
+    } else {
+      throw std::invalid_argument("Unknown option: " + arg);
+    }
+  }
+  if (options.threads.empty()) {
+    const unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned n : {1u, 2u, 4u, 8u, 16u, cpus}) {
+      if (n <= cpus && std::find(options.threads.begin(), options.threads.end(),
+                                 n) == options.threads.end()) {
+        options.threads.push_back(n);
+      }
+    }
+  }
+  return options;
+}
+
+// ============================================
+// 测量工具
+// ============================================
+
+// 复位本进程的峰值 RSS（Linux 4.0 起支持；失败时峰值为进程启动以来的最大值）
+void reset_peak_rss() {
+#if defined(__linux__)
+  std::ofstream clear("/proc/self/clear_refs");
+  clear << "5";
+#endif
+}
+
+long peak_rss_kb() {
+#if defined(__linux__)
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmHWM:", 0) == 0) {
+      return std::strtol(line.c_str() + 6, nullptr, 10);
+    }
+  }
+#endif
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return usage.ru_maxrss / 1024; // macOS 的 ru_maxrss 以字节为单位
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+double percentile(std::vector<double> samples, double p) {
+  if (samples.empty()) {
+    return 0;
+  }
+  std::sort(samples.begin(), samples.end());
+  size_t rank = static_cast<size_t>(std::ceil(p * samples.size()));
+  return samples[std::min(samples.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+// 冷缓存：先写回脏页（脏页无法丢弃），再逐文件请求内核丢弃页缓存；
+// 非 Linux 平台没有 POSIX_FADV_DONTNEED，退回 F_NOCACHE
+void drop_cache(const fs::path &path) {
+  ::sync();
+  auto drop = [](const fs::path &file) {
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+#if defined(__linux__)
+      ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#elif defined(F_NOCACHE)
+      ::fcntl(fd, F_NOCACHE, 1);
+#endif
+      ::close(fd);
+    }
+  };
+  if (fs::is_regular_file(path)) {
+    drop(path);
+    return;
+  }
+  for (const auto &entry : fs::recursive_directory_iterator(path)) {
+    if (entry.is_regular_file()) {
+      drop(entry.path());
+    }
+  }
+}
+
+// 单条目延迟：相邻两次条目完成回调的间隔（大条目的分块回调不计）
+class LatencyRecorder : public ArchiveObserver {
+public:
+  explicit LatencyRecorder(std::vector<double> &samples) : samples_(samples) {}
+
+  void start() {
+    done_ = 0;
+    last_ = Clock::now();
+  }
+
+  void on_progress(const ArchiveProgress &progress) override {
+    if (progress.entries_done == done_) {
+      return;
+    }
+    done_ = progress.entries_done;
+    const auto now = Clock::now();
+    samples_.push_back(
+        std::chrono::duration<double, std::milli>(now - last_).count());
+    last_ = now;
+  }
+
+private:
+  std::vector<double> &samples_;
+  uint64_t done_ = 0;
+  Clock::time_point last_;
+};
+
+// ============================================
+// 数据集生成
+// ============================================
+
+struct Dataset {
+  std::string name;
+  fs::path dir;
+  uint64_t files = 0;
+  uint64_t bytes = 0;
+};
+
+// 固定种子的数据生成器：文本内容（可压缩）或随机字节（不可压缩）
+class Generator {
+public:
+  explicit Generator(uint64_t seed) : state_(seed) {}
+
+  uint64_t next() {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 7;
+    state_ ^= state_ << 17;
+    return state_;
+  }
+
+  size_t between(size_t lo, size_t hi) { return lo + next() % (hi - lo + 1); }
+
+  void write_file(Dataset &dataset, const fs::path &rel, size_t size,
+                  bool binary = false) {
+    static const char chars[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+        "!\"#$%&'()*+,-./:;<=>?@[]^_{|}~\n ";
+    buffer_.resize(size);
+    for (size_t i = 0; i < size; i += 8) {
+      uint64_t v = next();
+      for (size_t j = i; j < std::min(size, i + 8); ++j, v >>= 8) {
+        buffer_[j] = binary ? static_cast<char>(v)
+                            : chars[(v & 0xff) % (sizeof(chars) - 1)];
+      }
+    }
+    const fs::path path = dataset.dir / rel;
+    fs::create_directories(path.parent_path());
+    std::ofstream(path, std::ios::binary).write(buffer_.data(), size);
+    ++dataset.files;
+    dataset.bytes += size;
+  }
+
+private:
+  uint64_t state_;
+  std::string buffer_;
+};
+
+size_t scaled(size_t count, double scale) {
+  return std::max<size_t>(1, static_cast<size_t>(std::lround(count * scale)));
+}
+
+// 各分类的数量与大小范围同 scripts/generate_test_data.py 的默认配置
+std::vector<Dataset> generate_datasets(const BenchOptions &options) {
+  std::vector<Dataset> datasets;
+  auto make = [&](const std::string &name) -> Dataset & {
+    datasets.push_back(Dataset{name, options.work_dir / "data" / name});
+    fs::remove_all(datasets.back().dir);
+    fs::create_directories(datasets.back().dir);
+    return datasets.back();
+  };
+  Generator gen(42);
+
+  Dataset &small = make("small"); // 1-10 KB，分散到三个子目录
+  const char *subdirs[] = {"tiny", "small", "micro"};
+  for (size_t i = 0, n = scaled(100, options.scale); i < n; ++i) {
+    gen.write_file(small,
+                   fs::path(subdirs[gen.next() % 3]) /
+                       ("file_" + std::to_string(i) + ".txt"),
+                   gen.between(1024, 10 * 1024));
+  }
+
+  Dataset &medium = make("medium"); // 100 KB - 1 MB
+  for (size_t i = 0, n = scaled(20, options.scale); i < n; ++i) {
+    gen.write_file(medium, "medium_" + std::to_string(i) + ".dat",
+                   gen.between(100 * 1024, 1024 * 1024));
+  }
+
+  Dataset &large = make("large"); // 5-20 MB
+  for (size_t i = 0, n = scaled(5, options.scale); i < n; ++i) {
+    gen.write_file(large, "large_" + std::to_string(i) + ".bin",
+                   gen.between(5 * 1024 * 1024, 20 * 1024 * 1024));
+  }
+
+  Dataset &deep = make("deep"); // 每层一个小文件，最深层 5 个
+  fs::path level;
+  for (size_t i = 0, n = scaled(10, options.scale); i < n; ++i) {
+    gen.write_file(deep, level / ("level_file_" + std::to_string(i) + ".txt"),
+                   gen.between(100, 1000));
+    level /= "level_" + std::to_string(i);
+  }
+  for (int i = 0; i < 5; ++i) {
+    gen.write_file(deep, level / ("deep_file_" + std::to_string(i) + ".txt"),
+                   gen.between(1024, 10 * 1024));
+  }
+
+  Dataset &mixed = make("mixed"); // 模拟项目：源码、头文件、配置、日志与二进制
+  for (size_t i = 0, n = scaled(20, options.scale); i < n; ++i) {
+    gen.write_file(mixed, "src/module_" + std::to_string(i) + ".cpp",
+                   gen.between(600, 2200));
+  }
+  for (size_t i = 0, n = scaled(15, options.scale); i < n; ++i) {
+    gen.write_file(mixed, "include/header_" + std::to_string(i) + ".h",
+                   gen.between(60, 120));
+  }
+  gen.write_file(mixed, "config/app.conf", 1024);
+  for (size_t i = 0, n = scaled(10, options.scale); i < n; ++i) {
+    gen.write_file(mixed, "logs/app_" + std::to_string(i) + ".log",
+                   gen.between(3000, 5000));
+  }
+  for (size_t i = 0, n = scaled(2, options.scale); i < n; ++i) {
+    gen.write_file(mixed, "assets/blob_" + std::to_string(i) + ".bin",
+                   gen.between(100 * 1024, 1024 * 1024), true);
+  }
+
+  Dataset &skewed = make("skewed"); // 倾斜负载：两个大文件 + 大量小文件
+  for (size_t i = 0, n = scaled(2, options.scale); i < n; ++i) {
+    gen.write_file(skewed, "images/disk_" + std::to_string(i) + ".img",
+                   24 * 1024 * 1024, true);
+  }
+  for (size_t i = 0, n = scaled(2000, options.scale); i < n; ++i) {
+    gen.write_file(skewed,
+                   fs::path("files") / std::to_string(i % 20) /
+                       ("f_" + std::to_string(i) + ".txt"),
+                   gen.between(512, 4096));
+  }
+
+  if (!options.data_dir.empty()) {
+    Dataset custom{"custom", options.data_dir};
+    for (const auto &entry : fs::recursive_directory_iterator(custom.dir)) {
+      if (entry.is_regular_file()) {
+        ++custom.files;
+        custom.bytes += entry.file_size();
+      }
+    }
+    datasets.push_back(custom);
+  }
+  return datasets;
+}
+
+// ============================================
+// 用例与结果
+// ============================================
+
+struct BenchResult {
+  std::string name;
+  std::string op; // crc32 / sched / pack / unpack / verify
+  std::string dataset;
+  std::string cache; // warm / cold
+  unsigned threads = 0;
+  uint64_t files = 0;
+  uint64_t bytes = 0;
+  double seconds = 0; // 重复中的耗时中位数
+  double mb_s = 0;
+  double files_s = 0; // sched 用例为 tasks/s
+  double p50_ms = 0;
+  double p99_ms = 0;
+  long peak_rss_kb = 0;
+};
+
+bool selected(const BenchOptions &options, const std::string &name) {
+  if (options.filters.empty()) {
+    return true;
+  }
+  for (const auto &filter : options.filters) {
+    if (name.find(filter) != std::string::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void print_result(std::ostream &out, const BenchResult &r) {
+  char line[256];
+  if (r.op == "crc32") {
+    std::snprintf(line, sizeof(line), "%-34s %10.1f MB/s\n", r.name.c_str(),
+                  r.mb_s);
+  } else if (r.op == "sched") {
+    std::snprintf(line, sizeof(line), "%-34s %10.1f MB/s %10.0f tasks/s\n",
+                  r.name.c_str(), r.mb_s, r.files_s);
+  } else {
+    std::snprintf(line, sizeof(line),
+                  "%-34s %10.1f MB/s %10.0f files/s  p50 %8.3f ms  p99 %8.3f "
+                  "ms  rss %7ld KB\n",
+                  r.name.c_str(), r.mb_s, r.files_s, r.p50_ms, r.p99_ms,
+                  r.peak_rss_kb);
+  }
+  out << line;
+  out.flush();
+}
+
+BenchResult bench_crc(CRC32Engine engine, size_t block_size) {
+  std::vector<uint8_t> data(16 * 1024 * 1024);
+  Generator gen(7);
+  for (auto &byte : data) {
+    byte = static_cast<uint8_t>(gen.next());
+  }
+  const CRC32 crc32(engine);
+  const size_t total_bytes = 256ull * 1024 * 1024;
+  size_t processed = 0;
+  uint32_t acc = 0;
+  const auto start = Clock::now();
+  while (processed < total_bytes) {
+    for (size_t off = 0; off + block_size <= data.size(); off += block_size) {
+      acc ^= crc32.calculate(data.data() + off, block_size);
+      processed += block_size;
+    }
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  g_sink = acc;
+
+  BenchResult r;
+  r.name = std::string("crc32/") + CRC32::engine_name(engine) + "/" +
+           (block_size >= 1024 * 1024 ? "1MB" : "4KB");
+  r.op = "crc32";
+  r.bytes = processed;
+  r.seconds = seconds;
+  r.mb_s = processed / kMB / seconds;
+  return r;
+}
+
+// 对照组：单个加锁队列的固定线程池（docs/parallel_archive_design.md 的原方案）
+class SharedQueuePool {
+public:
+  explicit SharedQueuePool(unsigned threads) {
+    for (unsigned i = 0; i < threads; ++i) {
+      workers_.emplace_back([this] {
+        std::function<void()> job;
+        while (jobs_.pop(job)) {
+          job();
+        }
+      });
+    }
+  }
+  void submit(std::function<void()> job) { jobs_.push(std::move(job)); }
+  void wait_all() {
+    jobs_.stop();
+    for (auto &worker : workers_) {
+      worker.join();
+    }
+  }
+
+private:
+  std::vector<std::thread> workers_;
+  ThreadSafeQueue<std::function<void()>> jobs_;
+};
+
+// 调度器微基准：20000 个 4 KB CRC 任务中随机夹 16 个 8 MB 任务，全部由当前线程提交
+template <typename Pool>
+BenchResult bench_scheduler(const BenchOptions &options, const char *kind,
+                            unsigned threads) {
+  static const std::vector<uint8_t> data = [] {
+    std::vector<uint8_t> bytes(8 * 1024 * 1024);
+    Generator gen(11);
+    for (auto &byte : bytes) {
+      byte = static_cast<uint8_t>(gen.next());
+    }
+    return bytes;
+  }();
+  constexpr size_t kSmallTasks = 20000;
+  constexpr size_t kLargeTasks = 16;
+  std::vector<size_t> sizes(kSmallTasks, 4096);
+  Generator gen(5);
+  for (size_t i = 0; i < kLargeTasks; ++i) {
+    sizes.insert(sizes.begin() + static_cast<std::ptrdiff_t>(gen.next() % sizes.size()),
+                 data.size());
+  }
+
+  BenchResult r;
+  r.op = "sched";
+  r.dataset = "skewed";
+  r.cache = "warm";
+  r.threads = threads;
+  r.name = std::string("sched/") + kind + "/t" + std::to_string(threads);
+  r.files = sizes.size();
+  std::vector<double> seconds;
+  for (unsigned i = 0; i < options.repeat; ++i) {
+    std::atomic<uint32_t> acc{0};
+    const auto start = Clock::now();
+    {
+      Pool pool(threads);
+      for (size_t size : sizes) {
+        pool.submit([&, size] {
+          acc.fetch_xor(CRC32().calculate(data.data(), size),
+                        std::memory_order_relaxed);
+        });
+      }
+      pool.wait_all();
+    }
+    seconds.push_back(
+        std::chrono::duration<double>(Clock::now() - start).count());
+    g_sink = acc;
+  }
+  for (size_t size : sizes) {
+    r.bytes += size;
+  }
+  r.seconds = median(seconds);
+  r.mb_s = r.bytes / kMB / r.seconds;
+  r.files_s = r.files / r.seconds;
+  return r;
+}
+
+// 一个 pack / unpack / verify 用例：重复 repeat 次，每次前清理输出（冷缓存时再丢弃输入缓存）。
+// adaptive 时以 threads 为上限自适应调整（用例名为 tauto，threads 记为 0）
+BenchResult bench_archive(const BenchOptions &options, const Dataset &dataset,
+                          const std::string &op, unsigned threads, bool cold,
+                          const fs::path &archive, bool adaptive = false) {
+  BenchResult r;
+  r.op = op;
+  r.dataset = dataset.name;
+  r.threads = adaptive ? 0 : threads;
+  r.cache = cold ? "cold" : "warm";
+  r.name = op + "/" + dataset.name + "/t" +
+           (adaptive ? std::string("auto") : std::to_string(threads)) + "/" +
+           r.cache;
+  r.files = dataset.files;
+  r.bytes = dataset.bytes;
+
+  ArchiverOptions archiver_options;
+  archiver_options.threads = threads;
+  archiver_options.adaptive = adaptive;
+  archiver_options.affinity = options.affinity;
+  std::vector<double> latencies;
+  std::vector<double> seconds;
+  const fs::path output = options.work_dir / (dataset.name + ".out");
+  const fs::path packed = options.work_dir / (dataset.name + ".out.kar");
+
+  reset_peak_rss();
+  for (unsigned i = 0; i < options.repeat; ++i) {
+    fs::remove_all(output);
+    fs::remove(packed);
+    if (cold) {
+      drop_cache(op == "pack" ? dataset.dir : archive);
+    }
+    Archiver archiver(archiver_options);
+    LatencyRecorder recorder(latencies);
+    archiver.set_observer(&recorder);
+    recorder.start();
+    const auto start = Clock::now();
+    if (op == "pack") {
+      archiver.pack(dataset.dir, packed);
+    } else if (op == "verify") {
+      archiver.verify(archive);
+    } else {
+      archiver.unpack(archive, output);
+    }
+    seconds.push_back(
+        std::chrono::duration<double>(Clock::now() - start).count());
+  }
+  r.peak_rss_kb = peak_rss_kb();
+  fs::remove_all(output);
+  fs::remove(packed);
+
+  r.seconds = median(seconds);
+  r.mb_s = r.bytes / kMB / r.seconds;
+  r.files_s = r.files / r.seconds;
+  r.p50_ms = percentile(latencies, 0.50);
+  r.p99_ms = percentile(latencies, 0.99);
+  return r;
+}
+
+// ============================================
+// JSON 输出与基准对比
+// ============================================
+
+std::string json_escape(const std::string &s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += c;
+  }
+  return out;
+}
+
+void write_json(std::ostream &out, const std::vector<BenchResult> &results) {
+  char timestamp[32];
+  const std::time_t now = std::time(nullptr);
+  std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S",
+                std::localtime(&now));
+  out << "{\n";
+  out << "  \"version\": 1,\n";
+  out << "  \"timestamp\": \"" << timestamp << "\",\n";
+  out << "  \"cpus\": " << std::thread::hardware_concurrency() << ",\n";
+  out << "  \"crc32_engine\": \"" << CRC32::engine_name(CRC32().engine())
+      << "\",\n";
+  out << "  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult &r = results[i];
+    char numbers[256];
+    out << "    {\"name\": \"" << json_escape(r.name) << "\", \"op\": \""
+        << r.op << "\"";
+    if (r.op != "crc32") {
+      out << ", \"dataset\": \"" << json_escape(r.dataset)
+          << "\", \"threads\": " << r.threads << ", \"cache\": \"" << r.cache
+          << "\", \"files\": " << r.files;
+    }
+    std::snprintf(numbers, sizeof(numbers),
+                  ", \"bytes\": %llu, \"seconds\": %.6f, \"mb_s\": %.2f",
+                  static_cast<unsigned long long>(r.bytes), r.seconds, r.mb_s);
+    out << numbers;
+    if (r.op != "crc32") {
+      std::snprintf(numbers, sizeof(numbers),
+                    ", \"files_s\": %.1f, \"p50_ms\": %.4f, \"p99_ms\": %.4f, "
+                    "\"peak_rss_kb\": %ld",
+                    r.files_s, r.p50_ms, r.p99_ms, r.peak_rss_kb);
+      out << numbers;
+    }
+    out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+}
+
+// 读取 write_json 写出的结果文件：每个用例一行，只取 name 与 mb_s
+std::map<std::string, double> read_baseline(const std::string &path) {
+  std::ifstream in(path);
+  if (!in) {
+    throw std::runtime_error("Cannot open baseline: " + path);
+  }
+  std::map<std::string, double> baseline;
+  std::string line;
+  while (std::getline(in, line)) {
+    const std::string name_key = "\"name\": \"";
+    const std::string mb_key = "\"mb_s\": ";
+    size_t name_pos = line.find(name_key);
+    size_t mb_pos = line.find(mb_key);
+    if (name_pos == std::string::npos || mb_pos == std::string::npos) {
+      continue;
+    }
+    name_pos += name_key.size();
+    const size_t name_end = line.find('"', name_pos);
+    baseline[line.substr(name_pos, name_end - name_pos)] =
+        std::strtod(line.c_str() + mb_pos + mb_key.size(), nullptr);
+  }
+  return baseline;
+}
+
+// 线程扩展：每个多线程用例相对同名 1 线程用例的加速比与并行效率
+void print_scaling(std::ostream &out, const std::vector<BenchResult> &results) {
+  auto single_thread_name = [](const BenchResult &r) {
+    std::string name = r.name;
+    const std::string segment = "/t" + std::to_string(r.threads);
+    for (size_t pos = name.find(segment); pos != std::string::npos;
+         pos = name.find(segment, pos + 1)) {
+      const size_t end = pos + segment.size();
+      if (end == name.size() || name[end] == '/') {
+        return name.replace(pos, segment.size(), "/t1");
+      }
+    }
+    return std::string();
+  };
+  std::map<std::string, double> single;
+  for (const BenchResult &r : results) {
+    if (r.threads == 1) {
+      single[r.name] = r.seconds;
+    }
+  }
+  bool header = false;
+  for (const BenchResult &r : results) {
+    auto it = single.find(single_thread_name(r));
+    if (r.threads <= 1 || it == single.end() || r.seconds <= 0) {
+      continue;
+    }
+    if (!header) {
+      out << "\nScaling (speedup vs 1 thread, parallel efficiency):\n";
+      header = true;
+    }
+    const double speedup = it->second / r.seconds;
+    char line[256];
+    std::snprintf(line, sizeof(line), "  %-34s %6.2fx  %5.1f%%\n",
+                  r.name.c_str(), speedup, speedup / r.threads * 100);
+    out << line;
+  }
+}
+
+// 自适应并发：每个 tauto 用例相对同一 op / 数据集 / 缓存下最快的固定线程数用例
+void print_adaptive(std::ostream &out, const std::vector<BenchResult> &results) {
+  auto group = [](const BenchResult &r) {
+    return r.op + "/" + r.dataset + "/" + r.cache;
+  };
+  std::map<std::string, const BenchResult *> best;
+  for (const BenchResult &r : results) {
+    if (r.threads == 0 || r.dataset.empty()) {
+      continue;
+    }
+    const BenchResult *&slot = best[group(r)];
+    if (slot == nullptr || r.mb_s > slot->mb_s) {
+      slot = &r;
+    }
+  }
+  bool header = false;
+  for (const BenchResult &r : results) {
+    auto it = best.find(group(r));
+    if (r.threads != 0 || r.dataset.empty() || it == best.end() ||
+        it->second->mb_s <= 0) {
+      continue;
+    }
+    if (!header) {
+      out << "\nAdaptive (vs best fixed thread count):\n";
+      header = true;
+    }
+    const double ratio = r.mb_s / it->second->mb_s * 100;
+    char line[256];
+    std::snprintf(line, sizeof(line), "  %-34s %5.1f%% of t%u%s\n",
+                  r.name.c_str(), ratio, it->second->threads,
+                  ratio < 90 ? "  BELOW 90%" : "");
+    out << line;
+  }
+}
+
+// 逐用例对比吞吐，返回回退的用例数
+size_t compare_baseline(std::ostream &out,
+                        const std::vector<BenchResult> &results,
+                        const std::map<std::string, double> &baseline,
+                        double threshold) {
+  size_t regressions = 0;
+  out << "\nCompared with baseline (threshold " << threshold << "%):\n";
+  for (const BenchResult &r : results) {
+    auto it = baseline.find(r.name);
+    char line[256];
+    if (it == baseline.end() || it->second <= 0) {
+      std::snprintf(line, sizeof(line), "  %-34s %10.1f MB/s  (new)\n",
+                    r.name.c_str(), r.mb_s);
+    } else {
+      const double change = (r.mb_s - it->second) / it->second * 100;
+      const bool regressed = change < -threshold;
+      regressions += regressed;
+      std::snprintf(line, sizeof(line),
+                    "  %-34s %10.1f -> %10.1f MB/s  %+7.1f%%%s\n",
+                    r.name.c_str(), it->second, r.mb_s, change,
+                    regressed ? "  REGRESSION" : "");
+    }
+    out << line;
+  }
+  return regressions;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    const BenchOptions options = parse_args(argc, argv);
+    // JSON 写到标准输出时，进度表改写到标准错误
+    std::ostream &log = options.json == "-" ? std::cerr : std::cout;
+    std::vector<BenchResult> results;
+    // 先读入基准：结果文件与基准文件可以是同一个
+    std::map<std::string, double> baseline;
+    if (!options.baseline.empty()) {
+      baseline = read_baseline(options.baseline);
+    }
+
+    log << "KAR benchmark (crc32 auto = " << CRC32::engine_name(CRC32().engine())
+        << ", repeat " << options.repeat << ")\n";
+    for (CRC32Engine engine : CRC32::all_engines()) {
+      if (!CRC32::is_supported(engine)) {
+        continue;
+      }
+      for (size_t block_size : {size_t{4096}, size_t{1024 * 1024}}) {
+        const std::string name = std::string("crc32/") +
+                                 CRC32::engine_name(engine) + "/" +
+                                 (block_size >= 1024 * 1024 ? "1MB" : "4KB");
+        if (selected(options, name)) {
+          results.push_back(bench_crc(engine, block_size));
+          print_result(log, results.back());
+        }
+      }
+    }
+
+    for (unsigned threads : options.threads) {
+      const std::string steal = "sched/steal/t" + std::to_string(threads);
+      const std::string queue = "sched/queue/t" + std::to_string(threads);
+      if (selected(options, steal)) {
+        results.push_back(bench_scheduler<ThreadPool>(options, "steal", threads));
+        print_result(log, results.back());
+      }
+      if (selected(options, queue)) {
+        results.push_back(
+            bench_scheduler<SharedQueuePool>(options, "queue", threads));
+        print_result(log, results.back());
+      }
+    }
+
+    // 自适应用例按分阶段耗时判断瓶颈，会启用 StageStats；
+    // 固定线程数用例同样启用，两者的计时开销一致
+    if (options.adaptive) {
+      StageStats::instance().enable(false);
+    }
+
+    for (const Dataset &dataset : generate_datasets(options)) {
+      // 解包用例读取的归档预先以默认选项打包（不计时）
+      const fs::path archive = options.work_dir / (dataset.name + ".kar");
+      bool packed = false;
+      for (const char *op : {"pack", "unpack", "verify"}) {
+        for (unsigned threads : options.threads) {
+          for (bool cold : {false, true}) {
+            if (cold && !options.cold) {
+              continue;
+            }
+            const std::string name = std::string(op) + "/" + dataset.name +
+                                     "/t" + std::to_string(threads) + "/" +
+                                     (cold ? "cold" : "warm");
+            if (!selected(options, name)) {
+              continue;
+            }
+            if (std::string(op) != "pack" && !packed) {
+              Archiver().pack(dataset.dir, archive);
+              packed = true;
+            }
+            results.push_back(
+                bench_archive(options, dataset, op, threads, cold, archive));
+            print_result(log, results.back());
+          }
+        }
+        // 自适应用例：线程上限取列表中的最大值（verify 不经过控制器）
+        for (bool cold : {false, true}) {
+          if (!options.adaptive || std::string(op) == "verify" ||
+              (cold && !options.cold)) {
+            continue;
+          }
+          const std::string name = std::string(op) + "/" + dataset.name +
+                                   "/tauto/" + (cold ? "cold" : "warm");
+          if (!selected(options, name)) {
+            continue;
+          }
+          if (std::string(op) != "pack" && !packed) {
+            Archiver().pack(dataset.dir, archive);
+            packed = true;
+          }
+          const unsigned max_threads =
+              *std::max_element(options.threads.begin(), options.threads.end());
+          results.push_back(bench_archive(options, dataset, op, max_threads,
+                                          cold, archive, true));
+          print_result(log, results.back());
+        }
+      }
+      fs::remove(archive);
+    }
+    if (!options.keep) {
+      fs::remove_all(options.work_dir);
+    }
+    print_scaling(log, results);
+    print_adaptive(log, results);
+
+    if (options.json == "-") {
+      write_json(std::cout, results);
+    } else {
+      std::ofstream out(options.json);
+      write_json(out, results);
+      log << "\nResults written to: " << options.json << "\n";
+    }
+
+    if (!options.baseline.empty()) {
+      const size_t regressions =
+          compare_baseline(log, results, baseline, options.threshold);
+      if (regressions > 0) {
+        log << regressions << " case(s) regressed\n";
+        return 1;
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
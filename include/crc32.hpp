@@ -6,18 +6,423 @@
 #include <vector>
 #include <string>
 
+#if defined(__x86_64__) || defined(__i386__)
+#define CRC32_HAVE_PCLMUL 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define CRC32_HAVE_ARM_CRC 1
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#endif
+
+/**
+ * CRC32 计算引擎
+ *
+ * 所有引擎计算同一个 IEEE 802.3 CRC32（与 zlib 一致），只是实现方式不同：
+ * - Bytewise: 经典单表查表法，每字节一次查表
+ * - Slice8 / Slice16: slicing-by-8/16，每次处理 8/16 字节
+ * - Pclmul: x86 PCLMULQDQ 无进位乘法折叠（Intel "Fast CRC Computation" 方案）
+ * - ArmCrc: ARMv8 CRC32 指令（crc32x/crc32b 使用的正是 IEEE 多项式）
+ *
+ * 注意：SSE4.2 的 crc32 指令固定使用 Castagnoli 多项式（CRC32C），
+ * 与归档格式使用的 IEEE 多项式不同，因此不能用于本格式。
+ */
+enum class CRC32Engine {
+    Auto,      // 启动时按 CPU 特性自动选择
+    Bytewise,
+    Slice8,
+    Slice16,
+    Pclmul,
+    ArmCrc,
+};
+
+namespace crc32_detail {
+
+constexpr uint32_t POLYNOMIAL = 0xEDB88320;  // IEEE 802.3（反射形式）
+
+/**
+ * slicing-by-16 查找表（16 x 256 项），table[0] 即经典单表
+ *
+ * 原理：table[k][i] 表示字节 i 之后再跟 k 个零字节时的 CRC 贡献，
+ * 因此一次可以并行查 16 张表处理 16 个字节。
+ */
+struct Tables {
+    uint32_t table[16][256];
+
+    Tables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            // 对每个字节，执行 8 次位运算（模拟除法）
+            for (int j = 0; j < 8; ++j) {
+                if (crc & 1) {
+                    crc = (crc >> 1) ^ POLYNOMIAL;
+                } else {
+                    crc >>= 1;
+                }
+            }
+            table[0][i] = crc;
+        }
+        for (int k = 1; k < 16; ++k) {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t prev = table[k - 1][i];
+                table[k][i] = (prev >> 8) ^ table[0][prev & 0xFF];
+            }
+        }
+    }
+};
+
+inline const Tables& tables() {
+    static const Tables instance;
+    return instance;
+}
+
+// 小端读取 32 位（在小端主机上编译为一次普通 load）
+inline uint32_t load_le32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) |
+           (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// 以下 update_* 函数都接收并返回“未取反”的中间状态（初始值 0xFFFFFFFF）
+
+inline uint32_t update_bytewise(uint32_t crc, const uint8_t* data, size_t len) {
+    const uint32_t (&t)[256] = tables().table[0];
+    for (size_t i = 0; i < len; ++i) {
+        // 核心算法：查表更新 CRC
+        crc = (crc >> 8) ^ t[(crc ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+inline uint32_t update_slice8(uint32_t crc, const uint8_t* data, size_t len) {
+    const auto& t = tables().table;
+    while (len >= 8) {
+        uint32_t one = load_le32(data) ^ crc;
+        uint32_t two = load_le32(data + 4);
+        crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^
+              t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24] ^
+              t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^
+              t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+        data += 8;
+        len -= 8;
+    }
+    return update_bytewise(crc, data, len);
+}
+
+inline uint32_t update_slice16(uint32_t crc, const uint8_t* data, size_t len) {
+    const auto& t = tables().table;
+    while (len >= 16) {
+        uint32_t one = load_le32(data) ^ crc;
+        uint32_t two = load_le32(data + 4);
+        uint32_t three = load_le32(data + 8);
+        uint32_t four = load_le32(data + 12);
+        crc = t[15][one & 0xFF] ^ t[14][(one >> 8) & 0xFF] ^
+              t[13][(one >> 16) & 0xFF] ^ t[12][one >> 24] ^
+              t[11][two & 0xFF] ^ t[10][(two >> 8) & 0xFF] ^
+              t[9][(two >> 16) & 0xFF] ^ t[8][two >> 24] ^
+              t[7][three & 0xFF] ^ t[6][(three >> 8) & 0xFF] ^
+              t[5][(three >> 16) & 0xFF] ^ t[4][three >> 24] ^
+              t[3][four & 0xFF] ^ t[2][(four >> 8) & 0xFF] ^
+              t[1][(four >> 16) & 0xFF] ^ t[0][four >> 24];
+        data += 16;
+        len -= 16;
+    }
+    return update_bytewise(crc, data, len);
+}
+
+#if defined(CRC32_HAVE_PCLMUL)
+
+/**
+ * PCLMULQDQ 折叠：每轮并行折叠 4 x 128 位，最后 Barrett 约减到 32 位
+ *
+ * 常量来自 Intel 白皮书 "Fast CRC Computation for Generic Polynomials
+ * Using PCLMULQDQ Instruction"（与 zlib/Linux 内核的 crc32-pclmul 相同）。
+ * 要求 len >= 64 且为 16 的倍数，其余部分由调用方用查表法处理。
+ */
+__attribute__((target("pclmul,sse4.1")))
+inline uint32_t fold_pclmul(uint32_t crc, const uint8_t* buf, size_t len) {
+    alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+    alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+    alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+    alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+    __m128i y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00));
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10));
+    x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20));
+    x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30));
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+
+    buf += 64;
+    len -= 64;
+
+    // 并行折叠 4 x 128 位
+    while (len >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        y5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00));
+        y6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10));
+        y7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20));
+        y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30));
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+        buf += 64;
+        len -= 64;
+    }
+
+    // 4 x 128 位合并为 128 位
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // 剩余的 128 位块逐个折叠
+    while (len >= 16) {
+        x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        buf += 16;
+        len -= 16;
+    }
+
+    // 128 位折叠到 64 位
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett 约减到 32 位
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+inline uint32_t update_pclmul(uint32_t crc, const uint8_t* data, size_t len) {
+    if (len >= 64) {
+        size_t folded = len & ~static_cast<size_t>(15);
+        crc = fold_pclmul(crc, data, folded);
+        data += folded;
+        len -= folded;
+    }
+    return update_slice8(crc, data, len);
+}
+
+#endif // CRC32_HAVE_PCLMUL
+
+#if defined(CRC32_HAVE_ARM_CRC)
+
+__attribute__((target("+crc")))
+inline uint32_t update_arm_crc(uint32_t crc, const uint8_t* data, size_t len) {
+    while (len >= 8) {
+        uint64_t word;
+        __builtin_memcpy(&word, data, sizeof(word));
+        crc = __crc32d(crc, word);
+        data += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc = __crc32b(crc, *data++);
+        --len;
+    }
+    return crc;
+}
+
+#endif // CRC32_HAVE_ARM_CRC
+
+/**
+ * 检测当前 CPU 是否支持某个引擎
+ */
+inline bool engine_supported(CRC32Engine engine) {
+    switch (engine) {
+    case CRC32Engine::Auto:
+    case CRC32Engine::Bytewise:
+    case CRC32Engine::Slice8:
+    case CRC32Engine::Slice16:
+        return true;
+    case CRC32Engine::Pclmul:
+#if defined(CRC32_HAVE_PCLMUL)
+        return __builtin_cpu_supports("pclmul") &&
+               __builtin_cpu_supports("sse4.1");
+#else
+        return false;
+#endif
+    case CRC32Engine::ArmCrc:
+#if defined(CRC32_HAVE_ARM_CRC) && defined(__APPLE__)
+        return true;  // Apple Silicon 均支持 CRC32 扩展
+#elif defined(CRC32_HAVE_ARM_CRC) && defined(__linux__)
+        return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+using UpdateFn = uint32_t (*)(uint32_t, const uint8_t*, size_t);
+
+inline UpdateFn engine_function(CRC32Engine engine) {
+    switch (engine) {
+    case CRC32Engine::Bytewise:
+        return update_bytewise;
+    case CRC32Engine::Slice8:
+        return update_slice8;
+#if defined(CRC32_HAVE_PCLMUL)
+    case CRC32Engine::Pclmul:
+        return update_pclmul;
+#endif
+#if defined(CRC32_HAVE_ARM_CRC)
+    case CRC32Engine::ArmCrc:
+        return update_arm_crc;
+#endif
+    default:
+        return update_slice16;
+    }
+}
+
+/**
+ * 启动时选择最快的可用引擎（结果缓存，只检测一次）
+ */
+inline CRC32Engine best_engine() {
+    static const CRC32Engine best = [] {
+        if (engine_supported(CRC32Engine::Pclmul)) {
+            return CRC32Engine::Pclmul;
+        }
+        if (engine_supported(CRC32Engine::ArmCrc)) {
+            return CRC32Engine::ArmCrc;
+        }
+        return CRC32Engine::Slice16;
+    }();
+    return best;
+}
+
+/**
+ * GF(2) 上模多项式乘法：a * b mod P（均为反射表示）
+ */
+inline uint32_t multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = static_cast<uint32_t>(1) << 31;
+    uint32_t p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ POLYNOMIAL : b >> 1;
+    }
+    return p;
+}
+
+/**
+ * x^(2^n) mod P 的预计算表，n = 0..31
+ */
+struct X2nTable {
+    uint32_t table[32];
+
+    X2nTable() {
+        uint32_t p = static_cast<uint32_t>(1) << 30;  // x^1
+        table[0] = p;
+        for (int n = 1; n < 32; ++n) {
+            table[n] = p = multmodp(p, p);
+        }
+    }
+};
+
+/**
+ * x^(n * 2^k) mod P
+ */
+inline uint32_t x2nmodp(uint64_t n, unsigned k) {
+    static const X2nTable x2n;
+    uint32_t p = static_cast<uint32_t>(1) << 31;  // x^0 == 1
+    while (n) {
+        if (n & 1) {
+            p = multmodp(x2n.table[k & 31], p);
+        }
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+} // namespace crc32_detail
+
+/**
+ * 合并两段数据的 CRC32：已知 crc(A)、crc(B) 与 B 的长度，求 crc(A + B)
+ *
+ * 用于把并行计算的分块 CRC 合并成整体 CRC，复杂度 O(log len2)，
+ * 不需要重新读取数据（算法同 zlib crc32_combine）。
+ */
+inline uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+    return crc32_detail::multmodp(crc32_detail::x2nmodp(len2, 3), crc1) ^ crc2;
+}
+
 /**
  * CRC32 校验和计算类
- * 
+ *
  * 使用 IEEE 802.3 标准多项式: 0xEDB88320
- * 查表法实现，时间复杂度 O(n)
+ * 默认按 CPU 特性自动选择最快的引擎，也可以显式指定引擎（测试/基准用）
+ *
+ * 两种用法：
+ * - 一次性：calculate(data) 直接返回结果（无状态，线程安全）
+ * - 流式：多次 update(ptr, len) 后调用 finalize()，适合分块读取的大文件
  */
 class CRC32 {
 public:
-    // 构造函数：初始化查找表
-    CRC32() {
-        init_table();
-    }
+    // 构造函数：选择计算引擎（查找表为全局共享，构造开销可以忽略）
+    // 指定的引擎在当前 CPU 上不可用时回退到自动选择
+    explicit CRC32(CRC32Engine engine = CRC32Engine::Auto)
+        : engine_(engine == CRC32Engine::Auto ||
+                          !crc32_detail::engine_supported(engine)
+                      ? crc32_detail::best_engine()
+                      : engine),
+          update_(crc32_detail::engine_function(engine_)) {}
 
     /**
      * 计算数据的 CRC32 校验和
@@ -26,15 +431,8 @@ public:
      * @return CRC32 校验和
      */
     uint32_t calculate(const uint8_t* data, size_t len) const {
-        uint32_t crc = 0xFFFFFFFF;  // 初始值
-        
-        for (size_t i = 0; i < len; ++i) {
-            // 核心算法：查表更新 CRC
-            uint8_t table_index = (crc ^ data[i]) & 0xFF;
-            crc = (crc >> 8) ^ table_[table_index];
-        }
-        
-        return crc ^ 0xFFFFFFFF;  // 最终结果取反
+        // 初始值 0xFFFFFFFF，最终结果取反
+        return update_(0xFFFFFFFF, data, len) ^ 0xFFFFFFFF;
     }
 
     /**
@@ -51,32 +449,63 @@ public:
         return calculate(reinterpret_cast<const uint8_t*>(data.data()), data.size());
     }
 
-private:
-    // CRC32 查找表（256 项）
-    uint32_t table_[256];
+    /**
+     * 流式计算：追加一段数据
+     */
+    void update(const void* data, size_t len) {
+        state_ = update_(state_, static_cast<const uint8_t*>(data), len);
+    }
 
     /**
-     * 初始化 CRC32 查找表
-     * 
-     * 原理：对 0-255 的每个字节，预计算其对应的 CRC32 值
-     * 多项式：0xEDB88320 (IEEE 802.3 标准)
+     * 流式计算：返回目前为止所有数据的 CRC32（不改变状态，可继续 update）
      */
-    void init_table() {
-        const uint32_t POLYNOMIAL = 0xEDB88320;
-        
-        for (uint32_t i = 0; i < 256; ++i) {
-            uint32_t crc = i;
-            // 对每个字节，执行 8 次位运算（模拟除法）
-            for (int j = 0; j < 8; ++j) {
-                if (crc & 1) {
-                    crc = (crc >> 1) ^ POLYNOMIAL;
-                } else {
-                    crc >>= 1;
-                }
-            }
-            table_[i] = crc;
+    uint32_t finalize() const { return state_ ^ 0xFFFFFFFF; }
+
+    /**
+     * 流式计算：清空状态，重新开始
+     */
+    void reset() { state_ = 0xFFFFFFFF; }
+
+    CRC32Engine engine() const { return engine_; }
+
+    /**
+     * 当前 CPU 是否支持指定引擎
+     */
+    static bool is_supported(CRC32Engine engine) {
+        return crc32_detail::engine_supported(engine);
+    }
+
+    static const char* engine_name(CRC32Engine engine) {
+        switch (engine) {
+        case CRC32Engine::Auto:
+            return "auto";
+        case CRC32Engine::Bytewise:
+            return "bytewise";
+        case CRC32Engine::Slice8:
+            return "slice8";
+        case CRC32Engine::Slice16:
+            return "slice16";
+        case CRC32Engine::Pclmul:
+            return "pclmul";
+        case CRC32Engine::ArmCrc:
+            return "armv8-crc";
         }
+        return "unknown";
+    }
+
+    /**
+     * 所有具体引擎（不含 Auto），用于测试与基准遍历
+     */
+    static std::vector<CRC32Engine> all_engines() {
+        return {CRC32Engine::Bytewise, CRC32Engine::Slice8,
+                CRC32Engine::Slice16, CRC32Engine::Pclmul,
+                CRC32Engine::ArmCrc};
     }
+
+private:
+    CRC32Engine engine_;
+    crc32_detail::UpdateFn update_;
+    uint32_t state_ = 0xFFFFFFFF;  // 流式计算的中间状态（未取反）
 };
 
 #endif // CRC32_HPP
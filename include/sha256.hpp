@@ -0,0 +1,321 @@
+#ifndef SHA256_HPP
+#define SHA256_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_HAVE_SHANI 1
+#include <immintrin.h>
+#endif
+
+/**
+ * SHA-256 计算引擎（FIPS 180-4），用于去重块的内容寻址
+ *
+ * - Scalar: 可移植的标准实现
+ * - ShaNi: x86 SHA 扩展指令（sha256rnds2/sha256msg1/sha256msg2）
+ */
+enum class SHA256Engine {
+    Auto,  // 启动时按 CPU 特性自动选择
+    Scalar,
+    ShaNi,
+};
+
+using SHA256Digest = std::array<uint8_t, 32>;
+
+namespace sha256_detail {
+
+alignas(16) constexpr uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+constexpr uint32_t INITIAL_STATE[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+inline uint32_t rotr(uint32_t x, unsigned n) { return (x >> n) | (x << (32 - n)); }
+
+inline uint32_t load_be32(const uint8_t* p) {
+    return (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) |
+           (uint32_t{p[2]} << 8) | uint32_t{p[3]};
+}
+
+// 以下 compress_* 函数处理 blocks 个完整的 64 字节块，就地更新 state
+inline void compress_scalar(uint32_t state[8], const uint8_t* data, size_t blocks) {
+    uint32_t w[64];
+    for (; blocks > 0; --blocks, data += 64) {
+        for (int i = 0; i < 16; ++i) {
+            w[i] = load_be32(data + 4 * i);
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + K[i] + w[i];
+            uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#if defined(SHA256_HAVE_SHANI)
+
+/**
+ * SHA 扩展指令实现
+ *
+ * 状态按指令要求排成 ABEF / CDGH 两个寄存器；每 4 轮一组，
+ * 消息调度用 sha256msg1/sha256msg2 在 4 个寄存器中滚动计算 W[t]。
+ */
+__attribute__((target("sha,sse4.1")))
+inline void compress_shani(uint32_t state[8], const uint8_t* data, size_t blocks) {
+    const __m128i byte_swap =
+        _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0]));
+    __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4]));
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);                // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);          // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);  // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);       // CDGH
+
+    for (; blocks > 0; --blocks, data += 64) {
+        const __m128i abef_save = state0;
+        const __m128i cdgh_save = state1;
+        __m128i w[4];
+        for (int i = 0; i < 16; ++i) {
+            __m128i& cur = w[i & 3];
+            if (i < 4) {
+                cur = _mm_shuffle_epi8(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)),
+                    byte_swap);
+            } else {
+                // W[t] = msg2(msg1(W[t-16..], W[t-12..]) + W[t-7..], W[t-4..])
+                const __m128i& prev1 = w[(i - 1) & 3];
+                const __m128i& prev2 = w[(i - 2) & 3];
+                const __m128i& prev3 = w[(i - 3) & 3];
+                cur = _mm_sha256msg1_epu32(cur, prev3);
+                cur = _mm_add_epi32(cur, _mm_alignr_epi8(prev1, prev2, 4));
+                cur = _mm_sha256msg2_epu32(cur, prev1);
+            }
+            __m128i msg = _mm_add_epi32(
+                cur, _mm_load_si128(reinterpret_cast<const __m128i*>(&K[4 * i])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);             // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);          // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);       // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);          // HGFE
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+
+#endif // SHA256_HAVE_SHANI
+
+/**
+ * 检测当前 CPU 是否支持某个引擎
+ */
+inline bool engine_supported(SHA256Engine engine) {
+    switch (engine) {
+    case SHA256Engine::Auto:
+    case SHA256Engine::Scalar:
+        return true;
+    case SHA256Engine::ShaNi:
+#if defined(SHA256_HAVE_SHANI)
+        return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+using CompressFn = void (*)(uint32_t*, const uint8_t*, size_t);
+
+inline CompressFn engine_function(SHA256Engine engine) {
+#if defined(SHA256_HAVE_SHANI)
+    if (engine == SHA256Engine::ShaNi) {
+        return compress_shani;
+    }
+#endif
+    (void)engine;
+    return compress_scalar;
+}
+
+/**
+ * 启动时选择最快的可用引擎（结果缓存，只检测一次）
+ */
+inline SHA256Engine best_engine() {
+    static const SHA256Engine best = engine_supported(SHA256Engine::ShaNi)
+                                         ? SHA256Engine::ShaNi
+                                         : SHA256Engine::Scalar;
+    return best;
+}
+
+} // namespace sha256_detail
+
+/**
+ * SHA-256 计算类
+ *
+ * 两种用法：
+ * - 一次性：calculate(data, len) 直接返回摘要（无状态，线程安全）
+ * - 流式：多次 update(ptr, len) 后调用 finalize()
+ */
+class SHA256 {
+public:
+    // 指定的引擎在当前 CPU 上不可用时回退到自动选择
+    explicit SHA256(SHA256Engine engine = SHA256Engine::Auto)
+        : engine_(engine == SHA256Engine::Auto ||
+                          !sha256_detail::engine_supported(engine)
+                      ? sha256_detail::best_engine()
+                      : engine),
+          compress_(sha256_detail::engine_function(engine_)) {
+        reset();
+    }
+
+    SHA256Digest calculate(const void* data, size_t len) const {
+        SHA256 hasher(engine_);
+        hasher.update(data, len);
+        return hasher.finalize();
+    }
+
+    /**
+     * 流式计算：追加一段数据
+     */
+    void update(const void* data, size_t len) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        total_ += len;
+        if (buffered_ > 0) {
+            size_t n = std::min(len, sizeof(buffer_) - buffered_);
+            std::memcpy(buffer_ + buffered_, p, n);
+            buffered_ += n;
+            p += n;
+            len -= n;
+            if (buffered_ < sizeof(buffer_)) {
+                return;
+            }
+            compress_(state_, buffer_, 1);
+            buffered_ = 0;
+        }
+        if (len >= 64) {
+            compress_(state_, p, len / 64);
+            p += len & ~size_t{63};
+            len &= 63;
+        }
+        std::memcpy(buffer_, p, len);
+        buffered_ = len;
+    }
+
+    /**
+     * 流式计算：补位并返回摘要（不改变状态，可继续 update）
+     */
+    SHA256Digest finalize() const {
+        uint32_t state[8];
+        std::memcpy(state, state_, sizeof(state));
+        uint8_t tail[128] = {};
+        std::memcpy(tail, buffer_, buffered_);
+        tail[buffered_] = 0x80;
+        const size_t tail_len = buffered_ < 56 ? 64 : 128;
+        const uint64_t bits = total_ * 8;
+        for (int i = 0; i < 8; ++i) {
+            tail[tail_len - 1 - i] = static_cast<uint8_t>(bits >> (8 * i));
+        }
+        compress_(state, tail, tail_len / 64);
+
+        SHA256Digest digest;
+        for (int i = 0; i < 8; ++i) {
+            digest[4 * i] = static_cast<uint8_t>(state[i] >> 24);
+            digest[4 * i + 1] = static_cast<uint8_t>(state[i] >> 16);
+            digest[4 * i + 2] = static_cast<uint8_t>(state[i] >> 8);
+            digest[4 * i + 3] = static_cast<uint8_t>(state[i]);
+        }
+        return digest;
+    }
+
+    /**
+     * 流式计算：清空状态，重新开始
+     */
+    void reset() {
+        std::memcpy(state_, sha256_detail::INITIAL_STATE, sizeof(state_));
+        buffered_ = 0;
+        total_ = 0;
+    }
+
+    SHA256Engine engine() const { return engine_; }
+
+    static bool is_supported(SHA256Engine engine) {
+        return sha256_detail::engine_supported(engine);
+    }
+
+    static const char* engine_name(SHA256Engine engine) {
+        switch (engine) {
+        case SHA256Engine::Auto:
+            return "auto";
+        case SHA256Engine::Scalar:
+            return "scalar";
+        case SHA256Engine::ShaNi:
+            return "sha-ni";
+        }
+        return "unknown";
+    }
+
+    /**
+     * 所有具体引擎（不含 Auto），用于测试遍历
+     */
+    static std::array<SHA256Engine, 2> all_engines() {
+        return {SHA256Engine::Scalar, SHA256Engine::ShaNi};
+    }
+
+private:
+    SHA256Engine engine_;
+    sha256_detail::CompressFn compress_;
+    uint32_t state_[8];
+    uint8_t buffer_[64];
+    size_t buffered_ = 0;
+    uint64_t total_ = 0;
+};
+
+#endif // SHA256_HPP
@@ -0,0 +1,321 @@
+#include "archive_index.hpp"
+#include "codec.hpp"
+
+#include "../include/crc32.hpp"
+#include <cstring>
+#include <stdexcept>
+
+uint32_t decode_entry_header(const char *data, uint16_t version,
+                             IndexRecord &record) {
+  record.version = version;
+  if (version < KAR_VERSION_CODEC) {
+    const auto entry = load_wire<EntryHeader>(data);
+    record.content_size = entry.content_size;
+    record.modified_time = entry.modified_time;
+    record.checksum = entry.checksum;
+    record.permissions = entry.permissions;
+    record.codec = static_cast<uint8_t>(Codec::None);
+    record.stored_size = entry.content_size;
+    return entry.path_length;
+  }
+
+  const auto entry = load_wire<EntryHeaderV3>(data);
+  record.content_size = entry.content_size;
+  record.modified_time = entry.modified_time;
+  record.checksum = entry.checksum;
+  record.permissions = entry.permissions;
+  record.codec = entry.codec;
+  record.flags = entry.flags;
+  record.stored_size = entry.stored_size;
+  if (entry.codec > static_cast<uint8_t>(Codec::Zstd) ||
+      (entry.flags & ~KAR_ENTRY_KNOWN_FLAGS) ||
+      (entry.codec == static_cast<uint8_t>(Codec::None) &&
+       !(entry.flags & (KAR_ENTRY_DEDUP | KAR_ENTRY_DEFERRED |
+                        KAR_ENTRY_SPARSE | KAR_ENTRY_SOLID)) &&
+       entry.stored_size != entry.content_size)) {
+    throw std::runtime_error("Unsupported entry encoding (codec " +
+                             std::to_string(entry.codec) + ", flags " +
+                             std::to_string(entry.flags) + ")");
+  }
+  return entry.path_length;
+}
+
+const IndexRecord *ArchiveIndex::find(const std::string &path) const {
+  if (by_path_.empty() && !entries_.empty()) {
+    by_path_.reserve(entries_.size());
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      by_path_.emplace(entries_[i].path, i);
+    }
+  }
+  auto it = by_path_.find(path);
+  return it == by_path_.end() ? nullptr : &entries_[it->second];
+}
+
+std::vector<const IndexRecord *> ArchiveIndex::in_original_order() const {
+  std::vector<const IndexRecord *> records(entries_.size());
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    records[order_.empty() ? i : order_[i]] = &entries_[i];
+  }
+  return records;
+}
+
+void ArchiveIndex::write(ArchiveWriter &archive) const {
+  archive.begin_directory();
+  IndexTrailer trailer{.index_offset = archive.tell(),
+                       .index_size = 0,
+                       .entry_count = static_cast<uint32_t>(entries_.size()),
+                       .index_checksum = 0,
+                       .magic = KAR_INDEX_MAGIC};
+
+  // 逐项写出并流式计算目录的 CRC32，不额外缓存整个目录
+  CRC32 crc32;
+  for (const auto &record : entries_) {
+    IndexEntryV3 entry{.entry_offset = record.entry_offset,
+                       .content_size = record.content_size,
+                       .modified_time = record.modified_time,
+                       .checksum = record.checksum,
+                       .permissions = record.permissions,
+                       .codec = record.codec,
+                       .flags = record.flags,
+                       .stored_size = record.stored_size,
+                       .path_length =
+                           static_cast<uint32_t>(record.path.size())};
+    const IndexEntryV3 wire = wire_order(entry);
+    archive.write(&wire, sizeof(wire));
+    archive.write(record.path.data(), record.path.size());
+    crc32.update(&wire, sizeof(wire));
+    crc32.update(record.path.data(), record.path.size());
+    trailer.index_size += sizeof(entry) + record.path.size();
+  }
+
+  // 去重块索引：紧随目录项之后，同样计入目录大小与 CRC32
+  if (!chunks_.empty()) {
+    ChunkIndexHeader header{.magic = KAR_CHUNK_MAGIC,
+                            .chunk_count = static_cast<uint32_t>(chunks_.size())};
+    const size_t table_size = chunks_.size() * sizeof(ChunkIndexEntry);
+    const ChunkIndexHeader wire = wire_order(header);
+    archive.write(&wire, sizeof(wire));
+    crc32.update(&wire, sizeof(wire));
+    if constexpr (wire::kNativeIsWire) {
+      archive.write(chunks_.data(), table_size);
+      crc32.update(chunks_.data(), table_size);
+    } else {
+      for (const auto &chunk : chunks_) {
+        const ChunkIndexEntry entry = wire_order(chunk);
+        archive.write(&entry, sizeof(entry));
+        crc32.update(&entry, sizeof(entry));
+      }
+    }
+    trailer.index_size += sizeof(header) + table_size;
+  }
+
+  // 原始顺序表：只在条目经过重排时写出
+  if (!order_.empty()) {
+    OrderIndexHeader header{.magic = KAR_ORDER_MAGIC,
+                            .entry_count = static_cast<uint32_t>(order_.size())};
+    const OrderIndexHeader wire = wire_order(header);
+    archive.write(&wire, sizeof(wire));
+    crc32.update(&wire, sizeof(wire));
+    for (uint32_t position : order_) {
+      const OrderIndexEntry entry = wire_order(OrderIndexEntry{position});
+      archive.write(&entry, sizeof(entry));
+      crc32.update(&entry, sizeof(entry));
+    }
+    trailer.index_size += sizeof(header) + order_.size() * sizeof(OrderIndexEntry);
+  }
+  trailer.index_checksum = crc32.finalize();
+  write_wire(archive, trailer);
+}
+
+ArchiveIndex ArchiveIndex::load(ArchiveReader &archive,
+                                const FileHeader &header,
+                                const WarningHandler &warn) {
+  if (header.version >= KAR_VERSION_INDEXED) {
+    ArchiveIndex index;
+    if (read_directory(archive, header, index)) {
+      return index;
+    }
+    // 流式归档的分块条目头未回填存储大小，无法顺序跳扫
+    if (header.flags & KAR_ARCHIVE_STREAMED) {
+      throw std::runtime_error("Archive index is damaged");
+    }
+    if (warn) {
+      warn("archive index is damaged, falling back to sequential scan");
+    }
+  }
+  return scan_entries(archive, header);
+}
+
+namespace {
+
+// 尾部自洽：魔数、条目数（流式归档的 FileHeader 不记录条目数）与目录位置
+bool valid_trailer(const IndexTrailer &trailer, const FileHeader &header,
+                   uint64_t archive_size) {
+  return trailer.magic == KAR_INDEX_MAGIC &&
+         ((header.flags & KAR_ARCHIVE_STREAMED) ||
+          trailer.entry_count == header.entry_count) &&
+         trailer.index_offset >= sizeof(FileHeader) &&
+         trailer.index_offset + trailer.index_size + sizeof(IndexTrailer) ==
+             archive_size;
+}
+
+} // namespace
+
+bool ArchiveIndex::read_directory(ArchiveReader &archive,
+                                  const FileHeader &header,
+                                  ArchiveIndex &index) {
+  if (archive.size() < sizeof(FileHeader) + sizeof(IndexTrailer)) {
+    return false;
+  }
+
+  // 一次读取尾部，校验后一次读取整个目录
+  IndexTrailer trailer;
+  archive.seek(archive.size() - sizeof(IndexTrailer));
+  if (!read_wire(archive, trailer) ||
+      !valid_trailer(trailer, header, archive.size())) {
+    return false;
+  }
+
+  archive.seek(trailer.index_offset);
+  const char *data = archive.view(static_cast<size_t>(trailer.index_size));
+  return data != nullptr && parse_directory(data, header, trailer, index);
+}
+
+bool ArchiveIndex::parse_tail(const char *data, size_t size, uint64_t offset,
+                              const FileHeader &header, ArchiveIndex &index) {
+  if (size < sizeof(IndexTrailer)) {
+    return false;
+  }
+  const auto trailer = load_wire<IndexTrailer>(data + size - sizeof(IndexTrailer));
+  return trailer.index_offset == offset &&
+         valid_trailer(trailer, header, offset + size) &&
+         parse_directory(data, header, trailer, index);
+}
+
+bool ArchiveIndex::parse_directory(const char *data, const FileHeader &header,
+                                   const IndexTrailer &trailer,
+                                   ArchiveIndex &index) {
+  if (CRC32().calculate(reinterpret_cast<const uint8_t *>(data),
+                        static_cast<size_t>(trailer.index_size)) !=
+      trailer.index_checksum) {
+    return false;
+  }
+
+  const char *end = data + trailer.index_size;
+  const bool v3 = header.version >= KAR_VERSION_CODEC;
+  const size_t entry_size = v3 ? sizeof(IndexEntryV3) : sizeof(IndexEntry);
+  index.entries_.reserve(trailer.entry_count);
+  for (uint32_t i = 0; i < trailer.entry_count; ++i) {
+    if (static_cast<size_t>(end - data) < entry_size) {
+      return false;
+    }
+    IndexRecord record;
+    record.version = header.version;
+    uint32_t path_length;
+    if (v3) {
+      const auto entry = load_wire<IndexEntryV3>(data);
+      record.entry_offset = entry.entry_offset;
+      record.content_size = entry.content_size;
+      record.modified_time = entry.modified_time;
+      record.checksum = entry.checksum;
+      record.permissions = entry.permissions;
+      record.codec = entry.codec;
+      record.flags = entry.flags;
+      record.stored_size = entry.stored_size;
+      path_length = entry.path_length;
+    } else {
+      const auto entry = load_wire<IndexEntry>(data);
+      record.entry_offset = entry.entry_offset;
+      record.content_size = entry.content_size;
+      record.modified_time = entry.modified_time;
+      record.checksum = entry.checksum;
+      record.permissions = entry.permissions;
+      record.stored_size = entry.content_size;
+      path_length = entry.path_length;
+    }
+    data += entry_size;
+    if (static_cast<size_t>(end - data) < path_length) {
+      return false;
+    }
+    record.path.assign(data, path_length);
+    index.entries_.push_back(std::move(record));
+    data += path_length;
+  }
+
+  // 可选的去重块索引
+  if (v3 && static_cast<size_t>(end - data) >= sizeof(ChunkIndexHeader) &&
+      load_wire<ChunkIndexHeader>(data).magic == KAR_CHUNK_MAGIC) {
+    const auto chunk_header = load_wire<ChunkIndexHeader>(data);
+    data += sizeof(chunk_header);
+    const size_t table_size =
+        static_cast<size_t>(chunk_header.chunk_count) * sizeof(ChunkIndexEntry);
+    if (static_cast<size_t>(end - data) < table_size) {
+      return false;
+    }
+    index.chunks_.resize(chunk_header.chunk_count);
+    std::memcpy(index.chunks_.data(), data, table_size);
+    if constexpr (!wire::kNativeIsWire) {
+      for (auto &chunk : index.chunks_) {
+        chunk = wire_order(chunk);
+      }
+    }
+    data += table_size;
+  }
+
+  // 可选的原始顺序表：每个目录项恰好一项，且序号互不相同
+  if (v3 && static_cast<size_t>(end - data) >= sizeof(OrderIndexHeader)) {
+    const auto order_header = load_wire<OrderIndexHeader>(data);
+    data += sizeof(order_header);
+    if (order_header.magic != KAR_ORDER_MAGIC ||
+        order_header.entry_count != index.entries_.size() ||
+        static_cast<size_t>(end - data) <
+            index.entries_.size() * sizeof(OrderIndexEntry)) {
+      return false;
+    }
+    std::vector<bool> seen(index.entries_.size(), false);
+    index.order_.reserve(index.entries_.size());
+    for (size_t i = 0; i < index.entries_.size(); ++i) {
+      const uint32_t position = load_wire<OrderIndexEntry>(data).position;
+      data += sizeof(OrderIndexEntry);
+      if (position >= seen.size() || seen[position]) {
+        return false;
+      }
+      seen[position] = true;
+      index.order_.push_back(position);
+    }
+  }
+  index.from_directory_ = true;
+  return data == end;
+}
+
+ArchiveIndex ArchiveIndex::scan_entries(ArchiveReader &archive,
+                                        const FileHeader &header) {
+  ArchiveIndex index;
+  index.entries_.reserve(header.entry_count);
+  archive.seek(sizeof(FileHeader));
+
+  for (uint32_t i = 0; i < header.entry_count; ++i) {
+    IndexRecord record;
+    record.entry_offset = archive.tell();
+
+    const char *data = archive.view(entry_header_size(header.version));
+    if (data == nullptr) {
+      throw std::runtime_error("Unexpected end of archive");
+    }
+    uint32_t path_length = decode_entry_header(data, header.version, record);
+    const char *path = archive.view(path_length);
+    if (path == nullptr) {
+      throw std::runtime_error("Unexpected end of archive");
+    }
+    record.path.assign(path, path_length);
+
+    // 跳过内容（对齐条目连同路径后的补齐）
+    if (!archive.skip(record.data_offset() - archive.tell() +
+                      record.stored_size)) {
+      throw std::runtime_error("Unexpected end of archive in file: " +
+                               record.path);
+    }
+    index.entries_.push_back(std::move(record));
+  }
+  return index;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "format.hpp"
+#include "io_backend.hpp"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ============================================
+// 归档索引（中央目录）
+// ============================================
+
+// 单个条目的元数据与位置
+struct IndexRecord {
+  std::string path;           // 归档内相对路径
+  uint64_t entry_offset = 0;  // EntryHeader 在归档中的偏移
+  uint64_t content_size = 0;  // 文件内容大小
+  uint64_t modified_time = 0; // 修改时间
+  uint32_t checksum = 0;      // CRC32 校验和
+  uint16_t permissions = 0;   // 文件权限
+  uint8_t codec = 0;          // 编码方式（版本 3 之前恒为 none）
+  uint8_t flags = 0;          // 条目标志（KAR_ENTRY_*）
+  uint64_t stored_size = 0;   // payload 在归档中的字节数
+  uint16_t version = KAR_VERSION_CURRENT; // 条目头所属的格式版本
+
+  // payload 是否为块序列（压缩、去重或稀疏条目），否则即原始内容
+  bool has_blocks() const {
+    return codec != 0 || (flags & (KAR_ENTRY_DEDUP | KAR_ENTRY_SPARSE)) != 0;
+  }
+
+  // payload 在归档中的偏移（对齐条目为路径之后的下一个对齐边界）
+  uint64_t data_offset() const {
+    const uint64_t offset =
+        entry_offset + entry_header_size(version) + path.size();
+    if (!(flags & KAR_ENTRY_ALIGNED)) {
+      return offset;
+    }
+    return (offset + KAR_ENTRY_ALIGNMENT - 1) / KAR_ENTRY_ALIGNMENT *
+           KAR_ENTRY_ALIGNMENT;
+  }
+};
+
+// 按 version 解析条目头（不含路径），填充 record 的元数据字段；
+// 返回路径长度。编码方式未知时抛出异常
+uint32_t decode_entry_header(const char *data, uint16_t version,
+                             IndexRecord &record);
+
+class ArchiveIndex {
+public:
+  void add(IndexRecord record) { entries_.push_back(std::move(record)); }
+
+  const std::vector<IndexRecord> &entries() const { return entries_; }
+
+  // 最近登记的条目（分块条目写入过程中逐块更新）
+  IndexRecord &back() { return entries_.back(); }
+  size_t size() const { return entries_.size(); }
+
+  // 是否来自中央目录（否则为版本 1 的顺序跳扫结果）
+  bool from_directory() const { return from_directory_; }
+
+  // 去重块索引（仅去重归档；版本 1 顺序跳扫时为空）
+  void add_chunk(const ChunkIndexEntry &chunk) { chunks_.push_back(chunk); }
+  const std::vector<ChunkIndexEntry> &chunks() const { return chunks_; }
+
+  // 原始顺序：order[i] 为第 i 个条目在扫描顺序中的序号（打包时重排了条目的
+  // 归档才有，否则为空，条目顺序即扫描顺序）
+  void set_order(std::vector<uint32_t> order) { order_ = std::move(order); }
+  const std::vector<uint32_t> &order() const { return order_; }
+
+  // 按原始顺序排列的条目（没有顺序表时即归档顺序）
+  std::vector<const IndexRecord *> in_original_order() const;
+
+  // 分卷归档的卷数与每卷字节数（普通归档卷数为 0）
+  void set_volumes(uint32_t count, uint64_t volume_size) {
+    volume_count_ = count;
+    volume_size_ = volume_size;
+  }
+  uint32_t volume_count() const { return volume_count_; }
+
+  // 归档偏移所在的卷（从 0 计；普通归档恒为 0）
+  uint32_t volume_of(uint64_t offset) const {
+    return volume_count_ == 0 ? 0 : static_cast<uint32_t>(offset / volume_size_);
+  }
+
+  // 按路径查找，未找到返回 nullptr（首次调用时建立哈希表，非线程安全）
+  const IndexRecord *find(const std::string &path) const;
+
+  // 在条目区之后写入中央目录（含块索引与原始顺序表）与尾部
+  void write(ArchiveWriter &archive) const;
+
+  // 读取索引：版本 2 起直接读取中央目录；版本 1（或目录损坏，经 warn 警告）时
+  // 从第一个条目开始顺序读取条目头并跳过内容
+  static ArchiveIndex load(ArchiveReader &archive, const FileHeader &header,
+                           const WarningHandler &warn = {});
+
+  // 从内存中的中央目录 + 尾部解析索引（顺序读取的归档末尾，data 位于归档偏移
+  // offset 处、共 size 字节）；尾部、CRC32 或目录项无效时返回 false
+  static bool parse_tail(const char *data, size_t size, uint64_t offset,
+                         const FileHeader &header, ArchiveIndex &index);
+
+private:
+  std::vector<IndexRecord> entries_;
+  std::vector<ChunkIndexEntry> chunks_;
+  std::vector<uint32_t> order_;
+  bool from_directory_ = false;
+  uint32_t volume_count_ = 0;
+  uint64_t volume_size_ = 0;
+  mutable std::unordered_map<std::string, size_t> by_path_;
+
+  static bool read_directory(ArchiveReader &archive, const FileHeader &header,
+                             ArchiveIndex &index);
+  // 校验目录 CRC32 并解析目录项与其后的可选段（data 为 trailer.index_size 字节）
+  static bool parse_directory(const char *data, const FileHeader &header,
+                              const IndexTrailer &trailer, ArchiveIndex &index);
+  static ArchiveIndex scan_entries(ArchiveReader &archive,
+                                   const FileHeader &header);
+};
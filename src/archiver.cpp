@@ -1,235 +1,2665 @@
 #include "archiver.hpp"
+#include "archive_index.hpp"
+#include "codec.hpp"
+#include "directory_cache.hpp"
 #include "format.hpp"
+#include "io_backend.hpp"
+#include "scanner.hpp"
+#include "stage_stats.hpp"
 #include "utils.hpp"
 
+#include "thread_pool.hpp"
+
 #include "../include/crc32.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
-#include <iomanip>
-#include <iostream>
+#include <exception>
+#include <fnmatch.h>
+#include <fstream>
+#include <optional>
+#include <queue>
 #include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+#include <unordered_map>
+
+// ============================================
+// 内部辅助
+// ============================================
+
+namespace {
+
+// 流水线消息：工作线程的结果，或扫描线程的结束标记
+struct PipelineMessage {
+  bool scan_done = false;   // 扫描线程已提交全部任务
+  uint32_t total = 0;       // scan_done 时有效：任务总数
+  std::exception_ptr error; // 读取或扫描失败
+  PackResult result;
+};
+
+// 按 task_id 排序的最小堆比较器
+struct TaskIdCompare {
+  bool operator()(const PackResult &a, const PackResult &b) const {
+    return a.task_id > b.task_id; // 小顶堆
+  }
+};
+
+// 进度累计：条目（或大条目的一个分块）完成时通知观察者；未设置观察者时只累计
+class ProgressTracker {
+public:
+  explicit ProgressTracker(ArchiveObserver *observer) : observer_(observer) {}
+
+  void set_totals(uint64_t entries, uint64_t bytes) {
+    progress_.entries_total = entries;
+    progress_.bytes_total = bytes;
+  }
+
+  // 又处理完 bytes 字节原始内容；entry_done 表示 path 已完整处理
+  void advance(const std::string &path, uint64_t bytes, bool entry_done) {
+    progress_.bytes_done += bytes;
+    if (entry_done) {
+      ++progress_.entries_done;
+    }
+    if (observer_ != nullptr) {
+      progress_.path = &path;
+      observer_->on_progress(progress_);
+    }
+  }
+
+private:
+  ArchiveObserver *observer_;
+  ArchiveProgress progress_;
+};
+
+// 结果对应的原始内容字节数（分块结果为本块）
+uint64_t result_bytes(const PackResult &result) {
+  if (result.base != nullptr) {
+    return result.base->content_size;
+  }
+  return result.chunk_count > 0 ? result.chunk_size : result.content_size;
+}
+
+// 写出一个结果后报告进度：固实块的每个成员各算一个完成的条目
+void report_result(ProgressTracker &progress, const PackResult &result,
+                   bool complete) {
+  if (result.solid.empty()) {
+    progress.advance(result.rel_path, result_bytes(result), complete);
+    return;
+  }
+  for (const SolidMember &member : result.solid) {
+    progress.advance(member.rel_path, member.content_size, true);
+  }
+}
+
+// 按中央目录汇总条目数与字节数
+void add_index_stats(const ArchiveIndex &index, ArchiveStats &stats) {
+  for (const IndexRecord &record : index.entries()) {
+    stats.bytes += record.content_size;
+    stats.stored_bytes += record.stored_size;
+  }
+  stats.entries += index.size();
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// 路径是否包含通配符（否则按精确路径走索引查找）
+bool has_glob(const std::string &pattern) {
+  return pattern.find_first_of("*?[") != std::string::npos;
+}
+
+// 精确路径、目录前缀（"dir" 或 "dir/"）或 fnmatch 通配符匹配
+bool matches_pattern(const std::string &pattern, const std::string &path) {
+  if (path == pattern) {
+    return true;
+  }
+  std::string dir = pattern;
+  if (!dir.empty() && dir.back() != '/') {
+    dir.push_back('/');
+  }
+  if (path.compare(0, dir.size(), dir) == 0) {
+    return true;
+  }
+  return has_glob(pattern) && fnmatch(pattern.c_str(), path.c_str(), 0) == 0;
+}
+
+// 流式归档的条目区结束标记：全零条目头（path_length 为 0）
+void write_end_marker(ArchiveWriter &archive) {
+  const EntryHeaderV3 marker{};
+  write_wire(archive, marker);
+}
+
+// 解出的文件校验通过后，经仍打开的 fd 恢复权限与修改时间（不再按路径查找）；
+// 须在全部写入完成之后调用
+void finish_output(OutputFile &out, const IndexRecord &record) {
+  out.set_permissions(record.permissions);
+  if (record.flags & KAR_ENTRY_MTIME_NS) {
+    out.set_mtime(record.modified_time);
+  }
+}
+
+// 写入前准备输出文件：稀疏条目先截断到完整大小，空洞部分不再写出；
+// 较大的普通条目一次预留空间，避免分段并发写入造成碎片
+void prepare_output(OutputFile &out, const IndexRecord &record) {
+  const bool sparse = (record.flags & KAR_ENTRY_SPARSE) != 0;
+  if (sparse || record.content_size >= Archiver::kStreamChunkSize) {
+    out.preallocate(record.content_size, sparse);
+  }
+}
+
+} // namespace
 
 // ============================================
 // 公开接口实现
 // ============================================
 
-void Archiver::pack(const fs::path &source_dir, const fs::path &archive_path) {
+VerifyLevel parse_verify_level(const std::string &name) {
+  if (name == "none") {
+    return VerifyLevel::None;
+  }
+  if (name == "crc") {
+    return VerifyLevel::Checksums;
+  }
+  throw std::invalid_argument("Unknown verify level: " + name);
+}
+
+PackLayout parse_pack_layout(const std::string &name) {
+  if (name == "scan") {
+    return PackLayout::Scan;
+  }
+  if (name == "grouped") {
+    return PackLayout::Grouped;
+  }
+  throw std::invalid_argument("Unknown layout: " + name);
+}
+
+Archiver::Archiver(const ArchiverOptions &options)
+    : options_(options),
+      backend_(make_io_backend(options.io, warning_handler())) {
+  options_.level = resolve_codec_level(options_.codec, options_.level);
+  if (options_.bandwidth_limit != 0) {
+    bandwidth_ = std::make_unique<BandwidthLimiter>(options_.bandwidth_limit);
+  }
+}
+
+void Archiver::set_observer(ArchiveObserver *observer) {
+  observer_ = observer;
+  if (observer_ != nullptr) {
+    for (const std::string &message : pending_warnings_) {
+      observer_->on_warning(message);
+    }
+    pending_warnings_.clear();
+  }
+}
+
+void Archiver::warn(const std::string &message) {
+  if (observer_ != nullptr) {
+    observer_->on_warning(message);
+  } else {
+    pending_warnings_.push_back(message);
+  }
+}
+
+ArchiveStats Archiver::pack(const fs::path &source_dir,
+                            const fs::path &archive_path) {
+  const auto start = std::chrono::steady_clock::now();
   if (!fs::exists(source_dir) || !fs::is_directory(source_dir)) {
     throw std::runtime_error("Source directory does not exist");
   }
 
-  std::ofstream archive(archive_path, std::ios::binary);
-  if (!archive) {
-    throw std::runtime_error("Cannot create archive file");
+  // 本次打包的状态（基准归档、去重存储）在返回或异常时释放
+  struct PackReset {
+    Archiver &self;
+    ~PackReset() {
+      self.base_.reset();
+      self.dedup_.reset();
+      self.scan_cache_.reset();
+      self.scan_record_.reset();
+    }
+  } pack_reset{*this};
+  reused_ = 0;
+  dedup_saved_ = 0;
+  cached_dirs_ = 0;
+  adaptive_threads_ = 0;
+  streaming_ = archive_path == "-";
+  if (options_.volume_size != 0) {
+    if (streaming_) {
+      throw std::runtime_error("Volumes cannot be written to standard output");
+    }
+    if (options_.volume_size < kMinVolumeSize) {
+      throw std::runtime_error("Volume size must be at least 64 KB");
+    }
+  }
+  if (options_.direct_io || options_.direct_sources) {
+    if (streaming_) {
+      throw std::runtime_error("Direct I/O cannot write to standard output");
+    }
+    if (options_.volume_size != 0) {
+      throw std::runtime_error("Direct I/O cannot be combined with volumes");
+    }
+  }
+  if (options_.dedup) {
+    dedup_ = std::make_unique<DedupStore>();
+  }
+  if (options_.trust_dir_mtime && options_.scan_cache.empty()) {
+    throw std::runtime_error("--trust-dir-mtime requires a scan cache");
+  }
+  if (!options_.scan_cache.empty()) {
+    scan_cache_ =
+        ScanCache::load(options_.scan_cache, source_dir, warning_handler());
+    scan_record_ = std::make_unique<ScanCacheWriter>(source_dir);
   }
 
-  // 收集所有文件路径
-  std::vector<fs::path> files;
-  for (const auto &entry : fs::recursive_directory_iterator(source_dir)) {
-    if (entry.is_regular_file()) {
-      files.push_back(entry.path());
+  // 增量打包：先读入基准归档的索引（必须在创建输出文件之前）
+  if (!options_.incremental_base.empty()) {
+    if (!streaming_ && fs::exists(archive_path) &&
+        fs::equivalent(options_.incremental_base, archive_path)) {
+      throw std::runtime_error("Incremental base must differ from the output archive");
     }
+    auto base = std::make_unique<BaseArchive>();
+    base->reader =
+        std::make_unique<ArchiveReader>(options_.incremental_base, backend_->use_mmap());
+    if (base->reader->volumes() != nullptr) {
+      // 未变文件按基准归档内的偏移直接拷贝，需要单个归档文件
+      throw std::runtime_error("Incremental base cannot be a multi-volume archive");
+    }
+    FileHeader base_header;
+    if (!read_wire(*base->reader, base_header) ||
+        base_header.magic != KAR_MAGIC) {
+      throw std::runtime_error("Invalid base archive format (wrong magic number)");
+    }
+    base->index =
+        ArchiveIndex::load(*base->reader, base_header, warning_handler());
+    base->index.find(""); // 预先建立路径哈希表，之后只读
+    base->file = std::make_shared<InputFile>(options_.incremental_base);
+    if (backend_->use_mmap()) {
+      base->file->map();
+    }
+    base_ = std::move(base);
+  }
+
+  // "-"：顺序写到标准输出（管道），不回写已写出的区域
+  std::unique_ptr<ArchiveWriter> output =
+      streaming_
+          ? std::make_unique<ArchiveWriter>(STDOUT_FILENO,
+                                            options_.write_buffer_size)
+          : std::make_unique<ArchiveWriter>(archive_path,
+                                            options_.write_buffer_size,
+                                            options_.volume_size,
+                                            options_.direct_io,
+                                            warning_handler());
+  ArchiveWriter &archive = *output;
+  backend_->prepare(archive);
+
+  unsigned threads = options_.threads;
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // 单核环境下自动回退到串行模式
+  ArchiveIndex index = threads == 1
+                           ? pack_serial(archive, source_dir)
+                           : pack_parallel(archive, source_dir, threads);
+  ArchiveStats stats;
+  stats.archive_bytes = archive.tell();
+  archive.close();
+  stats.volumes = archive.volume_count();
+  stats.cached_directories = cached_dirs_;
+  stats.adaptive_threads = adaptive_threads_;
+
+  // 归档完整写出后才替换扫描缓存，其中的 CRC32 取自本次的中央目录
+  if (scan_record_) {
+    scan_record_->write(options_.scan_cache,
+                        [&](const std::string &rel) -> std::optional<uint32_t> {
+                          const IndexRecord *record = index.find(rel);
+                          if (record == nullptr) {
+                            return std::nullopt;
+                          }
+                          return record->checksum;
+                        });
+  }
+
+  add_index_stats(index, stats);
+  stats.archive_entries = stats.entries;
+  stats.reused_entries = reused_;
+  if (dedup_) {
+    stats.unique_chunks = dedup_->chunk_count();
+    stats.dedup_bytes = dedup_saved_;
+  }
+  stats.seconds = seconds_since(start);
+  return stats;
+}
+
+ArchiveIndex Archiver::pack_serial(ArchiveWriter &archive,
+                                   const fs::path &source_dir) {
+  // 收集所有文件（大小与 mtime 随扫描取得）
+  std::vector<ScanEntry> files;
+  scan_sources(source_dir, 0, [&](ScanEntry &&entry) {
+    files.push_back(std::move(entry));
+    return true;
+  });
+  std::vector<uint32_t> order;
+  if (options_.layout == PackLayout::Grouped) {
+    order = plan_layout(files);
   }
 
   // 写入全局 Header
+  // 流式输出的条目数量只写在尾部
+  FileHeader global_header{
+      .magic = KAR_MAGIC,
+      .version = KAR_VERSION_CURRENT,
+      .entry_count = streaming_ ? 0 : static_cast<uint32_t>(files.size()),
+      .created_at = current_timestamp(),
+      .flags = streaming_ ? KAR_ARCHIVE_STREAMED : 0};
+  write_wire(archive, global_header);
+
+  // 逐个写入文件（大文件逐块处理），报告进度
+  const size_t total_files = files.size();
+  ArchiveIndex index;
+  ProgressTracker progress(observer_);
+  uint64_t total_bytes = 0;
+  for (const ScanEntry &entry : files) {
+    total_bytes += entry.size;
+  }
+  progress.set_totals(total_files, total_bytes);
+  uint32_t next_id = 0;
+  auto write = [&](const PackResult &result) {
+    throttle(result_bytes(result));
+    bool complete = write_entry(archive, result, index);
+    report_result(progress, result, complete);
+  };
+
+  // 批量读取：连续的小文件攒满一批再读，其他任务写入前先写出已攒的批
+  std::vector<PackTask> batch;
+  size_t batch_bytes = 0;
+  auto flush_batch = [&] {
+    if (!batch.empty()) {
+      for (const PackResult &result : load_batch(batch)) {
+        write(result);
+      }
+      batch.clear();
+      batch_bytes = 0;
+    }
+  };
+  for (size_t i = 0; i < total_files;) {
+    for (PackTask &task : plan_next(files, i, next_id)) {
+      if (batchable(task)) {
+        batch_bytes += task.stat.size;
+        batch.push_back(std::move(task));
+        if (batch.size() == kReadBatchFiles || batch_bytes >= kReadBatchBytes) {
+          flush_batch();
+        }
+        continue;
+      }
+      flush_batch();
+      write(load_entry(task));
+    }
+  }
+  flush_batch();
+
+  // 条目之后写入中央目录
+  if (streaming_) {
+    write_end_marker(archive);
+  }
+  index.set_order(std::move(order));
+  index.write(archive);
+
+  return index;
+}
+
+ArchiveIndex Archiver::pack_parallel(ArchiveWriter &archive,
+                                     const fs::path &source_dir,
+                                     unsigned threads) {
+  // entry_count 先写 0，全部条目写完后回填（流式输出不回填），
+  // 其余字节与串行输出一致
   FileHeader global_header{.magic = KAR_MAGIC,
-                           .version = 1,
-                           .entry_count = static_cast<uint32_t>(files.size()),
+                           .version = KAR_VERSION_CURRENT,
+                           .entry_count = 0,
                            .created_at = current_timestamp(),
-                           .reserved = 0};
-  archive.write(reinterpret_cast<const char *>(&global_header),
-                sizeof(global_header));
+                           .flags = streaming_ ? KAR_ARCHIVE_STREAMED : 0};
+  const uint64_t header_pos = archive.tell();
+  write_wire(archive, global_header);
 
-  // 逐个写入文件，显示进度条
-  const size_t total_files = files.size();
-  for (size_t i = 0; i < total_files; ++i) {
-    const auto &file_path = files[i];
-    write_entry(archive, source_dir, file_path);
+  ThreadSafeQueue<PipelineMessage> results;
+  MemoryLimiter limiter(options_.max_inflight_bytes);
+  std::atomic<bool> aborted{false};
+  std::atomic<uint32_t> scanned{0};       // 已扫描的文件数（用于进度显示）
+  std::atomic<uint64_t> scanned_bytes{0}; // 已扫描文件的总字节数
+
+  ThreadPool pool(threads, options_.affinity);
+  std::vector<uint32_t> order; // 分组布局的原始顺序表（扫描线程结束后有效）
+
+  // 自适应并发：按写出的字节数采样吞吐，调整启用的线程数与在途预算
+  // （至少容纳每个启用线程一个分块）
+  // 扫描早于第一次采样，其目录列出线程数取控制器的起点
+  std::atomic<uint64_t> written{0};
+  std::optional<AdaptiveController> controller;
+  unsigned scan_threads = threads;
+  if (options_.adaptive) {
+    controller.emplace(pool, written, &limiter, options_.max_inflight_bytes,
+                       kChunkSize);
+    scan_threads =
+        static_cast<unsigned>(AdaptiveController::initial_workers(threads));
+  }
+
+  // 扫描线程：按写出顺序分配 task_id（大文件的每个分块各占一个），
+  // 并按同一顺序申请在途预算，保证写入线程等待的任务一定已经拿到预算（不会死锁）。
+  // 目录由扫描器的后台线程并行列出，与工作线程的读取重叠；
+  // 分组布局需要完整的文件列表，扫描结束后才开始重排并提交
+  std::thread scanner([&] {
+    PipelineMessage done;
+    done.scan_done = true;
+    // 批量读取：小文件任务攒成一批交给一个工作线程；扫描线程因预算阻塞前
+    // 先提交已攒的批，写入线程等待的任务不会滞留在批中
+    std::vector<PackTask> batch;
+    size_t batch_bytes = 0;
+    auto flush_batch = [&] {
+      if (batch.empty()) {
+        return;
+      }
+      pool.submit([&, batch = std::move(batch)] {
+        std::vector<PackResult> loaded;
+        std::exception_ptr error;
+        try {
+          loaded = load_batch(batch);
+          uint64_t bytes = 0;
+          for (const PackResult &result : loaded) {
+            bytes += result_bytes(result);
+          }
+          throttle(bytes);
+        } catch (...) {
+          error = std::current_exception();
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+          PipelineMessage msg;
+          msg.error = error;
+          if (!error) {
+            msg.result = std::move(loaded[i]);
+          }
+          msg.result.task_id = batch[i].task_id;
+          msg.result.reserved = batch[i].reserved;
+          results.push(std::move(msg));
+        }
+      });
+      batch.clear();
+      batch_bytes = 0;
+    };
 
-    // 计算进度
-    int progress = static_cast<int>((i + 1) * 100 / total_files);
-    int bar_width = 30;
-    int pos = static_cast<int>(bar_width * (i + 1) / total_files);
+    // 按顺序申请预算并提交任务；中止时返回 false
+    auto submit = [&](std::vector<PackTask> &&tasks) {
+      for (PackTask &task : tasks) {
+        if (!limiter.try_acquire(task.reserved)) {
+          flush_batch();
+          if (!limiter.acquire(task.reserved)) {
+            aborted = true;
+            return false;
+          }
+        }
+        if (batchable(task)) {
+          batch_bytes += task.stat.size;
+          batch.push_back(std::move(task));
+          if (batch.size() == kReadBatchFiles ||
+              batch_bytes >= kReadBatchBytes) {
+            flush_batch();
+          }
+          continue;
+        }
+        pool.submit([&, task = std::move(task)] {
+          PipelineMessage msg;
+          try {
+            msg.result = load_entry(task);
+            throttle(result_bytes(msg.result));
+          } catch (...) {
+            msg.error = std::current_exception();
+          }
+          msg.result.task_id = task.task_id;
+          msg.result.reserved = task.reserved;
+          results.push(std::move(msg));
+        });
+      }
+      return true;
+    };
 
-    // 构建进度条
-    std::cout << "\r[";
-    for (int j = 0; j < bar_width; ++j) {
-      if (j < pos)
-        std::cout << "█";
-      else
-        std::cout << "░";
+    try {
+      uint32_t task_id = 0;
+      if (options_.layout == PackLayout::Grouped) {
+        std::vector<ScanEntry> files;
+        scan_sources(source_dir, scan_threads, [&](ScanEntry &&entry) {
+          scanned_bytes += entry.size;
+          files.push_back(std::move(entry));
+          return !aborted;
+        });
+        scanned = static_cast<uint32_t>(files.size());
+        order = plan_layout(files);
+        for (size_t i = 0; i < files.size() && !aborted;) {
+          if (!submit(plan_next(files, i, task_id))) {
+            break;
+          }
+        }
+      } else {
+        scan_sources(source_dir, scan_threads, [&](ScanEntry &&entry) {
+          if (aborted) {
+            return false;
+          }
+          const uint64_t size = entry.size;
+          if (!submit(plan_tasks(std::move(entry), task_id))) {
+            return false;
+          }
+          ++scanned;
+          scanned_bytes += size;
+          return true;
+        });
+      }
+      flush_batch();
+      done.total = task_id;
+    } catch (...) {
+      done.error = std::current_exception();
     }
-    std::cout << "] " << std::setw(3) << progress << "% ";
-    std::cout << "(" << (i + 1) << "/" << total_files << ") ";
-    std::cout << fs::relative(file_path, source_dir).string();
-    std::cout.flush();
+    results.push(std::move(done));
+  });
+
+  // 写入线程（当前线程）：最小堆缓存乱序到达的结果，按 task_id 顺序写入
+  std::priority_queue<PackResult, std::vector<PackResult>, TaskIdCompare>
+      pending_results;
+  uint32_t next_expected_id = 0;
+  ArchiveIndex index;
+  ProgressTracker progress(observer_);
+  bool scan_done = false;
+  uint32_t total_tasks = 0;
+  std::exception_ptr error;
+
+  try {
+    PipelineMessage msg;
+    while (!(scan_done && next_expected_id == total_tasks) &&
+           results.pop(msg)) {
+      if (msg.error) {
+        std::rethrow_exception(msg.error);
+      }
+      if (msg.scan_done) {
+        scan_done = true;
+        total_tasks = msg.total;
+        continue;
+      }
+      pending_results.push(std::move(msg.result));
+
+      // 写入所有已就绪且顺序正确的结果
+      while (!pending_results.empty() &&
+             pending_results.top().task_id == next_expected_id) {
+        const PackResult &result = pending_results.top();
+        bool complete = write_entry(archive, result, index);
+        limiter.release(result.reserved);
+        written.fetch_add(result_bytes(result), std::memory_order_relaxed);
+        next_expected_id++;
+        progress.set_totals(std::max<size_t>(index.size(), scanned),
+                            scanned_bytes);
+        report_result(progress, result, complete);
+        pending_results.pop();
+      }
+    }
+  } catch (...) {
+    error = std::current_exception();
   }
 
-  std::cout << "\n\nArchive created: " << archive_path << " (" << total_files
-            << " files)\n";
+  // 任一任务失败：通知扫描线程停止，等待在途任务结束后再抛出
+  if (error) {
+    aborted = true;
+    limiter.stop();
+  }
+  if (controller) {
+    adaptive_threads_ = static_cast<uint32_t>(controller->stop());
+  }
+  scanner.join();
+  pool.wait_all();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  // 条目之后写入中央目录，并回填条目数量
+  const uint32_t total_files = static_cast<uint32_t>(index.size());
+  index.set_order(std::move(order));
+  if (streaming_) {
+    write_end_marker(archive);
+    index.write(archive);
+    return index;
+  }
+  index.write(archive);
+  global_header.entry_count = total_files;
+  const FileHeader wire_header = wire_order(global_header);
+  archive.write_at(header_pos, &wire_header, sizeof(wire_header));
+
+  return index;
 }
 
-void Archiver::unpack(const fs::path &archive_path,
-                      const fs::path &target_dir) {
-  std::ifstream archive(archive_path, std::ios::binary);
-  if (!archive) {
-    throw std::runtime_error("Cannot open archive file");
+ArchiveStats Archiver::unpack(const fs::path &archive_path,
+                              const fs::path &target_dir) {
+  if (archive_path == "-") {
+    return unpack_stream(STDIN_FILENO, target_dir);
   }
+  const auto start = std::chrono::steady_clock::now();
+  ArchiveReader archive(archive_path, backend_->use_mmap());
 
   // 读取并验证全局 Header
   FileHeader global_header;
-  archive.read(reinterpret_cast<char *>(&global_header), sizeof(global_header));
-
-  if (global_header.magic != KAR_MAGIC) {
+  if (!read_wire(archive, global_header) ||
+      global_header.magic != KAR_MAGIC) {
     throw std::runtime_error("Invalid archive format (wrong magic number)");
   }
 
-  std::cout << "Archive version: " << global_header.version << "\n";
-  std::cout << "Total entries: " << global_header.entry_count << "\n\n";
+  // 流式归档的条目数量只在尾部，分块条目头未回填：始终按中央目录解包
+  const bool streamed = (global_header.flags & KAR_ARCHIVE_STREAMED) != 0;
+  ArchiveIndex index;
+  uint32_t total_entries = global_header.entry_count;
+  if (streamed) {
+    index = ArchiveIndex::load(archive, global_header, warning_handler());
+    total_entries = static_cast<uint32_t>(index.size());
+  }
+
+  ArchiveStats stats;
+  stats.version = global_header.version;
+  stats.archive_entries = total_entries;
+  stats.archive_bytes = archive.size();
 
-  const uint32_t total_entries = global_header.entry_count;
+  unsigned threads = options_.threads;
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  if (threads > 1 && total_entries > 1) {
+    if (!streamed) {
+      index = ArchiveIndex::load(archive, global_header, warning_handler());
+    }
+    unpack_parallel(archive, index, target_dir, threads);
+    add_index_stats(index, stats);
+    stats.adaptive_threads = adaptive_threads_;
+    stats.seconds = seconds_since(start);
+    return stats;
+  }
+
+  DirectoryCache dirs(target_dir);
+  ByteBuffer scratch;
+  ProgressTracker progress(observer_);
+  progress.set_totals(total_entries, 0);
 
-  // 逐个读取文件，显示进度条
+  // 逐个读取文件并报告进度
   for (uint32_t i = 0; i < total_entries; ++i) {
-    // 先读取 entry header 获取文件名
-    EntryHeader entry;
-    archive.read(reinterpret_cast<char *>(&entry), sizeof(entry));
-
-    std::string rel_path(entry.path_length, '\0');
-    archive.read(rel_path.data(), entry.path_length);
-
-    // 计算并显示进度
-    int progress = static_cast<int>((i + 1) * 100 / total_entries);
-    int bar_width = 30;
-    int pos = static_cast<int>(bar_width * (i + 1) / total_entries);
-
-    std::cout << "\r[";
-    for (int j = 0; j < bar_width; ++j) {
-      if (j < pos)
-        std::cout << "█";
-      else
-        std::cout << "░";
-    }
-    std::cout << "] " << std::setw(3) << progress << "% ";
-    std::cout << "(" << (i + 1) << "/" << total_entries << ") ";
-    std::cout << rel_path;
-    std::cout.flush();
-
-    // 读取内容并解压
-    std::vector<char> buffer(entry.content_size);
-    archive.read(buffer.data(), entry.content_size);
-
-    // 验证 CRC32 校验和
+    // 先读取 entry header 获取文件名（流式归档取自中央目录）
+    IndexRecord record = streamed
+                             ? index.entries()[i]
+                             : read_entry_header(archive, global_header.version);
+
+    // 分块读取内容、校验并写入目标文件
+    extract_payload(archive, record, dirs, scratch);
+    throttle(record.content_size);
+    if (!streamed) {
+      archive.seek(record.data_offset() + record.stored_size);
+    }
+    progress.advance(record.path, record.content_size, true);
+    stats.bytes += record.content_size;
+    stats.stored_bytes += record.stored_size;
+    ++stats.entries;
+  }
+
+  stats.seconds = seconds_since(start);
+  return stats;
+}
+
+void Archiver::unpack_parallel(const ArchiveReader &archive,
+                               const ArchiveIndex &index,
+                               const fs::path &target_dir, unsigned threads) {
+  // 阶段 1: 全部条目头已由调用方预读（版本 2 起读中央目录，版本 1 跳扫）
+  const auto &records = index.entries();
+
+  // 阶段 2: 建立目录骨架并拆分任务：每个条目的父目录在此一次性创建并缓存 fd，
+  // 工作线程只查缓存。小条目一个任务（同一固实块的相邻成员合为一个任务，
+  // 块只解码一次）；大条目先创建输出文件，
+  // 再按可独立解码的段拆成多个任务，最后完成的任务合并各段 CRC32 并校验
+  struct ChunkedExtract {
+    fs::path out_path;
+    std::unique_ptr<OutputFile> out;
+    std::vector<PayloadRange> ranges;
+    std::vector<uint32_t> checksums;
+    std::atomic<size_t> remaining{0};
+    std::atomic<bool> failed{false};
+  };
+  struct Job {
+    size_t record;                // 条目序号
+    ChunkedExtract *chunked;      // 大条目的共享状态，小条目为 nullptr
+    size_t range;                 // 大条目中的段序号
+    size_t count = 1;             // 小条目：从 record 起连续的条目数
+  };
+  DirectoryCache dirs(target_dir);
+  std::vector<std::unique_ptr<ChunkedExtract>> chunked_entries;
+  std::vector<Job> jobs;
+  jobs.reserve(records.size());
+  {
+    ByteBuffer scratch;
+    for (size_t i = 0; i < records.size(); ++i) {
+      const IndexRecord &record = records[i];
+      const DirectoryCache::Location location = dirs.locate(record.path);
+      if (record.content_size <= kChunkSize) {
+        // 只有 SolidRef 的成员跟随前一个固实任务（组首的 payload 带有块）
+        const bool member = (record.flags & KAR_ENTRY_SOLID) &&
+                            record.stored_size == sizeof(SolidRef);
+        if (member && !jobs.empty() && jobs.back().chunked == nullptr &&
+            jobs.back().record + jobs.back().count == i &&
+            (records[jobs.back().record].flags & KAR_ENTRY_SOLID)) {
+          ++jobs.back().count;
+        } else {
+          jobs.push_back(Job{i, nullptr, 0});
+        }
+        continue;
+      }
+      verify_entry_header(archive, record, scratch);
+      auto state = std::make_unique<ChunkedExtract>();
+      state->ranges = plan_ranges(archive, record, scratch);
+      state->checksums.resize(state->ranges.size());
+      state->remaining = state->ranges.size();
+      state->out_path = dirs.full_path(record.path);
+      state->out = std::make_unique<OutputFile>(location.dir_fd, location.name,
+                                                state->out_path);
+      try {
+        prepare_output(*state->out, record);
+      } catch (...) {
+        fs::remove(state->out_path);
+        throw;
+      }
+      for (size_t r = 0; r < state->ranges.size(); ++r) {
+        jobs.push_back(Job{i, state.get(), r});
+      }
+      chunked_entries.push_back(std::move(state));
+    }
+  }
+
+  // 大条目的全部段完成后：合并 CRC32、校验，再经同一 fd 恢复权限与修改时间；
+  // 失败时删除文件
+  auto finish_chunked = [&](const IndexRecord &record, ChunkedExtract &state) {
+    uint32_t calculated_crc = 0;
+    for (size_t r = 0; r < state.ranges.size(); ++r) {
+      calculated_crc = crc32_combine(calculated_crc, state.checksums[r],
+                                     state.ranges[r].raw_size);
+    }
+    try {
+      if (!state.failed) {
+        if (options_.verify != VerifyLevel::None &&
+            calculated_crc != record.checksum) {
+          throw std::runtime_error(
+              "CRC32 mismatch for file: " + record.path +
+              " (expected: " + std::to_string(record.checksum) +
+              ", got: " + std::to_string(calculated_crc) + ")");
+        }
+        finish_output(*state.out, record);
+      }
+      state.out->close();
+    } catch (...) {
+      fs::remove(state.out_path);
+      throw;
+    }
+    if (state.failed) {
+      fs::remove(state.out_path);
+    }
+  };
+
+  // 阶段 3: 工作线程各自读取内容、校验 CRC 并写出文件；
+  // 目录创建经共享缓存去重
+  struct Done {
+    size_t job;
+    std::exception_ptr error;
+    bool entry_done = false; // 小条目，或大条目的最后一段
+  };
+  ThreadSafeQueue<Done> done_queue;
+  std::atomic<bool> aborted{false};
+  std::atomic<uint64_t> extracted{0}; // 已解出的原始字节数（自适应并发的采样）
+  adaptive_threads_ = 0;
+
+  {
+    ThreadPool pool(threads, options_.affinity);
+    std::optional<AdaptiveController> controller;
+    if (options_.adaptive) {
+      controller.emplace(pool, extracted);
+    }
+    for (size_t j = 0; j < jobs.size(); ++j) {
+      pool.submit([&, j] {
+        // 每个工作线程复用自己的 scratch 缓冲区
+        thread_local ByteBuffer scratch;
+        const Job &job = jobs[j];
+        const IndexRecord &record = records[job.record];
+        Done done{j, nullptr};
+        try {
+          if (job.chunked == nullptr) {
+            done.entry_done = true;
+            for (size_t k = 0; k < job.count && !aborted; ++k) {
+              extract_payload(archive, records[job.record + k], dirs, scratch);
+              throttle(records[job.record + k].content_size);
+              extracted.fetch_add(records[job.record + k].content_size,
+                                  std::memory_order_relaxed);
+            }
+          } else {
+            ChunkedExtract &state = *job.chunked;
+            try {
+              if (!aborted && !state.failed) {
+                state.checksums[job.range] =
+                    extract_range(archive, record, state.ranges[job.range],
+                                  state.out.get(), scratch);
+                throttle(state.ranges[job.range].raw_size);
+                extracted.fetch_add(state.ranges[job.range].raw_size,
+                                    std::memory_order_relaxed);
+              }
+            } catch (...) {
+              state.failed = true;
+              done.error = std::current_exception();
+            }
+            if (aborted) {
+              state.failed = true;
+            }
+            if (--state.remaining == 0) {
+              done.entry_done = true;
+              finish_chunked(record, state);
+            }
+          }
+        } catch (...) {
+          done.error = std::current_exception();
+        }
+        if (done.error) {
+          aborted = true;
+        }
+        done_queue.push(std::move(done));
+      });
+    }
+
+    // 阶段 4: 当前线程汇总进度，记录第一个错误
+    ProgressTracker progress(observer_);
+    uint64_t total_bytes = 0;
+    for (const IndexRecord &record : records) {
+      total_bytes += record.content_size;
+    }
+    progress.set_totals(records.size(), total_bytes);
+    std::exception_ptr error;
+    Done done;
+    for (size_t completed = 0; completed < jobs.size(); ++completed) {
+      done_queue.pop(done);
+      if (done.error && !error) {
+        error = done.error;
+      }
+      if (!error) {
+        const Job &job = jobs[done.job];
+        if (job.chunked != nullptr) {
+          progress.advance(records[job.record].path,
+                           job.chunked->ranges[job.range].raw_size,
+                           done.entry_done);
+          continue;
+        }
+        for (size_t k = 0; k < job.count; ++k) {
+          const IndexRecord &record = records[job.record + k];
+          progress.advance(record.path, record.content_size, true);
+        }
+      }
+    }
+    if (controller) {
+      adaptive_threads_ = static_cast<uint32_t>(controller->stop());
+    }
+    pool.wait_all();
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+namespace {
+
+// 顺序解包中已解出的字面块（仅去重条目）：按 BlockHeader 的归档偏移登记，
+// 引用块从所在的输出文件读回，不在内存中保留块数据。
+// 另保留最近一个固实块的原始数据，供同组的后续成员切取
+class StreamBlocks {
+public:
+  struct Solid {
+    uint64_t offset = UINT64_MAX; // BlockHeader 的归档偏移
+    ByteBuffer raw;
+  };
+  Solid solid;
+
+  struct Block {
+    size_t file = 0;         // 所在输出文件的序号
+    uint64_t raw_offset = 0; // 在该文件中的偏移
+    uint32_t raw_size = 0;
+    uint32_t checksum = 0;
+  };
+
+  // 登记一个输出文件，返回其序号
+  size_t add_file(const fs::path &path) {
+    files_.push_back(path);
+    return files_.size() - 1;
+  }
+
+  void add(uint64_t block_offset, const Block &block) {
+    blocks_.emplace(block_offset, block);
+  }
+
+  const Block *find(uint64_t block_offset) const {
+    auto it = blocks_.find(block_offset);
+    return it == blocks_.end() ? nullptr : &it->second;
+  }
+
+  // 把块的原始数据读入 dst；文件已不存在或变短时返回 false
+  bool read(const Block &block, char *dst) {
+    try {
+      if (!input_ || input_file_ != block.file) {
+        input_.reset();
+        input_ = std::make_unique<InputFile>(files_[block.file]);
+        input_file_ = block.file;
+      }
+    } catch (const std::exception &) {
+      return false;
+    }
+    return input_->read_at(dst, block.raw_size, block.raw_offset) ==
+           block.raw_size;
+  }
+
+private:
+  std::vector<fs::path> files_;
+  std::unordered_map<uint64_t, Block> blocks_;
+  std::unique_ptr<InputFile> input_; // 最近读回的文件（引用多集中于相邻条目）
+  size_t input_file_ = 0;
+};
+
+// 从顺序输入读取并解码一个条目的 payload，写入 out；verify 时逐块核对 CRC32
+// 并返回原始内容的 CRC32，stored 返回消费的 payload 字节数。
+// 条目头已回填时 payload 不得超出其 stored_size
+uint32_t extract_stream_payload(StreamReader &archive,
+                                const IndexRecord &record, OutputFile &out,
+                                size_t file, StreamBlocks &blocks, bool verify,
+                                uint64_t &stored) {
+  const Codec codec = static_cast<Codec>(record.codec);
+  const bool dedup = (record.flags & KAR_ENTRY_DEDUP) != 0;
+  const bool sparse = (record.flags & KAR_ENTRY_SPARSE) != 0;
+  const bool deferred = (record.flags & KAR_ENTRY_DEFERRED) != 0;
+  uint64_t produced = 0;
+
+  // 固实条目：组内首个成员带有块，解码后保留；后续成员只能指向该块
+  if (record.flags & KAR_ENTRY_SOLID) {
+    SolidRef ref;
+    if (!read_wire(archive, ref)) {
+      throw std::runtime_error("Unexpected end of archive in file: " +
+                               record.path);
+    }
+    stored = sizeof(ref);
+    StreamBlocks::Solid &solid = blocks.solid;
+    if (ref.block_offset == archive.tell()) {
+      BlockHeader block;
+      if (!read_wire(archive, block)) {
+        throw std::runtime_error("Unexpected end of archive in file: " +
+                                 record.path);
+      }
+      if (block.raw_size == 0 || block.raw_size > kCodecBlockSize ||
+          block.stored_size == 0 || block.stored_size > block.raw_size) {
+        throw std::runtime_error("Corrupted solid block in file: " +
+                                 record.path);
+      }
+      const char *data = archive.view(block.stored_size);
+      if (data == nullptr) {
+        throw std::runtime_error("Unexpected end of archive in file: " +
+                                 record.path);
+      }
+      stored += sizeof(block) + block.stored_size;
+      solid.offset = UINT64_MAX;
+      solid.raw.resize(block.raw_size);
+      if (block.stored_size == block.raw_size) {
+        std::memcpy(solid.raw.data(), data, block.raw_size);
+      } else {
+        decode_block(codec, block, data, solid.raw.data());
+      }
+      solid.offset = ref.block_offset;
+    }
+    if (ref.block_offset != solid.offset || ref.raw_offset > solid.raw.size() ||
+        record.content_size > solid.raw.size() - ref.raw_offset) {
+      throw std::runtime_error("Corrupted solid block in file: " + record.path);
+    }
+    const char *member = solid.raw.data() + ref.raw_offset;
+    const size_t n = static_cast<size_t>(record.content_size);
+    uint32_t checksum = 0;
+    if (verify) {
+      StageTimer timer(Stage::Crc, n);
+      checksum = CRC32().calculate(reinterpret_cast<const uint8_t *>(member), n);
+    }
+    out.write_at(member, n, 0);
+    return checksum;
+  }
+
+  // 原样存储：payload 即原始内容（未回填的条目同样等于 content_size）
+  if (!record.has_blocks()) {
     CRC32 crc32;
-    uint32_t calculated_crc = crc32.calculate(buffer);
-    if (calculated_crc != entry.checksum) {
-      throw std::runtime_error("CRC32 mismatch for file: " + rel_path +
-                               " (expected: " + std::to_string(entry.checksum) +
-                               ", got: " + std::to_string(calculated_crc) + ")");
+    while (produced < record.content_size) {
+      size_t n = static_cast<size_t>(std::min<uint64_t>(
+          record.content_size - produced, Archiver::kStreamChunkSize));
+      const char *chunk = archive.view(n);
+      if (chunk == nullptr) {
+        throw std::runtime_error("Unexpected end of archive in file: " +
+                                 record.path);
+      }
+      if (verify) {
+        StageTimer timer(Stage::Crc, n);
+        crc32.update(chunk, n);
+      }
+      out.write_at(chunk, n, produced);
+      produced += n;
+    }
+    stored = record.content_size;
+    return crc32.finalize();
+  }
+
+  // 逐块解码直到凑满 content_size；引用块只能指向此前已解出的字面块
+  thread_local ByteBuffer raw;
+  uint32_t checksum = 0;
+  stored = 0;
+  while (produced < record.content_size) {
+    const uint64_t block_offset = archive.tell();
+    BlockHeader block;
+    if (!read_wire(archive, block)) {
+      throw std::runtime_error("Unexpected end of archive in file: " +
+                               record.path);
+    }
+    if (sparse && block.raw_size == 0) {
+      // 空洞记录：输出文件已截断到完整大小，不写出；CRC32 按全零合并
+      HoleRun hole;
+      if (!read_wire(archive, hole)) {
+        throw std::runtime_error("Unexpected end of archive in file: " +
+                                 record.path);
+      }
+      if (block.stored_size != 0 || block.checksum != 0 || hole.length == 0 ||
+          hole.length > record.content_size - produced ||
+          (!deferred &&
+           sizeof(block) + sizeof(hole) > record.stored_size - stored)) {
+        throw std::runtime_error("Corrupted block in file: " + record.path);
+      }
+      stored += sizeof(block) + sizeof(hole);
+      if (verify) {
+        checksum = crc32_combine(checksum, zeros_checksum(hole.length),
+                                 hole.length);
+      }
+      produced += hole.length;
+      continue;
+    }
+    const uint64_t item_size =
+        block.stored_size == 0 ? sizeof(ChunkRef) : block.stored_size;
+    if (block.raw_size == 0 || block.raw_size > kCodecBlockSize ||
+        block.stored_size > block.raw_size ||
+        (block.stored_size == 0 && !dedup) ||
+        block.raw_size > record.content_size - produced ||
+        (!deferred &&
+         sizeof(block) + item_size > record.stored_size - stored)) {
+      throw std::runtime_error("Corrupted block in file: " + record.path);
+    }
+    stored += sizeof(block) + item_size;
+
+    const char *data = nullptr;
+    if (block.stored_size == 0) {
+      ChunkRef ref;
+      if (!read_wire(archive, ref)) {
+        throw std::runtime_error("Unexpected end of archive in file: " +
+                                 record.path);
+      }
+      const StreamBlocks::Block *target = blocks.find(ref.block_offset);
+      raw.resize(block.raw_size);
+      if (target == nullptr || target->raw_size != block.raw_size ||
+          target->checksum != block.checksum ||
+          !blocks.read(*target, raw.data())) {
+        throw std::runtime_error("Corrupted chunk reference in file: " +
+                                 record.path);
+      }
+      data = raw.data();
+    } else {
+      data = archive.view(block.stored_size);
+      if (data == nullptr) {
+        throw std::runtime_error("Unexpected end of archive in file: " +
+                                 record.path);
+      }
+      if (block.stored_size != block.raw_size) {
+        raw.resize(block.raw_size);
+        decode_block(codec, block, data, raw.data());
+        data = raw.data();
+      }
+      if (dedup) {
+        blocks.add(block_offset, StreamBlocks::Block{.file = file,
+                                                     .raw_offset = produced,
+                                                     .raw_size = block.raw_size,
+                                                     .checksum = block.checksum});
+      }
+    }
+    if (verify) {
+      StageTimer timer(Stage::Crc, block.raw_size);
+      uint32_t block_crc = CRC32().calculate(
+          reinterpret_cast<const uint8_t *>(data), block.raw_size);
+      if (block_crc != block.checksum) {
+        throw std::runtime_error("CRC32 mismatch for file: " + record.path +
+                                 " (block at offset " +
+                                 std::to_string(produced) + ")");
+      }
+      checksum = crc32_combine(checksum, block_crc, block.raw_size);
+    }
+    out.write_at(data, block.raw_size, produced);
+    produced += block.raw_size;
+  }
+  return checksum;
+}
+
+} // namespace
+
+ArchiveStats Archiver::unpack_stream(int fd, const fs::path &target_dir) {
+  const auto start = std::chrono::steady_clock::now();
+  StreamReader archive(fd);
+
+  // 读取并验证全局 Header
+  FileHeader global_header;
+  if (!read_wire(archive, global_header) ||
+      global_header.magic != KAR_MAGIC) {
+    throw std::runtime_error("Invalid archive format (wrong magic number)");
+  }
+  const bool streamed = (global_header.flags & KAR_ARCHIVE_STREAMED) != 0;
+  const uint16_t version = global_header.version;
+  const bool verify = options_.verify != VerifyLevel::None;
+
+  // 逐条目边读边解出：流式归档读到结束标记为止，否则读 entry_count 个条目。
+  // extracted 保存实际算得的 CRC32 与存储大小，读完后与中央目录核对
+  DirectoryCache dirs(target_dir);
+  StreamBlocks blocks;
+  std::vector<IndexRecord> extracted;
+  ProgressTracker progress(observer_);
+  progress.set_totals(streamed ? 0 : global_header.entry_count, 0);
+  ArchiveStats stats;
+  stats.version = version;
+  for (uint32_t i = 0; streamed || i < global_header.entry_count; ++i) {
+    IndexRecord record;
+    record.entry_offset = archive.tell();
+    const char *header = archive.view(entry_header_size(version));
+    if (header == nullptr) {
+      throw std::runtime_error("Unexpected end of archive");
+    }
+    uint32_t path_length = decode_entry_header(header, version, record);
+    if (streamed && path_length == 0) {
+      break;
+    }
+    const char *path = archive.view(path_length);
+    if (path == nullptr) {
+      throw std::runtime_error("Unexpected end of archive");
+    }
+    record.path.assign(path, path_length);
+    if ((record.flags & KAR_ENTRY_ALIGNED) &&
+        archive.view(static_cast<size_t>(record.data_offset() - archive.tell())) ==
+            nullptr) {
+      throw std::runtime_error("Unexpected end of archive");
     }
 
-    // 创建目标路径并写入文件
-    fs::path out_path = target_dir / rel_path;
-    fs::create_directories(out_path.parent_path());
+    const DirectoryCache::Location location = dirs.locate(record.path);
+    const fs::path out_path = dirs.full_path(record.path);
+    const size_t file = blocks.add_file(out_path);
+    OutputFile out_file(location.dir_fd, location.name, out_path);
+    uint32_t calculated_crc = 0;
+    uint64_t stored = 0;
+    try {
+      prepare_output(out_file, record);
+      calculated_crc = extract_stream_payload(archive, record, out_file, file,
+                                              blocks, verify, stored);
 
-    std::ofstream out_file(out_path, std::ios::binary);
-    out_file.write(buffer.data(), entry.content_size);
+      // 已回填的条目立即校验；未回填的条目等读到中央目录后再核对
+      const bool deferred = (record.flags & KAR_ENTRY_DEFERRED) != 0;
+      if (!deferred && stored != record.stored_size) {
+        throw std::runtime_error("Corrupted block in file: " + record.path);
+      }
+      if (verify && !deferred && calculated_crc != record.checksum) {
+        throw std::runtime_error(
+            "CRC32 mismatch for file: " + record.path +
+            " (expected: " + std::to_string(record.checksum) +
+            ", got: " + std::to_string(calculated_crc) + ")");
+      }
+      finish_output(out_file, record);
+      out_file.close();
+    } catch (...) {
+      fs::remove(out_path);
+      throw;
+    }
+    throttle(record.content_size);
+    progress.advance(record.path, record.content_size, true);
+    stats.bytes += record.content_size;
+    stats.stored_bytes += stored;
+    record.checksum = calculated_crc;
+    record.stored_size = stored;
+    extracted.push_back(std::move(record));
+  }
+  stats.entries = extracted.size();
+  stats.archive_entries = extracted.size();
 
-    // 恢复权限
-    fs::permissions(out_path, static_cast<fs::perms>(entry.permissions));
+  // 读完余下的中央目录与尾部（同时避免上游写端因管道提前关闭而失败）
+  const uint64_t tail_offset = archive.tell();
+  std::vector<char> tail = archive.read_to_end();
+  stats.archive_bytes = archive.tell();
+  if (version >= KAR_VERSION_INDEXED) {
+    ArchiveIndex index;
+    bool valid = ArchiveIndex::parse_tail(tail.data(), tail.size(), tail_offset,
+                                          global_header, index) &&
+                 index.size() == extracted.size();
+    for (size_t i = 0; valid && i < extracted.size(); ++i) {
+      const IndexRecord &expected = index.entries()[i];
+      const IndexRecord &got = extracted[i];
+      valid = expected.path == got.path &&
+              expected.entry_offset == got.entry_offset &&
+              expected.content_size == got.content_size &&
+              expected.stored_size == got.stored_size;
+      if (valid && verify && expected.checksum != got.checksum) {
+        fs::remove(target_dir / got.path);
+        throw std::runtime_error(
+            "CRC32 mismatch for file: " + got.path +
+            " (expected: " + std::to_string(expected.checksum) +
+            ", got: " + std::to_string(got.checksum) + ")");
+      }
+    }
+    if (!valid) {
+      // 未回填的条目无法校验：删除后报错；其余条目已逐个校验通过
+      bool unverified = false;
+      for (const IndexRecord &record : extracted) {
+        if (record.flags & KAR_ENTRY_DEFERRED) {
+          fs::remove(target_dir / record.path);
+          unverified = true;
+        }
+      }
+      if (unverified || streamed) {
+        throw std::runtime_error("Archive index is damaged");
+      }
+      warn("archive index is damaged");
+    }
   }
 
-  std::cout << "\n\nExtracted to: " << target_dir << "\n";
+  stats.seconds = seconds_since(start);
+  return stats;
 }
 
-void Archiver::list(const fs::path &archive_path) {
-  std::ifstream archive(archive_path, std::ios::binary);
+ArchiveIndex Archiver::list(const fs::path &archive_path) {
+  ArchiveReader archive(archive_path, backend_->use_mmap());
   FileHeader global_header;
-  archive.read(reinterpret_cast<char *>(&global_header), sizeof(global_header));
+  if (!read_wire(archive, global_header) ||
+      global_header.magic != KAR_MAGIC) {
+    throw std::runtime_error("Invalid archive format (wrong magic number)");
+  }
+
+  // 版本 2 起只读取尾部与中央目录；版本 1 顺序跳扫条目头
+  ArchiveIndex index =
+      ArchiveIndex::load(archive, global_header, warning_handler());
+  if (const VolumeReader *volumes = archive.volumes()) {
+    index.set_volumes(volumes->count(), volumes->volume_size());
+  }
+  return index;
+}
 
-  std::cout << "Archive: " << archive_path << "\n";
-  std::cout << "Entries: " << global_header.entry_count << "\n";
-  std::cout << "------------------------\n";
+ArchiveStats Archiver::extract(const fs::path &archive_path,
+                               const std::vector<std::string> &patterns,
+                               const fs::path &target_dir) {
+  const auto start = std::chrono::steady_clock::now();
+  ArchiveReader archive(archive_path, backend_->use_mmap());
+  FileHeader global_header;
+  if (!read_wire(archive, global_header) ||
+      global_header.magic != KAR_MAGIC) {
+    throw std::runtime_error("Invalid archive format (wrong magic number)");
+  }
 
-  for (uint32_t i = 0; i < global_header.entry_count; ++i) {
-    EntryHeader entry;
-    archive.read(reinterpret_cast<char *>(&entry), sizeof(entry));
+  // 版本 2 起读取中央目录；版本 1 跳扫条目头（只 seek，不读内容）
+  ArchiveIndex index =
+      ArchiveIndex::load(archive, global_header, warning_handler());
 
-    std::string rel_path(entry.path_length, '\0');
-    archive.read(rel_path.data(), entry.path_length);
+  // 选出匹配的条目：精确路径走哈希查找，其余逐项匹配
+  std::vector<const IndexRecord *> selected;
+  std::vector<bool> picked(index.size(), false);
+  std::vector<std::string> missing;
+  for (const auto &pattern : patterns) {
+    bool found = false;
+    if (const IndexRecord *record = index.find(pattern)) {
+      size_t i = static_cast<size_t>(record - index.entries().data());
+      if (!picked[i]) {
+        picked[i] = true;
+        selected.push_back(record);
+      }
+      found = true;
+    } else {
+      for (size_t i = 0; i < index.size(); ++i) {
+        if (matches_pattern(pattern, index.entries()[i].path)) {
+          if (!picked[i]) {
+            picked[i] = true;
+            selected.push_back(&index.entries()[i]);
+          }
+          found = true;
+        }
+      }
+    }
+    if (!found) {
+      missing.push_back(pattern);
+    }
+  }
+  if (!missing.empty()) {
+    std::string names;
+    for (const auto &name : missing) {
+      names += (names.empty() ? "" : ", ") + name;
+    }
+    throw std::runtime_error("Not found in archive: " + names);
+  }
 
-    // 跳过内容
-    archive.seekg(entry.content_size, std::ios::cur);
+  // 按归档中的顺序读取，保持顺序访问
+  std::sort(selected.begin(), selected.end(),
+            [](const IndexRecord *a, const IndexRecord *b) {
+              return a->entry_offset < b->entry_offset;
+            });
 
-    std::cout << rel_path << " (" << format_size(entry.content_size) << ")\n";
+  // 只读取并校验匹配的条目（按索引记录读取，流式归档的条目头未回填）
+  ArchiveStats stats;
+  stats.version = global_header.version;
+  stats.archive_entries = index.size();
+  stats.archive_bytes = archive.size();
+  unsigned threads = options_.threads;
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
   }
+  if (threads > 1 && selected.size() > 1) {
+    // 与 unpack 相同的并行解包，只含选中的条目（分卷归档的各卷并发读取）
+    ArchiveIndex subset;
+    for (const IndexRecord *record : selected) {
+      subset.add(*record);
+    }
+    unpack_parallel(archive, subset, target_dir, threads);
+    add_index_stats(subset, stats);
+    stats.adaptive_threads = adaptive_threads_;
+    stats.seconds = seconds_since(start);
+    return stats;
+  }
+
+  DirectoryCache dirs(target_dir);
+  ByteBuffer scratch;
+  ProgressTracker progress(observer_);
+  uint64_t total_bytes = 0;
+  for (const IndexRecord *record : selected) {
+    total_bytes += record->content_size;
+  }
+  progress.set_totals(selected.size(), total_bytes);
+  for (const IndexRecord *record : selected) {
+    extract_payload(archive, *record, dirs, scratch);
+    throttle(record->content_size);
+    progress.advance(record->path, record->content_size, true);
+    stats.bytes += record->content_size;
+    stats.stored_bytes += record->stored_size;
+  }
+  stats.entries = selected.size();
+  stats.seconds = seconds_since(start);
+  return stats;
+}
+
+VerifyReport Archiver::verify(const fs::path &archive_path) {
+  const auto start = std::chrono::steady_clock::now();
+  ArchiveReader archive(archive_path, backend_->use_mmap());
+  FileHeader global_header;
+  if (!read_wire(archive, global_header) ||
+      global_header.magic != KAR_MAGIC) {
+    throw std::runtime_error("Invalid archive format (wrong magic number)");
+  }
+  ArchiveIndex index =
+      ArchiveIndex::load(archive, global_header, warning_handler());
+  const auto &records = index.entries();
+
+  // 拆分任务：小条目一个任务；大条目按可独立解码的段拆分，
+  // 最后完成的段合并各段 CRC32 并与索引核对
+  struct EntryCheck {
+    std::vector<PayloadRange> ranges;
+    std::vector<uint32_t> checksums;
+    std::atomic<size_t> remaining{0};
+    std::atomic<bool> failed{false};
+  };
+  struct Job {
+    size_t record;
+    size_t range;
+  };
+  std::vector<EntryCheck> checks(records.size());
+  std::vector<std::string> errors(records.size()); // 每个条目的第一个错误
+  std::vector<Job> jobs;
+  jobs.reserve(records.size());
+  {
+    ByteBuffer scratch;
+    for (size_t i = 0; i < records.size(); ++i) {
+      const IndexRecord &record = records[i];
+      EntryCheck &check = checks[i];
+      if (record.content_size <= kChunkSize) {
+        check.ranges.push_back(
+            PayloadRange{.stored_offset = record.data_offset(),
+                         .raw_offset = 0,
+                         .raw_size = record.content_size});
+      } else {
+        try {
+          verify_entry_header(archive, record, scratch);
+          check.ranges = plan_ranges(archive, record, scratch);
+        } catch (const std::exception &e) {
+          errors[i] = e.what();
+          continue;
+        }
+      }
+      check.checksums.resize(check.ranges.size());
+      check.remaining = check.ranges.size();
+      for (size_t r = 0; r < check.ranges.size(); ++r) {
+        jobs.push_back(Job{i, r});
+      }
+    }
+  }
+
+  // 工作线程只读取、解码并计算 CRC32（out 为空，不写出）
+  struct Done {
+    size_t job;
+    std::string error;
+    bool entry_done = false;
+  };
+  ThreadSafeQueue<Done> done_queue;
+  unsigned threads = options_.threads;
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  {
+    ThreadPool pool(threads, options_.affinity);
+    for (size_t j = 0; j < jobs.size(); ++j) {
+      pool.submit([&, j] {
+        thread_local ByteBuffer scratch;
+        const Job &job = jobs[j];
+        const IndexRecord &record = records[job.record];
+        EntryCheck &check = checks[job.record];
+        Done done{j, {}};
+        try {
+          if (record.content_size <= kChunkSize) {
+            verify_entry_header(archive, record, scratch);
+          }
+          if (!check.failed) {
+            check.checksums[job.range] = extract_range(
+                archive, record, check.ranges[job.range], nullptr, scratch);
+          }
+        } catch (const std::exception &e) {
+          check.failed = true;
+          done.error = e.what();
+        }
+        if (--check.remaining == 0) {
+          done.entry_done = true;
+          uint32_t calculated_crc = 0;
+          for (size_t r = 0; r < check.ranges.size(); ++r) {
+            calculated_crc = crc32_combine(calculated_crc, check.checksums[r],
+                                           check.ranges[r].raw_size);
+          }
+          if (!check.failed && calculated_crc != record.checksum) {
+            done.error = "CRC32 mismatch for file: " + record.path +
+                         " (expected: " + std::to_string(record.checksum) +
+                         ", got: " + std::to_string(calculated_crc) + ")";
+          }
+        }
+        done_queue.push(std::move(done));
+      });
+    }
+
+    // 当前线程汇总进度并记录每个条目的第一个错误
+    ProgressTracker progress(observer_);
+    uint64_t total_bytes = 0;
+    for (const IndexRecord &record : records) {
+      total_bytes += record.content_size;
+    }
+    progress.set_totals(records.size(), total_bytes);
+    Done done;
+    for (size_t completed = 0; completed < jobs.size(); ++completed) {
+      done_queue.pop(done);
+      const Job &job = jobs[done.job];
+      if (!done.error.empty() && errors[job.record].empty()) {
+        errors[job.record] = std::move(done.error);
+      }
+      progress.advance(records[job.record].path,
+                       checks[job.record].ranges[job.range].raw_size,
+                       done.entry_done);
+    }
+    pool.wait_all();
+  }
+
+  VerifyReport report;
+  report.stats.version = global_header.version;
+  report.stats.archive_entries = index.size();
+  report.stats.archive_bytes = archive.size();
+  add_index_stats(index, report.stats);
+  for (size_t i = 0; i < records.size(); ++i) {
+    if (!errors[i].empty()) {
+      report.failures.push_back(VerifyFailure{records[i].path, errors[i]});
+    }
+  }
+  report.stats.seconds = seconds_since(start);
+  return report;
 }
 
 // ============================================
 // 私有方法实现
 // ============================================
 
-void Archiver::write_entry(std::ofstream &archive, const fs::path &base_dir,
-                           const fs::path &file_path) {
-  // 计算相对路径（关键：保持目录结构）
-  std::string rel_path = fs::relative(file_path, base_dir).string();
 
-  // 读取文件内容
-  std::ifstream file(file_path, std::ios::binary | std::ios::ate);
-  auto size = file.tellg();
-  file.seekg(0, std::ios::beg);
+void Archiver::scan_sources(const fs::path &source_dir, unsigned threads,
+                            const std::function<bool(ScanEntry &&)> &on_entry) {
+  DirectoryScanner scanner(threads);
+  scanner.set_cache(scan_cache_.get(), options_.trust_dir_mtime,
+                    scan_record_.get());
+  cached_dirs_ = scanner.scan(source_dir, on_entry);
+}
+
+const IndexRecord *Archiver::find_unchanged(const ScanEntry &entry) const {
+  const IndexRecord *record = base_->index.find(entry.rel_path);
+  if (record == nullptr || !(record->flags & KAR_ENTRY_MTIME_NS) ||
+      record->content_size != entry.size ||
+      record->modified_time != entry.mtime_ns ||
+      (entry.cached && record->checksum != entry.checksum)) {
+    return nullptr;
+  }
+  // 去重条目的引用、固实条目的块指向基准归档内的偏移，不能原样拷贝
+  if (record->flags & (KAR_ENTRY_DEDUP | KAR_ENTRY_SOLID)) {
+    return nullptr;
+  }
+  if (record->codec != static_cast<uint8_t>(options_.codec)) {
+    // 编码方式不同：只有原样存储、且当前编码同样会判定为不可压缩的条目可复用
+    if (record->codec != static_cast<uint8_t>(Codec::None) ||
+        options_.codec == Codec::None || entry.size == 0) {
+      return nullptr;
+    }
+    InputFile input(entry.path);
+    char probe[kCompressProbeSize];
+    size_t n = input.read_at(probe, sizeof(probe), 0);
+    if (!looks_incompressible(probe, n)) {
+      // 样本已覆盖整个文件时直接试压缩，与 load_entry 的“无收益则原样存储”一致
+      if (n != entry.size) {
+        return nullptr;
+      }
+      ByteBuffer payload;
+      encode_blocks(options_.codec, options_.level, probe, n, payload);
+      if (payload.size() < n) {
+        return nullptr;
+      }
+    }
+  }
+  return record;
+}
+
+std::vector<uint32_t>
+Archiver::plan_layout(std::vector<ScanEntry> &files) const {
+  // 排序键：父目录（'/' 之前）、是否大文件、扩展名（最后一个 '.' 之后）、文件名。
+  // 同一目录内同类小文件相邻，压缩在一起更有效，解出时也集中在同一目录
+  struct Key {
+    std::string_view dir;
+    bool large;
+    std::string_view ext;
+    std::string_view name;
+    bool operator<(const Key &other) const {
+      return std::tie(dir, large, ext, name) <
+             std::tie(other.dir, other.large, other.ext, other.name);
+    }
+  };
+  std::vector<Key> keys(files.size());
+  std::vector<uint32_t> order(files.size());
+  for (size_t i = 0; i < files.size(); ++i) {
+    const std::string_view path = files[i].rel_path;
+    const size_t slash = path.rfind('/');
+    const std::string_view name =
+        slash == std::string_view::npos ? path : path.substr(slash + 1);
+    const size_t dot = name.rfind('.');
+    keys[i] = Key{.dir = slash == std::string_view::npos
+                             ? std::string_view()
+                             : path.substr(0, slash),
+                  .large = files[i].size > kSolidFileSize,
+                  .ext = dot == std::string_view::npos || dot == 0
+                             ? std::string_view()
+                             : name.substr(dot + 1),
+                  .name = name};
+    order[i] = static_cast<uint32_t>(i);
+  }
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return keys[a] < keys[b];
+  });
+
+  std::vector<ScanEntry> sorted;
+  sorted.reserve(files.size());
+  for (uint32_t position : order) {
+    sorted.push_back(std::move(files[position]));
+  }
+  files.swap(sorted);
+  return order;
+}
+
+bool Archiver::solid_candidate(const ScanEntry &entry) const {
+  if (options_.layout != PackLayout::Grouped ||
+      options_.codec == Codec::None || dedup_ || entry.size == 0 ||
+      entry.size > kSolidFileSize) {
+    return false;
+  }
+  // 增量打包时未变化的文件直接拷贝，不重新压缩
+  return !base_ || find_unchanged(entry) == nullptr;
+}
+
+std::vector<PackTask> Archiver::plan_next(std::vector<ScanEntry> &files,
+                                          size_t &i, uint32_t &next_id) const {
+  size_t end = i;
+  uint64_t bytes = 0;
+  while (end < files.size() && bytes + files[end].size <= kCodecBlockSize &&
+         solid_candidate(files[end])) {
+    bytes += files[end].size;
+    ++end;
+  }
+  if (end - i < 2) {
+    return plan_tasks(std::move(files[i++]), next_id);
+  }
+
+  PackTask task;
+  task.task_id = next_id++;
+  task.permissions = 0;
+  task.reserved = bytes;
+  task.solid.reserve(end - i);
+  for (; i < end; ++i) {
+    task.solid.push_back(std::move(files[i]));
+  }
+  std::vector<PackTask> tasks;
+  tasks.push_back(std::move(task));
+  return tasks;
+}
+
+std::vector<PackTask> Archiver::plan_tasks(ScanEntry &&entry,
+                                           uint32_t &next_id) const {
+  std::vector<PackTask> tasks;
+  const FileStat st{.size = entry.size, .mtime_ns = entry.mtime_ns};
+  const uint16_t permissions = static_cast<uint16_t>(entry.mode & 07777);
+  const fs::path &file_path = entry.path;
+  uint64_t size = st.size;
+
+  // 增量打包：未变化的文件不读取内容，写入线程直接从基准归档拷贝
+  if (base_) {
+    if (const IndexRecord *record = find_unchanged(entry)) {
+      PackTask task;
+      task.file_path = std::move(entry.path);
+      task.task_id = next_id++;
+      task.permissions = record->permissions;
+      task.reserved = 0;
+      task.base = record;
+      tasks.push_back(std::move(task));
+      return tasks;
+    }
+  }
+
+  if (size <= kStreamChunkSize) {
+    PackTask task;
+    task.file_path = std::move(entry.path);
+    task.rel_path = std::move(entry.rel_path);
+    task.stat = st;
+    task.task_id = next_id++;
+    task.permissions = permissions;
+    task.reserved = static_cast<size_t>(size);
+    tasks.push_back(std::move(task));
+    return tasks;
+  }
+
+  // 大文件：打开一次供各分块共享，并用开头样本决定整个条目的编码。
+  // 先查数据区：有空洞即按稀疏文件拆分，样本取自第一段数据
+  auto input = std::make_shared<InputFile>(file_path, st);
+  const std::vector<DataExtent> extents = input->data_extents(kMinHoleSize);
+  const bool sparse = extents.size() != 1 || extents[0].length != size;
+  // 直接读取的分块与分块偏移均按页对齐；稀疏文件的数据区不对齐，仍经页缓存
+  if (!(options_.direct_sources && !sparse && input->open_direct()) &&
+      backend_->use_mmap()) {
+    input->map();
+  }
+  Codec codec = options_.codec;
+  if (codec != Codec::None) {
+    char probe[kCompressProbeSize];
+    const uint64_t probe_offset = extents.empty() ? 0 : extents[0].offset;
+    size_t n = input->read_at(probe, sizeof(probe), probe_offset);
+    if (looks_incompressible(probe, n)) {
+      codec = Codec::None;
+    }
+  }
+
+  auto new_task = [&](uint64_t offset) {
+    PackTask task;
+    task.file_path = file_path;
+    task.rel_path = entry.rel_path;
+    task.stat = st;
+    task.permissions = permissions;
+    task.chunk_offset = offset;
+    task.reserved = 0;
+    task.codec = codec;
+    task.input = input;
+    task.sparse = sparse;
+    // 分组布局与直接 I/O：原样存储的大文件对齐写出，解出时可直接按页拷贝
+    task.aligned = align_payloads() && codec == Codec::None && !sparse &&
+                   !dedup_;
+    return task;
+  };
+  if (sparse) {
+    // 稀疏文件：每个任务至多 kChunkSize 数据，连同其前的空洞；
+    // 各任务首尾相接覆盖整个文件，末任务延伸到文件末尾（全空洞时只有一个任务）
+    PackTask task = new_task(0);
+    for (const DataExtent &extent : extents) {
+      const uint64_t extent_end = extent.offset + extent.length;
+      for (uint64_t pos = extent.offset; pos < extent_end;) {
+        const uint64_t n =
+            std::min<uint64_t>(extent_end - pos, kChunkSize - task.reserved);
+        task.extents.push_back(DataExtent{.offset = pos, .length = n});
+        task.reserved += n;
+        pos += n;
+        if (task.reserved == kChunkSize) {
+          task.chunk_size = pos - task.chunk_offset;
+          tasks.push_back(std::move(task));
+          task = new_task(pos);
+        }
+      }
+    }
+    if (task.chunk_offset < size || tasks.empty()) {
+      task.chunk_size = size - task.chunk_offset;
+      tasks.push_back(std::move(task));
+    }
+  } else {
+    const uint64_t chunk_count = (size + kChunkSize - 1) / kChunkSize;
+    tasks.reserve(chunk_count);
+    for (uint64_t i = 0; i < chunk_count; ++i) {
+      PackTask task = new_task(i * kChunkSize);
+      task.chunk_size = std::min<uint64_t>(size - task.chunk_offset, kChunkSize);
+      task.reserved = static_cast<size_t>(task.chunk_size);
+      tasks.push_back(std::move(task));
+    }
+  }
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    tasks[i].task_id = next_id++;
+    tasks[i].chunk_index = static_cast<uint32_t>(i);
+    tasks[i].chunk_count = static_cast<uint32_t>(tasks.size());
+  }
+  return tasks;
+}
+
+PackResult Archiver::load_entry(const PackTask &task) const {
+  if (task.chunk_count > 0) {
+    return load_chunk(task);
+  }
+  if (!task.solid.empty()) {
+    return load_solid(task);
+  }
+
+  PackResult result;
+  result.task_id = task.task_id;
+  result.permissions = task.permissions;
+  result.reserved = task.reserved;
+  if (task.base != nullptr) {
+    // 未变化的文件：元数据沿用基准归档，payload 由写入线程拷贝
+    result.base = task.base;
+    result.rel_path = task.base->path;
+    return result;
+  }
+
+  // 相对路径（保持目录结构）、大小与 mtime 均来自扫描
+  result.rel_path = task.rel_path;
+  auto input = std::make_shared<InputFile>(task.file_path, task.stat);
+  result.content_size = input->size();
+  result.modified_time = input->mtime_ns();
+  result.flags = KAR_ENTRY_MTIME_NS;
+
+  if (dedup_) {
+    // 去重：整体读入本线程的缓冲区，payload 只保存新块的编码数据
+    thread_local ByteBuffer raw;
+    raw.resize(static_cast<size_t>(result.content_size));
+    if (input->read_at(raw.data(), raw.size(), 0) != raw.size()) {
+      throw std::runtime_error("File changed while reading: " +
+                               task.file_path.string());
+    }
+    encode_dedup(task, raw.data(), raw.size(), result);
+    return result;
+  }
+
+  const bool compress =
+      options_.codec != Codec::None && result.content_size > 0;
+  const char *data = nullptr;
+  if (!compress && backend_->use_mmap() &&
+      result.content_size >= kMmapThreshold) {
+    data = input->map();
+  }
+  if (data != nullptr) {
+    // mmap：直接在映射上计算 CRC，写入线程复用同一映射（或内核态拷贝）
+    StageTimer timer(Stage::Crc, result.content_size);
+    CRC32 crc32;
+    crc32.update(data, static_cast<size_t>(result.content_size));
+    result.checksum = crc32.finalize();
+    result.input = std::move(input);
+  } else {
+    // 小文件：整体读入内存，由写入线程直接写出
+    result.content.resize(static_cast<size_t>(result.content_size));
+    if (input->read_at(result.content.data(), result.content.size(), 0) !=
+        result.content.size()) {
+      throw std::runtime_error("File changed while reading: " +
+                               task.file_path.string());
+    }
+    encode_content(result);
+  }
+  return result;
+}
+
+bool Archiver::batchable(const PackTask &task) const {
+  return backend_->batch_reads() && task.chunk_count == 0 &&
+         task.base == nullptr && task.solid.empty();
+}
+
+std::vector<PackResult>
+Archiver::load_batch(const std::vector<PackTask> &batch) const {
+  std::vector<ByteBuffer> contents(batch.size());
+  std::vector<ReadRequest> requests(batch.size());
+  for (size_t i = 0; i < batch.size(); ++i) {
+    contents[i].resize(static_cast<size_t>(batch[i].stat.size));
+    requests[i].path = &batch[i].file_path;
+    requests[i].dst = contents[i].data();
+    requests[i].size = contents[i].size();
+  }
+  backend_->read_batch(requests);
+
+  std::vector<PackResult> results;
+  results.reserve(batch.size());
+  for (size_t i = 0; i < batch.size(); ++i) {
+    results.push_back(load_preloaded(batch[i], std::move(contents[i])));
+  }
+  return results;
+}
+
+PackResult Archiver::load_preloaded(const PackTask &task,
+                                    ByteBuffer &&content) const {
+  PackResult result;
+  result.task_id = task.task_id;
+  result.permissions = task.permissions;
+  result.reserved = task.reserved;
+  result.rel_path = task.rel_path;
+  result.content_size = task.stat.size;
+  result.modified_time = task.stat.mtime_ns;
+  result.flags = KAR_ENTRY_MTIME_NS;
+  if (dedup_) {
+    encode_dedup(task, content.data(), content.size(), result);
+  } else {
+    result.content = std::move(content);
+    encode_content(result);
+  }
+  return result;
+}
+
+void Archiver::encode_content(PackResult &result) const {
+  const bool compress =
+      options_.codec != Codec::None && !result.content.empty();
+  if (compress &&
+      !looks_incompressible(result.content.data(), result.content.size())) {
+    // 在工作线程中逐块压缩（CRC32 随块计算）；无收益时仍原样存储
+    ByteBuffer payload;
+    result.checksum =
+        encode_blocks(options_.codec, options_.level, result.content.data(),
+                      result.content.size(), payload);
+    if (payload.size() < result.content.size()) {
+      result.content.swap(payload);
+      result.codec = options_.codec;
+    }
+  } else {
+    StageTimer timer(Stage::Crc, result.content.size());
+    result.checksum = CRC32().calculate(
+        reinterpret_cast<const uint8_t *>(result.content.data()),
+        result.content.size());
+  }
+}
+
+void Archiver::encode_dedup(const PackTask &task, const char *data, size_t n,
+                            PackResult &result) const {
+  // 先按大小 + CRC32 查找整文件重复，未命中再逐块切分、寻址并编码新块
+  result.codec = options_.codec;
+  result.flags |= KAR_ENTRY_DEDUP;
+  result.source_path = task.file_path;
+  {
+    StageTimer timer(Stage::Crc, n);
+    result.checksum =
+        CRC32().calculate(reinterpret_cast<const uint8_t *>(data), n);
+  }
+  if (!dedup_->match_file(data, n, result.checksum, result.dedup_chunks)) {
+    const Codec codec =
+        looks_incompressible(data, n) ? Codec::None : options_.codec;
+    dedup_encode(codec, options_.level, data, n, *dedup_, result.dedup_chunks,
+                 result.content);
+  }
+}
+
+PackResult Archiver::load_chunk(const PackTask &task) const {
+  PackResult result;
+  result.task_id = task.task_id;
+  result.permissions = task.permissions;
+  result.reserved = task.reserved;
+  result.rel_path = task.rel_path;
+  result.content_size = task.input->size();
+  result.modified_time = task.input->mtime_ns();
+  result.flags = KAR_ENTRY_MTIME_NS | (task.aligned ? KAR_ENTRY_ALIGNED : 0);
+  result.codec = task.codec;
+  result.chunk_index = task.chunk_index;
+  result.chunk_count = task.chunk_count;
+  result.chunk_offset = task.chunk_offset;
+  result.chunk_size = task.chunk_size;
+
+  // 映射可用时直接使用映射，否则读入本线程的缓冲区
+  thread_local ByteBuffer buffer;
+  if (task.sparse) {
+    // 稀疏分块：数据区逐段编码为块序列，其间的空洞写成空洞记录，不读取；
+    // 本块 CRC32 按含空洞（全零）的完整内容合并。去重时只切分数据区，
+    // 空洞记录作为字面项夹在块列表中
+    result.flags |= KAR_ENTRY_SPARSE;
+    if (dedup_) {
+      result.codec = options_.codec;
+      result.flags |= KAR_ENTRY_DEDUP;
+    }
+    uint64_t pos = task.chunk_offset;
+    uint32_t checksum = 0;
+    auto add_hole = [&](uint64_t until) {
+      if (until > pos) {
+        DedupChunk hole{.encoded_offset = result.content.size()};
+        checksum = crc32_combine(
+            checksum, encode_hole(until - pos, result.content), until - pos);
+        if (dedup_) {
+          hole.encoded_size = result.content.size() - hole.encoded_offset;
+          result.dedup_chunks.push_back(hole);
+        }
+        pos = until;
+      }
+    };
+    for (const DataExtent &extent : task.extents) {
+      add_hole(extent.offset);
+      const size_t n = static_cast<size_t>(extent.length);
+      const char *data =
+          task.input->data() ? task.input->data() + extent.offset : nullptr;
+      if (data == nullptr) {
+        buffer.resize(n);
+        if (task.input->read_at(buffer.data(), n, extent.offset) != n) {
+          throw std::runtime_error("File changed while reading: " +
+                                   task.file_path.string());
+        }
+        data = buffer.data();
+      }
+      checksum = crc32_combine(
+          checksum,
+          dedup_ ? dedup_encode(task.codec, options_.level, data, n, *dedup_,
+                                result.dedup_chunks, result.content)
+                 : encode_blocks(task.codec, options_.level, data, n,
+                                 result.content),
+          n);
+      pos += n;
+    }
+    add_hole(task.chunk_offset + task.chunk_size);
+    result.checksum = checksum;
+    return result;
+  }
+
+  const size_t n = static_cast<size_t>(task.chunk_size);
+  const char *data =
+      task.input->data() ? task.input->data() + task.chunk_offset : nullptr;
+  if (data == nullptr) {
+    ByteBuffer &dst =
+        task.codec == Codec::None && !dedup_ ? result.content : buffer;
+    // 直接读取按整块读入（缓冲区来自池，已按页对齐），读完截回 n
+    constexpr size_t kAlign = InputFile::kDirectAlignment;
+    dst.resize(task.input->direct() ? (n + kAlign - 1) / kAlign * kAlign : n);
+    if (task.input->read_direct(dst.data(), n, task.chunk_offset) != n) {
+      throw std::runtime_error("File changed while reading: " +
+                               task.file_path.string());
+    }
+    dst.resize(n);
+    data = dst.data();
+  }
+
+  if (dedup_) {
+    // 去重：切点在分块任务边界处重新开始，entry 编码固定为打包编码
+    result.codec = options_.codec;
+    result.flags |= KAR_ENTRY_DEDUP;
+    result.checksum =
+        dedup_encode(task.codec, options_.level, data, n, *dedup_,
+                     result.dedup_chunks, result.content);
+    return result;
+  }
 
-  std::vector<char> buffer(static_cast<size_t>(size));
-  file.read(buffer.data(), size);
+  if (task.codec == Codec::None) {
+    // 原样存储：内容已在内存中则直接写出，否则由 I/O 后端从映射拷贝
+    StageTimer timer(Stage::Crc, n);
+    result.checksum = CRC32().calculate(
+        reinterpret_cast<const uint8_t *>(data), n);
+    if (result.content.empty()) {
+      result.input = task.input;
+    }
+  } else {
+    result.checksum =
+        encode_blocks(task.codec, options_.level, data, n, result.content);
+  }
+  return result;
+}
+
+PackResult Archiver::load_solid(const PackTask &task) const {
+  PackResult result;
+  result.task_id = task.task_id;
+  result.reserved = task.reserved;
+  result.rel_path = task.solid.front().rel_path;
+  result.content_size = task.reserved;
+  result.codec = options_.codec;
+
+  // 各成员按扫描得到的大小一次读入相邻位置（I/O 后端可合并成一批）
+  thread_local ByteBuffer raw;
+  raw.resize(static_cast<size_t>(task.reserved));
+  std::vector<ReadRequest> requests(task.solid.size());
+  size_t offset = 0;
+  for (size_t i = 0; i < task.solid.size(); ++i) {
+    requests[i].path = &task.solid[i].path;
+    requests[i].dst = raw.data() + offset;
+    requests[i].size = static_cast<size_t>(task.solid[i].size);
+    offset += requests[i].size;
+  }
+  backend_->read_batch(requests);
 
-  // 计算 CRC32 校验和
-  CRC32 crc32;
-  uint32_t checksum = crc32.calculate(buffer);
+  result.solid.reserve(task.solid.size());
+  offset = 0;
+  for (const ScanEntry &entry : task.solid) {
+    const size_t n = static_cast<size_t>(entry.size);
+    SolidMember member{.rel_path = entry.rel_path,
+                       .content_size = entry.size,
+                       .modified_time = entry.mtime_ns,
+                       .checksum = 0,
+                       .permissions =
+                           static_cast<uint16_t>(entry.mode & 07777),
+                       .raw_offset = static_cast<uint32_t>(offset)};
+    {
+      StageTimer timer(Stage::Crc, n);
+      member.checksum = CRC32().calculate(
+          reinterpret_cast<const uint8_t *>(raw.data() + offset), n);
+    }
+    result.solid.push_back(std::move(member));
+    offset += n;
+  }
+  result.checksum = encode_blocks(options_.codec, options_.level, raw.data(),
+                                  raw.size(), result.content);
+  return result;
+}
 
-  // 填充 Entry Header
-  EntryHeader entry{.path_length = static_cast<uint32_t>(rel_path.size()),
-                    .content_size = static_cast<uint64_t>(size),
-                    .modified_time =
-                        current_timestamp(), // 简化处理，实际应取文件 mtime
-                    .checksum = checksum,    // CRC32 校验和
-                    .permissions = 0644};
+namespace {
 
-  // 写入：Header -> 路径 -> 内容
-  archive.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
-  archive.write(rel_path.data(), rel_path.size());
-  archive.write(buffer.data(), size);
+EntryHeaderV3 make_entry_header(const IndexRecord &record) {
+  return EntryHeaderV3{
+      .path_length = static_cast<uint32_t>(record.path.size()),
+      .content_size = record.content_size,
+      .modified_time = record.modified_time,
+      .checksum = record.checksum, // CRC32 校验和
+      .permissions = record.permissions,
+      .codec = record.codec,
+      .flags = record.flags,
+      .stored_size = record.stored_size};
 }
 
-void Archiver::read_entry(std::ifstream &archive, const fs::path &target_dir) {
-  EntryHeader entry;
-  archive.read(reinterpret_cast<char *>(&entry), sizeof(entry));
+// 对齐条目：路径之后补零到 payload 的对齐边界
+void write_alignment(ArchiveWriter &archive, const IndexRecord &record) {
+  if (record.flags & KAR_ENTRY_ALIGNED) {
+    static const char zeros[KAR_ENTRY_ALIGNMENT] = {};
+    archive.write(zeros, static_cast<size_t>(record.data_offset() - archive.tell()));
+  }
+}
 
-  // 读取相对路径
-  std::string rel_path(entry.path_length, '\0');
-  archive.read(rel_path.data(), entry.path_length);
+} // namespace
 
-  // 读取文件内容
-  std::vector<char> buffer(entry.content_size);
-  archive.read(buffer.data(), entry.content_size);
+bool Archiver::write_entry(ArchiveWriter &archive, const PackResult &result,
+                           ArchiveIndex &index) {
+  if (result.base != nullptr) {
+    // 未变化的条目：条目头按新偏移重写，payload 原样从基准归档拷贝
+    IndexRecord record = *result.base;
+    const uint64_t source_offset = record.data_offset();
+    record.entry_offset = archive.tell();
+    record.version = KAR_VERSION_CURRENT;
+    // 分组布局与直接 I/O 下沿用的原样存储的大文件同样按页对齐
+    if (align_payloads() && !record.has_blocks() &&
+        record.content_size > kStreamChunkSize) {
+      record.flags |= KAR_ENTRY_ALIGNED;
+    }
+    EntryHeaderV3 entry = make_entry_header(record);
+    write_wire(archive, entry);
+    archive.write(record.path.data(), record.path.size());
+    write_alignment(archive, record);
+    backend_->copy(*base_->file, source_offset, record.stored_size, archive);
+    index.add(std::move(record));
+    ++reused_;
+    return true;
+  }
 
-  // 验证 CRC32 校验和
-  CRC32 crc32;
-  uint32_t calculated_crc = crc32.calculate(buffer);
-  if (calculated_crc != entry.checksum) {
-    throw std::runtime_error("CRC32 mismatch for file: " + rel_path +
-                             " (expected: " + std::to_string(entry.checksum) +
-                             ", got: " + std::to_string(calculated_crc) + ")");
+  if (!result.solid.empty()) {
+    write_solid(archive, result, index);
+    return true;
   }
 
-  // 创建目标路径（自动创建父目录）
-  fs::path out_path = target_dir / rel_path;
-  fs::create_directories(out_path.parent_path());
+  const bool chunked = result.chunk_count > 0;
+  const bool write_header = !chunked || result.chunk_index == 0;
+  const bool dedup = (result.flags & KAR_ENTRY_DEDUP) != 0;
+  std::vector<ChunkLocation> refs;
+  uint64_t payload_size = result.content.empty() && result.input
+                              ? (chunked ? result.chunk_size
+                                         : result.content_size)
+                              : result.content.size();
+  if (dedup) {
+    uint64_t payload_offset = archive.tell();
+    if (write_header) {
+      payload_offset += sizeof(EntryHeaderV3) + result.rel_path.size();
+    }
+    payload_size = resolve_dedup(result, payload_offset, index, refs);
+  }
 
-  // 写入文件
-  std::ofstream out_file(out_path, std::ios::binary);
-  out_file.write(buffer.data(), entry.content_size);
+  if (write_header) {
+    // 记录中央目录项；分块条目的 CRC32 与存储大小随后续分块累加
+    IndexRecord record;
+    record.path = result.rel_path;
+    record.entry_offset = archive.tell();
+    record.content_size = result.content_size;
+    record.modified_time = result.modified_time;
+    record.checksum = chunked ? 0 : result.checksum;
+    record.permissions = result.permissions;
+    record.codec = static_cast<uint8_t>(result.codec);
+    record.flags = result.flags;
+    record.stored_size = chunked ? 0 : payload_size;
 
-  // 恢复权限（简化版）
-  fs::permissions(out_path, static_cast<fs::perms>(entry.permissions));
+    // 写入：Header -> 路径；流式输出无法回填，分块条目头标记为未回填
+    EntryHeaderV3 entry = make_entry_header(record);
+    if (chunked && streaming_) {
+      entry.flags |= KAR_ENTRY_DEFERRED;
+    }
+    write_wire(archive, entry);
+    archive.write(result.rel_path.data(), result.rel_path.size());
+    write_alignment(archive, record);
+    index.add(std::move(record));
+  }
 
-  std::cout << "Extracted: " << rel_path << " (CRC32 OK)\n";
+  // 写入内容
+  if (dedup) {
+    // 字面块直接写出编码数据，其余写引用
+    for (size_t i = 0; i < refs.size(); ++i) {
+      const DedupChunk &chunk = result.dedup_chunks[i];
+      if (refs[i].block_offset == 0) {
+        archive.write(result.content.data() + chunk.encoded_offset,
+                      chunk.encoded_size);
+        continue;
+      }
+      BlockHeader block{.raw_size = chunk.raw_size,
+                        .stored_size = 0,
+                        .checksum = chunk.checksum};
+      ChunkRef ref{.block_offset = refs[i].block_offset};
+      write_wire(archive, block);
+      write_wire(archive, ref);
+    }
+    if (!chunked && result.content_size > 0) {
+      dedup_->add_file(result.source_path, result.content_size,
+                       result.checksum, result.dedup_chunks);
+    }
+  } else if (result.content.empty() && result.input) {
+    // 内容不在内存中：由 I/O 后端从源文件拷贝（mmap 写入或内核态拷贝）
+    backend_->copy(*result.input, result.chunk_offset, payload_size, archive);
+  } else {
+    archive.write(result.content.data(), result.content.size());
+  }
+  if (!chunked) {
+    return true;
+  }
+
+  // 分块条目：合并本块的 CRC32，末块写完后回填条目头
+  IndexRecord &record = index.back();
+  record.checksum =
+      crc32_combine(record.checksum, result.checksum, result.chunk_size);
+  record.stored_size += payload_size;
+  if (result.chunk_index + 1 < result.chunk_count) {
+    return false;
+  }
+  if (!streaming_) {
+    const EntryHeaderV3 entry = wire_order(make_entry_header(record));
+    archive.write_at(record.entry_offset, &entry, sizeof(entry));
+  }
+  return true;
+}
+
+void Archiver::write_solid(ArchiveWriter &archive, const PackResult &result,
+                           ArchiveIndex &index) {
+  uint64_t block_offset = 0;
+  for (size_t i = 0; i < result.solid.size(); ++i) {
+    const SolidMember &member = result.solid[i];
+    IndexRecord record;
+    record.path = member.rel_path;
+    record.entry_offset = archive.tell();
+    record.content_size = member.content_size;
+    record.modified_time = member.modified_time;
+    record.checksum = member.checksum;
+    record.permissions = member.permissions;
+    record.codec = static_cast<uint8_t>(result.codec);
+    record.flags = KAR_ENTRY_MTIME_NS | KAR_ENTRY_SOLID;
+    record.stored_size = sizeof(SolidRef) + (i == 0 ? result.content.size() : 0);
+    if (i == 0) {
+      block_offset = record.data_offset() + sizeof(SolidRef);
+    }
+
+    // Header -> 路径 -> SolidRef（首个成员之后紧跟块本身）
+    write_wire(archive, make_entry_header(record));
+    archive.write(record.path.data(), record.path.size());
+    write_wire(archive, SolidRef{.block_offset = block_offset,
+                                 .raw_offset = member.raw_offset});
+    if (i == 0) {
+      archive.write(result.content.data(), result.content.size());
+    }
+    index.add(std::move(record));
+  }
+}
+
+uint64_t Archiver::resolve_dedup(const PackResult &result,
+                                 uint64_t payload_offset, ArchiveIndex &index,
+                                 std::vector<ChunkLocation> &refs) {
+  // 写入线程是唯一的登记者：编码时未知、此刻已写出的块（并发任务中的重复）
+  // 同样改为引用；新块按即将写出的位置登记，同一条目中再次出现时即为引用
+  uint64_t size = 0;
+  refs.assign(result.dedup_chunks.size(), ChunkLocation{});
+  for (size_t i = 0; i < result.dedup_chunks.size(); ++i) {
+    const DedupChunk &chunk = result.dedup_chunks[i];
+    if (chunk.raw_size == 0) {
+      // 空洞记录原样写出
+      size += chunk.encoded_size;
+      continue;
+    }
+    if (dedup_->find(chunk.digest, refs[i])) {
+      size += sizeof(BlockHeader) + sizeof(ChunkRef);
+      dedup_saved_ += chunk.raw_size;
+      continue;
+    }
+    if (chunk.encoded_size == 0) {
+      throw std::logic_error("Deduplicated chunk was never written");
+    }
+    ChunkLocation location{.block_offset = payload_offset + size,
+                           .raw_size = chunk.raw_size,
+                           .checksum = chunk.checksum};
+    dedup_->add(chunk.digest, location);
+    ChunkIndexEntry entry{};
+    std::memcpy(entry.digest, chunk.digest.data(), sizeof(entry.digest));
+    entry.block_offset = location.block_offset;
+    entry.raw_size = location.raw_size;
+    entry.checksum = location.checksum;
+    index.add_chunk(entry);
+    size += chunk.encoded_size;
+  }
+  return size;
+}
+
+IndexRecord Archiver::read_entry_header(ArchiveReader &archive,
+                                        uint16_t version) {
+  IndexRecord record;
+  record.entry_offset = archive.tell();
+
+  const char *header = archive.view(entry_header_size(version));
+  if (header == nullptr) {
+    throw std::runtime_error("Unexpected end of archive");
+  }
+  uint32_t path_length = decode_entry_header(header, version, record);
+  const char *path = archive.view(path_length);
+  if (path == nullptr) {
+    throw std::runtime_error("Unexpected end of archive");
+  }
+  record.path.assign(path, path_length);
+  return record;
+}
+
+void Archiver::verify_entry_header(const ArchiveReader &archive,
+                                   const IndexRecord &record,
+                                   ByteBuffer &scratch) const {
+  // 核对索引与条目头一致，防止目录与条目区不匹配时写出错误数据
+  const char *header = archive.view_at(
+      record.entry_offset, entry_header_size(record.version), scratch);
+  if (header == nullptr) {
+    throw std::runtime_error("Unexpected end of archive in file: " + record.path);
+  }
+  IndexRecord entry;
+  if (decode_entry_header(header, record.version, entry) != record.path.size() ||
+      entry.content_size != record.content_size ||
+      entry.codec != record.codec ||
+      (!(entry.flags & KAR_ENTRY_DEFERRED) &&
+       entry.stored_size != record.stored_size)) {
+    throw std::runtime_error("Archive index does not match entry: " +
+                             record.path);
+  }
+}
+
+std::vector<PayloadRange>
+Archiver::plan_ranges(const ArchiveReader &archive, const IndexRecord &record,
+                      ByteBuffer &scratch) const {
+  std::vector<PayloadRange> ranges;
+  const uint64_t begin = record.data_offset();
+  const bool dedup = (record.flags & KAR_ENTRY_DEDUP) != 0;
+  const bool sparse = (record.flags & KAR_ENTRY_SPARSE) != 0;
+  if (record.flags & KAR_ENTRY_SOLID) {
+    // 固实条目只能整体从所在的块中切出
+    ranges.push_back(PayloadRange{
+        .stored_offset = begin, .raw_offset = 0, .raw_size = record.content_size});
+    return ranges;
+  }
+  if (!record.has_blocks()) {
+    for (uint64_t offset = 0; offset < record.content_size; offset += kChunkSize) {
+      ranges.push_back(PayloadRange{
+          .stored_offset = begin + offset,
+          .raw_offset = offset,
+          .raw_size = std::min<uint64_t>(record.content_size - offset, kChunkSize)});
+    }
+    return ranges;
+  }
+
+  // 压缩 / 去重 / 稀疏条目：沿块头前进，每累计约 kChunkSize 块数据切一段
+  // （引用块只占块头 + ChunkRef，不必读取被引用的数据；空洞计入段长但不计数据量）
+  const uint64_t end = begin + record.stored_size;
+  uint64_t offset = begin;
+  uint64_t produced = 0;
+  uint64_t current_data = 0;
+  PayloadRange current{.stored_offset = begin, .raw_offset = 0, .raw_size = 0};
+  while (offset < end) {
+    BlockHeader block;
+    const char *data = archive.view_at(offset, sizeof(block), scratch);
+    if (data == nullptr || end - offset < sizeof(block)) {
+      throw std::runtime_error("Unexpected end of archive in file: " +
+                               record.path);
+    }
+    block = load_wire<BlockHeader>(data);
+    if (sparse && block.raw_size == 0) {
+      HoleRun hole;
+      data = end - offset - sizeof(block) >= sizeof(hole)
+                 ? archive.view_at(offset + sizeof(block), sizeof(hole), scratch)
+                 : nullptr;
+      if (data == nullptr) {
+        throw std::runtime_error("Unexpected end of archive in file: " +
+                                 record.path);
+      }
+      hole = load_wire<HoleRun>(data);
+      if (block.stored_size != 0 || hole.length == 0 ||
+          hole.length > record.content_size - produced) {
+        throw std::runtime_error("Corrupted block in file: " + record.path);
+      }
+      offset += sizeof(block) + sizeof(hole);
+      produced += hole.length;
+      current.raw_size += hole.length;
+      continue;
+    }
+    const uint64_t item_size = block.stored_size == 0 && dedup
+                                   ? sizeof(ChunkRef)
+                                   : block.stored_size;
+    if (block.raw_size == 0 || (block.stored_size == 0 && !dedup) ||
+        item_size > end - offset - sizeof(block) ||
+        block.raw_size > record.content_size - produced) {
+      throw std::runtime_error("Corrupted block in file: " + record.path);
+    }
+    offset += sizeof(block) + item_size;
+    produced += block.raw_size;
+    current.raw_size += block.raw_size;
+    current_data += block.raw_size;
+    if (current_data >= kChunkSize) {
+      ranges.push_back(current);
+      current = PayloadRange{
+          .stored_offset = offset, .raw_offset = produced, .raw_size = 0};
+      current_data = 0;
+    }
+  }
+  if (current.raw_size > 0) {
+    ranges.push_back(current);
+  }
+  if (produced != record.content_size) {
+    throw std::runtime_error("Corrupted block in file: " + record.path);
+  }
+  return ranges;
+}
+
+uint32_t Archiver::extract_range(const ArchiveReader &archive,
+                                 const IndexRecord &record,
+                                 const PayloadRange &range, OutputFile *out,
+                                 ByteBuffer &scratch) const {
+  const Codec codec = static_cast<Codec>(record.codec);
+  const bool dedup = (record.flags & KAR_ENTRY_DEDUP) != 0;
+  const bool sparse = (record.flags & KAR_ENTRY_SPARSE) != 0;
+  uint64_t offset = range.stored_offset;
+  uint64_t produced = 0;
+
+  if (record.flags & KAR_ENTRY_SOLID) {
+    return extract_solid(archive, record, out, scratch);
+  }
+
+  // 原样存储：分块读取、校验并写入（mmap 模式下直接使用映射中的数据，无额外拷贝）
+  const bool verify = out == nullptr || options_.verify != VerifyLevel::None;
+  if (!record.has_blocks()) {
+    CRC32 crc32;
+    while (produced < range.raw_size) {
+      size_t n = static_cast<size_t>(
+          std::min<uint64_t>(range.raw_size - produced, kStreamChunkSize));
+      const char *chunk = archive.view_at(offset, n, scratch);
+      if (chunk == nullptr) {
+        throw std::runtime_error("Unexpected end of archive in file: " +
+                                 record.path);
+      }
+      if (verify) {
+        StageTimer timer(Stage::Crc, n);
+        crc32.update(chunk, n);
+      }
+      if (out != nullptr) {
+        out->write_at(chunk, n, range.raw_offset + produced);
+      }
+      offset += n;
+      produced += n;
+    }
+    return crc32.finalize();
+  }
+
+  // 逐块解码：每块先核对自身的 CRC32，整段 CRC32 由块 CRC 合并得到；
+  // 去重条目中的引用块随读随解析到此前写出的同内容块。不校验时返回值无意义
+  const uint64_t end = record.data_offset() + record.stored_size;
+  thread_local ByteBuffer raw;
+  uint32_t checksum = 0;
+  while (produced < range.raw_size) {
+    BlockHeader block;
+    const uint64_t item_offset = offset;
+    const char *data = archive.view_at(offset, sizeof(block), scratch);
+    if (data == nullptr || end - offset < sizeof(block)) {
+      throw std::runtime_error("Unexpected end of archive in file: " +
+                               record.path);
+    }
+    block = load_wire<BlockHeader>(data);
+    offset += sizeof(block);
+    if (sparse && block.raw_size == 0) {
+      // 空洞记录：输出文件已截断到完整大小，不写出；CRC32 按全零合并
+      HoleRun hole;
+      data = end - offset >= sizeof(hole)
+                 ? archive.view_at(offset, sizeof(hole), scratch)
+                 : nullptr;
+      if (data == nullptr) {
+        throw std::runtime_error("Unexpected end of archive in file: " +
+                                 record.path);
+      }
+      hole = load_wire<HoleRun>(data);
+      if (block.stored_size != 0 || block.checksum != 0 || hole.length == 0 ||
+          hole.length > range.raw_size - produced) {
+        throw std::runtime_error("Corrupted block in file: " + record.path);
+      }
+      if (verify) {
+        checksum = crc32_combine(checksum, zeros_checksum(hole.length),
+                                 hole.length);
+      }
+      offset += sizeof(hole);
+      produced += hole.length;
+      continue;
+    }
+    if (block.raw_size == 0 || block.raw_size > kCodecBlockSize ||
+        block.stored_size > block.raw_size ||
+        (block.stored_size == 0 && !dedup) ||
+        (block.stored_size == 0 ? sizeof(ChunkRef) : block.stored_size) >
+            end - offset ||
+        block.raw_size > range.raw_size - produced) {
+      throw std::runtime_error("Corrupted block in file: " + record.path);
+    }
+
+    BlockHeader stored = block;
+    uint64_t data_offset = offset;
+    uint64_t item_size = block.stored_size;
+    if (block.stored_size == 0) {
+      ChunkRef ref;
+      data = archive.view_at(offset, sizeof(ref), scratch);
+      if (data == nullptr) {
+        throw std::runtime_error("Unexpected end of archive in file: " +
+                                 record.path);
+      }
+      ref = load_wire<ChunkRef>(data);
+      item_size = sizeof(ref);
+      // 只允许指向更早的字面块，且原始大小与 CRC32 必须一致
+      data = ref.block_offset >= sizeof(FileHeader) &&
+                     ref.block_offset + sizeof(stored) <= item_offset
+                 ? archive.view_at(ref.block_offset, sizeof(stored), scratch)
+                 : nullptr;
+      if (data != nullptr) {
+        stored = load_wire<BlockHeader>(data);
+      }
+      if (data == nullptr || stored.raw_size != block.raw_size ||
+          stored.checksum != block.checksum || stored.stored_size == 0 ||
+          stored.stored_size > stored.raw_size) {
+        throw std::runtime_error("Corrupted chunk reference in file: " +
+                                 record.path);
+      }
+      data_offset = ref.block_offset + sizeof(stored);
+    }
+
+    data = archive.view_at(data_offset, stored.stored_size, scratch);
+    if (data == nullptr) {
+      throw std::runtime_error("Unexpected end of archive in file: " +
+                               record.path);
+    }
+    if (stored.stored_size != stored.raw_size) {
+      raw.resize(stored.raw_size);
+      decode_block(codec, stored, data, raw.data());
+      data = raw.data();
+    }
+    if (verify) {
+      StageTimer timer(Stage::Crc, block.raw_size);
+      uint32_t block_crc = CRC32().calculate(
+          reinterpret_cast<const uint8_t *>(data), block.raw_size);
+      if (block_crc != block.checksum) {
+        throw std::runtime_error("CRC32 mismatch for file: " + record.path +
+                                 " (block at offset " +
+                                 std::to_string(range.raw_offset + produced) +
+                                 ")");
+      }
+      checksum = crc32_combine(checksum, block_crc, block.raw_size);
+    }
+    if (out != nullptr) {
+      out->write_at(data, block.raw_size, range.raw_offset + produced);
+    }
+    produced += block.raw_size;
+    offset += item_size;
+  }
+  return checksum;
+}
+
+uint32_t Archiver::extract_solid(const ArchiveReader &archive,
+                                 const IndexRecord &record, OutputFile *out,
+                                 ByteBuffer &scratch) const {
+  // 首个成员的块紧跟在自己的 SolidRef 之后，其余成员只能指向更早的块
+  const uint64_t begin = record.data_offset();
+  const char *data = record.stored_size >= sizeof(SolidRef)
+                         ? archive.view_at(begin, sizeof(SolidRef), scratch)
+                         : nullptr;
+  if (data == nullptr) {
+    throw std::runtime_error("Unexpected end of archive in file: " + record.path);
+  }
+  const auto ref = load_wire<SolidRef>(data);
+  const bool head = ref.block_offset == begin + sizeof(SolidRef);
+  BlockHeader block{};
+  data = (head || (ref.block_offset >= sizeof(FileHeader) &&
+                   ref.block_offset + sizeof(block) <= record.entry_offset &&
+                   record.stored_size == sizeof(SolidRef)))
+             ? archive.view_at(ref.block_offset, sizeof(block), scratch)
+             : nullptr;
+  if (data != nullptr) {
+    block = load_wire<BlockHeader>(data);
+  }
+  if (data == nullptr || block.raw_size == 0 ||
+      block.raw_size > kCodecBlockSize || block.stored_size == 0 ||
+      block.stored_size > block.raw_size ||
+      (head && record.stored_size !=
+                   sizeof(SolidRef) + sizeof(block) + block.stored_size) ||
+      ref.raw_offset > block.raw_size ||
+      record.content_size > block.raw_size - ref.raw_offset) {
+    throw std::runtime_error("Corrupted solid block in file: " + record.path);
+  }
+
+  // 解码结果按块的偏移与块头缓存在本线程：同一块的成员多数相邻，
+  // 顺序解包与并行解包的同一任务中只解码一次。原样存储的块直接读取成员
+  struct SolidCache {
+    uint64_t offset = UINT64_MAX;
+    BlockHeader block{};
+    ByteBuffer raw;
+  };
+  thread_local SolidCache cache;
+  const size_t n = static_cast<size_t>(record.content_size);
+  const uint64_t data_offset = ref.block_offset + sizeof(block);
+  const char *member = nullptr;
+  if (block.stored_size == block.raw_size) {
+    member = archive.view_at(data_offset + ref.raw_offset, n, scratch);
+  } else {
+    if (cache.offset != ref.block_offset ||
+        std::memcmp(&cache.block, &block, sizeof(block)) != 0) {
+      data = archive.view_at(data_offset, block.stored_size, scratch);
+      if (data == nullptr) {
+        throw std::runtime_error("Unexpected end of archive in file: " +
+                                 record.path);
+      }
+      cache.offset = UINT64_MAX;
+      cache.raw.resize(block.raw_size);
+      decode_block(static_cast<Codec>(record.codec), block, data,
+                   cache.raw.data());
+      cache.offset = ref.block_offset;
+      cache.block = block;
+    }
+    member = cache.raw.data() + ref.raw_offset;
+  }
+  if (member == nullptr) {
+    throw std::runtime_error("Unexpected end of archive in file: " + record.path);
+  }
+
+  // 成员的 CRC32 覆盖其全部内容，不再核对整块的 CRC32
+  uint32_t checksum = 0;
+  if (out == nullptr || options_.verify != VerifyLevel::None) {
+    StageTimer timer(Stage::Crc, n);
+    checksum = CRC32().calculate(reinterpret_cast<const uint8_t *>(member), n);
+  }
+  if (out != nullptr) {
+    out->write_at(member, n, 0);
+  }
+  return checksum;
+}
+
+void Archiver::extract_payload(const ArchiveReader &archive,
+                               const IndexRecord &record,
+                               DirectoryCache &dirs,
+                               ByteBuffer &scratch) const {
+  verify_entry_header(archive, record, scratch);
+
+  // 相对缓存的父目录 fd 创建文件（父目录经缓存只创建一次）
+  const DirectoryCache::Location location = dirs.locate(record.path);
+  const fs::path out_path = dirs.full_path(record.path);
+  OutputFile out_file(location.dir_fd, location.name, out_path);
+
+  // 整个 payload 作为一段读取、解码并写出（小文件即一次 write），
+  // 校验通过后经同一 fd 恢复权限与修改时间；出错时删除不完整的文件
+  try {
+    prepare_output(out_file, record);
+    PayloadRange whole{.stored_offset = record.data_offset(),
+                       .raw_offset = 0,
+                       .raw_size = record.content_size};
+    const uint32_t calculated_crc =
+        extract_range(archive, record, whole, &out_file, scratch);
+    if (options_.verify != VerifyLevel::None &&
+        calculated_crc != record.checksum) {
+      throw std::runtime_error(
+          "CRC32 mismatch for file: " + record.path +
+          " (expected: " + std::to_string(record.checksum) +
+          ", got: " + std::to_string(calculated_crc) + ")");
+    }
+    finish_output(out_file, record);
+    out_file.close();
+  } catch (...) {
+    fs::remove(out_path);
+    throw;
+  }
 }
@@ -1,29 +1,422 @@
 #pragma once
 
+#include "archive_index.hpp"
+#include "codec.hpp"
+#include "dedup.hpp"
+#include "format.hpp"
+#include "io_backend.hpp"
+#include "scan_cache.hpp"
+#include "scanner.hpp"
+#include "thread_pool.hpp"
+#include "throttle.hpp"
+
+#include <cstdint>
 #include <filesystem>
-#include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace fs = std::filesystem;
 
+class ArchiveIndex;
+class DirectoryCache;
+
+// ============================================
+// 并行打包任务/结果（见 docs/parallel_archive_design.md）
+// ============================================
+struct PackTask {
+  fs::path file_path;    // 源文件路径
+  std::string rel_path;  // 相对路径（扫描时生成）
+  FileStat stat;         // 扫描时取得的大小与 mtime（不再重复 stat）
+  uint32_t task_id;      // 任务序号（用于保序）
+  uint16_t permissions;  // 文件权限
+  uint64_t reserved;     // 扫描时占用的在途字节预算
+
+  // 分块条目：大文件拆成多个任务，各自处理 [chunk_offset, +chunk_size)
+  uint32_t chunk_index = 0;
+  uint32_t chunk_count = 0; // 0 表示整体条目（小文件）
+  uint64_t chunk_offset = 0;
+  uint64_t chunk_size = 0;
+  Codec codec = Codec::None;          // 扫描时按文件开头预判的编码（去重时为块编码）
+  std::shared_ptr<InputFile> input;   // 同一文件的各分块共享
+  // 稀疏文件的分块：只读取 extents 中的数据区，其余部分写成空洞记录
+  bool sparse = false;
+  std::vector<DataExtent> extents;
+
+  // 分组布局下原样存储的大文件：payload 写在对齐边界上
+  bool aligned = false;
+
+  // 固实块任务：这些相邻小文件一起读入，拼接后编码为一个块（其余字段不用）
+  std::vector<ScanEntry> solid;
+
+  // 增量打包：大小与 mtime 未变化，直接从基准归档拷贝该条目
+  const IndexRecord *base = nullptr;
+};
+
+// 固实块中的一个成员文件
+struct SolidMember {
+  std::string rel_path;
+  uint64_t content_size = 0;
+  uint64_t modified_time = 0;
+  uint32_t checksum = 0;    // 成员内容的 CRC32
+  uint16_t permissions = 0;
+  uint32_t raw_offset = 0;  // 在原始块中的偏移
+};
+
+struct PackResult {
+  uint32_t task_id = 0;       // 对应任务ID
+  uint64_t content_size = 0;  // 文件内容大小
+  ByteBuffer content;  // 待写出的 payload（压缩时为块序列）
+  // 去重条目：按文件顺序的块列表，新块的编码数据在 content 中
+  std::vector<DedupChunk> dedup_chunks;
+  fs::path source_path;       // 去重条目的源文件（整文件重复比较用）
+  Codec codec = Codec::None;  // payload 的编码方式
+  // 内容不在内存中时保持打开的源文件，写入时由 I/O 后端拷贝
+  std::shared_ptr<InputFile> input;
+  uint32_t chunk_index = 0;   // 分块序号
+  uint32_t chunk_count = 0;   // 分块总数（0 表示整体条目）
+  uint64_t chunk_offset = 0;  // 分块在源文件中的偏移
+  uint64_t chunk_size = 0;    // 分块原始字节数
+  uint64_t modified_time = 0; // 修改时间（源文件 mtime，纳秒）
+  uint8_t flags = 0;          // 条目标志（KAR_ENTRY_*）
+  const IndexRecord *base = nullptr; // 非空时从基准归档拷贝 payload
+  uint32_t checksum = 0;      // CRC32校验和（分块条目为本块的 CRC32）
+  std::string rel_path;       // 相对路径
+  uint16_t permissions = 0;   // 权限
+  uint64_t reserved = 0;      // 写入后归还的在途字节预算
+  // 固实块结果：content 为编码后的块（BlockHeader + 块数据），
+  // content_size 为各成员大小之和
+  std::vector<SolidMember> solid;
+};
+
+// ============================================
+// 库接口：选项、进度观察者与结果统计
+// ============================================
+
+// 解包（unpack / extract）时的校验级别
+enum class VerifyLevel {
+  None,      // 不计算 CRC32，只做结构检查（可信来源、追求吞吐时使用）
+  Checksums, // 逐块与整文件核对 CRC32（默认）
+};
+
+// 解析 --verify 参数："none" / "crc"
+VerifyLevel parse_verify_level(const std::string &name);
+
+// 打包时的条目布局
+enum class PackLayout {
+  Scan,    // 按扫描顺序逐个写出（默认）
+  Grouped, // 先按目录与扩展名重排：相邻小文件合并为固实块，
+           // 原样存储的大文件 payload 对齐到页边界；目录中记录原始顺序
+};
+
+// 解析 --layout 参数："scan" / "grouped"
+PackLayout parse_pack_layout(const std::string &name);
+
+struct ArchiverOptions {
+  // 工作线程数：0 为硬件线程数，1 走串行路径
+  unsigned threads = 0;
+  // 工作线程的 CPU 绑定方式（pack / unpack / extract / verify 的线程池）
+  CpuAffinity affinity = CpuAffinity::None;
+  // 并行打包的在途字节预算（已读入、尚未写出的数据）
+  size_t max_inflight_bytes = 256ull * 1024 * 1024;
+  // 归档写缓冲区大小（小块写入在此合并后整块写出）
+  size_t write_buffer_size = ArchiveWriter::kDefaultBufferSize;
+  IoBackendKind io = IoBackendKind::Auto;
+  Codec codec = Codec::None; // 打包编码
+  int level = 0;             // 压缩级别，0 取编码的默认级别
+  bool dedup = false;        // 内容定义分块去重
+  // 增量打包的基准归档：大小与 mtime 未变的文件直接从中拷贝；空路径为完整打包
+  fs::path incremental_base;
+  VerifyLevel verify = VerifyLevel::Checksums;
+  // 分卷打包的每卷字节数：非 0 时写出 <archive>.001、.002……与卷表 <archive>
+  uint64_t volume_size = 0;
+  PackLayout layout = PackLayout::Scan;
+  // 归档以 O_DIRECT 写出（不能用于标准输出与分卷），原样存储的大文件按页对齐
+  bool direct_io = false;
+  // 大文件的分块以 O_DIRECT 读取（稀疏文件除外），不再映射
+  bool direct_sources = false;
+  // 扫描缓存文件：存在时未变化的目录沿用其中的列表，打包完成后重写；空路径为不使用
+  fs::path scan_cache;
+  // 未变化目录中的文件同样取自扫描缓存、不再 stat（需要 scan_cache）
+  bool trust_dir_mtime = false;
+  // 自适应并发：并行路径按实测吞吐与分阶段耗时判断的瓶颈（I/O 或计算），
+  // 在 [1, threads]（计算受限时至多 CPU 数）内调整启用的工作线程数，
+  // 打包的在途预算随之按比例缩放
+  bool adaptive = false;
+  // 源文件读取（pack）与解出写入（unpack / extract）的总带宽上限（字节/秒），0 为不限
+  uint64_t bandwidth_limit = 0;
+};
+
+// 进度快照
+struct ArchiveProgress {
+  const std::string *path = nullptr; // 刚处理的条目
+  uint64_t entries_done = 0;
+  uint64_t entries_total = 0; // 已知条目总数（并行打包时随扫描增长），0 表示未知
+  uint64_t bytes_done = 0;    // 已处理的原始内容字节数
+  uint64_t bytes_total = 0;   // 已知原始内容总字节数，0 表示未知
+};
+
+// 进度观察者：回调在调用 pack() / unpack() / extract() 的线程中执行，
+// 每个条目（大条目为每个分块）完成后一次。回调应尽量轻量，刷新频率由实现自行节流
+class ArchiveObserver {
+public:
+  virtual ~ArchiveObserver() = default;
+  virtual void on_progress(const ArchiveProgress &progress) = 0;
+  // 可恢复的问题（中央目录损坏、io_uring 不可用等）已退回其他实现；
+  // 同样在调用线程中执行。默认忽略
+  virtual void on_warning(const std::string &message) { (void)message; }
+};
+
+// pack() / unpack() / extract() 的结果统计
+struct ArchiveStats {
+  uint16_t version = KAR_VERSION_CURRENT; // 归档格式版本
+  uint64_t entries = 0;         // 写入 / 解出的条目数
+  uint64_t archive_entries = 0; // 归档中的条目总数
+  uint64_t bytes = 0;           // 原始内容字节数
+  uint64_t stored_bytes = 0;    // 这些条目的 payload 在归档中的字节数
+  uint64_t archive_bytes = 0;   // 写出 / 读入的归档字节数
+  uint64_t reused_entries = 0;  // 增量打包：从基准归档拷贝的条目数
+  uint64_t unique_chunks = 0;   // 去重打包：不重复的块数
+  uint64_t dedup_bytes = 0;     // 去重打包：以引用代替存储的原始字节数
+  uint32_t volumes = 0;         // 分卷打包：写出的卷数（未分卷为 0）
+  uint64_t cached_directories = 0; // 扫描缓存：沿用缓存列表的目录数
+  uint32_t adaptive_threads = 0; // 自适应并发：最后采用的工作线程数（未启用为 0）
+  double seconds = 0;           // 耗时
+};
+
+// verify() 中校验失败的条目
+struct VerifyFailure {
+  std::string path;
+  std::string error; // 异常信息，如 "CRC32 mismatch for file: ..."
+};
+
+// verify() 的结果：统计与全部失败条目（按归档顺序）
+struct VerifyReport {
+  ArchiveStats stats;
+  std::vector<VerifyFailure> failures;
+};
+
+// 条目 payload 中可独立解码的一段（由若干完整的块组成）
+struct PayloadRange {
+  uint64_t stored_offset = 0; // 在归档中的起始偏移
+  uint64_t raw_offset = 0;    // 对应原始内容的偏移
+  uint64_t raw_size = 0;      // 原始字节数
+};
+
 // ============================================
 // 核心 Archive 类
 // ============================================
 class Archiver {
 public:
-  // 打包文件夹到 archive 文件
-  void pack(const fs::path &source_dir, const fs::path &archive_path);
+  // 流式读写的分块大小：超过该大小的文件不整体载入内存
+  static constexpr size_t kStreamChunkSize = 1024 * 1024;
+
+  // mmap 后端下，不小于该大小的文件改用映射读取（更小的文件 read 更快）
+  static constexpr size_t kMmapThreshold = 64 * 1024;
+
+  // 分块条目的块大小：超过 kStreamChunkSize 的文件按此拆分到多个工作线程，
+  // 解包时同样按此拆分并行解码
+  static constexpr size_t kChunkSize = 4 * kCodecBlockSize;
+
+  // 打包时不短于该大小的空洞不读取，记为空洞记录（更短的空洞按数据读取）
+  static constexpr size_t kMinHoleSize = 64 * 1024;
 
-  // 解包 archive 到指定目录
-  void unpack(const fs::path &archive_path, const fs::path &target_dir);
+  // 分卷打包的最小卷大小（全局头须完整落在第一卷内）
+  static constexpr uint64_t kMinVolumeSize = 64 * 1024;
 
-  // 查看 archive 内容（不解压）
-  void list(const fs::path &archive_path);
+  // 分组布局下不超过该大小的文件可合并进固实块（每块至多 kCodecBlockSize）
+  static constexpr size_t kSolidFileSize = 64 * 1024;
+
+  // 本类不向标准输出或标准错误写任何内容：进度与警告经 ArchiveObserver 回调
+  // （个别可恢复的问题如中央目录损坏、io_uring 不可用时退回并警告），结果以
+  // ArchiveStats 返回，失败时抛出 std::runtime_error
+  explicit Archiver(const ArchiverOptions &options = {});
+
+  const ArchiverOptions &options() const { return options_; }
+
+  // 设置进度观察者（不转移所有权，nullptr 取消）；设置之前产生的警告
+  // （如构造时选择 I/O 后端）随即交给新的观察者
+  void set_observer(ArchiveObserver *observer);
+
+  // 打包文件夹到 archive 文件；archive_path 为 "-" 时流式写到标准输出
+  // （不回写，流式归档格式见 format.hpp）
+  ArchiveStats pack(const fs::path &source_dir, const fs::path &archive_path);
+
+  // 解包 archive 到指定目录；archive_path 为 "-" 时从标准输入顺序读取，
+  // 边读边解出
+  ArchiveStats unpack(const fs::path &archive_path, const fs::path &target_dir);
+
+  // 读取 archive 的条目索引（不解压）
+  ArchiveIndex list(const fs::path &archive_path);
+
+  // 只解出匹配的条目（精确路径、目录前缀或通配符），其余条目不读取；
+  // 多个条目且多线程时与 unpack 一样并行解出
+  ArchiveStats extract(const fs::path &archive_path,
+                       const std::vector<std::string> &patterns,
+                       const fs::path &target_dir);
+
+  // 多线程核对全部条目的 CRC32，不写磁盘；单个条目失败不中止，记入结果。
+  // 归档本身无法打开或索引无法读取时抛出异常
+  VerifyReport verify(const fs::path &archive_path);
 
 private:
-  void write_entry(std::ofstream &archive, const fs::path &base_dir,
-                   const fs::path &file_path);
+  ArchiverOptions options_; // level 已解析为实际级别
+  ArchiveObserver *observer_ = nullptr;
+  std::vector<std::string> pending_warnings_; // 尚无观察者时产生的警告
+  std::unique_ptr<IoBackend> backend_;
+
+  // 把警告交给观察者，尚未设置时暂存；warning_handler() 供底层模块回调
+  void warn(const std::string &message);
+  WarningHandler warning_handler() {
+    return [this](const std::string &message) { warn(message); };
+  }
+
+  // 增量打包的基准归档：索引 + 用于拷贝未变化条目的只读文件
+  struct BaseArchive {
+    std::unique_ptr<ArchiveReader> reader;
+    std::shared_ptr<InputFile> file;
+    ArchiveIndex index;
+  };
+  std::unique_ptr<BaseArchive> base_; // 仅在 pack() 期间有效
+  size_t reused_ = 0;                 // 从基准归档拷贝的条目数
+
+  bool streaming_ = false; // 本次 pack() 写入顺序输出（不回写）
+
+  std::unique_ptr<DedupStore> dedup_; // 仅在 pack() 期间有效
+  uint64_t dedup_saved_ = 0;          // 以引用代替存储的原始字节数
+
+  // 扫描缓存：上一次的记录（可为空）与本次的记录，仅在 pack() 期间有效
+  std::unique_ptr<ScanCache> scan_cache_;
+  std::unique_ptr<ScanCacheWriter> scan_record_;
+  uint64_t cached_dirs_ = 0; // 沿用缓存列表的目录数
+
+  // 带宽上限（未限速时为空）与最近一次自适应并行流水线最后采用的线程数
+  std::unique_ptr<BandwidthLimiter> bandwidth_;
+  uint32_t adaptive_threads_ = 0;
+
+  // 按带宽上限等待 bytes 字节的配额（未限速时立即返回）；可并发调用
+  void throttle(uint64_t bytes) const {
+    if (bandwidth_) {
+      bandwidth_->consume(bytes);
+    }
+  }
+
+  // 遍历源目录（按需经扫描缓存，并记录本次扫描），回调语义同 DirectoryScanner::scan
+  void scan_sources(const fs::path &source_dir, unsigned threads,
+                    const std::function<bool(ScanEntry &&)> &on_entry);
+
+  // 串行打包：扫描完成后逐个读取并写入，返回中央目录
+  ArchiveIndex pack_serial(ArchiveWriter &archive, const fs::path &source_dir);
+
+  // 并行打包：扫描线程 -> 工作线程池（读取 + CRC）-> 按 task_id 保序写入
+  ArchiveIndex pack_parallel(ArchiveWriter &archive, const fs::path &source_dir,
+                             unsigned threads);
+
+  // 把一个文件拆成打包任务：增量打包时未变化的文件一个拷贝任务；
+  // 小文件一个任务；大文件打开后预判编码，每 kChunkSize 一个分块任务
+  // （稀疏文件每 kChunkSize 数据一个分块任务，空洞不计入）。
+  // task_id 从 next_id 开始连续分配
+  std::vector<PackTask> plan_tasks(ScanEntry &&entry, uint32_t &next_id) const;
+
+  // 分组布局：按（父目录、小文件在前、扩展名、文件名）稳定重排 files，
+  // 返回重排后每个文件在扫描顺序中的序号（写入中央目录的原始顺序表）
+  std::vector<uint32_t> plan_layout(std::vector<ScanEntry> &files) const;
+
+  // 从 files[i] 起规划下一批任务并前移 i：分组布局下相邻的可合并小文件
+  // （至少两个）成为一个固实块任务，否则同 plan_tasks(files[i])
+  std::vector<PackTask> plan_next(std::vector<ScanEntry> &files, size_t &i,
+                                  uint32_t &next_id) const;
+
+  // 原样存储的大文件是否按页对齐写出（分组布局或直接 I/O）
+  bool align_payloads() const {
+    return options_.layout == PackLayout::Grouped || options_.direct_io;
+  }
+
+  // 该文件能否合并进固实块（分组布局、压缩、非去重、非空小文件且不复用基准）
+  bool solid_candidate(const ScanEntry &entry) const;
+
+  // 增量打包：在基准归档中查找大小与 mtime 未变化的条目；扫描缓存给出了
+  // 上次的 CRC32 时还须与基准条目一致（基准归档确是缓存记录的那次打包）。
+  // 编码方式不同时，只复用原样存储且开头样本仍判定为不可压缩的条目
+  const IndexRecord *find_unchanged(const ScanEntry &entry) const;
+
+  // 读取单个文件（或分块）、计算 CRC32 并按需压缩（可在工作线程中执行）
+  PackResult load_entry(const PackTask &task) const;
+  PackResult load_chunk(const PackTask &task) const;
+  // 读入固实块的全部成员、计算各自的 CRC32 并把拼接内容编码为一个块
+  PackResult load_solid(const PackTask &task) const;
+
+  // I/O 后端支持批量读取时，连续的小文件任务攒成一批一次读取
+  static constexpr size_t kReadBatchFiles = 64;
+  static constexpr size_t kReadBatchBytes = 4 * 1024 * 1024;
+
+  // 该任务能否加入批量读取（整体读入的小文件）
+  bool batchable(const PackTask &task) const;
+
+  // 用 IoBackend::read_batch() 一次读入 batch 中的全部文件，再逐个 load_preloaded()
+  std::vector<PackResult> load_batch(const std::vector<PackTask> &batch) const;
+
+  // 小文件内容已由 IoBackend::read_batch() 读入 content 时的 load_entry()
+  PackResult load_preloaded(const PackTask &task, ByteBuffer &&content) const;
+
+  // 整体读入的小文件：按需压缩并计算 CRC32（result.content 为原始内容）
+  void encode_content(PackResult &result) const;
+
+  // 去重条目：计算 CRC32、查找整文件重复，否则切块并编码新块到 result.content
+  void encode_dedup(const PackTask &task, const char *data, size_t n,
+                    PackResult &result) const;
+
+  // 写入条目（或分块），并把其位置与元数据登记到中央目录；
+  // 分块条目首块写条目头，末块回填合并后的 CRC32 与存储大小。
+  // 返回条目是否已完整写出
+  bool write_entry(ArchiveWriter &archive, const PackResult &result,
+                   ArchiveIndex &index);
+
+  // 写出固实块的各成员条目：首个成员的 payload 带有块本身
+  void write_solid(ArchiveWriter &archive, const PackResult &result,
+                   ArchiveIndex &index);
+
+  // 去重条目写出前确定每块写字面数据还是引用：refs[i].block_offset 为 0
+  // 表示字面块（按 payload_offset 起的位置登记到存储与块索引），否则为引用目标。
+  // 返回 payload 字节数
+  uint64_t resolve_dedup(const PackResult &result, uint64_t payload_offset,
+                         ArchiveIndex &index, std::vector<ChunkLocation> &refs);
+
+  // 读取当前位置的条目头与相对路径（读取位置停在内容起始处）
+  IndexRecord read_entry_header(ArchiveReader &archive, uint16_t version);
+
+  // 核对条目头与索引记录一致
+  void verify_entry_header(const ArchiveReader &archive,
+                           const IndexRecord &record,
+                           ByteBuffer &scratch) const;
+
+  // 把条目 payload 切成约 kChunkSize 的可独立解码段（压缩条目需遍历块头）
+  std::vector<PayloadRange> plan_ranges(const ArchiveReader &archive,
+                                        const IndexRecord &record,
+                                        ByteBuffer &scratch) const;
+
+  // 读取并解码一段 payload，按原始偏移写入 out；逐块核对块 CRC32，
+  // 返回该段原始数据的 CRC32。out 为空时只校验不写出（此时总是核对 CRC32）。
+  // 只使用 view_at()，可并发调用
+  uint32_t extract_range(const ArchiveReader &archive, const IndexRecord &record,
+                         const PayloadRange &range, OutputFile *out,
+                         ByteBuffer &scratch) const;
+
+  // 固实条目：按 SolidRef 取得所在的块（解码结果按线程缓存，同一块的
+  // 相邻成员只解码一次），切出本成员写入 out，返回其 CRC32
+  uint32_t extract_solid(const ArchiveReader &archive, const IndexRecord &record,
+                         OutputFile *out, ByteBuffer &scratch) const;
+
+  // 按记录读取条目内容（必要时逐块解码）、校验 CRC32 并写入 dirs 的目标目录
+  // 只使用 view_at()，可在多个工作线程中并发调用
+  void extract_payload(const ArchiveReader &archive, const IndexRecord &record,
+                       DirectoryCache &dirs, ByteBuffer &scratch) const;
+
+  // 并行解包：按预读的条目索引，工作线程池并发读取、校验与写出
+  void unpack_parallel(const ArchiveReader &archive, const ArchiveIndex &index,
+                       const fs::path &target_dir, unsigned threads);
 
-  void read_entry(std::ifstream &archive, const fs::path &target_dir);
+  // 顺序解包：从 fd 读取（不 seek），逐条目解码写出；流式归档中未回填的
+  // CRC32 与存储大小在读到末尾的中央目录后核对
+  ArchiveStats unpack_stream(int fd, const fs::path &target_dir);
 };
@@ -0,0 +1,78 @@
+#include "buffer_pool.hpp"
+
+#include <cstdlib>
+
+BufferPool &BufferPool::instance() {
+  static BufferPool *pool = new BufferPool();
+  return *pool;
+}
+
+size_t BufferPool::class_index(size_t n) {
+  if (n > kMaxClassSize) {
+    return kClassCount;
+  }
+  size_t index = 0;
+  for (size_t size = kMinClassSize; size < n; size <<= 1) {
+    ++index;
+  }
+  return index;
+}
+
+void *BufferPool::acquire(size_t n) {
+  if (n == 0) {
+    return nullptr;
+  }
+  const size_t index = class_index(n);
+  size_t size = n;
+  if (index < kClassCount) {
+    size = kMinClassSize << index;
+    SizeClass &cls = classes_[index];
+    std::lock_guard<std::mutex> lock(cls.mutex);
+    if (!cls.free.empty()) {
+      void *data = cls.free.back();
+      cls.free.pop_back();
+      retained_ -= size;
+      ++reuses_;
+      return data;
+    }
+  }
+  ++allocations_;
+  // 页大小以上按页对齐（大小须为对齐的整数倍；级别大小本身即是）
+  void *data = size < kPageAlignment
+                   ? std::malloc(size)
+                   : std::aligned_alloc(kPageAlignment,
+                                        (size + kPageAlignment - 1) /
+                                            kPageAlignment * kPageAlignment);
+  if (data == nullptr) {
+    throw std::bad_alloc();
+  }
+  return data;
+}
+
+void BufferPool::release(void *data, size_t n) {
+  if (data == nullptr) {
+    return;
+  }
+  ++releases_;
+  const size_t index = class_index(n);
+  if (index < kClassCount) {
+    const size_t size = kMinClassSize << index;
+    if (retained_ + size <= kMaxRetainedBytes) {
+      SizeClass &cls = classes_[index];
+      std::lock_guard<std::mutex> lock(cls.mutex);
+      cls.free.push_back(data);
+      retained_ += size;
+      return;
+    }
+  }
+  std::free(data);
+}
+
+BufferPool::Stats BufferPool::stats() const {
+  Stats stats;
+  stats.allocations = allocations_;
+  stats.reuses = reuses_;
+  stats.releases = releases_;
+  stats.retained_bytes = retained_;
+  return stats;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// ============================================
+// 缓冲区池：payload / scratch 缓冲区按 2 的幂次分级复用
+//
+// 打包时工作线程分配、写入线程归还，因此是全局共享的线程安全池；
+// 每个大小级别一把锁，稳定状态下每个条目不再调用 malloc/free。
+// 不小于 kPageAlignment 的缓冲区按页对齐，可直接用于 O_DIRECT 读写。
+// ============================================
+class BufferPool {
+public:
+  static constexpr size_t kMinClassSize = 256;
+  static constexpr size_t kMaxClassSize = 16 * 1024 * 1024;
+  static constexpr size_t kPageAlignment = 4096;
+  // 池中最多保留的空闲字节数，超出时直接释放（避免突发后长期占用）
+  static constexpr size_t kMaxRetainedBytes = 256 * 1024 * 1024;
+
+  struct Stats {
+    uint64_t allocations = 0;    // 向系统申请的次数（池未命中或超出最大级别）
+    uint64_t reuses = 0;         // 由池中空闲缓冲区满足的次数
+    uint64_t releases = 0;       // 归还次数
+    uint64_t retained_bytes = 0; // 当前池中空闲字节数
+  };
+
+  // 进程级单例（不析构，线程局部缓冲区在任何时刻归还都安全）
+  static BufferPool &instance();
+
+  // 返回至少 n 字节的未初始化缓冲区；n 为 0 时返回 nullptr
+  void *acquire(size_t n);
+
+  // 归还 acquire(n) 得到的缓冲区（n 必须与申请时一致）
+  void release(void *data, size_t n);
+
+  Stats stats() const;
+
+private:
+  static constexpr size_t kClassCount = 17; // 256 B .. 16 MB
+
+  struct SizeClass {
+    std::mutex mutex;
+    std::vector<void *> free;
+  };
+
+  SizeClass classes_[kClassCount];
+  std::atomic<uint64_t> allocations_{0};
+  std::atomic<uint64_t> reuses_{0};
+  std::atomic<uint64_t> releases_{0};
+  std::atomic<uint64_t> retained_{0};
+
+  BufferPool() = default;
+
+  // n 所属的级别，超出最大级别时返回 kClassCount
+  static size_t class_index(size_t n);
+};
+
+// 从 BufferPool 分配的分配器；元素默认初始化（resize 不清零）
+template <typename T> struct PoolAllocator {
+  using value_type = T;
+
+  PoolAllocator() = default;
+  template <typename U> PoolAllocator(const PoolAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(BufferPool::instance().acquire(n * sizeof(T)));
+  }
+  void deallocate(T *data, size_t n) {
+    BufferPool::instance().release(data, n * sizeof(T));
+  }
+
+  template <typename U>
+  void construct(U *p) noexcept(std::is_nothrow_default_constructible_v<U>) {
+    ::new (static_cast<void *>(p)) U;
+  }
+  template <typename U, typename... Args> void construct(U *p, Args &&...args) {
+    ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+  }
+
+  template <typename U> bool operator==(const PoolAllocator<U> &) const {
+    return true;
+  }
+  template <typename U> bool operator!=(const PoolAllocator<U> &) const {
+    return false;
+  }
+};
+
+// payload 与 scratch 使用的字节缓冲区：接口同 std::vector<char>，
+// 存储来自 BufferPool，扩容时不清零
+using ByteBuffer = std::vector<char, PoolAllocator<char>>;
@@ -0,0 +1,532 @@
+#include "codec.hpp"
+#include "stage_stats.hpp"
+
+#include "../include/crc32.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef KAR_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+// ============================================
+// LZ4 块格式（与 lz4 官方块格式兼容）
+//
+// 序列 = token(高 4 位字面量长度, 低 4 位匹配长度 - 4)
+//        [+ 字面量长度扩展] + 字面量 + 偏移(2 字节 LE) [+ 匹配长度扩展]
+// 最后一个序列只有字面量；最后 5 字节必须是字面量，
+// 最后一个匹配至少在结尾前 12 字节开始。
+// ============================================
+
+namespace {
+
+constexpr size_t kMinMatch = 4;
+constexpr size_t kLastLiterals = 5;
+constexpr size_t kMfLimit = 12;
+constexpr size_t kMaxDistance = 65535;
+constexpr int kMaxHashLog = 16;
+
+constexpr int kLz4DefaultLevel = 1;
+constexpr int kLz4MaxLevel = 12;
+constexpr int kZstdDefaultLevel = 3;
+constexpr int kZstdMaxLevel = 22;
+
+// 熵估计：每块均匀抽取 4 段 1 KB；熵高于阈值（比特/字节）视为不可压缩。
+// 均匀随机数据的 4 KB 样本约为 7.95，文本与一般二进制通常在 6 以下
+constexpr size_t kEntropySlices = 4;
+constexpr size_t kEntropySliceSize = 1024;
+constexpr double kIncompressibleEntropy = 7.5;
+
+// 最坏情况（完全不可压缩）下的输出上界
+size_t lz4_bound(size_t n) { return n + n / 255 + 16; }
+
+uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint32_t hash4(uint32_t v, int hash_log) {
+  return (v * 2654435761u) >> (32 - hash_log);
+}
+
+uint8_t *write_length(uint8_t *op, size_t len) {
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = static_cast<uint8_t>(len);
+  return op;
+}
+
+uint8_t *emit_literals(uint8_t *op, uint8_t *token, const uint8_t *lit,
+                       size_t lit_len) {
+  *token = static_cast<uint8_t>(std::min<size_t>(lit_len, 15) << 4);
+  if (lit_len >= 15) {
+    op = write_length(op, lit_len - 15);
+  }
+  std::memcpy(op, lit, lit_len);
+  return op + lit_len;
+}
+
+uint8_t *emit_sequence(uint8_t *op, const uint8_t *lit, size_t lit_len,
+                       size_t offset, size_t match_len) {
+  uint8_t *token = op++;
+  op = emit_literals(op, token, lit, lit_len);
+  *op++ = static_cast<uint8_t>(offset & 0xFF);
+  *op++ = static_cast<uint8_t>(offset >> 8);
+  size_t ml = match_len - kMinMatch;
+  *token |= static_cast<uint8_t>(std::min<size_t>(ml, 15));
+  if (ml >= 15) {
+    op = write_length(op, ml - 15);
+  }
+  return op;
+}
+
+size_t count_match(const uint8_t *p, const uint8_t *match,
+                   const uint8_t *limit) {
+  const uint8_t *start = p;
+  while (p < limit && *p == *match) {
+    ++p;
+    ++match;
+  }
+  return static_cast<size_t>(p - start);
+}
+
+// 贪心匹配：级别 1 每个位置只查一个候选（并在连续未命中时加速跳过），
+// 更高级别沿哈希链搜索 2^(level-1) 个候选，换取更高压缩率
+size_t lz4_compress(const char *src_chars, size_t n, char *dst_chars,
+                    int level) {
+  const uint8_t *src = reinterpret_cast<const uint8_t *>(src_chars);
+  uint8_t *op = reinterpret_cast<uint8_t *>(dst_chars);
+  size_t anchor = 0;
+
+  if (n > kMfLimit) {
+    // 哈希表随输入大小缩放，避免小文件为整张表付出清零开销
+    int hash_log = 8;
+    while (hash_log < kMaxHashLog && (size_t{1} << hash_log) < n) {
+      ++hash_log;
+    }
+    const bool use_chain = level > 1;
+    const int depth = use_chain ? 1 << std::min(level - 1, 11) : 1;
+    const size_t chain_mask = std::min<size_t>(size_t{1} << hash_log, 65536) - 1;
+
+    thread_local std::vector<int32_t> head;
+    thread_local std::vector<int32_t> chain;
+    head.assign(size_t{1} << hash_log, -1);
+    if (use_chain && chain.size() < chain_mask + 1) {
+      chain.resize(chain_mask + 1);
+    }
+
+    const size_t limit = n - kMfLimit;
+    const uint8_t *match_limit = src + n - kLastLiterals;
+    auto insert = [&](size_t pos, uint32_t h) {
+      if (use_chain) {
+        chain[pos & chain_mask] = head[h];
+      }
+      head[h] = static_cast<int32_t>(pos);
+    };
+
+    size_t ip = 0;
+    size_t misses = 0;
+    while (ip < limit) {
+      const uint32_t seq = read32(src + ip);
+      const uint32_t h = hash4(seq, hash_log);
+
+      size_t best_len = 0;
+      size_t best_pos = 0;
+      int32_t cand = head[h];
+      for (int attempts = depth;
+           cand >= 0 && ip - static_cast<size_t>(cand) <= kMaxDistance &&
+           attempts > 0;
+           --attempts) {
+        if (read32(src + cand) == seq) {
+          size_t len = kMinMatch + count_match(src + ip + kMinMatch,
+                                                src + cand + kMinMatch,
+                                                match_limit);
+          if (len > best_len) {
+            best_len = len;
+            best_pos = static_cast<size_t>(cand);
+            if (src + ip + len == match_limit) {
+              break; // 已匹配到可用末尾，不会更长
+            }
+          }
+        }
+        if (!use_chain) {
+          break;
+        }
+        int32_t next = chain[static_cast<size_t>(cand) & chain_mask];
+        if (next >= cand) {
+          break;
+        }
+        cand = next;
+      }
+      insert(ip, h);
+
+      if (best_len == 0) {
+        ip += use_chain ? 1 : 1 + (misses++ >> 6);
+        continue;
+      }
+      misses = 0;
+
+      // 向前扩展匹配
+      while (ip > anchor && best_pos > 0 && src[ip - 1] == src[best_pos - 1]) {
+        --ip;
+        --best_pos;
+        ++best_len;
+      }
+      op = emit_sequence(op, src + anchor, ip - anchor, ip - best_pos,
+                         best_len);
+
+      // 链式级别把匹配内部的位置也加入哈希链
+      const size_t match_end = ip + best_len;
+      for (size_t p = use_chain ? ip + 1 : match_end - 2;
+           p < match_end && p < limit; ++p) {
+        insert(p, hash4(read32(src + p), hash_log));
+      }
+      ip = match_end;
+      anchor = ip;
+    }
+  }
+
+  uint8_t *token = op++;
+  op = emit_literals(op, token, src + anchor, n - anchor);
+  return static_cast<size_t>(op - reinterpret_cast<uint8_t *>(dst_chars));
+}
+
+bool read_length(const uint8_t *&ip, const uint8_t *end, size_t &len) {
+  uint8_t b;
+  do {
+    if (ip >= end) {
+      return false;
+    }
+    b = *ip++;
+    len += b;
+  } while (b == 255);
+  return true;
+}
+
+bool lz4_decompress(const char *src_chars, size_t n, char *dst_chars,
+                    size_t raw_size) {
+  const uint8_t *ip = reinterpret_cast<const uint8_t *>(src_chars);
+  const uint8_t *const iend = ip + n;
+  uint8_t *const dst = reinterpret_cast<uint8_t *>(dst_chars);
+  uint8_t *op = dst;
+  uint8_t *const oend = dst + raw_size;
+
+  while (ip < iend) {
+    const uint8_t token = *ip++;
+    size_t lit = token >> 4;
+    if (lit == 15 && !read_length(ip, iend, lit)) {
+      return false;
+    }
+    if (lit > static_cast<size_t>(iend - ip) ||
+        lit > static_cast<size_t>(oend - op)) {
+      return false;
+    }
+    std::memcpy(op, ip, lit);
+    ip += lit;
+    op += lit;
+    if (ip == iend) {
+      break; // 最后一个序列只有字面量
+    }
+
+    if (iend - ip < 2) {
+      return false;
+    }
+    const size_t offset = ip[0] | (static_cast<size_t>(ip[1]) << 8);
+    ip += 2;
+    if (offset == 0 || offset > static_cast<size_t>(op - dst)) {
+      return false;
+    }
+    size_t ml = token & 15;
+    if (ml == 15 && !read_length(ip, iend, ml)) {
+      return false;
+    }
+    ml += kMinMatch;
+    if (ml > static_cast<size_t>(oend - op)) {
+      return false;
+    }
+
+    const uint8_t *match = op - offset;
+    if (offset >= ml) {
+      std::memcpy(op, match, ml);
+      op += ml;
+    } else {
+      // 重叠拷贝（如 offset 为 1 的游程）必须逐字节
+      for (size_t i = 0; i < ml; ++i) {
+        *op++ = *match++;
+      }
+    }
+  }
+  return op == oend;
+}
+
+// ============================================
+// 可压缩性预判
+// ============================================
+
+bool starts_with(const uint8_t *data, size_t n, const char *magic,
+                 size_t len, size_t offset = 0) {
+  return n >= offset + len && std::memcmp(data + offset, magic, len) == 0;
+}
+
+// 常见已压缩格式的魔数
+bool has_compressed_magic(const uint8_t *p, size_t n) {
+  return starts_with(p, n, "\xFF\xD8\xFF", 3) ||              // JPEG
+         starts_with(p, n, "\x89PNG\r\n\x1A\n", 8) ||          // PNG
+         starts_with(p, n, "GIF8", 4) ||                        // GIF
+         (starts_with(p, n, "RIFF", 4) &&
+          starts_with(p, n, "WEBP", 4, 8)) ||                   // WebP
+         starts_with(p, n, "ftyp", 4, 4) ||                     // MP4/MOV/HEIC
+         starts_with(p, n, "PK\x03\x04", 4) ||                  // zip/jar/docx
+         starts_with(p, n, "\x1F\x8B", 2) ||                    // gzip
+         starts_with(p, n, "BZh", 3) ||                         // bzip2
+         starts_with(p, n, "\xFD" "7zXZ\x00", 6) ||             // xz
+         starts_with(p, n, "\x28\xB5\x2F\xFD", 4) ||            // zstd
+         starts_with(p, n, "\x04\x22\x4D\x18", 4) ||            // lz4 frame
+         starts_with(p, n, "7z\xBC\xAF\x27\x1C", 6);            // 7z
+}
+
+// 抽样的零阶熵（比特/字节）
+double sampled_entropy(const uint8_t *data, size_t n) {
+  uint32_t histogram[256] = {};
+  size_t total = 0;
+  if (n <= kEntropySlices * kEntropySliceSize) {
+    for (size_t i = 0; i < n; ++i) {
+      histogram[data[i]]++;
+    }
+    total = n;
+  } else {
+    const size_t stride = (n - kEntropySliceSize) / (kEntropySlices - 1);
+    for (size_t s = 0; s < kEntropySlices; ++s) {
+      const uint8_t *slice = data + s * stride;
+      for (size_t i = 0; i < kEntropySliceSize; ++i) {
+        histogram[slice[i]]++;
+      }
+    }
+    total = kEntropySlices * kEntropySliceSize;
+  }
+
+  double entropy = 0;
+  for (uint32_t count : histogram) {
+    if (count != 0) {
+      double p = static_cast<double>(count) / static_cast<double>(total);
+      entropy -= p * std::log2(p);
+    }
+  }
+  return entropy;
+}
+
+// 样本太小时熵估计不可靠，直接尝试压缩
+bool high_entropy(const uint8_t *data, size_t n) {
+  return n >= kEntropySliceSize &&
+         sampled_entropy(data, n) > kIncompressibleEntropy;
+}
+
+} // namespace
+
+// ============================================
+// 公开接口
+// ============================================
+
+bool looks_incompressible(const char *data, size_t n) {
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+  n = std::min(n, kCompressProbeSize);
+  return has_compressed_magic(p, n) || high_entropy(p, n);
+}
+
+const char *codec_name(Codec codec) {
+  switch (codec) {
+  case Codec::None:
+    return "none";
+  case Codec::Lz4:
+    return "lz4";
+  case Codec::Zstd:
+    return "zstd";
+  }
+  return "unknown";
+}
+
+bool codec_available(Codec codec) {
+  switch (codec) {
+  case Codec::None:
+  case Codec::Lz4:
+    return true;
+  case Codec::Zstd:
+#ifdef KAR_WITH_ZSTD
+    return true;
+#else
+    return false;
+#endif
+  }
+  return false;
+}
+
+Codec parse_codec(const std::string &name) {
+  Codec codec;
+  if (name == "none") {
+    codec = Codec::None;
+  } else if (name == "lz4") {
+    codec = Codec::Lz4;
+  } else if (name == "zstd") {
+    codec = Codec::Zstd;
+  } else {
+    throw std::invalid_argument("Unknown codec: " + name +
+                                " (expected none, lz4 or zstd)");
+  }
+  if (!codec_available(codec)) {
+    throw std::invalid_argument(
+        "Codec not available in this build: " + name +
+        " (rebuild with make KAR_WITH_ZSTD=1)");
+  }
+  return codec;
+}
+
+int resolve_codec_level(Codec codec, int level) {
+  int default_level = 0;
+  int max_level = 0;
+  switch (codec) {
+  case Codec::None:
+    return 0;
+  case Codec::Lz4:
+    default_level = kLz4DefaultLevel;
+    max_level = kLz4MaxLevel;
+    break;
+  case Codec::Zstd:
+    default_level = kZstdDefaultLevel;
+    max_level = kZstdMaxLevel;
+    break;
+  }
+  if (level == 0) {
+    return default_level;
+  }
+  if (level < 1 || level > max_level) {
+    throw std::invalid_argument(std::string("Invalid level for ") +
+                                codec_name(codec) + ": " +
+                                std::to_string(level) + " (expected 1-" +
+                                std::to_string(max_level) + ")");
+  }
+  return level;
+}
+
+uint32_t encode_block(Codec codec, int level, const char *data, size_t n,
+                      ByteBuffer &out) {
+  BlockHeader header{.raw_size = static_cast<uint32_t>(n),
+                     .stored_size = static_cast<uint32_t>(n),
+                     .checksum = CRC32().calculate(
+                         reinterpret_cast<const uint8_t *>(data), n)};
+
+  // 抽样判定不可压缩的块不尝试压缩，直接原样存储
+  if (high_entropy(reinterpret_cast<const uint8_t *>(data), n)) {
+    codec = Codec::None;
+  }
+
+  const size_t header_pos = out.size();
+  size_t bound = n;
+  if (codec == Codec::Lz4) {
+    bound = lz4_bound(n);
+  }
+#ifdef KAR_WITH_ZSTD
+  if (codec == Codec::Zstd) {
+    bound = ZSTD_compressBound(n);
+  }
+#endif
+  out.resize(header_pos + sizeof(header) + std::max(bound, n));
+  char *dst = out.data() + header_pos + sizeof(header);
+
+  size_t compressed = n;
+  if (codec == Codec::Lz4) {
+    compressed = lz4_compress(data, n, dst, level);
+  }
+#ifdef KAR_WITH_ZSTD
+  if (codec == Codec::Zstd) {
+    size_t ret = ZSTD_compress(dst, bound, data, n, level);
+    compressed = ZSTD_isError(ret) ? n : ret;
+  }
+#endif
+
+  // 压缩无收益时原样存储，解码时直接使用
+  if (compressed >= n) {
+    std::memcpy(dst, data, n);
+  } else {
+    header.stored_size = static_cast<uint32_t>(compressed);
+  }
+  store_wire(out.data() + header_pos, header);
+  out.resize(header_pos + sizeof(header) + header.stored_size);
+  return header.checksum;
+}
+
+uint32_t encode_blocks(Codec codec, int level, const char *data, size_t n,
+                       ByteBuffer &out) {
+  StageTimer timer(Stage::Compress, n);
+  uint32_t checksum = 0;
+  for (size_t offset = 0; offset < n; offset += kCodecBlockSize) {
+    size_t len = std::min(n - offset, kCodecBlockSize);
+    uint32_t block_crc = encode_block(codec, level, data + offset, len, out);
+    checksum = crc32_combine(checksum, block_crc, len);
+  }
+  return checksum;
+}
+
+uint32_t zeros_checksum(uint64_t length) {
+  static constexpr size_t kZeroBlock = 64 * 1024;
+  static const uint32_t block_crc = [] {
+    const std::vector<uint8_t> zeros(kZeroBlock, 0);
+    return CRC32().calculate(zeros.data(), zeros.size());
+  }();
+
+  // 全零内容与拼接顺序无关：整块部分按二进制位倍增合并，余数直接计算
+  uint32_t checksum = 0;
+  uint32_t power = block_crc;
+  uint64_t power_len = kZeroBlock;
+  for (uint64_t blocks = length / kZeroBlock; blocks != 0; blocks >>= 1) {
+    if (blocks & 1) {
+      checksum = crc32_combine(checksum, power, power_len);
+    }
+    power = crc32_combine(power, power, power_len);
+    power_len *= 2;
+  }
+  const size_t rest = static_cast<size_t>(length % kZeroBlock);
+  if (rest != 0) {
+    const std::vector<uint8_t> zeros(rest, 0);
+    checksum = crc32_combine(
+        checksum, CRC32().calculate(zeros.data(), zeros.size()), rest);
+  }
+  return checksum;
+}
+
+uint32_t encode_hole(uint64_t length, ByteBuffer &out) {
+  const size_t pos = out.size();
+  out.resize(pos + sizeof(BlockHeader) + sizeof(HoleRun));
+  store_wire(out.data() + pos, BlockHeader{});
+  store_wire(out.data() + pos + sizeof(BlockHeader), HoleRun{length});
+  return zeros_checksum(length);
+}
+
+void decode_block(Codec codec, const BlockHeader &header, const char *data,
+                  char *dst) {
+  StageTimer timer(Stage::Decompress, header.raw_size);
+  if (header.stored_size == header.raw_size) {
+    std::memcpy(dst, data, header.raw_size);
+    return;
+  }
+
+  bool ok = false;
+  if (codec == Codec::Lz4) {
+    ok = lz4_decompress(data, header.stored_size, dst, header.raw_size);
+  } else if (codec == Codec::Zstd) {
+#ifdef KAR_WITH_ZSTD
+    size_t ret = ZSTD_decompress(dst, header.raw_size, data, header.stored_size);
+    ok = !ZSTD_isError(ret) && ret == header.raw_size;
+#else
+    throw std::runtime_error("Archive uses zstd, but this build has no zstd "
+                             "support (rebuild with make KAR_WITH_ZSTD=1)");
+#endif
+  }
+  if (!ok) {
+    throw std::runtime_error("Corrupted compressed block");
+  }
+}
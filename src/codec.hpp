@@ -0,0 +1,63 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "format.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ============================================
+// 压缩编码层：按块独立压缩/解压（版本 3 payload，见 format.hpp）
+// ============================================
+
+enum class Codec : uint8_t {
+  None = 0, // 原样存储
+  Lz4 = 1,  // LZ4 块格式（内置实现，级别 1 为快速模式，2-12 为链式搜索）
+  Zstd = 2, // Zstandard（需以 make KAR_WITH_ZSTD=1 编译并链接 libzstd）
+};
+
+// 块大小：每块独立编码，可分派到不同工作线程
+constexpr size_t kCodecBlockSize = 1024 * 1024;
+
+const char *codec_name(Codec codec);
+
+// 当前构建是否支持该编码
+bool codec_available(Codec codec);
+
+// 解析 --codec 参数："none" / "lz4" / "zstd"；未知或未编译支持时抛出异常
+Codec parse_codec(const std::string &name);
+
+// level 为 0 时返回该编码的默认级别；超出范围时抛出 std::invalid_argument
+int resolve_codec_level(Codec codec, int level);
+
+// 可压缩性预判使用的文件开头样本大小
+constexpr size_t kCompressProbeSize = 4096;
+
+// 快速预判文件开头（至多 kCompressProbeSize 字节）是否值得压缩：
+// 先识别常见已压缩格式的魔数（JPEG/PNG/GIF/WebP/MP4/zip/gzip/bzip2/xz/zstd/7z），
+// 再按字节直方图估计熵；返回 true 表示应原样存储
+bool looks_incompressible(const char *data, size_t n);
+
+// 编码单个块（n <= kCodecBlockSize）：BlockHeader + 块数据追加到 out。
+// 抽样熵过高时不尝试压缩，压缩后不小于原始大小时同样原样存储；
+// 返回该块原始数据的 CRC32
+uint32_t encode_block(Codec codec, int level, const char *data, size_t n,
+                      ByteBuffer &out);
+
+// 按 kCodecBlockSize 切块依次编码，返回整段原始数据的 CRC32
+uint32_t encode_blocks(Codec codec, int level, const char *data, size_t n,
+                       ByteBuffer &out);
+
+// 稀疏条目的空洞记录（raw_size 为 0 的块头 + HoleRun）追加到 out，
+// 返回 length 字节零的 CRC32
+uint32_t encode_hole(uint64_t length, ByteBuffer &out);
+
+// length 字节零的 CRC32（按 2 的幂合并，耗时与 length 的位数成正比）
+uint32_t zeros_checksum(uint64_t length);
+
+// 解码压缩块到 dst（header.raw_size 字节）；数据损坏时抛出 std::runtime_error
+// 不校验 CRC32，由调用方核对 header.checksum
+void decode_block(Codec codec, const BlockHeader &header, const char *data,
+                  char *dst);
@@ -0,0 +1,178 @@
+#include "dedup.hpp"
+#include "io_backend.hpp"
+#include "stage_stats.hpp"
+
+#include "../include/crc32.hpp"
+#include <algorithm>
+#include <array>
+#include <mutex>
+
+namespace {
+
+// Gear 表：256 个固定的伪随机 64 位数（splitmix64），决定切点位置，
+// 修改会让新旧归档的块边界不再对齐
+constexpr std::array<uint64_t, 256> make_gear_table() {
+  std::array<uint64_t, 256> table{};
+  uint64_t state = 0x6b61722d67656172ULL; // "kar-gear"
+  for (auto &value : table) {
+    state += 0x9e3779b97f4a7c15ULL;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    value = z ^ (z >> 31);
+  }
+  return table;
+}
+
+constexpr std::array<uint64_t, 256> kGear = make_gear_table();
+
+// 归一化分块（FastCDC）：平均长度之前用更严格的掩码（18 位），之后用更宽松的
+// 掩码（14 位），让块长集中在平均值附近。取高位：Gear 哈希左移，高位覆盖最近 64 字节
+constexpr uint64_t kMaskStrict = ((uint64_t{1} << 18) - 1) << (64 - 18);
+constexpr uint64_t kMaskLoose = ((uint64_t{1} << 14) - 1) << (64 - 14);
+
+// 与 path 处源文件的内容逐字节比较
+bool same_content(const fs::path &path, const char *data, size_t n) {
+  try {
+    InputFile input(path);
+    if (input.size() != n) {
+      return false;
+    }
+    char buffer[64 * 1024];
+    for (size_t offset = 0; offset < n;) {
+      size_t len = std::min(n - offset, sizeof(buffer));
+      if (input.read_at(buffer, len, offset) != len ||
+          std::memcmp(buffer, data + offset, len) != 0) {
+        return false;
+      }
+      offset += len;
+    }
+    return true;
+  } catch (const std::exception &) {
+    return false; // 第一份已被删除或不可读：按不重复处理
+  }
+}
+
+} // namespace
+
+size_t cdc_chunk_length(const char *data, size_t n) {
+  if (n <= kCdcMinSize) {
+    return n;
+  }
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+  const size_t limit = std::min(n, kCdcMaxSize);
+  const size_t normal = std::min(limit, kCdcAvgSize);
+
+  // 最小长度之内不可能切分，直接跳过
+  uint64_t fingerprint = 0;
+  size_t i = kCdcMinSize;
+  for (; i < normal; ++i) {
+    fingerprint = (fingerprint << 1) + kGear[bytes[i]];
+    if ((fingerprint & kMaskStrict) == 0) {
+      return i + 1;
+    }
+  }
+  for (; i < limit; ++i) {
+    fingerprint = (fingerprint << 1) + kGear[bytes[i]];
+    if ((fingerprint & kMaskLoose) == 0) {
+      return i + 1;
+    }
+  }
+  return limit;
+}
+
+bool DedupStore::find(const SHA256Digest &digest,
+                      ChunkLocation &location) const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it = chunks_.find(digest);
+  if (it == chunks_.end()) {
+    return false;
+  }
+  location = it->second;
+  return true;
+}
+
+void DedupStore::add(const SHA256Digest &digest,
+                     const ChunkLocation &location) {
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  chunks_.emplace(digest, location);
+}
+
+bool DedupStore::match_file(const char *data, size_t n, uint32_t checksum,
+                            std::vector<DedupChunk> &chunks) const {
+  std::vector<std::shared_ptr<const FileCopy>> candidates;
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto [begin, end] = files_.equal_range(n);
+    for (auto it = begin; it != end; ++it) {
+      if (it->second->checksum == checksum) {
+        candidates.push_back(it->second);
+      }
+    }
+  }
+  // 逐字节比较在锁外进行
+  for (const auto &copy : candidates) {
+    if (same_content(copy->source, data, n)) {
+      chunks = copy->chunks;
+      return true;
+    }
+  }
+  return false;
+}
+
+void DedupStore::add_file(const fs::path &source, uint64_t size,
+                          uint32_t checksum,
+                          const std::vector<DedupChunk> &chunks) {
+  auto copy = std::make_shared<FileCopy>();
+  copy->source = source;
+  copy->checksum = checksum;
+  copy->chunks.reserve(chunks.size());
+  for (const DedupChunk &chunk : chunks) {
+    DedupChunk ref = chunk;
+    ref.encoded_offset = 0;
+    ref.encoded_size = 0;
+    copy->chunks.push_back(ref);
+  }
+
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  auto [begin, end] = files_.equal_range(size);
+  for (auto it = begin; it != end; ++it) {
+    if (it->second->checksum == checksum) {
+      return; // 同大小同 CRC32 已有一份，重复文件无需再登记
+    }
+  }
+  files_.emplace(size, std::move(copy));
+}
+
+size_t DedupStore::chunk_count() const {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  return chunks_.size();
+}
+
+uint32_t dedup_encode(Codec codec, int level, const char *data, size_t n,
+                      const DedupStore &store, std::vector<DedupChunk> &chunks,
+                      ByteBuffer &content) {
+  StageTimer timer(Stage::Compress, n);
+  const SHA256 sha256;
+  uint32_t checksum = 0;
+  for (size_t offset = 0; offset < n;) {
+    const size_t len = cdc_chunk_length(data + offset, n - offset);
+    DedupChunk chunk;
+    chunk.digest = sha256.calculate(data + offset, len);
+    chunk.raw_size = static_cast<uint32_t>(len);
+
+    // 已写出的块不再压缩，写入线程改写为引用
+    ChunkLocation location;
+    if (store.find(chunk.digest, location)) {
+      chunk.checksum = location.checksum;
+    } else {
+      chunk.encoded_offset = content.size();
+      chunk.checksum = encode_block(codec, level, data + offset, len, content);
+      chunk.encoded_size = content.size() - chunk.encoded_offset;
+    }
+    checksum = crc32_combine(checksum, chunk.checksum, len);
+    chunks.push_back(chunk);
+    offset += len;
+  }
+  return checksum;
+}
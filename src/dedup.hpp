@@ -0,0 +1,89 @@
+#pragma once
+
+#include "codec.hpp"
+#include "format.hpp"
+
+#include "../include/sha256.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// ============================================
+// 去重：内容定义分块（FastCDC）+ 按 SHA-256 寻址的块存储
+// （去重条目的 payload 格式见 format.hpp 中的 KAR_ENTRY_DEDUP）
+// ============================================
+
+// 分块长度范围：切点由内容决定，插入/删除只影响附近的块
+constexpr size_t kCdcMinSize = 16 * 1024;
+constexpr size_t kCdcAvgSize = 64 * 1024;
+constexpr size_t kCdcMaxSize = 256 * 1024;
+static_assert(kCdcMaxSize <= kCodecBlockSize, "CDC chunk must fit in a block");
+
+// 返回从 data 开始的下一个块的长度（不超过 n）
+size_t cdc_chunk_length(const char *data, size_t n);
+
+struct DigestHash {
+  size_t operator()(const SHA256Digest &digest) const {
+    size_t h;
+    std::memcpy(&h, digest.data(), sizeof(h));
+    return h;
+  }
+};
+
+// 工作线程对一个块的编码结果；raw_size 为 0 的是稀疏条目的空洞记录
+// （encoded_* 指向块头 + HoleRun），不参与寻址
+struct DedupChunk {
+  SHA256Digest digest{};
+  uint32_t raw_size = 0;
+  uint32_t checksum = 0;      // 块原始数据的 CRC32
+  size_t encoded_offset = 0;  // BlockHeader + 块数据在 content 中的偏移
+  size_t encoded_size = 0;    // 0 表示编码时已在存储中（只写引用）
+};
+
+// 已写出块的位置
+struct ChunkLocation {
+  uint64_t block_offset = 0; // BlockHeader 在归档中的偏移
+  uint32_t raw_size = 0;
+  uint32_t checksum = 0;
+};
+
+// 已写出的块与整文件，供工作线程查询、写入线程登记（线程安全）
+class DedupStore {
+public:
+  bool find(const SHA256Digest &digest, ChunkLocation &location) const;
+  void add(const SHA256Digest &digest, const ChunkLocation &location);
+
+  // 整文件重复：按大小、CRC32 依次筛选候选，再与其源文件逐字节比较；
+  // 命中时把第一份的块列表（全部为引用）写入 chunks
+  bool match_file(const char *data, size_t n, uint32_t checksum,
+                  std::vector<DedupChunk> &chunks) const;
+  void add_file(const fs::path &source, uint64_t size, uint32_t checksum,
+                const std::vector<DedupChunk> &chunks);
+
+  size_t chunk_count() const;
+
+private:
+  struct FileCopy {
+    fs::path source;
+    uint32_t checksum;
+    std::vector<DedupChunk> chunks;
+  };
+
+  mutable std::shared_mutex mutex_;
+  std::unordered_map<SHA256Digest, ChunkLocation, DigestHash> chunks_;
+  std::unordered_multimap<uint64_t, std::shared_ptr<const FileCopy>> files_;
+};
+
+// 按内容定义分块切分 data 并逐块计算 SHA-256：store 中已有的块只记录引用，
+// 其余块按 codec 编码（BlockHeader + 块数据）追加到 content。
+// 返回整段原始数据的 CRC32
+uint32_t dedup_encode(Codec codec, int level, const char *data, size_t n,
+                      const DedupStore &store, std::vector<DedupChunk> &chunks,
+                      ByteBuffer &content);
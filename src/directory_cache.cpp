@@ -0,0 +1,99 @@
+#include "directory_cache.hpp"
+#include "stage_stats.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// 目录 fd 的缓存上限：至多占用一半的 fd 配额，其余留给输出文件与归档
+size_t directory_fd_budget() {
+  struct rlimit limit;
+  if (::getrlimit(RLIMIT_NOFILE, &limit) != 0 ||
+      limit.rlim_cur == RLIM_INFINITY) {
+    return 4096;
+  }
+  return std::clamp<size_t>(static_cast<size_t>(limit.rlim_cur / 2), 16,
+                            65536);
+}
+
+} // namespace
+
+DirectoryCache::DirectoryCache(const fs::path &root)
+    : root_(root), max_fds_(directory_fd_budget()) {}
+
+DirectoryCache::~DirectoryCache() {
+  for (const auto &entry : dirs_) {
+    if (entry.second >= 0) {
+      ::close(entry.second);
+    }
+  }
+}
+
+DirectoryCache::Location DirectoryCache::locate(const std::string &rel_path) {
+  const size_t slash = rel_path.rfind('/');
+  const std::string rel_dir =
+      slash == std::string::npos ? std::string() : rel_path.substr(0, slash);
+  std::lock_guard<std::mutex> lock(mutex_);
+  const int dir_fd = open_dir(rel_dir);
+  if (dir_fd < 0) {
+    return Location{AT_FDCWD, full_path(rel_path).string()};
+  }
+  return Location{dir_fd, rel_path.substr(slash + 1)};
+}
+
+int DirectoryCache::open_dir(const std::string &rel_dir) {
+  auto it = dirs_.find(rel_dir);
+  if (it != dirs_.end()) {
+    return it->second;
+  }
+
+  // 先确保父目录存在，再相对父目录 fd 创建本级目录（已存在时直接打开）
+  int parent_fd = AT_FDCWD;
+  std::string name = (root_ / rel_dir).string();
+  if (rel_dir.empty()) {
+    StageTimer timer(Stage::Mkdir);
+    fs::create_directories(root_);
+  } else {
+    const size_t slash = rel_dir.rfind('/');
+    const int fd = open_dir(slash == std::string::npos
+                                ? std::string()
+                                : rel_dir.substr(0, slash));
+    if (fd >= 0) {
+      parent_fd = fd;
+      name = rel_dir.substr(slash + 1);
+    }
+    StageTimer timer(Stage::Mkdir);
+    if (::mkdirat(parent_fd, name.c_str(), 0777) != 0 && errno != EEXIST) {
+      throw std::runtime_error("Cannot create directory: " +
+                               (root_ / rel_dir).string() + " (" +
+                               std::strerror(errno) + ")");
+    }
+  }
+
+  int dir_fd = -1;
+  if (open_fds_ < max_fds_) {
+    dir_fd = ::openat(parent_fd, name.c_str(),
+                      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+  if (dir_fd >= 0) {
+    ++open_fds_;
+  } else {
+    // 未缓存 fd（配额用尽或打开失败）：仍须确认已存在的同名项是目录
+    struct stat st;
+    if (::fstatat(parent_fd, name.c_str(), &st, 0) != 0 ||
+        !S_ISDIR(st.st_mode)) {
+      throw std::runtime_error("Cannot create directory: " +
+                               (root_ / rel_dir).string());
+    }
+  }
+  dirs_.emplace(rel_dir, dir_fd);
+  return dir_fd;
+}
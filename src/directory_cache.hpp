@@ -0,0 +1,49 @@
+#pragma once
+
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+// ============================================
+// 目标目录缓存：多个解包线程共享，同一目录只创建、打开一次
+//
+// 每个已创建的目录保留一个目录 fd，其中的文件经 openat 以文件名创建，
+// 不必每次由内核逐级解析完整路径；子目录同样相对父目录 fd 以 mkdirat 创建。
+// 缓存的 fd 数量受 RLIMIT_NOFILE 约束，超出后的目录只记录“已创建”，
+// 其中的文件退回按完整路径打开。
+// ============================================
+class DirectoryCache {
+public:
+  // 文件的打开位置：相对 dir_fd 的 name（目录未缓存 fd 时为 AT_FDCWD + 完整路径）
+  struct Location {
+    int dir_fd;
+    std::string name;
+  };
+
+  explicit DirectoryCache(const fs::path &root);
+  ~DirectoryCache();
+
+  DirectoryCache(const DirectoryCache &) = delete;
+  DirectoryCache &operator=(const DirectoryCache &) = delete;
+
+  // 确保 rel_path（相对目标根目录的文件路径）的父目录存在，返回文件的打开位置。
+  // 解包前对全部条目调用一次即建立目录骨架，之后的调用只查缓存
+  Location locate(const std::string &rel_path);
+
+  // 目标根目录下的完整路径
+  fs::path full_path(const std::string &rel_path) const { return root_ / rel_path; }
+
+private:
+  fs::path root_;
+  size_t max_fds_;
+  size_t open_fds_ = 0;
+  std::mutex mutex_;
+  // 相对目录 -> 目录 fd（-1 表示已创建但未缓存 fd）
+  std::unordered_map<std::string, int> dirs_;
+
+  // 确保相对目录 rel_dir 存在并返回其缓存项（调用方持有 mutex_）
+  int open_dir(const std::string &rel_dir);
+};
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <type_traits>
 
 // ============================================
 // 文件格式协议定义（关键！）
@@ -12,7 +15,7 @@ struct FileHeader {
   uint16_t version;     // 版本号，目前为 1
   uint32_t entry_count; // 文件条目数量
   uint64_t created_at;  // 创建时间戳
-  uint32_t reserved;    // 预留字段
+  uint32_t flags;       // 归档标志（KAR_ARCHIVE_*，早期版本恒为 0）
 };
 
 struct EntryHeader {
@@ -23,6 +26,395 @@ struct EntryHeader {
   uint16_t permissions;   // 文件权限（Unix style）
 };
 
+// ============================================
+// 版本 2：条目之后追加中央目录（Central Directory）与定长尾部
+//
+// [FileHeader] + [EntryHeader + path + content] * N
+//              + [IndexEntry + path] * N + [IndexTrailer]
+//
+// 条目区与版本 1 完全相同，顺序读取方式依然可用；
+// list / 单文件查找只需读取尾部与中央目录。
+// ============================================
+
+struct IndexEntry {
+  uint64_t entry_offset;  // EntryHeader 在归档中的偏移
+  uint64_t content_size;  // 文件内容大小
+  uint64_t modified_time; // 修改时间
+  uint32_t checksum;      // CRC32 校验和
+  uint16_t permissions;   // 文件权限（Unix style）
+  uint32_t path_length;   // 紧随其后的路径长度
+};
+
+struct IndexTrailer {
+  uint64_t index_offset;   // 中央目录起始偏移
+  uint64_t index_size;     // 中央目录字节数（不含尾部）
+  uint32_t entry_count;    // 目录项数量（与 FileHeader 一致）
+  uint32_t index_checksum; // 中央目录的 CRC32
+  uint32_t magic;          // KAR_INDEX_MAGIC
+};
+
+// ============================================
+// 版本 3：条目头增加编码方式与存储大小（分块压缩，见 codec.hpp）
+//
+// [EntryHeaderV3 + path + payload]
+//   codec 为 none：payload 即原始内容（stored_size == content_size）
+//   其他编码：payload = [BlockHeader + 块数据] * K，每块对应原始内容中
+//             连续的至多 kCodecBlockSize 字节，可独立解码
+//   去重条目（KAR_ENTRY_DEDUP，任意编码）：payload 为块序列（见 dedup.hpp），
+//             块头 stored_size 为 0 时是引用：其后跟 ChunkRef，指向归档中
+//             此前写出的同内容块的 BlockHeader
+//
+// 稀疏条目（KAR_ENTRY_SPARSE，任意编码）：payload 同样为块序列，其中可夹有
+//             空洞记录：raw_size 为 0 的块头（其余字段为 0）之后跟 HoleRun，
+//             表示原始内容中 length 字节的零；解包时不写出，保留为文件空洞。
+//             content_size 与 CRC32 均按含空洞的完整内容计算
+//
+// 对齐条目（KAR_ENTRY_ALIGNED）：路径之后补零到下一个 KAR_ENTRY_ALIGNMENT
+//             的整数倍再开始 payload，补齐的字节不计入 stored_size
+//
+// 固实条目（KAR_ENTRY_SOLID）：若干相邻小文件的内容拼接后编码为一个块
+//             （原始大小不超过 kCodecBlockSize），各成员的 payload 均以 SolidRef
+//             开头，指向该块的 BlockHeader 与本成员在原始块中的偏移；组内第一个
+//             成员的 SolidRef 之后紧跟块本身（BlockHeader + 块数据），其余成员
+//             的 payload 只有 SolidRef。成员的 CRC32 按各自内容计算
+//
+// 中央目录项相应扩展为 IndexEntryV3，尾部不变。目录项之后依次为可选段
+// （同样计入目录大小与 CRC32）：去重归档的块索引
+// [ChunkIndexHeader + ChunkIndexEntry * M]；打包时重排了条目顺序的归档的
+// 原始顺序表 [OrderIndexHeader + OrderIndexEntry * N]，第 i 项为第 i 个
+// 目录项在扫描顺序中的序号。
+//
+// 流式归档（KAR_ARCHIVE_STREAMED，写入管道等不可回写的输出）：
+//   FileHeader.entry_count 为 0，条目数量以尾部为准；条目区之后先写一个
+//   全零的 EntryHeaderV3（path_length 为 0）作为结束标记，再写中央目录与尾部。
+//   分块条目的条目头写出时 CRC32 与存储大小尚未知（KAR_ENTRY_DEFERRED），
+//   实际值只记录在中央目录中。顺序读取者读到结束标记即知条目区结束。
+// ============================================
+
+struct EntryHeaderV3 {
+  uint32_t path_length;   // 文件路径长度
+  uint64_t content_size;  // 原始内容大小
+  uint64_t modified_time; // 修改时间
+  uint32_t checksum;      // 原始内容的 CRC32
+  uint16_t permissions;   // 文件权限（Unix style）
+  uint8_t codec;          // 编码方式（Codec）
+  uint8_t flags;          // 条目标志（KAR_ENTRY_*）
+  uint64_t stored_size;   // payload 在归档中的字节数
+};
+
+struct BlockHeader {
+  uint32_t raw_size;    // 块的原始字节数
+  uint32_t stored_size; // 块数据字节数；等于 raw_size 表示原样存储
+  uint32_t checksum;    // 块原始数据的 CRC32
+};
+
+struct ChunkRef {
+  uint64_t block_offset; // 被引用块的 BlockHeader 在归档中的偏移
+};
+
+struct HoleRun {
+  uint64_t length; // 空洞的字节数
+};
+
+struct SolidRef {
+  uint64_t block_offset; // 固实块的 BlockHeader 在归档中的偏移
+  uint32_t raw_offset;   // 本成员在原始块中的偏移
+};
+
+struct IndexEntryV3 {
+  uint64_t entry_offset;  // EntryHeaderV3 在归档中的偏移
+  uint64_t content_size;  // 原始内容大小
+  uint64_t modified_time; // 修改时间
+  uint32_t checksum;      // 原始内容的 CRC32
+  uint16_t permissions;   // 文件权限（Unix style）
+  uint8_t codec;          // 编码方式（Codec）
+  uint8_t flags;          // 条目标志（KAR_ENTRY_*）
+  uint64_t stored_size;   // payload 在归档中的字节数
+  uint32_t path_length;   // 紧随其后的路径长度
+};
+
+struct ChunkIndexHeader {
+  uint32_t magic;       // KAR_CHUNK_MAGIC
+  uint32_t chunk_count; // 其后的块索引项数量
+};
+
+struct ChunkIndexEntry {
+  uint8_t digest[32];    // 块原始数据的 SHA-256
+  uint64_t block_offset; // BlockHeader 在归档中的偏移
+  uint32_t raw_size;     // 块的原始字节数
+  uint32_t checksum;     // 块原始数据的 CRC32
+};
+
+struct OrderIndexHeader {
+  uint32_t magic;       // KAR_ORDER_MAGIC
+  uint32_t entry_count; // 其后的顺序表项数量（等于目录项数量）
+};
+
+struct OrderIndexEntry {
+  uint32_t position; // 对应目录项在扫描顺序中的序号
+};
+
+// ============================================
+// 分卷归档（pack --volume-size）
+//
+// 完整归档的字节流按 volume_size 切分为 <archive>.001、<archive>.002……，
+// 除最后一卷外每卷恰好 volume_size 字节，按序拼接即为普通归档；
+// 条目、块引用与中央目录中的偏移一律是拼接后的逻辑偏移，
+// 偏移 / volume_size 即其所在的卷（从 0 计）。
+//
+// <archive> 本身为共享卷表：
+// [VolumeHeader] + [VolumeEntry * volume_count] + [FileHeader]
+//   + [逻辑偏移 tail_offset 起至归档末尾的副本（中央目录与尾部）]
+// 读取者从卷表取得全局头与中央目录，只打开所选条目实际用到的卷。
+// ============================================
+
+struct VolumeHeader {
+  uint32_t magic;        // KAR_VOLUME_MAGIC
+  uint32_t volume_count; // 卷数
+  uint64_t volume_size;  // 每卷字节数（最后一卷可以更短）
+  uint64_t archive_size; // 拼接后的归档总字节数
+  uint64_t tail_offset;  // 卷表中目录副本对应的逻辑起始偏移
+  uint32_t checksum;     // 卷表中 VolumeHeader 之后全部内容的 CRC32
+};
+
+struct VolumeEntry {
+  uint64_t size; // 该卷的字节数
+};
+
+// ============================================
+// 扫描缓存（pack --scan-cache，与归档分开存放）
+//
+// [ScanCacheHeader] + [ScanCacheDir * dir_count] + [ScanCacheFile * file_count]
+//   + [ScanCacheChild * child_count] + [名字区 names_size 字节]
+// 目录按深度优先顺序编号（父目录在前，根目录为 0 号），每个目录的子项在
+// ScanCacheChild 表中连续存放、保持 getdents64 顺序；名字区开头为源目录的
+// 绝对路径（root_length 字节），其后为各目录与文件在父目录中的名字。
+// 整个文件可直接 mmap，按下标定长访问。
+// ============================================
+
+struct ScanCacheHeader {
+  uint32_t magic;       // KAR_SCAN_MAGIC
+  uint32_t dir_count;   // 目录数
+  uint32_t file_count;  // 文件数
+  uint32_t child_count; // 子项总数（= 目录数 - 1 + 文件数）
+  uint32_t names_size;  // 名字区字节数
+  uint32_t root_length; // 名字区开头源目录路径的字节数
+  uint64_t scanned_ns;  // 这次扫描开始的时刻（Unix 纳秒）
+  uint32_t checksum;    // 头部之后全部内容的 CRC32
+};
+
+struct ScanCacheDir {
+  uint64_t inode;
+  uint64_t mtime_ns;     // 目录 mtime（增删、改名子项时变化）
+  uint64_t ctime_ns;     // 目录 ctime（mtime 被改回时仍会变化）
+  uint32_t parent;       // 父目录序号，根目录为 UINT32_MAX
+  uint32_t name_offset;  // 名字在名字区中的偏移（根目录名字为空）
+  uint32_t name_length;
+  uint32_t first_child;  // 子项在 ScanCacheChild 表中的起点
+  uint32_t child_count;
+};
+
+struct ScanCacheFile {
+  uint64_t inode;
+  uint64_t size;
+  uint64_t mtime_ns;
+  uint32_t mode;        // st_mode
+  uint32_t checksum;    // 打包时的内容 CRC32
+  uint32_t name_offset;
+  uint32_t name_length;
+};
+
+struct ScanCacheChild {
+  uint32_t ref; // 最高位为 1 时低 31 位是子目录序号，否则为文件序号
+};
+
 #pragma pack(pop)
 
-constexpr uint32_t KAR_MAGIC = 0x5241414B; // 'KAAR' in little-endian
+constexpr uint32_t KAR_MAGIC = 0x5241414B;       // 'KAAR' in little-endian
+constexpr uint32_t KAR_INDEX_MAGIC = 0x5844494B; // 'KIDX' in little-endian
+constexpr uint32_t KAR_CHUNK_MAGIC = 0x4B48434B; // 'KCHK' in little-endian
+constexpr uint32_t KAR_ORDER_MAGIC = 0x44524F4B; // 'KORD' in little-endian
+constexpr uint32_t KAR_VOLUME_MAGIC = 0x4C4F564B; // 'KVOL' in little-endian
+constexpr uint32_t KAR_SCAN_MAGIC = 0x4E43534B;   // 'KSCN' in little-endian
+
+constexpr uint16_t KAR_VERSION_SEQUENTIAL = 1; // 仅顺序条目
+constexpr uint16_t KAR_VERSION_INDEXED = 2;    // 顺序条目 + 中央目录
+constexpr uint16_t KAR_VERSION_CODEC = 3;      // 条目头含编码方式（可压缩）
+constexpr uint16_t KAR_VERSION_CURRENT = KAR_VERSION_CODEC;
+
+// 条目标志：modified_time 为源文件 mtime（Unix 纳秒），
+// 解包时恢复，增量打包时用于变化检测；未设置时为打包时间（秒）
+constexpr uint8_t KAR_ENTRY_MTIME_NS = 0x01;
+
+// 条目标志：payload 为内容定义分块的块序列，可含指向先前块的引用
+constexpr uint8_t KAR_ENTRY_DEDUP = 0x02;
+
+// 条目标志（仅条目头）：checksum 与 stored_size 未回填（恒为 0），
+// 以中央目录为准；原样存储的条目 payload 大小仍等于 content_size
+constexpr uint8_t KAR_ENTRY_DEFERRED = 0x04;
+
+// 条目标志：payload 为块序列，可含空洞记录（HoleRun）
+constexpr uint8_t KAR_ENTRY_SPARSE = 0x08;
+
+// 条目标志：payload 起始于下一个 KAR_ENTRY_ALIGNMENT 边界（路径后补零）
+constexpr uint8_t KAR_ENTRY_ALIGNED = 0x10;
+
+// 条目标志：内容位于与相邻条目共享的固实块中，payload 以 SolidRef 开头
+constexpr uint8_t KAR_ENTRY_SOLID = 0x20;
+
+constexpr uint8_t KAR_ENTRY_KNOWN_FLAGS =
+    KAR_ENTRY_MTIME_NS | KAR_ENTRY_DEDUP | KAR_ENTRY_DEFERRED |
+    KAR_ENTRY_SPARSE | KAR_ENTRY_ALIGNED | KAR_ENTRY_SOLID;
+
+// 对齐条目的 payload 对齐粒度（页大小，满足零拷贝与 O_DIRECT 的偏移要求）
+constexpr uint64_t KAR_ENTRY_ALIGNMENT = 4096;
+
+// 归档标志：流式写出（无回填，条目区以结束标记终止）
+constexpr uint32_t KAR_ARCHIVE_STREAMED = 0x01;
+
+// 各版本条目头的字节数
+constexpr size_t entry_header_size(uint16_t version) {
+  return version >= KAR_VERSION_CODEC ? sizeof(EntryHeaderV3)
+                                      : sizeof(EntryHeader);
+}
+
+// ============================================
+// 线上字节序（小端）编解码
+//
+// 归档中的整数一律为小端。每个格式结构体在 WireLayout 中按声明顺序列出
+// 字段类型，编译期校验与 #pragma pack 布局的大小一致；load_wire / store_wire
+// 在小端主机上就是一次定长 memcpy（编译为普通 load/store），
+// 大端主机上再逐字段翻转字节序。解析从调用方已读入的缓冲区进行，不发起 I/O。
+// ============================================
+
+namespace wire {
+
+constexpr bool kNativeIsWire = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+// 不翻转的定长字节数组字段（如 SHA-256 摘要）
+template <size_t N> struct Bytes {};
+
+template <typename... Fields> struct FieldList {};
+
+template <typename T> struct FieldTraits {
+  static constexpr size_t size = sizeof(T);
+};
+template <size_t N> struct FieldTraits<Bytes<N>> {
+  static constexpr size_t size = N;
+};
+
+template <typename... F> constexpr size_t packed_size(FieldList<F...>) {
+  return (size_t{0} + ... + FieldTraits<F>::size);
+}
+
+template <typename T> T byteswap(T value) {
+  static_assert(std::is_integral_v<T>, "wire fields must be integers");
+  if constexpr (sizeof(T) == 1) {
+    return value;
+  } else if constexpr (sizeof(T) == 2) {
+    return static_cast<T>(__builtin_bswap16(static_cast<uint16_t>(value)));
+  } else if constexpr (sizeof(T) == 4) {
+    return static_cast<T>(__builtin_bswap32(static_cast<uint32_t>(value)));
+  } else {
+    static_assert(sizeof(T) == 8, "unsupported wire field size");
+    return static_cast<T>(__builtin_bswap64(static_cast<uint64_t>(value)));
+  }
+}
+
+template <typename F> void swap_field(char *bytes, size_t &offset) {
+  if constexpr (!std::is_integral_v<F>) {
+    offset += FieldTraits<F>::size;
+  } else {
+    F value;
+    std::memcpy(&value, bytes + offset, sizeof(F));
+    value = byteswap(value);
+    std::memcpy(bytes + offset, &value, sizeof(F));
+    offset += sizeof(F);
+  }
+}
+
+template <typename... F> void swap_fields(char *bytes, FieldList<F...>) {
+  size_t offset = 0;
+  (swap_field<F>(bytes, offset), ...);
+}
+
+} // namespace wire
+
+// 各格式结构体的字段类型序列（与结构体声明一一对应）
+template <typename T> struct WireLayout;
+
+#define KAR_WIRE_LAYOUT(Type, ...)                                             \
+  template <> struct WireLayout<Type> {                                        \
+    using fields = wire::FieldList<__VA_ARGS__>;                                 \
+  };                                                                           \
+  static_assert(wire::packed_size(WireLayout<Type>::fields{}) == sizeof(Type), \
+                "WireLayout of " #Type " does not match its declaration")
+
+KAR_WIRE_LAYOUT(FileHeader, uint32_t, uint16_t, uint32_t, uint64_t, uint32_t);
+KAR_WIRE_LAYOUT(EntryHeader, uint32_t, uint64_t, uint64_t, uint32_t, uint16_t);
+KAR_WIRE_LAYOUT(IndexEntry, uint64_t, uint64_t, uint64_t, uint32_t, uint16_t,
+                uint32_t);
+KAR_WIRE_LAYOUT(IndexTrailer, uint64_t, uint64_t, uint32_t, uint32_t,
+                uint32_t);
+KAR_WIRE_LAYOUT(EntryHeaderV3, uint32_t, uint64_t, uint64_t, uint32_t,
+                uint16_t, uint8_t, uint8_t, uint64_t);
+KAR_WIRE_LAYOUT(BlockHeader, uint32_t, uint32_t, uint32_t);
+KAR_WIRE_LAYOUT(ChunkRef, uint64_t);
+KAR_WIRE_LAYOUT(HoleRun, uint64_t);
+KAR_WIRE_LAYOUT(SolidRef, uint64_t, uint32_t);
+KAR_WIRE_LAYOUT(IndexEntryV3, uint64_t, uint64_t, uint64_t, uint32_t, uint16_t,
+                uint8_t, uint8_t, uint64_t, uint32_t);
+KAR_WIRE_LAYOUT(ChunkIndexHeader, uint32_t, uint32_t);
+KAR_WIRE_LAYOUT(ChunkIndexEntry, wire::Bytes<32>, uint64_t, uint32_t,
+                uint32_t);
+KAR_WIRE_LAYOUT(OrderIndexHeader, uint32_t, uint32_t);
+KAR_WIRE_LAYOUT(OrderIndexEntry, uint32_t);
+KAR_WIRE_LAYOUT(VolumeHeader, uint32_t, uint32_t, uint64_t, uint64_t,
+                uint64_t, uint32_t);
+KAR_WIRE_LAYOUT(VolumeEntry, uint64_t);
+KAR_WIRE_LAYOUT(ScanCacheHeader, uint32_t, uint32_t, uint32_t, uint32_t,
+                uint32_t, uint32_t, uint64_t, uint32_t);
+KAR_WIRE_LAYOUT(ScanCacheDir, uint64_t, uint64_t, uint64_t, uint32_t, uint32_t,
+                uint32_t, uint32_t, uint32_t);
+KAR_WIRE_LAYOUT(ScanCacheFile, uint64_t, uint64_t, uint64_t, uint32_t,
+                uint32_t, uint32_t, uint32_t);
+KAR_WIRE_LAYOUT(ScanCacheChild, uint32_t);
+
+#undef KAR_WIRE_LAYOUT
+
+// 主机序与线上字节序互转（对合：两次调用还原）；小端主机上原样返回
+template <typename T> T wire_order(T value) {
+  if constexpr (!wire::kNativeIsWire) {
+    wire::swap_fields(reinterpret_cast<char *>(&value),
+                      typename WireLayout<T>::fields{});
+  }
+  return value;
+}
+
+// 从缓冲区解析一个结构体（src 无对齐要求）
+template <typename T> T load_wire(const void *src) {
+  T value;
+  std::memcpy(&value, src, sizeof(T));
+  return wire_order(value);
+}
+
+// 把结构体按线上格式写入缓冲区（dst 无对齐要求）
+template <typename T> void store_wire(void *dst, const T &value) {
+  const T wire = wire_order(value);
+  std::memcpy(dst, &wire, sizeof(T));
+}
+
+// 经读者 / 写者（ArchiveReader、StreamReader、ArchiveWriter……）读写一个结构体
+template <typename Reader, typename T> bool read_wire(Reader &reader, T &value) {
+  if (!reader.read(&value, sizeof(T))) {
+    return false;
+  }
+  value = wire_order(value);
+  return true;
+}
+
+template <typename Writer, typename T>
+void write_wire(Writer &writer, const T &value) {
+  const T wire = wire_order(value);
+  writer.write(&wire, sizeof(T));
+}
@@ -0,0 +1,351 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+#include "uring.hpp"
+#include "volume.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// ============================================
+// I/O 后端：源文件读取、归档写入与归档读取
+// ============================================
+
+// 可恢复问题（退回其他实现、忽略损坏的缓存等）的警告；为空时丢弃
+using WarningHandler = std::function<void(const std::string &)>;
+
+// 源文件元数据（stat 结果）
+struct FileStat {
+  uint64_t size = 0;
+  uint64_t mtime_ns = 0; // 修改时间（Unix 纳秒）
+};
+
+// 文件中的一段数据区（其外为空洞）
+struct DataExtent {
+  uint64_t offset = 0;
+  uint64_t length = 0;
+};
+
+// stat 源文件，失败时抛出异常
+FileStat stat_file(const fs::path &path);
+
+// 只读输入文件：POSIX fd，可选整体 mmap 映射
+class InputFile {
+public:
+  // read_direct() 要求的缓冲区、偏移与长度对齐
+  static constexpr size_t kDirectAlignment = 4096;
+
+  explicit InputFile(const fs::path &path);
+  // 大小与 mtime 已由扫描取得：只打开，不再 fstat
+  InputFile(const fs::path &path, const FileStat &st);
+  ~InputFile();
+
+  InputFile(const InputFile &) = delete;
+  InputFile &operator=(const InputFile &) = delete;
+
+  const fs::path &path() const { return path_; }
+  int fd() const { return fd_; }
+  uint64_t size() const { return size_; }
+  uint64_t mtime_ns() const { return mtime_ns_; }
+
+  // 映射整个文件并 madvise(SEQUENTIAL)；空文件或映射失败时返回 nullptr
+  const char *map();
+
+  // 已映射时返回映射地址，否则为 nullptr
+  const char *data() const { return mapped_; }
+
+  // 从 offset 处读取最多 n 字节，返回实际读取的字节数（EOF 时小于 n）
+  size_t read_at(void *buf, size_t n, uint64_t offset) const;
+
+  // 另以 O_DIRECT 打开一次，此后 read_direct() 绕过页缓存；
+  // 文件系统不支持时返回 false（read_direct() 退回 read_at()）。须在并发读取前调用
+  bool open_direct();
+  bool direct() const { return direct_fd_ >= 0; }
+
+  // 同 read_at()；direct() 时经 O_DIRECT 读取：buf 与 offset 须按 kDirectAlignment
+  // 对齐，buf 须能容纳 n 向上取整到 kDirectAlignment 的字节数
+  size_t read_direct(void *buf, size_t n, uint64_t offset) const;
+
+  // 经 SEEK_DATA / SEEK_HOLE 列出 [0, size) 内的数据区；短于 min_hole 的空洞
+  // 并入相邻数据区。文件系统不支持时整个文件视为一个数据区，全空洞时返回空表
+  std::vector<DataExtent> data_extents(uint64_t min_hole) const;
+
+private:
+  fs::path path_;
+  int fd_ = -1;
+  int direct_fd_ = -1; // open_direct() 打开的 O_DIRECT fd
+  uint64_t size_ = 0;
+  uint64_t mtime_ns_ = 0;
+  char *mapped_ = nullptr;
+};
+
+// 解包输出文件：POSIX fd，多个线程可按偏移并发写入不同区域
+class OutputFile {
+public:
+  explicit OutputFile(const fs::path &path);
+  // 相对目录 fd 以 name 创建（openat）；path 为完整路径，用于报错
+  OutputFile(int dir_fd, const std::string &name, const fs::path &path);
+  ~OutputFile();
+
+  OutputFile(const OutputFile &) = delete;
+  OutputFile &operator=(const OutputFile &) = delete;
+
+  const fs::path &path() const { return path_; }
+  int fd() const { return fd_; }
+
+  // pwrite 到 offset 处，失败时抛出异常（线程安全）
+  void write_at(const void *data, size_t n, uint64_t offset);
+
+  // 写入前确定文件大小：sparse 时只 ftruncate 到 size，未写出的区域即为空洞；
+  // 否则 fallocate 预留 size 字节的连续空间（文件系统不支持时忽略）
+  void preallocate(uint64_t size, bool sparse);
+
+  // 设置修改时间（Unix 纳秒）；须在全部写入完成之后调用
+  void set_mtime(uint64_t mtime_ns);
+
+  // 设置权限位（fchmod，不受 umask 影响）
+  void set_permissions(uint16_t permissions);
+
+  // 关闭文件，失败时抛出异常
+  void close();
+
+private:
+  fs::path path_;
+  int fd_ = -1;
+};
+
+// 归档输出：带用户态缓冲的 fd 写入器
+//
+// 小块写入（条目头、路径、小文件内容）先合并进页对齐的缓冲区，填满后整块写出，
+// 大量小条目只需少量 write()；不小于缓冲区的写入与缓冲区剩余内容一次 writev() 写出。
+// 零拷贝写入（copy_file_range/sendfile）前需先 flush()，再用 advance() 记账。
+// 分卷输出时缓冲区写满后交给 VolumeWriter 的各卷写出线程，没有单一 fd。
+//
+// 直接 I/O（O_DIRECT）输出绕过页缓存：数据一律经对齐缓冲区按整块 pwrite，
+// 写满的一块交给后台写出线程、同时填充另一块（双缓冲）；flush() 只写出整块部分，
+// 不足一块的尾部留在缓冲区，close() 时补零写出再 ftruncate 到实际大小。
+// 回填已写出的区域时按块读出、修改再写回。
+class DirectFlusher;
+
+class ArchiveWriter {
+public:
+  static constexpr size_t kDefaultBufferSize = 1024 * 1024;
+  static constexpr size_t kBufferAlignment = 4096;
+
+  // volume_size 非 0 时分卷写出到 <path>.001、.002……，close() 时写出卷表 <path>；
+  // direct 时以 O_DIRECT 打开（分卷输出忽略），文件系统不支持时经 warn 警告并退回普通写入
+  explicit ArchiveWriter(const fs::path &path,
+                         size_t buffer_size = kDefaultBufferSize,
+                         uint64_t volume_size = 0, bool direct = false,
+                         const WarningHandler &warn = {});
+  // 写入已打开的 fd（标准输出、管道）：只顺序写出，不支持 write_at()，
+  // close() 只 flush 不关闭 fd
+  explicit ArchiveWriter(int fd, size_t buffer_size = kDefaultBufferSize);
+  ~ArchiveWriter();
+
+  ArchiveWriter(const ArchiveWriter &) = delete;
+  ArchiveWriter &operator=(const ArchiveWriter &) = delete;
+
+  void write(const void *data, size_t n);
+
+  // 把缓冲区写入 fd，之后 fd 的文件偏移等于 tell()；
+  // 直接 I/O 时只写出整块部分
+  void flush();
+
+  // 覆盖已写出区域（用于回填全局 Header），不改变当前写入位置；
+  // 顺序输出上抛出 std::logic_error
+  void write_at(uint64_t offset, const void *data, size_t n);
+
+  // 能否回写已写出的区域（输出为本对象创建的文件）
+  bool seekable() const { return owns_fd_; }
+
+  // 记账：绕过本对象直接写入 fd 的字节数
+  void advance(uint64_t n) { offset_ += n; }
+
+  uint64_t tell() const { return offset_ + buffered_; }
+  // 分卷或直接 I/O 输出时为 -1（零拷贝写入应退回缓冲写入）
+  int fd() const { return direct_ ? -1 : fd_; }
+
+  // 是否以 O_DIRECT 写出
+  bool direct() const { return static_cast<bool>(direct_); }
+
+  // 当前位置起为中央目录：分卷输出把此后写出的内容另存进卷表
+  void begin_directory();
+
+  // 分卷输出的卷数（普通输出为 0）
+  uint32_t volume_count() const { return volume_count_; }
+
+  // flush 并关闭，失败时抛出异常
+  void close();
+
+  // 写满的缓冲区改由 io_uring 异步写出（双缓冲：写出一块的同时填充另一块）；
+  // io_uring 不可用或输出为顺序 fd 时返回 false，保持同步写出。
+  // 直接 I/O 输出已由后台线程双缓冲写出，直接返回 true
+  bool enable_async_writes();
+
+private:
+  int fd_ = -1;
+  bool owns_fd_ = true; // 由路径打开（可回写），close() 时关闭
+  uint64_t offset_ = 0; // 已写入（或已提交写入）fd 的字节数
+  size_t capacity_;
+  char *buffer_ = nullptr; // kBufferAlignment 对齐
+  size_t buffered_ = 0;
+
+  // 异步写出：spare_ 为正在写出（或空闲）的另一块缓冲区，
+  // 由 io_uring 或直接 I/O 的后台线程写出
+  std::unique_ptr<IoUring> ring_;
+  std::unique_ptr<DirectFlusher> direct_;
+  char *spare_ = nullptr;
+  size_t inflight_ = 0; // 正在写出的字节数，0 表示没有在途写入
+
+  std::unique_ptr<VolumeWriter> volumes_; // 分卷输出，普通输出为空
+  uint32_t volume_count_ = 0;
+
+  // 等待在途的异步写入完成（部分写入时同步补写），之后 fd 偏移等于 offset_
+  void wait_inflight();
+
+  // 异步写出写满的缓冲区，换另一块继续填充
+  void submit_buffer();
+
+  // 直接 I/O 的 write_at()：缓冲区中的部分直接修改，已写出的部分按块读改写
+  void patch_direct(uint64_t offset, const char *data, size_t n);
+
+  void write_fully(const char *data, size_t n);
+  // 缓冲区内容 + data 一次聚合写出（处理部分写入），之后缓冲区为空
+  void write_gather(const char *data, size_t n);
+};
+
+// 归档输入：mmap 整个归档（零拷贝），或回退到缓冲 pread 顺序读取；
+// 分卷归档（path 为卷表或只有 <path>.001……）经 VolumeReader 按需打开各卷
+class ArchiveReader {
+public:
+  static constexpr size_t kBufferSize = 1024 * 1024;
+
+  ArchiveReader(const fs::path &path, bool use_mmap);
+  ~ArchiveReader();
+
+  ArchiveReader(const ArchiveReader &) = delete;
+  ArchiveReader &operator=(const ArchiveReader &) = delete;
+
+  // 读取 n 字节到 dst；剩余数据不足时返回 false
+  bool read(void *dst, size_t n);
+
+  // 返回接下来 n 字节的连续只读视图并前移读取位置；不足时返回 nullptr
+  // 视图在下一次读取操作前有效
+  const char *view(size_t n);
+
+  bool skip(uint64_t n);
+  void seek(uint64_t offset);
+
+  // 线程安全的随机读取，不改变读取位置：mmap 模式返回映射内地址，
+  // 否则 pread 到调用方提供的 scratch 并返回其地址；越界时返回 nullptr
+  const char *view_at(uint64_t offset, size_t n,
+                      ByteBuffer &scratch) const;
+
+  uint64_t tell() const { return pos_; }
+  uint64_t size() const { return size_; }
+  bool mapped() const { return mapped_ != nullptr; }
+
+  // 分卷归档的读取器（普通归档为 nullptr）
+  const VolumeReader *volumes() const { return volumes_.get(); }
+
+private:
+  int fd_ = -1;
+  uint64_t size_ = 0;
+  uint64_t pos_ = 0;
+  char *mapped_ = nullptr;
+  std::unique_ptr<VolumeReader> volumes_; // 分卷归档：读取经各卷拼接
+
+  // 缓冲模式：buffer_ 中保存从 buffer_start_ 开始的数据
+  std::vector<char> buffer_;
+  uint64_t buffer_start_ = 0;
+  size_t buffer_len_ = 0;
+};
+
+// 顺序输入：从 fd（标准输入、管道）按序读取，不 seek；
+// 缓冲区按需增长以提供连续视图
+class StreamReader {
+public:
+  static constexpr size_t kBufferSize = 1024 * 1024;
+
+  explicit StreamReader(int fd);
+
+  StreamReader(const StreamReader &) = delete;
+  StreamReader &operator=(const StreamReader &) = delete;
+
+  // 读取 n 字节到 dst；数据不足（提前到达 EOF）时返回 false
+  bool read(void *dst, size_t n);
+
+  // 返回接下来 n 字节的连续只读视图并前移读取位置；不足时返回 nullptr
+  // 视图在下一次读取操作前有效
+  const char *view(size_t n);
+
+  // 读取余下的全部数据直到 EOF
+  std::vector<char> read_to_end();
+
+  // 已消费的字节数（即归档内偏移）
+  uint64_t tell() const { return pos_; }
+
+private:
+  int fd_;
+  uint64_t pos_ = 0;
+  std::vector<char> buffer_;
+  size_t begin_ = 0; // 缓冲区中未消费数据的起点
+  size_t end_ = 0;   // 缓冲区中有效数据的终点
+
+  // 保证缓冲区中至少有 n 字节未消费数据；EOF 时返回 false
+  bool fill(size_t n);
+};
+
+enum class IoBackendKind {
+  Auto,   // Linux 上为 splice，其他平台为 mmap
+  Stream, // pread/write，经用户态缓冲区拷贝（可移植基线）
+  Mmap,   // 源文件与归档 mmap + madvise(SEQUENTIAL)
+  Splice, // mmap 读取 + copy_file_range/sendfile 内核态拷贝到归档
+  Uring,  // io_uring 批量 openat/read/close 小文件 + 归档异步写出（不可用时退回 stream）
+};
+
+// 批量读取中的一个文件：整体读入调用方分配好的 dst
+struct ReadRequest {
+  const fs::path *path = nullptr;
+  char *dst = nullptr;
+  size_t size = 0; // 扫描得到的文件大小
+};
+
+class IoBackend {
+public:
+  virtual ~IoBackend() = default;
+
+  virtual const char *name() const = 0;
+
+  // 读取源文件与归档时是否使用 mmap
+  virtual bool use_mmap() const = 0;
+
+  // 把 input 的 [offset, offset + len) 原样写入归档
+  virtual void copy(InputFile &input, uint64_t offset, uint64_t len,
+                    ArchiveWriter &archive);
+
+  // 打包时是否把多个小文件合并成一次 read_batch()
+  virtual bool batch_reads() const { return false; }
+
+  // 读取每个文件的前 size 字节：默认逐个 open/pread/close；
+  // 文件无法打开或变短时抛出异常。可在多个工作线程中并发调用
+  virtual void read_batch(const std::vector<ReadRequest> &requests);
+
+  // 为归档写入做准备（如开启异步写出）
+  virtual void prepare(ArchiveWriter &) {}
+};
+
+// io_uring 不可用时经 warn 警告并退回 stream 后端
+std::unique_ptr<IoBackend> make_io_backend(IoBackendKind kind,
+                                           const WarningHandler &warn = {});
+
+// 解析 --io 参数："auto" / "stream" / "mmap" / "splice" / "uring"
+IoBackendKind parse_io_backend(const std::string &name);
@@ -1,8 +1,14 @@
 #include "archiver.hpp"
+#include "stage_stats.hpp"
+#include "utils.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 // ============================================
 // CLI 接口
@@ -10,9 +16,321 @@
 
 void print_usage(const char *prog) {
   std::cout << "Usage:\n"
-            << "  " << prog << " pack <source_dir> <archive.kar>\n"
-            << "  " << prog << " unpack <archive.kar> <target_dir>\n"
-            << "  " << prog << " list <archive.kar>\n";
+            << "  " << prog << " pack [options] <source_dir> <archive.kar|->\n"
+            << "  " << prog << " unpack [options] <archive.kar|-> <target_dir>\n"
+            << "  " << prog << " list [options] <archive.kar>\n"
+            << "  " << prog
+            << " extract [options] <archive.kar> <path-or-glob>...\n"
+            << "  " << prog << " verify [options] <archive.kar>\n"
+            << "\n  verify 多线程核对全部条目的 CRC32，不写磁盘；列出全部失败条目，有失败时返回 1\n"
+            << "\n  归档写为 \"-\" 时 pack 流式写到标准输出、unpack 从标准输入边读边解，\n"
+            << "  可直接经管道传输：" << prog << " pack dir - | ssh host kar unpack - dst\n"
+            << "\nOptions:\n"
+            << "  --threads N   pack/unpack/extract/verify 使用的工作线程数（默认：CPU 核数，1 为串行）\n"
+            << "  --adaptive    pack/unpack/extract 按实测吞吐自动调整启用的工作线程数（上限为 --threads）\n"
+            << "                与打包的在途预算：HDD 上收缩以免争抢磁头，NVMe 上保持满并发\n"
+            << "  --bwlimit MB  pack 读取源文件、unpack/extract 写出文件的总带宽上限（MB/s，可带小数）\n"
+            << "  --affinity MODE\n"
+            << "                工作线程的 CPU 绑定：none（默认）| compact（按 NUMA 节点依次占满）\n"
+            << "                | scatter（在 NUMA 节点间轮转）\n"
+            << "  --io MODE     I/O 后端：auto | stream | mmap | splice | uring（默认 auto）\n"
+            << "  --codec NAME  pack 的压缩编码：none | lz4 | zstd（默认 none）\n"
+            << "  --level N     压缩级别（lz4: 1-12，zstd: 1-22；默认取编码的默认级别）\n"
+            << "  --output DIR  extract 的目标目录（默认当前目录）\n"
+            << "  --incremental BASE.kar\n"
+            << "                pack 时大小与 mtime 未变的文件直接从 BASE 拷贝，不再读取\n"
+            << "  --dedup       pack 时按内容定义分块去重，重复的块与文件只存储一次\n"
+            << "  --volume-size SIZE\n"
+            << "                pack 时分卷写出 <archive>.001、.002……（每卷 SIZE 字节，可带 K/M/G），\n"
+            << "                <archive> 为记录各卷的卷表；其他命令给出 <archive> 即可\n"
+            << "  --layout MODE pack 的条目布局：scan（默认，按扫描顺序）| grouped（按目录与扩展名\n"
+            << "                重排，压缩时相邻小文件合并为固实块，原样存储的大文件按页对齐；\n"
+            << "                list 仍按原始顺序列出）\n"
+            << "  --direct      pack 时以 O_DIRECT 写出归档（绕过页缓存，经 4 KB 对齐的双缓冲整块写出，\n"
+            << "                原样存储的大文件按页对齐）；文件系统不支持时退回普通写入\n"
+            << "  --direct-sources\n"
+            << "                同 --direct，且大文件的分块同样以 O_DIRECT 读取\n"
+            << "  --scan-cache FILE\n"
+            << "                pack 的扫描缓存：inode、mtime 与 ctime 均未变的目录沿用 FILE 中的列表，\n"
+            << "                不再读取目录；打包完成后重写 FILE（不存在时新建）\n"
+            << "  --trust-dir-mtime\n"
+            << "                与 --scan-cache 同用：未变目录中的文件也不再 stat，直接取缓存记录，\n"
+            << "                扫描开销只与目录数相关（目录内就地修改的文件不会被发现）\n"
+            << "  --verify LEVEL\n"
+            << "                unpack/extract 的校验级别：crc（默认，核对 CRC32）| none（不校验）\n"
+            << "  --quiet       不显示进度条（进度条默认至多每 100 ms 刷新一次）\n"
+            << "  --pool-stats  结束时输出缓冲区池的分配统计（系统分配次数 / 复用次数）\n"
+            << "  --stats       结束时按阶段（scan/open/read/crc/compress/write/mkdir/chmod）\n"
+            << "                输出调用次数、字节数、耗时与 p50/p99，以及每个线程的耗时分布\n"
+            << "  --trace FILE  同时把逐次操作写为 Chrome trace JSON（ui.perfetto.dev 可直接打开）\n";
+}
+
+// 命令行参数：位置参数 + 选项
+struct CliArgs {
+  std::vector<std::string> positional;
+  unsigned threads = 0; // 0 表示自动
+  bool adaptive = false;        // 自适应并发
+  uint64_t bandwidth_limit = 0; // 带宽上限（字节/秒，0 表示不限）
+  CpuAffinity affinity = CpuAffinity::None;
+  IoBackendKind io = IoBackendKind::Auto;
+  Codec codec = Codec::None;
+  int level = 0; // 0 表示编码的默认级别
+  std::string output = "."; // extract 目标目录
+  std::string incremental;  // pack 增量基准归档（空表示完整打包）
+  bool dedup = false;       // pack 去重
+  uint64_t volume_size = 0; // pack 分卷大小（0 表示不分卷）
+  PackLayout layout = PackLayout::Scan; // pack 条目布局
+  bool direct = false;         // pack 以 O_DIRECT 写出归档
+  bool direct_sources = false; // pack 以 O_DIRECT 读取大文件
+  std::string scan_cache;      // pack 扫描缓存文件（空表示不使用）
+  bool trust_dir_mtime = false; // 未变目录中的文件取自扫描缓存
+  VerifyLevel verify = VerifyLevel::Checksums; // unpack/extract 校验级别
+  bool quiet = false;       // 不显示进度
+  bool pool_stats = false;  // 输出缓冲区池统计
+  bool stats = false;       // 输出分阶段计时
+  std::string trace;        // 分阶段 trace 输出文件（空表示不记录）
+};
+
+CliArgs parse_args(int argc, char *argv[]) {
+  CliArgs args;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    // 同时支持 "--opt value" 与 "--opt=value"
+    std::string value;
+    bool has_value = false;
+    if (auto eq = arg.find('='); arg.rfind("--", 0) == 0 && eq != std::string::npos) {
+      value = arg.substr(eq + 1);
+      arg = arg.substr(0, eq);
+      has_value = true;
+    }
+    auto next_value = [&]() -> std::string {
+      if (has_value) {
+        return value;
+      }
+      if (i + 1 >= argc) {
+        throw std::invalid_argument(arg + " requires a value");
+      }
+      return argv[++i];
+    };
+
+    if (arg == "--threads") {
+      args.threads = static_cast<unsigned>(std::stoul(next_value()));
+    } else if (arg == "--adaptive") {
+      args.adaptive = true;
+    } else if (arg == "--bwlimit") {
+      args.bandwidth_limit = parse_bandwidth_limit(next_value());
+    } else if (arg == "--affinity") {
+      args.affinity = parse_cpu_affinity(next_value());
+    } else if (arg == "--io") {
+      args.io = parse_io_backend(next_value());
+    } else if (arg == "--codec") {
+      args.codec = parse_codec(next_value());
+    } else if (arg == "--level") {
+      args.level = std::stoi(next_value());
+    } else if (arg == "--incremental") {
+      args.incremental = next_value();
+    } else if (arg == "--quiet") {
+      args.quiet = true;
+    } else if (arg == "--pool-stats") {
+      args.pool_stats = true;
+    } else if (arg == "--stats") {
+      args.stats = true;
+    } else if (arg == "--trace") {
+      args.trace = next_value();
+    } else if (arg == "--dedup") {
+      args.dedup = true;
+    } else if (arg == "--volume-size") {
+      args.volume_size = parse_size(next_value());
+    } else if (arg == "--layout") {
+      args.layout = parse_pack_layout(next_value());
+    } else if (arg == "--direct") {
+      args.direct = true;
+    } else if (arg == "--scan-cache") {
+      args.scan_cache = next_value();
+    } else if (arg == "--trust-dir-mtime") {
+      args.trust_dir_mtime = true;
+    } else if (arg == "--direct-sources") {
+      args.direct = true;
+      args.direct_sources = true;
+    } else if (arg == "--verify") {
+      args.verify = parse_verify_level(next_value());
+    } else if (arg == "--output") {
+      args.output = next_value();
+    } else if (arg.rfind("--", 0) == 0) {
+      throw std::invalid_argument("Unknown option: " + arg);
+    } else {
+      args.positional.push_back(arg);
+    }
+  }
+  return args;
+}
+
+// 进度条：由 Archiver 的进度回调驱动，至多每 100 ms 重绘一次（最后一次总会输出）；
+// 警告输出到标准错误（--quiet 只关闭进度条）
+class ProgressRenderer : public ArchiveObserver {
+public:
+  static constexpr std::chrono::milliseconds kInterval{100};
+
+  explicit ProgressRenderer(bool quiet) : quiet_(quiet) {}
+
+  void on_progress(const ArchiveProgress &p) override {
+    if (quiet_) {
+      return;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    const bool last = p.entries_total > 0 && p.entries_done >= p.entries_total;
+    if (!last && printed_ && now - last_ < kInterval) {
+      return;
+    }
+    printed_ = true;
+    last_ = now;
+    print(p);
+  }
+
+  void on_warning(const std::string &message) override {
+    if (printed_) {
+      // 进度条所在行未换行，警告另起一行
+      std::cout.flush();
+      std::cerr << "\n";
+    }
+    std::cerr << "Warning: " << message << "\n";
+  }
+
+private:
+  bool quiet_;
+  bool printed_ = false;
+  std::chrono::steady_clock::time_point last_;
+
+  static void print(const ArchiveProgress &p) {
+    const std::string &name = p.path != nullptr ? *p.path : std::string();
+    if (p.entries_total == 0) {
+      std::cout << "\r(" << p.entries_done << ") " << format_size(p.bytes_done)
+                << " " << name;
+      std::cout.flush();
+      return;
+    }
+    // 字节总数已知时按字节计算比例（大文件占比更真实），否则按条目数
+    double ratio = p.bytes_total > 0
+                       ? static_cast<double>(p.bytes_done) / p.bytes_total
+                       : static_cast<double>(p.entries_done) / p.entries_total;
+    ratio = std::min(ratio, 1.0);
+    if (p.entries_done >= p.entries_total) {
+      ratio = 1.0;
+    }
+    const int bar_width = 30;
+    const int pos = static_cast<int>(bar_width * ratio);
+
+    // 构建进度条，一次写出
+    std::string bar = "\r[";
+    for (int j = 0; j < bar_width; ++j) {
+      bar += j < pos ? "█" : "░";
+    }
+    std::cout << bar << "] " << std::setw(3) << static_cast<int>(ratio * 100)
+              << "% ";
+    std::cout << "(" << p.entries_done << "/" << p.entries_total << ") ";
+    std::cout << format_size(p.bytes_done);
+    if (p.bytes_total > 0) {
+      std::cout << "/" << format_size(p.bytes_total);
+    }
+    std::cout << " " << name;
+    std::cout.flush();
+  }
+};
+
+void print_list(const fs::path &archive_path, const ArchiveIndex &index) {
+  std::cout << "Archive: " << archive_path << "\n";
+  std::cout << "Entries: " << index.size() << "\n";
+  if (index.volume_count() != 0) {
+    std::cout << "Volumes: " << index.volume_count() << "\n";
+  }
+  std::cout << "------------------------\n";
+
+  // 重排过的归档按原始（扫描）顺序列出
+  for (const IndexRecord *entry : index.in_original_order()) {
+    const IndexRecord &record = *entry;
+    std::cout << record.path << " (" << format_size(record.content_size);
+    if (record.codec != static_cast<uint8_t>(Codec::None)) {
+      std::cout << ", " << codec_name(static_cast<Codec>(record.codec)) << " "
+                << format_size(record.stored_size);
+    }
+    if (record.flags & KAR_ENTRY_SOLID) {
+      std::cout << ", solid";
+    }
+    if (record.flags & KAR_ENTRY_DEDUP) {
+      std::cout << ", dedup";
+    }
+    if (record.flags & KAR_ENTRY_SPARSE) {
+      std::cout << ", sparse";
+      if (record.codec == static_cast<uint8_t>(Codec::None)) {
+        std::cout << " " << format_size(record.stored_size);
+      }
+    }
+    if (index.volume_count() != 0) {
+      // 条目头与 payload 所在的卷（与卷文件后缀一致，从 1 计）
+      const uint32_t first = index.volume_of(record.entry_offset) + 1;
+      const uint32_t last =
+          index.volume_of(record.data_offset() + record.stored_size - 1) + 1;
+      std::cout << ", volume " << first;
+      if (last != first) {
+        std::cout << "-" << last;
+      }
+    }
+    std::cout << ")\n";
+  }
+}
+
+// 分阶段计时汇总：各阶段合计一行，再按线程列出各阶段耗时（ms）
+void print_stage_stats(double wall_seconds) {
+  const auto threads = StageStats::instance().snapshot();
+  StageStats::Counter total[kStageCount];
+  for (const auto &thread : threads) {
+    for (size_t s = 0; s < kStageCount; ++s) {
+      total[s].merge(thread.stages[s]);
+    }
+  }
+  std::vector<size_t> active;
+  for (size_t s = 0; s < kStageCount; ++s) {
+    if (total[s].calls != 0) {
+      active.push_back(s);
+    }
+  }
+
+  std::cout << "\nStage breakdown (" << threads.size() << " threads, "
+            << std::fixed << std::setprecision(3) << wall_seconds
+            << " s wall):\n";
+  std::cout << std::left << std::setw(12) << "stage" << std::right
+            << std::setw(10) << "calls" << std::setw(12) << "bytes"
+            << std::setw(12) << "time ms" << std::setw(14) << "rate"
+            << std::setw(10) << "p50 us" << std::setw(10) << "p99 us"
+            << "\n";
+  for (size_t s : active) {
+    const StageStats::Counter &c = total[s];
+    const double ms = c.ns / 1e6;
+    std::string rate = "-";
+    if (c.bytes != 0 && c.ns != 0) {
+      rate = format_size(static_cast<uint64_t>(c.bytes * 1e9 / c.ns)) + "/s";
+    }
+    std::cout << std::left << std::setw(12) << stage_name(static_cast<Stage>(s))
+              << std::right << std::setw(10) << c.calls << std::setw(12)
+              << format_size(c.bytes) << std::setw(12) << std::setprecision(1)
+              << ms << std::setw(14) << rate << std::setw(10)
+              << c.percentile(0.50) / 1e3 << std::setw(10)
+              << c.percentile(0.99) / 1e3 << "\n";
+  }
+
+  std::cout << "\nPer thread (ms):\n" << std::left << std::setw(8) << "thread"
+            << std::right;
+  for (size_t s : active) {
+    std::cout << std::setw(11) << stage_name(static_cast<Stage>(s));
+  }
+  std::cout << "\n";
+  for (const auto &thread : threads) {
+    std::cout << std::left << std::setw(8) << thread.thread << std::right;
+    for (size_t s : active) {
+      std::cout << std::setw(11) << thread.stages[s].ns / 1e6;
+    }
+    std::cout << "\n";
+  }
 }
 
 int main(int argc, char *argv[]) {
@@ -22,27 +340,122 @@ int main(int argc, char *argv[]) {
   }
 
   try {
-    Archiver ar;
     std::string cmd = argv[1];
+    CliArgs args = parse_args(argc, argv);
+    const auto &pos = args.positional;
+    ArchiverOptions options;
+    options.threads = args.threads;
+    options.adaptive = args.adaptive;
+    options.bandwidth_limit = args.bandwidth_limit;
+    options.affinity = args.affinity;
+    options.io = args.io;
+    options.codec = args.codec;
+    options.level = args.level;
+    options.dedup = args.dedup;
+    options.volume_size = args.volume_size;
+    options.layout = args.layout;
+    options.direct_io = args.direct;
+    options.direct_sources = args.direct_sources;
+    options.scan_cache = args.scan_cache;
+    options.trust_dir_mtime = args.trust_dir_mtime;
+    options.incremental_base = args.incremental;
+    options.verify = args.verify;
+    Archiver ar(options);
+    ProgressRenderer renderer(args.quiet);
+    ar.set_observer(&renderer);
+    const auto started = std::chrono::steady_clock::now();
+    if (args.stats || !args.trace.empty()) {
+      StageStats::instance().enable(!args.trace.empty());
+    }
 
     if (cmd == "pack") {
-      if (argc < 4) {
+      if (pos.size() < 2) {
         print_usage(argv[0]);
         return 1;
       }
-      ar.pack(argv[2], argv[3]);
+      if (pos[1] == "-") {
+        // 归档写到标准输出：提示信息改走标准错误，不混入归档数据
+        std::cout.rdbuf(std::cerr.rdbuf());
+      }
+      const ArchiveStats stats = ar.pack(pos[0], pos[1]);
+      std::cout << "\n\nArchive created: " << fs::path(pos[1]) << " ("
+                << stats.entries << " files";
+      if (!args.incremental.empty()) {
+        std::cout << ", " << stats.reused_entries << " unchanged from base";
+      }
+      if (args.dedup) {
+        std::cout << ", " << stats.unique_chunks << " unique chunks, "
+                  << format_size(stats.dedup_bytes) << " deduplicated";
+      }
+      if (stats.volumes != 0) {
+        std::cout << ", " << stats.volumes << " volumes";
+      }
+      if (!args.scan_cache.empty()) {
+        std::cout << ", " << stats.cached_directories
+                  << " directories from scan cache";
+      }
+      if (stats.adaptive_threads != 0) {
+        std::cout << ", settled on " << stats.adaptive_threads << " threads";
+      }
+      std::cout << ")\n";
     } else if (cmd == "unpack") {
-      if (argc < 4) {
+      if (pos.size() < 2) {
         print_usage(argv[0]);
         return 1;
       }
-      ar.unpack(argv[2], argv[3]);
-    } else if (cmd == "list" && argc == 3) {
-      ar.list(argv[2]);
+      const ArchiveStats stats = ar.unpack(pos[0], pos[1]);
+      std::cout << "\n\nArchive version: " << stats.version << ", "
+                << stats.entries << " entries";
+      if (stats.adaptive_threads != 0) {
+        std::cout << ", settled on " << stats.adaptive_threads << " threads";
+      }
+      std::cout << "\n";
+      std::cout << "Extracted to: " << fs::path(pos[1]) << "\n";
+    } else if (cmd == "list" && pos.size() == 1) {
+      print_list(pos[0], ar.list(pos[0]));
+    } else if (cmd == "verify" && pos.size() == 1) {
+      const VerifyReport report = ar.verify(pos[0]);
+      const ArchiveStats &stats = report.stats;
+      std::cout << (args.quiet ? "" : "\n\n");
+      for (const VerifyFailure &failure : report.failures) {
+        std::cout << "FAILED: " << failure.path << ": " << failure.error
+                  << "\n";
+      }
+      const double rate = stats.seconds > 0 ? stats.bytes / stats.seconds : 0;
+      std::cout << "Verified " << stats.entries << " entries ("
+                << format_size(stats.bytes) << ") in " << std::fixed
+                << std::setprecision(3) << stats.seconds << " s, "
+                << format_size(static_cast<uint64_t>(rate)) << "/s: "
+                << report.failures.size() << " failed\n";
+      if (!report.failures.empty()) {
+        return 1;
+      }
+    } else if (cmd == "extract" && pos.size() >= 2) {
+      const ArchiveStats stats =
+          ar.extract(pos[0], {pos.begin() + 1, pos.end()}, args.output);
+      std::cout << "\nExtracted " << stats.entries << " of "
+                << stats.archive_entries << " entries to: "
+                << fs::path(args.output) << "\n";
     } else {
       print_usage(argv[0]);
       return 1;
     }
+
+    if (args.pool_stats) {
+      const BufferPool::Stats stats = BufferPool::instance().stats();
+      std::cout << "Buffer pool: " << stats.allocations << " allocations, "
+                << stats.reuses << " reuses, " << stats.retained_bytes
+                << " bytes retained\n";
+    }
+    if (args.stats) {
+      print_stage_stats(std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - started)
+                            .count());
+    }
+    if (!args.trace.empty()) {
+      StageStats::instance().write_trace(args.trace);
+      std::cout << "Trace written to: " << fs::path(args.trace) << "\n";
+    }
   } catch (const std::exception &e) {
     std::cerr << "Error: " << e.what() << "\n";
     return 1;
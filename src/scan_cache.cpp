@@ -0,0 +1,321 @@
+#include "scan_cache.hpp"
+#include "crc32.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+std::string errno_message() { return std::strerror(errno); }
+
+constexpr uint32_t kDirRef = 0x80000000u;
+
+// 缓存按源目录的规范绝对路径识别
+std::string canonical_root(const fs::path &root) {
+  return fs::weakly_canonical(fs::absolute(root)).string();
+}
+
+uint64_t now_ns() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+}
+
+template <typename T> void append_wire(std::vector<char> &out, const T &value) {
+  char wire[sizeof(T)];
+  store_wire(wire, value);
+  out.insert(out.end(), wire, wire + sizeof(wire));
+}
+
+} // namespace
+
+// ============================================
+// ScanCache
+// ============================================
+
+std::unique_ptr<ScanCache> ScanCache::load(const fs::path &path,
+                                           const fs::path &root,
+                                           const WarningHandler &warn) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno == ENOENT) {
+      return nullptr;
+    }
+    throw std::runtime_error("Cannot open scan cache: " + path.string() + " (" +
+                             errno_message() + ")");
+  }
+  struct stat st;
+  std::unique_ptr<ScanCache> cache(new ScanCache());
+  if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+    cache->size_ = static_cast<size_t>(st.st_size);
+    void *addr =
+        ::mmap(nullptr, cache->size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      cache->mapped_ = static_cast<char *>(addr);
+    }
+  }
+  ::close(fd);
+  if (cache->mapped_ == nullptr || !cache->parse(root)) {
+    if (warn) {
+      warn("scan cache " + path.string() +
+           " is damaged or belongs to another tree, rescanning");
+    }
+    return nullptr;
+  }
+  return cache;
+}
+
+ScanCache::~ScanCache() {
+  if (mapped_ != nullptr) {
+    ::munmap(mapped_, size_);
+  }
+}
+
+bool ScanCache::parse(const fs::path &root) {
+  if (size_ < sizeof(ScanCacheHeader)) {
+    return false;
+  }
+  header_ = load_wire<ScanCacheHeader>(mapped_);
+  const uint64_t body =
+      static_cast<uint64_t>(header_.dir_count) * sizeof(ScanCacheDir) +
+      static_cast<uint64_t>(header_.file_count) * sizeof(ScanCacheFile) +
+      static_cast<uint64_t>(header_.child_count) * sizeof(ScanCacheChild) +
+      header_.names_size;
+  if (header_.magic != KAR_SCAN_MAGIC || header_.dir_count == 0 ||
+      header_.root_length > header_.names_size ||
+      sizeof(ScanCacheHeader) + body != size_) {
+    return false;
+  }
+  const char *data = mapped_ + sizeof(ScanCacheHeader);
+  if (CRC32().calculate(reinterpret_cast<const uint8_t *>(data),
+                        static_cast<size_t>(body)) != header_.checksum) {
+    return false;
+  }
+  dirs_ = data;
+  files_ = dirs_ + header_.dir_count * sizeof(ScanCacheDir);
+  children_ = files_ + header_.file_count * sizeof(ScanCacheFile);
+  names_ = children_ + header_.child_count * sizeof(ScanCacheChild);
+  if (std::string_view(names_, header_.root_length) != canonical_root(root)) {
+    return false;
+  }
+
+  // 校验各表的引用，并按父目录在前的顺序拼出每个目录的相对路径
+  std::vector<std::string> rels(header_.dir_count);
+  dir_index_.reserve(header_.dir_count);
+  for (uint32_t i = 0; i < header_.dir_count; ++i) {
+    const ScanCacheDir d = dir(i);
+    if (static_cast<uint64_t>(d.name_offset) + d.name_length >
+            header_.names_size ||
+        static_cast<uint64_t>(d.first_child) + d.child_count >
+            header_.child_count ||
+        (i == 0) != (d.parent == ScanCacheWriter::kNoParent) ||
+        (i != 0 && d.parent >= i)) {
+      return false;
+    }
+    if (i != 0) {
+      const std::string_view name(names_ + d.name_offset, d.name_length);
+      rels[i] = rels[d.parent].empty()
+                    ? std::string(name)
+                    : rels[d.parent] + "/" + std::string(name);
+    }
+    dir_index_.emplace(rels[i], i);
+  }
+  for (uint32_t i = 0; i < header_.child_count; ++i) {
+    const uint32_t ref =
+        load_wire<ScanCacheChild>(children_ + i * sizeof(ScanCacheChild)).ref;
+    if ((ref & kDirRef) ? (ref & ~kDirRef) >= header_.dir_count
+                        : ref >= header_.file_count) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < header_.file_count; ++i) {
+    const auto f =
+        load_wire<ScanCacheFile>(files_ + i * sizeof(ScanCacheFile));
+    if (static_cast<uint64_t>(f.name_offset) + f.name_length >
+        header_.names_size) {
+      return false;
+    }
+  }
+  return true;
+}
+
+ScanCacheDir ScanCache::dir(uint32_t index) const {
+  return load_wire<ScanCacheDir>(dirs_ + index * sizeof(ScanCacheDir));
+}
+
+std::optional<uint32_t> ScanCache::find_unchanged(const std::string &rel,
+                                                  uint64_t inode,
+                                                  uint64_t mtime_ns,
+                                                  uint64_t ctime_ns) const {
+  const auto it = dir_index_.find(rel);
+  if (it == dir_index_.end()) {
+    return std::nullopt;
+  }
+  const ScanCacheDir d = dir(it->second);
+  if (d.inode != inode || d.mtime_ns != mtime_ns || d.ctime_ns != ctime_ns ||
+      std::max(mtime_ns, ctime_ns) + kRacyWindowNs > header_.scanned_ns) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+uint32_t ScanCache::child_count(uint32_t dir_index) const {
+  return dir(dir_index).child_count;
+}
+
+ScanCacheItem ScanCache::child(uint32_t dir_index, uint32_t i) const {
+  const ScanCacheDir d = dir(dir_index);
+  const uint32_t ref =
+      load_wire<ScanCacheChild>(children_ + (d.first_child + i) *
+                                                sizeof(ScanCacheChild))
+          .ref;
+  ScanCacheItem item;
+  if (ref & kDirRef) {
+    const ScanCacheDir sub = dir(ref & ~kDirRef);
+    item.is_dir = true;
+    item.name = std::string_view(names_ + sub.name_offset, sub.name_length);
+  } else {
+    item.file = load_wire<ScanCacheFile>(files_ + ref * sizeof(ScanCacheFile));
+    item.name =
+        std::string_view(names_ + item.file.name_offset, item.file.name_length);
+  }
+  return item;
+}
+
+// ============================================
+// ScanCacheWriter
+// ============================================
+
+ScanCacheWriter::ScanCacheWriter(const fs::path &root)
+    : root_(canonical_root(root)), scanned_ns_(now_ns()), names_(root_) {}
+
+uint32_t ScanCacheWriter::add_name(std::string_view name) {
+  if (names_.size() + name.size() > UINT32_MAX) {
+    throw std::runtime_error("Scan cache is too large");
+  }
+  const uint32_t offset = static_cast<uint32_t>(names_.size());
+  names_.append(name);
+  return offset;
+}
+
+uint32_t ScanCacheWriter::add_directory(uint32_t parent, std::string_view name,
+                                        uint64_t inode, uint64_t mtime_ns,
+                                        uint64_t ctime_ns) {
+  const uint32_t index = static_cast<uint32_t>(dirs_.size());
+  Dir d;
+  d.record = ScanCacheDir{.inode = inode,
+                          .mtime_ns = mtime_ns,
+                          .ctime_ns = ctime_ns,
+                          .parent = parent,
+                          .name_offset = add_name(name),
+                          .name_length = static_cast<uint32_t>(name.size()),
+                          .first_child = 0,
+                          .child_count = 0};
+  if (parent != kNoParent) {
+    d.rel = dirs_[parent].rel.empty()
+                ? std::string(name)
+                : dirs_[parent].rel + "/" + std::string(name);
+    dirs_[parent].children.push_back(index | kDirRef);
+  }
+  dirs_.push_back(std::move(d));
+  return index;
+}
+
+void ScanCacheWriter::add_file(uint32_t dir, const ScanEntry &entry) {
+  const size_t slash = entry.rel_path.rfind('/');
+  const std::string_view name =
+      slash == std::string::npos
+          ? std::string_view(entry.rel_path)
+          : std::string_view(entry.rel_path).substr(slash + 1);
+  File f;
+  f.dir = dir;
+  f.record = ScanCacheFile{.inode = entry.inode,
+                           .size = entry.size,
+                           .mtime_ns = entry.mtime_ns,
+                           .mode = entry.mode,
+                           .checksum = 0,
+                           .name_offset = add_name(name),
+                           .name_length = static_cast<uint32_t>(name.size())};
+  dirs_[dir].children.push_back(static_cast<uint32_t>(files_.size()));
+  files_.push_back(f);
+}
+
+void ScanCacheWriter::write(
+    const fs::path &path,
+    const std::function<std::optional<uint32_t>(const std::string &)> &checksum)
+    const {
+  std::vector<char> body;
+  uint32_t child_count = 0;
+  for (const Dir &d : dirs_) {
+    ScanCacheDir record = d.record;
+    record.first_child = child_count;
+    record.child_count = static_cast<uint32_t>(d.children.size());
+    child_count += record.child_count;
+    append_wire(body, record);
+  }
+  for (const File &f : files_) {
+    ScanCacheFile record = f.record;
+    const Dir &d = dirs_[f.dir];
+    const std::string name(names_, record.name_offset, record.name_length);
+    record.checksum =
+        checksum(d.rel.empty() ? name : d.rel + "/" + name).value_or(0);
+    append_wire(body, record);
+  }
+  for (const Dir &d : dirs_) {
+    for (uint32_t ref : d.children) {
+      append_wire(body, ScanCacheChild{.ref = ref});
+    }
+  }
+  body.insert(body.end(), names_.begin(), names_.end());
+
+  const ScanCacheHeader header{
+      .magic = KAR_SCAN_MAGIC,
+      .dir_count = static_cast<uint32_t>(dirs_.size()),
+      .file_count = static_cast<uint32_t>(files_.size()),
+      .child_count = child_count,
+      .names_size = static_cast<uint32_t>(names_.size()),
+      .root_length = static_cast<uint32_t>(root_.size()),
+      .scanned_ns = scanned_ns_,
+      .checksum = CRC32().calculate(body)};
+  char wire[sizeof(ScanCacheHeader)];
+  store_wire(wire, header);
+
+  fs::path temp = path;
+  temp += ".tmp";
+  const int fd =
+      ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot create scan cache: " + temp.string() +
+                             " (" + errno_message() + ")");
+  }
+  bool ok = true;
+  for (const auto &[data, n] :
+       {std::pair<const char *, size_t>{wire, sizeof(wire)},
+        std::pair<const char *, size_t>{body.data(), body.size()}}) {
+    size_t done = 0;
+    while (ok && done < n) {
+      ssize_t w = ::write(fd, data + done, n - done);
+      if (w < 0 && errno == EINTR) {
+        continue;
+      }
+      ok = w > 0;
+      done += ok ? static_cast<size_t>(w) : 0;
+    }
+  }
+  const std::string error = ok ? "" : errno_message();
+  if (::close(fd) != 0 || !ok ||
+      ::rename(temp.c_str(), path.c_str()) != 0) {
+    ::unlink(temp.c_str());
+    throw std::runtime_error("Failed to write scan cache: " + path.string() +
+                             (error.empty() ? "" : " (" + error + ")"));
+  }
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "format.hpp"
+#include "io_backend.hpp"
+#include "scanner.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// ============================================
+// 扫描缓存（格式见 format.hpp 中的 ScanCacheHeader）
+//
+// 记录上一次扫描看到的目录（inode、mtime、ctime 与有序的子项列表）与文件
+// （inode、大小、mtime、权限与打包时的 CRC32）。再次扫描同一棵树时，
+// 未变化的目录直接沿用缓存中的列表，不再 getdents64。
+// ============================================
+
+// 缓存中的一个子项
+struct ScanCacheItem {
+  bool is_dir = false;
+  std::string_view name;
+  ScanCacheFile file; // is_dir 为 false 时有效
+};
+
+// 读取：整个文件 mmap，目录按路径建立哈希表，其余按下标访问
+class ScanCache {
+public:
+  // 记录时刻之前这段时间内改动过的目录不沿用：时间戳粒度内的再次改动无法区分
+  static constexpr uint64_t kRacyWindowNs = 1'000'000'000ull;
+
+  // 读取 path；文件不存在时返回 nullptr（首次打包），
+  // 损坏或记录的不是 root 时经 warn 警告并返回 nullptr（退回完整扫描）
+  static std::unique_ptr<ScanCache> load(const fs::path &path,
+                                         const fs::path &root,
+                                         const WarningHandler &warn = {});
+  ~ScanCache();
+
+  ScanCache(const ScanCache &) = delete;
+  ScanCache &operator=(const ScanCache &) = delete;
+
+  // 相对路径为 rel 的目录在记录之后未变化（inode、mtime、ctime 一致且不在
+  // racy 窗口内）时返回其序号
+  std::optional<uint32_t> find_unchanged(const std::string &rel, uint64_t inode,
+                                         uint64_t mtime_ns,
+                                         uint64_t ctime_ns) const;
+
+  // 目录 dir 的子项数与第 i 个子项（getdents64 顺序）
+  uint32_t child_count(uint32_t dir) const;
+  ScanCacheItem child(uint32_t dir, uint32_t i) const;
+
+private:
+  char *mapped_ = nullptr;
+  size_t size_ = 0;
+  ScanCacheHeader header_{};
+  const char *dirs_ = nullptr;
+  const char *files_ = nullptr;
+  const char *children_ = nullptr;
+  const char *names_ = nullptr;
+  std::unordered_map<std::string, uint32_t> dir_index_; // 相对路径 -> 序号
+
+  ScanCache() = default;
+  ScanCacheDir dir(uint32_t index) const;
+  // 校验并建立路径表；格式不符时返回 false
+  bool parse(const fs::path &root);
+};
+
+// 记录：在扫描的回调线程中按深度优先顺序追加，打包完成后写出
+class ScanCacheWriter {
+public:
+  static constexpr uint32_t kNoParent = UINT32_MAX;
+
+  // 以当前时刻为扫描开始时刻
+  explicit ScanCacheWriter(const fs::path &root);
+
+  // 追加目录（根目录的 parent 为 kNoParent），返回其序号
+  uint32_t add_directory(uint32_t parent, std::string_view name, uint64_t inode,
+                         uint64_t mtime_ns, uint64_t ctime_ns);
+
+  // 追加目录 dir 中的文件 entry（名字取 rel_path 的最后一段）
+  void add_file(uint32_t dir, const ScanEntry &entry);
+
+  // 写出到 path（先写临时文件再 rename，中途失败不破坏旧缓存）；
+  // checksum 按相对路径给出各文件打包时的 CRC32，缺失的记为 0。失败时抛出异常
+  void write(const fs::path &path,
+             const std::function<std::optional<uint32_t>(const std::string &)>
+                 &checksum) const;
+
+private:
+  struct Dir {
+    ScanCacheDir record{};
+    std::string rel;
+    std::vector<uint32_t> children; // ScanCacheChild::ref
+  };
+  struct File {
+    ScanCacheFile record{};
+    uint32_t dir = 0;
+  };
+
+  std::string root_;
+  uint64_t scanned_ns_ = 0;
+  std::vector<Dir> dirs_;
+  std::vector<File> files_;
+  std::string names_;
+
+  uint32_t add_name(std::string_view name);
+};
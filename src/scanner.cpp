@@ -0,0 +1,420 @@
+#include "scanner.hpp"
+#include "scan_cache.hpp"
+#include "stage_stats.hpp"
+#include "thread_pool.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <dirent.h>
+#include <exception>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+std::string errno_message() { return std::strerror(errno); }
+
+uint64_t to_ns(const struct timespec &ts) {
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull +
+         static_cast<uint64_t>(ts.tv_nsec);
+}
+
+#if defined(__linux__)
+// getdents64 返回的目录项（内核 ABI，glibc 旧版本未导出）
+struct LinuxDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+#endif
+
+bool is_dot_or_dotdot(const char *name) {
+  return name[0] == '.' &&
+         (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+// 目录 fd：子目录 openat 完成前由子节点共同持有
+struct DirFd {
+  int fd;
+  explicit DirFd(int f) : fd(f) {}
+  ~DirFd() { ::close(fd); }
+};
+
+// 目录节点：由某个线程认领后列出，列出结果按目录项顺序保存
+struct DirNode {
+  enum State { kPending, kClaimed };
+
+  std::string rel;               // 相对源目录的路径（根为空）
+  std::string name;              // 在父目录中的名字
+  std::shared_ptr<DirFd> parent; // 父目录 fd（openat 用，打开后释放）
+  std::atomic<int> state{kPending};
+
+  // 列出时 fstat 得到的目录元数据（写入扫描缓存用）
+  uint64_t inode = 0;
+  uint64_t mtime_ns = 0;
+  uint64_t ctime_ns = 0;
+
+  // 子项：dir 非空为子目录，否则为文件
+  struct Child {
+    ScanEntry file;
+    std::shared_ptr<DirNode> dir;
+  };
+  std::vector<Child> children;
+  std::exception_ptr error;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool ready = false;
+
+  bool claim() {
+    int expected = kPending;
+    return state.compare_exchange_strong(expected, kClaimed);
+  }
+};
+
+// 列出目录的后台任务：每个子目录一个任务，提交到工作窃取线程池。
+// 工作线程内提交的子目录进入自己队列的底部（深度优先，打开的目录 fd 少），
+// 空闲线程从其他队列顶部窃取（浅层目录，子树大）
+class ScanWorkers {
+public:
+  ScanWorkers(const fs::path &root, unsigned threads, const ScanCache *cache,
+              bool trust_files)
+      : root_(root), cache_(cache), trust_files_(trust_files) {
+    if (threads > 0) {
+      pool_ = std::make_unique<ThreadPool>(threads);
+    }
+  }
+
+  // 提前结束（回调停止或出错）时，尚未开始的任务直接返回，不再列出子树
+  ~ScanWorkers() {
+    cancelled_ = true;
+    if (pool_) {
+      pool_->wait_all();
+    }
+  }
+
+  // 沿用扫描缓存列表的目录数
+  uint64_t cached_dirs() const { return cached_dirs_; }
+
+  // 认领并列出节点，结束后唤醒等待者
+  void list(DirNode &node) {
+    try {
+      list_entries(node);
+    } catch (...) {
+      node.error = std::current_exception();
+    }
+    {
+      std::lock_guard<std::mutex> lock(node.mutex);
+      node.ready = true;
+    }
+    node.cv.notify_all();
+  }
+
+  // 等待节点列出：未被认领时由调用线程自己列出
+  void wait(DirNode &node) {
+    if (node.claim()) {
+      list(node);
+    } else {
+      std::unique_lock<std::mutex> lock(node.mutex);
+      node.cv.wait(lock, [&] { return node.ready; });
+    }
+  }
+
+private:
+  fs::path root_;
+  const ScanCache *cache_;
+  bool trust_files_;
+  std::atomic<uint64_t> cached_dirs_{0};
+  std::atomic<bool> cancelled_{false};
+  std::unique_ptr<ThreadPool> pool_; // threads 为 0 时为空
+
+  void push(std::shared_ptr<DirNode> node) {
+    if (!pool_) {
+      return;
+    }
+    pool_->submit([this, node = std::move(node)] {
+      if (!cancelled_ && node->claim()) {
+        list(*node);
+      }
+    });
+  }
+
+  int open_dir(DirNode &node) const {
+    const int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    if (!node.parent) {
+      return ::open(root_.c_str(), flags);
+    }
+    int fd = ::openat(node.parent->fd, node.name.c_str(), flags | O_NOFOLLOW);
+    if (fd < 0 && (errno == EMFILE || errno == ENFILE)) {
+      // fd 耗尽时退回按完整路径打开（父目录 fd 可能已被其他子树占满）
+      fd = ::open((root_ / node.rel).c_str(), flags | O_NOFOLLOW);
+    }
+    return fd;
+  }
+
+  // 取 name 的 stat：符号链接取其指向的普通文件；应跳过（设备、悬空链接、
+  // 目录链接等）时返回 false。is_dir 传入 d_type 判断的结果，遇到目录时置为 true
+  bool stat_child(const DirNode &node, int dir_fd, const char *name,
+                  unsigned char type, struct stat &st, bool &is_dir) const {
+    if (is_dir) {
+      return true;
+    }
+    if (type != DT_REG && type != DT_LNK && type != DT_UNKNOWN) {
+      return false; // 设备、管道、套接字
+    }
+    if (::fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+      const std::string prefix = node.rel.empty() ? "" : node.rel + "/";
+      throw std::runtime_error("Cannot stat file: " + prefix + name + " (" +
+                               errno_message() + ")");
+    }
+    if (S_ISLNK(st.st_mode)) {
+      // 符号链接：只收录指向普通文件的链接，悬空链接与目录链接跳过
+      return ::fstatat(dir_fd, name, &st, 0) == 0 && S_ISREG(st.st_mode);
+    }
+    if (S_ISDIR(st.st_mode)) {
+      is_dir = true;
+      return true;
+    }
+    return S_ISREG(st.st_mode);
+  }
+
+  static DirNode::Child make_child(const std::shared_ptr<DirFd> &dir,
+                                   const std::string &prefix,
+                                   std::string_view name, bool is_dir,
+                                   const struct stat &st) {
+    DirNode::Child child;
+    if (is_dir) {
+      child.dir = std::make_shared<DirNode>();
+      child.dir->rel = prefix + std::string(name);
+      child.dir->name = std::string(name);
+      child.dir->parent = dir;
+    } else {
+      child.file.rel_path = prefix + std::string(name);
+      child.file.size = static_cast<uint64_t>(st.st_size);
+      child.file.mtime_ns = to_ns(st.st_mtim);
+      child.file.mode = st.st_mode;
+      child.file.inode = static_cast<uint64_t>(st.st_ino);
+    }
+    return child;
+  }
+
+  void list_entries(DirNode &node) {
+    StageTimer timer(Stage::Scan);
+    const int raw = open_dir(node);
+    node.parent.reset();
+    if (raw < 0) {
+      throw std::runtime_error("Cannot open directory: " +
+                               (root_ / node.rel).string() + " (" +
+                               errno_message() + ")");
+    }
+    auto dir = std::make_shared<DirFd>(raw);
+    const std::string prefix = node.rel.empty() ? "" : node.rel + "/";
+    struct stat dir_st;
+    if (::fstat(dir->fd, &dir_st) != 0) {
+      throw std::runtime_error("Cannot stat directory: " +
+                               (root_ / node.rel).string() + " (" +
+                               errno_message() + ")");
+    }
+    node.inode = static_cast<uint64_t>(dir_st.st_ino);
+    node.mtime_ns = to_ns(dir_st.st_mtim);
+    node.ctime_ns = to_ns(dir_st.st_ctim);
+
+    std::optional<uint32_t> cached;
+    if (cache_ != nullptr) {
+      cached = cache_->find_unchanged(node.rel, node.inode, node.mtime_ns,
+                                      node.ctime_ns);
+    }
+    if (cached) {
+      list_cached(node, *cached, dir, prefix);
+      ++cached_dirs_;
+    } else {
+      list_fresh(node, dir, prefix);
+    }
+
+    // 列出完成后才发布子目录，保证 children 不再变化
+    for (const DirNode::Child &child : node.children) {
+      if (child.dir) {
+        push(child.dir);
+      }
+    }
+  }
+
+  // 按目录项顺序列出子项：Linux 直接 getdents64 批量读取，
+  // 其他平台经 fdopendir/readdir（复制 fd，DirFd 仍供子目录 openat）
+  void list_fresh(DirNode &node, const std::shared_ptr<DirFd> &dir,
+                  const std::string &prefix) {
+#if defined(__linux__)
+    alignas(LinuxDirent64) char buffer[64 * 1024];
+    while (true) {
+      long n = ::syscall(SYS_getdents64, dir->fd, buffer, sizeof(buffer));
+      if (n < 0) {
+        throw_read_error(node);
+      }
+      if (n == 0) {
+        break;
+      }
+      for (long pos = 0; pos < n;) {
+        const auto *entry = reinterpret_cast<const LinuxDirent64 *>(buffer + pos);
+        pos += entry->d_reclen;
+        add_fresh_child(node, dir, prefix, entry->d_name, entry->d_type);
+      }
+    }
+#else
+    const int copy = ::dup(dir->fd);
+    DIR *stream = copy < 0 ? nullptr : ::fdopendir(copy);
+    if (stream == nullptr) {
+      if (copy >= 0) {
+        ::close(copy);
+      }
+      throw_read_error(node);
+    }
+    std::unique_ptr<DIR, int (*)(DIR *)> guard(stream, ::closedir);
+    while (true) {
+      errno = 0;
+      const struct dirent *entry = ::readdir(stream);
+      if (entry == nullptr) {
+        if (errno != 0) {
+          throw_read_error(node);
+        }
+        break;
+      }
+      add_fresh_child(node, dir, prefix, entry->d_name, entry->d_type);
+    }
+#endif
+  }
+
+  [[noreturn]] void throw_read_error(const DirNode &node) const {
+    throw std::runtime_error("Cannot read directory: " +
+                             (root_ / node.rel).string() + " (" +
+                             errno_message() + ")");
+  }
+
+  void add_fresh_child(DirNode &node, const std::shared_ptr<DirFd> &dir,
+                       const std::string &prefix, const char *name,
+                       unsigned char type) {
+    if (is_dot_or_dotdot(name)) {
+      return;
+    }
+    bool is_dir = type == DT_DIR;
+    struct stat st;
+    if (stat_child(node, dir->fd, name, type, st, is_dir)) {
+      node.children.push_back(make_child(dir, prefix, name, is_dir, st));
+    }
+  }
+
+  // 未变化的目录：子项取自缓存（顺序与上次 getdents64 相同）；
+  // 文件仍逐个 fstatat，与缓存一致时带上记录的 CRC32，trust_files_ 时不再 stat
+  void list_cached(DirNode &node, uint32_t index,
+                   const std::shared_ptr<DirFd> &dir,
+                   const std::string &prefix) {
+    const uint32_t count = cache_->child_count(index);
+    node.children.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+      const ScanCacheItem item = cache_->child(index, i);
+      struct stat st;
+      if (item.is_dir) {
+        node.children.push_back(make_child(dir, prefix, item.name, true, st));
+        continue;
+      }
+      DirNode::Child child;
+      if (trust_files_) {
+        child.file.rel_path = prefix + std::string(item.name);
+        child.file.size = item.file.size;
+        child.file.mtime_ns = item.file.mtime_ns;
+        child.file.mode = item.file.mode;
+        child.file.inode = item.file.inode;
+      } else {
+        const std::string name(item.name);
+        bool is_dir = false;
+        if (!stat_child(node, dir->fd, name.c_str(), DT_UNKNOWN, st, is_dir)) {
+          continue;
+        }
+        child = make_child(dir, prefix, name, is_dir, st);
+        if (is_dir) {
+          node.children.push_back(std::move(child));
+          continue;
+        }
+      }
+      child.file.cached = child.file.inode == item.file.inode &&
+                          child.file.size == item.file.size &&
+                          child.file.mtime_ns == item.file.mtime_ns;
+      child.file.checksum = item.file.checksum;
+      node.children.push_back(std::move(child));
+    }
+  }
+};
+
+} // namespace
+
+uint64_t DirectoryScanner::scan(
+    const fs::path &root,
+    const std::function<bool(ScanEntry &&)> &on_entry) const {
+  ScanWorkers workers(root, threads_, cache_, trust_files_);
+
+  // 显式栈深度优先遍历：(目录, 下一个子项)；已回调的子项随即释放。
+  // 记录扫描缓存时 record_id 为该目录在 record_ 中的序号
+  struct Frame {
+    std::shared_ptr<DirNode> node;
+    size_t next = 0;
+    uint32_t record_id = 0;
+  };
+  std::vector<Frame> stack;
+  auto push_frame = [&](std::shared_ptr<DirNode> node) {
+    if (node->error) {
+      std::rethrow_exception(node->error);
+    }
+    uint32_t record_id = 0;
+    if (record_ != nullptr) {
+      record_id = record_->add_directory(
+          stack.empty() ? ScanCacheWriter::kNoParent : stack.back().record_id,
+          node->name, node->inode, node->mtime_ns, node->ctime_ns);
+    }
+    stack.push_back(Frame{std::move(node), 0, record_id});
+  };
+  auto enter = [&](std::shared_ptr<DirNode> node) {
+    workers.wait(*node);
+    push_frame(std::move(node));
+  };
+
+  auto top = std::make_shared<DirNode>();
+  top->claim();
+  workers.list(*top);
+  push_frame(std::move(top));
+
+  while (!stack.empty()) {
+    Frame &frame = stack.back();
+    if (frame.next == frame.node->children.size()) {
+      stack.pop_back();
+      continue;
+    }
+    DirNode::Child child = std::move(frame.node->children[frame.next++]);
+    if (child.dir) {
+      enter(std::move(child.dir));
+      continue;
+    }
+    child.file.path = root / child.file.rel_path;
+    if (record_ != nullptr) {
+      record_->add_file(frame.record_id, child.file);
+    }
+    if (!on_entry(std::move(child.file))) {
+      break;
+    }
+  }
+  return workers.cached_dirs();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+
+namespace fs = std::filesystem;
+
+class ScanCache;
+class ScanCacheWriter;
+
+// ============================================
+// 目录扫描：多线程并行遍历各子树（空闲线程从其他线程的队列窃取目录），
+// getdents64（非 Linux 平台为 readdir）+ openat/fstatat 相对目录 fd 访问，每个文件只 stat 一次；
+// 给出扫描缓存时，未变化的目录按缓存中的列表访问（见 scan_cache.hpp）
+// ============================================
+
+// 扫描得到的普通文件（大小、权限与 mtime 取自同一次 fstatat）
+struct ScanEntry {
+  fs::path path;         // 源文件路径（source_dir / rel_path）
+  std::string rel_path;  // 相对源目录的路径，'/' 分隔
+  uint64_t size = 0;
+  uint64_t mtime_ns = 0; // 修改时间（Unix 纳秒）
+  uint32_t mode = 0;     // st_mode
+  uint64_t inode = 0;
+  // 与扫描缓存中的记录一致（inode、大小、mtime 均未变）时为 true，
+  // checksum 即上一次打包时的内容 CRC32
+  bool cached = false;
+  uint32_t checksum = 0;
+};
+
+class DirectoryScanner {
+public:
+  // threads 为后台遍历线程数；0 时只在调用线程中遍历
+  explicit DirectoryScanner(unsigned threads) : threads_(threads) {}
+
+  // 使用扫描缓存：inode、mtime 与 ctime 均未变的目录不再 getdents64，按缓存中的
+  // 列表逐个 fstatat；trust_files 时这些目录中的文件也不再 stat，直接取缓存记录
+  // （目录内就地修改的文件因此不会被发现）。record 非空时把本次扫描到的目录与
+  // 文件记入其中，供写出新的缓存
+  void set_cache(const ScanCache *cache, bool trust_files,
+                 ScanCacheWriter *record) {
+    cache_ = cache;
+    trust_files_ = trust_files;
+    record_ = record;
+  }
+
+  // 遍历 root 下的普通文件（含指向普通文件的符号链接，不进入目录符号链接），
+  // 在调用线程中按确定的顺序回调 on_entry：深度优先，目录内按 getdents64 顺序，
+  // 与 fs::recursive_directory_iterator 一致，不受线程数影响。
+  // 后台线程提前列出后续目录，使扫描与回调中的读取重叠。
+  // on_entry 返回 false 时停止；目录或文件无法访问时抛出异常。
+  // 返回沿用扫描缓存列表的目录数
+  uint64_t scan(const fs::path &root,
+                const std::function<bool(ScanEntry &&)> &on_entry) const;
+
+private:
+  unsigned threads_;
+  const ScanCache *cache_ = nullptr;
+  bool trust_files_ = false;
+  ScanCacheWriter *record_ = nullptr;
+};
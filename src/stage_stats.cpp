@@ -0,0 +1,198 @@
+#include "stage_stats.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+// 单写者累加：只有所属线程写入，汇总线程只读，不需要读改写
+void bump(std::atomic<uint64_t> &counter, uint64_t value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+}
+
+size_t bucket_of(uint64_t ns) {
+  size_t bucket = 0;
+  while (ns > 1 && bucket + 1 < StageStats::kHistogramBuckets) {
+    ns >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+} // namespace
+
+const char *stage_name(Stage stage) {
+  switch (stage) {
+  case Stage::Scan:
+    return "scan";
+  case Stage::Open:
+    return "open";
+  case Stage::Read:
+    return "read";
+  case Stage::Crc:
+    return "crc";
+  case Stage::Compress:
+    return "compress";
+  case Stage::Decompress:
+    return "decompress";
+  case Stage::Write:
+    return "write";
+  case Stage::Mkdir:
+    return "mkdir";
+  case Stage::Chmod:
+    return "chmod";
+  }
+  return "unknown";
+}
+
+struct StageStats::ThreadState {
+  struct AtomicCounter {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> ns{0};
+    std::atomic<uint64_t> histogram[kHistogramBuckets] = {};
+  };
+  struct TraceEvent {
+    uint64_t start_ns;
+    uint64_t dur_ns;
+    uint64_t bytes;
+    Stage stage;
+  };
+
+  unsigned thread = 0;
+  AtomicCounter stages[kStageCount];
+  std::vector<TraceEvent> events; // 只由所属线程追加
+};
+
+void StageStats::Counter::merge(const Counter &other) {
+  calls += other.calls;
+  bytes += other.bytes;
+  ns += other.ns;
+  for (size_t i = 0; i < kHistogramBuckets; ++i) {
+    histogram[i] += other.histogram[i];
+  }
+}
+
+uint64_t StageStats::Counter::percentile(double p) const {
+  if (calls == 0) {
+    return 0;
+  }
+  const uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(p * static_cast<double>(calls) + 0.5));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kHistogramBuckets; ++i) {
+    seen += histogram[i];
+    if (seen >= rank) {
+      return 2ull << i;
+    }
+  }
+  return 2ull << (kHistogramBuckets - 1);
+}
+
+StageStats &StageStats::instance() {
+  static StageStats *stats = new StageStats();
+  return *stats;
+}
+
+uint64_t StageStats::now_ns() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+void StageStats::enable(bool trace) {
+  origin_ns_ = now_ns();
+  trace_.store(trace, std::memory_order_relaxed);
+  enabled_.store(true, std::memory_order_release);
+}
+
+StageStats::ThreadState &StageStats::local() {
+  thread_local ThreadState *state = nullptr;
+  if (state == nullptr) {
+    auto owned = std::make_unique<ThreadState>();
+    std::lock_guard<std::mutex> lock(mutex_);
+    owned->thread = static_cast<unsigned>(threads_.size());
+    state = owned.get();
+    threads_.push_back(std::move(owned));
+  }
+  return *state;
+}
+
+void StageStats::record(Stage stage, uint64_t start_ns, uint64_t end_ns,
+                        uint64_t bytes) {
+  ThreadState &state = local();
+  const uint64_t ns = end_ns > start_ns ? end_ns - start_ns : 0;
+  auto &counter = state.stages[static_cast<size_t>(stage)];
+  bump(counter.calls, 1);
+  bump(counter.bytes, bytes);
+  bump(counter.ns, ns);
+  bump(counter.histogram[bucket_of(ns)], 1);
+  if (trace_.load(std::memory_order_relaxed) &&
+      state.events.size() < kMaxTraceEvents) {
+    state.events.push_back(ThreadState::TraceEvent{
+        .start_ns = start_ns, .dur_ns = ns, .bytes = bytes, .stage = stage});
+  }
+}
+
+std::vector<StageStats::ThreadCounters> StageStats::snapshot() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<ThreadCounters> result;
+  result.reserve(threads_.size());
+  for (const auto &state : threads_) {
+    ThreadCounters counters;
+    counters.thread = state->thread;
+    for (size_t s = 0; s < kStageCount; ++s) {
+      const auto &src = state->stages[s];
+      Counter &dst = counters.stages[s];
+      dst.calls = src.calls.load(std::memory_order_relaxed);
+      dst.bytes = src.bytes.load(std::memory_order_relaxed);
+      dst.ns = src.ns.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < kHistogramBuckets; ++i) {
+        dst.histogram[i] = src.histogram[i].load(std::memory_order_relaxed);
+      }
+    }
+    result.push_back(counters);
+  }
+  return result;
+}
+
+void StageStats::write_trace(const std::string &path) const {
+  std::ofstream out(path);
+  if (!out) {
+    throw std::runtime_error("Cannot create trace file: " + path);
+  }
+  // Trace Event Format：每次操作一个完整事件（ph = X），时间单位为微秒
+  std::lock_guard<std::mutex> lock(mutex_);
+  out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+  bool first = true;
+  char line[192];
+  for (const auto &state : threads_) {
+    std::snprintf(line, sizeof(line),
+                  "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                  "\"tid\": %u, \"args\": {\"name\": \"thread %u\"}}",
+                  first ? "" : ",\n", state->thread, state->thread);
+    out << line;
+    first = false;
+    for (const auto &event : state->events) {
+      const uint64_t start =
+          event.start_ns > origin_ns_ ? event.start_ns - origin_ns_ : 0;
+      std::snprintf(line, sizeof(line),
+                    ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+                    "\"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, "
+                    "\"args\": {\"bytes\": %llu}}",
+                    stage_name(event.stage), state->thread, start / 1000.0,
+                    event.dur_ns / 1000.0,
+                    static_cast<unsigned long long>(event.bytes));
+      out << line;
+    }
+  }
+  out << "\n]}\n";
+  if (!out) {
+    throw std::runtime_error("Failed to write trace file: " + path);
+  }
+}
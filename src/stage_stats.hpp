@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// ============================================
+// 分阶段计时（--stats / --trace）
+//
+// 热路径上的每次操作（扫描一个目录、打开、读取、CRC、压缩、写入……）
+// 由 StageTimer 计时，累加到当前线程自己的计数器：单写者，
+// 无锁、无原子读改写；未启用时 StageTimer 只读一个 relaxed 原子标志。
+// 启用 trace 时另外保留逐次事件，可导出为 Chrome trace JSON
+// （chrome://tracing 或 ui.perfetto.dev 直接打开）。
+// ============================================
+
+enum class Stage : uint8_t {
+  Scan,       // 列出一个目录（getdents64 + fstatat）
+  Open,       // 打开输入文件 / 创建输出文件
+  Read,       // 读取源文件或归档（pread / read / io_uring 批量读取）
+  Crc,        // 原样存储内容的 CRC32
+  Compress,   // 分块编码（含块 CRC32）与去重分块
+  Decompress, // 块解码
+  Write,      // 写出归档或解出的文件
+  Mkdir,      // 创建目录（缓存未命中时）
+  Chmod,      // 恢复权限与修改时间
+};
+
+constexpr size_t kStageCount = 9;
+
+const char *stage_name(Stage stage);
+
+class StageStats {
+public:
+  // 耗时直方图：第 i 桶为 [2^i, 2^(i+1)) ns
+  static constexpr size_t kHistogramBuckets = 40;
+  // 每个线程最多保留的 trace 事件数（超出后只计数，不再记录事件）
+  static constexpr size_t kMaxTraceEvents = 1u << 20;
+
+  struct Counter {
+    uint64_t calls = 0;
+    uint64_t bytes = 0;
+    uint64_t ns = 0;
+    uint64_t histogram[kHistogramBuckets] = {};
+
+    void merge(const Counter &other);
+    // 由直方图估计的分位数（所在桶的上界，ns）
+    uint64_t percentile(double p) const;
+  };
+
+  struct ThreadCounters {
+    unsigned thread = 0; // 按首次记录的先后编号
+    Counter stages[kStageCount];
+  };
+
+  // 进程级单例（不析构，线程退出后其计数仍可汇总）
+  static StageStats &instance();
+
+  // 开始记录；trace 为 true 时同时保留逐次事件。应在工作开始前调用
+  void enable(bool trace);
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  // 记录一次操作（由 StageTimer 调用）
+  void record(Stage stage, uint64_t start_ns, uint64_t end_ns, uint64_t bytes);
+
+  // 各线程的计数快照；应在记录线程结束或空闲后调用
+  std::vector<ThreadCounters> snapshot() const;
+
+  // 写出 Chrome trace JSON（需以 trace 启用）；同样应在工作结束后调用
+  void write_trace(const std::string &path) const;
+
+  static uint64_t now_ns();
+
+private:
+  struct ThreadState;
+
+  std::atomic<bool> enabled_{false};
+  std::atomic<bool> trace_{false};
+  uint64_t origin_ns_ = 0; // trace 时间戳的起点
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadState>> threads_;
+
+  StageStats() = default;
+
+  // 当前线程的计数器（首次调用时登记）
+  ThreadState &local();
+};
+
+// 作用域计时：析构时记录一次操作；未启用时不读时钟
+class StageTimer {
+public:
+  explicit StageTimer(Stage stage, uint64_t bytes = 0)
+      : stage_(stage), bytes_(bytes),
+        start_(StageStats::instance().enabled() ? StageStats::now_ns() : 0) {}
+
+  ~StageTimer() {
+    if (start_ != 0) {
+      StageStats::instance().record(stage_, start_, StageStats::now_ns(),
+                                    bytes_);
+    }
+  }
+
+  StageTimer(const StageTimer &) = delete;
+  StageTimer &operator=(const StageTimer &) = delete;
+
+  void add_bytes(uint64_t n) { bytes_ += n; }
+
+private:
+  Stage stage_;
+  uint64_t bytes_;
+  uint64_t start_;
+};
@@ -0,0 +1,136 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// 解析 /sys 的 cpulist 格式（"0-3,8,10-11"）
+std::vector<int> parse_cpu_list(const std::string &text) {
+  std::vector<int> cpus;
+  std::stringstream ss(text);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (item.empty() || item == "\n") {
+      continue;
+    }
+    const size_t dash = item.find('-');
+    try {
+      const int first = std::stoi(item.substr(0, dash));
+      const int last =
+          dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+      for (int cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    } catch (const std::exception &) {
+      return {};
+    }
+  }
+  return cpus;
+}
+
+// 各 NUMA 节点的 CPU 列表；没有 NUMA 信息时全部 CPU 视为一个节点
+std::vector<std::vector<int>> numa_nodes() {
+  std::vector<std::vector<int>> nodes;
+  for (int node = 0;; ++node) {
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) +
+                     "/cpulist");
+    if (!in) {
+      break;
+    }
+    std::string text;
+    std::getline(in, text);
+    nodes.push_back(parse_cpu_list(text));
+  }
+  return nodes;
+}
+
+} // namespace
+
+CpuAffinity parse_cpu_affinity(const std::string &name) {
+  if (name == "none") {
+    return CpuAffinity::None;
+  }
+  if (name == "compact") {
+    return CpuAffinity::Compact;
+  }
+  if (name == "scatter") {
+    return CpuAffinity::Scatter;
+  }
+  throw std::invalid_argument("Unknown CPU affinity: " + name);
+}
+
+std::vector<int> affinity_cpus(CpuAffinity affinity) {
+  std::vector<int> result;
+#if defined(__linux__)
+  if (affinity == CpuAffinity::None) {
+    return result;
+  }
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return result;
+  }
+
+  // 只保留本进程允许使用的 CPU；节点信息缺失时退回单节点
+  std::vector<std::vector<int>> nodes;
+  for (const auto &node : numa_nodes()) {
+    std::vector<int> usable;
+    for (int cpu : node) {
+      if (cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+        usable.push_back(cpu);
+      }
+    }
+    if (!usable.empty()) {
+      nodes.push_back(std::move(usable));
+    }
+  }
+  if (nodes.empty()) {
+    nodes.emplace_back();
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        nodes.back().push_back(cpu);
+      }
+    }
+  }
+
+  if (affinity == CpuAffinity::Compact) {
+    for (const auto &node : nodes) {
+      result.insert(result.end(), node.begin(), node.end());
+    }
+  } else {
+    size_t longest = 0;
+    for (const auto &node : nodes) {
+      longest = std::max(longest, node.size());
+    }
+    for (size_t i = 0; i < longest; ++i) {
+      for (const auto &node : nodes) {
+        if (i < node.size()) {
+          result.push_back(node[i]);
+        }
+      }
+    }
+  }
+#else
+  (void)affinity;
+#endif
+  return result;
+}
+
+void pin_current_thread(int cpu) {
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+#else
+  (void)cpu;
+#endif
+}
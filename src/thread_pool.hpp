@@ -0,0 +1,424 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ============================================
+// 并行基础设施（见 docs/parallel_archive_design.md）
+// ============================================
+
+// 线程安全队列：stop() 之后 pop() 取完剩余元素再返回 false
+template <typename T> class ThreadSafeQueue {
+public:
+  void push(T item) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push(std::move(item));
+    }
+    cond_.notify_one();
+  }
+
+  // 阻塞直到取到元素；队列已停止且为空时返回 false
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      return false;
+    }
+    item = std::move(queue_.front());
+    queue_.pop();
+    return true;
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+  }
+
+  bool empty() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.empty();
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+  }
+
+private:
+  std::queue<T> queue_;
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stop_ = false;
+};
+
+// CPU 亲和性：none 不绑定；compact 按 NUMA 节点依次占满各节点的 CPU
+// （线程共享同一节点的缓存与内存）；scatter 在节点间轮转（聚合各节点的内存带宽）
+enum class CpuAffinity : uint8_t { None, Compact, Scatter };
+
+// "none" / "compact" / "scatter"，其他名称抛出 std::invalid_argument
+CpuAffinity parse_cpu_affinity(const std::string &name);
+
+// 按 affinity 排列的可用 CPU（取自 sched_getaffinity 与 /sys 的 NUMA 拓扑）；
+// None 或无法取得时返回空表
+std::vector<int> affinity_cpus(CpuAffinity affinity);
+
+// 把调用线程绑定到 cpu；失败时忽略（容器或受限的 cpuset）
+void pin_current_thread(int cpu);
+
+// 工作窃取双端队列（Chase-Lev，无锁）：所有者在底部 push / pop（后进先出），
+// 其他线程从顶部 steal（先进先出）。T 须为可平凡复制的类型（这里是任务指针）。
+// 扩容时旧数组保留到析构，窃取者可能仍在读取
+template <typename T> class WorkStealingDeque {
+public:
+  explicit WorkStealingDeque(size_t capacity = 256)
+      : array_(new Array(capacity)) {}
+
+  ~WorkStealingDeque() { delete array_.load(std::memory_order_relaxed); }
+
+  WorkStealingDeque(const WorkStealingDeque &) = delete;
+  WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+  // 仅所有者调用
+  void push(T item) {
+    const int64_t b = bottom_.load(std::memory_order_relaxed);
+    const int64_t t = top_.load(std::memory_order_acquire);
+    Array *a = array_.load(std::memory_order_relaxed);
+    if (b - t > static_cast<int64_t>(a->capacity) - 1) {
+      a = grow(a, t, b);
+    }
+    a->put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // 仅所有者调用；为空（或最后一个元素被窃取）时返回 false
+  bool pop(T &item) {
+    const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array *a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    item = a->get(b);
+    if (t == b) {
+      // 只剩一个元素：与窃取者竞争
+      const bool won = top_.compare_exchange_strong(
+          t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  // 任意线程调用；为空或与其他线程竞争失败时返回 false
+  bool steal(T &item) {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) {
+      return false;
+    }
+    Array *a = array_.load(std::memory_order_acquire);
+    T x = a->get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return false;
+    }
+    item = x;
+    return true;
+  }
+
+  bool empty() const {
+    return top_.load(std::memory_order_acquire) >=
+           bottom_.load(std::memory_order_acquire);
+  }
+
+private:
+  struct Array {
+    size_t capacity; // 2 的幂
+    std::unique_ptr<std::atomic<T>[]> slots;
+
+    explicit Array(size_t n) : capacity(n), slots(new std::atomic<T>[n]) {}
+    T get(int64_t i) const {
+      return slots[static_cast<size_t>(i) & (capacity - 1)].load(
+          std::memory_order_relaxed);
+    }
+    void put(int64_t i, T item) {
+      slots[static_cast<size_t>(i) & (capacity - 1)].store(
+          item, std::memory_order_relaxed);
+    }
+  };
+
+  alignas(64) std::atomic<int64_t> top_{0};
+  alignas(64) std::atomic<int64_t> bottom_{0};
+  alignas(64) std::atomic<Array *> array_;
+  std::vector<std::unique_ptr<Array>> retired_; // 仅所有者访问
+
+  Array *grow(Array *old, int64_t t, int64_t b) {
+    auto bigger = std::make_unique<Array>(old->capacity * 2);
+    for (int64_t i = t; i < b; ++i) {
+      bigger->put(i, old->get(i));
+    }
+    retired_.emplace_back(old);
+    Array *a = bigger.release();
+    array_.store(a, std::memory_order_release);
+    return a;
+  }
+};
+
+// 工作窃取线程池：每个工作线程一个无锁双端队列，外部线程提交的任务进入
+// 共享的提交队列（提交方之间以互斥量串行，工作线程取任务不加锁）。
+// 工作线程先取自己队列的底部（工作线程内提交的子任务，缓存仍热），
+// 再按提交顺序从提交队列窃取，最后从其他工作线程的队列顶部窃取；
+// 都没有任务时短暂让出 CPU，之后在条件变量上休眠，直到有新任务
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t num_threads,
+                      CpuAffinity affinity = CpuAffinity::None) {
+    if (num_threads == 0) {
+      num_threads = 1;
+    }
+    const std::vector<int> cpus = affinity_cpus(affinity);
+    queues_.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+      queues_.push_back(std::make_unique<WorkStealingDeque<Job *>>());
+    }
+    workers_.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+      const int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+      workers_.emplace_back([this, i, cpu] { worker_loop(i, cpu); });
+    }
+  }
+
+  ~ThreadPool() { wait_all(); }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(std::function<void()> job) {
+    Job *task = new Job(std::move(job));
+    if (current_pool_ == this) {
+      queues_[current_worker_]->push(task);
+    } else {
+      std::lock_guard<std::mutex> lock(submit_mutex_);
+      submitted_.push(task);
+    }
+    // 先入队再计数：工作线程看到计数时一定能找到任务
+    pending_.fetch_add(1, std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_seq_cst) > 0) {
+      { std::lock_guard<std::mutex> lock(idle_mutex_); }
+      idle_cv_.notify_one();
+    }
+  }
+
+  // 限制参与取任务的工作线程数（自适应并发，取值 [1, size()]）：
+  // 序号不小于 n 的线程只取完自己队列中的任务，之后在单独的条件变量上
+  // 停放到重新启用（提交任务不会唤醒它们）。
+  // wait_all() 开始后不再生效，剩余任务由全部线程执行
+  void set_active(size_t n) {
+    n = std::max<size_t>(1, std::min(n, workers_.size()));
+    {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+      if (stop_) {
+        return;
+      }
+      active_.store(n, std::memory_order_relaxed);
+    }
+    idle_cv_.notify_all(); // 被停用的休眠线程转去停放
+    parked_cv_.notify_all();
+  }
+
+  size_t active() const { return active_.load(std::memory_order_relaxed); }
+
+  // 停止接收任务，等待已提交的任务全部执行完毕
+  void wait_all() {
+    {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+      stop_ = true;
+      active_.store(workers_.size(), std::memory_order_relaxed);
+    }
+    idle_cv_.notify_all();
+    parked_cv_.notify_all();
+    for (auto &worker : workers_) {
+      if (worker.joinable()) {
+        worker.join();
+      }
+    }
+  }
+
+  size_t size() const { return workers_.size(); }
+
+  // 各工作线程从其他队列窃取到的任务数之和（不含提交队列）
+  uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+  using Job = std::function<void()>;
+
+  static constexpr int kSpinRounds = 64; // 休眠前让出 CPU 的轮数
+
+  std::vector<std::unique_ptr<WorkStealingDeque<Job *>>> queues_;
+  WorkStealingDeque<Job *> submitted_;
+  std::mutex submit_mutex_;
+  std::vector<std::thread> workers_;
+  std::atomic<int64_t> pending_{0}; // 已入队、尚未被取走的任务数
+  std::atomic<int> sleepers_{0};
+  std::atomic<uint64_t> steals_{0};
+  std::atomic<size_t> active_{SIZE_MAX}; // 受 idle_mutex_ 保护地修改
+  std::mutex idle_mutex_;
+  std::condition_variable idle_cv_;
+  std::condition_variable parked_cv_; // 停用的线程（见 set_active）
+  bool stop_ = false; // 受 idle_mutex_ 保护
+
+  static inline thread_local ThreadPool *current_pool_ = nullptr;
+  static inline thread_local size_t current_worker_ = 0;
+
+  Job *find_job(size_t self, uint64_t &seed) {
+    Job *job = nullptr;
+    if (queues_[self]->pop(job) || submitted_.steal(job)) {
+      return job;
+    }
+    // 从随机位置开始依次尝试其他工作线程，避免窃取者集中到同一个队列
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    const size_t n = queues_.size();
+    const size_t start = static_cast<size_t>(seed % n);
+    for (size_t k = 0; k < n; ++k) {
+      const size_t victim = (start + k) % n;
+      if (victim != self && queues_[victim]->steal(job)) {
+        steals_.fetch_add(1, std::memory_order_relaxed);
+        return job;
+      }
+    }
+    return nullptr;
+  }
+
+  void worker_loop(size_t self, int cpu) {
+    if (cpu >= 0) {
+      pin_current_thread(cpu);
+    }
+    current_pool_ = this;
+    current_worker_ = self;
+    uint64_t seed = 0x9E3779B97F4A7C15ull * (self + 1);
+    int idle_rounds = 0;
+    while (true) {
+      // 停用的线程只取自己队列中的任务（其他线程也可以窃取）
+      const bool enabled = self < active_.load(std::memory_order_relaxed);
+      Job *job = nullptr;
+      if (enabled ? (job = find_job(self, seed)) != nullptr
+                  : queues_[self]->pop(job)) {
+        pending_.fetch_sub(1, std::memory_order_seq_cst);
+        idle_rounds = 0;
+        (*job)();
+        delete job;
+        continue;
+      }
+      if (!enabled) {
+        std::unique_lock<std::mutex> lock(idle_mutex_);
+        parked_cv_.wait(lock, [this, self] {
+          return stop_ || self < active_.load(std::memory_order_relaxed);
+        });
+        idle_rounds = 0;
+        continue;
+      }
+      if (pending_.load(std::memory_order_seq_cst) > 0 ||
+          ++idle_rounds < kSpinRounds) {
+        std::this_thread::yield(); // 任务正被其他线程取走，或即将到达
+        continue;
+      }
+      // 休眠中被停用时同样醒来，转去停放：提交方的单个通知只落在启用的线程上
+      std::unique_lock<std::mutex> lock(idle_mutex_);
+      sleepers_.fetch_add(1, std::memory_order_seq_cst);
+      idle_cv_.wait(lock, [this, self] {
+        return stop_ || pending_.load(std::memory_order_seq_cst) > 0 ||
+               self >= active_.load(std::memory_order_relaxed);
+      });
+      sleepers_.fetch_sub(1, std::memory_order_seq_cst);
+      if (stop_ && pending_.load(std::memory_order_seq_cst) <= 0) {
+        return;
+      }
+      idle_rounds = 0;
+    }
+  }
+};
+
+// 在途字节预算：限制同时驻留内存的文件内容总量
+//
+// 单个超过预算的文件在没有其他在途数据时仍允许通过，避免永久阻塞。
+class MemoryLimiter {
+public:
+  explicit MemoryLimiter(size_t max_bytes) : max_usage_(max_bytes) {}
+
+  // 预算不足时阻塞；stop() 之后立即返回 false
+  bool acquire(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [&] {
+      return stop_ || current_usage_ == 0 ||
+             current_usage_ + bytes <= max_usage_;
+    });
+    if (stop_) {
+      return false;
+    }
+    current_usage_ += bytes;
+    return true;
+  }
+
+  // 不阻塞：预算不足（或已 stop()）时返回 false
+  bool try_acquire(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_ || (current_usage_ != 0 && current_usage_ + bytes > max_usage_)) {
+      return false;
+    }
+    current_usage_ += bytes;
+    return true;
+  }
+
+  // 调整预算（自适应并发随工作线程数缩放）；调小时已在途的数据不受影响
+  void set_limit(size_t max_bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      max_usage_ = max_bytes;
+    }
+    cond_.notify_all();
+  }
+
+  void release(size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      current_usage_ -= bytes;
+    }
+    cond_.notify_all();
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+  }
+
+private:
+  size_t current_usage_ = 0;
+  size_t max_usage_;
+  bool stop_ = false;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+};
@@ -0,0 +1,236 @@
+#include "throttle.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+uint64_t parse_bandwidth_limit(const std::string &text) {
+  size_t used = 0;
+  double mb = 0;
+  try {
+    mb = std::stod(text, &used);
+  } catch (const std::exception &) {
+    throw std::invalid_argument("Invalid bandwidth limit: " + text);
+  }
+  if (used != text.size() || !std::isfinite(mb) || mb <= 0 || mb > 1e9) {
+    throw std::invalid_argument("Invalid bandwidth limit: " + text);
+  }
+  return std::max<uint64_t>(1, static_cast<uint64_t>(mb * 1024 * 1024));
+}
+
+// ============================================
+// BandwidthLimiter
+// ============================================
+
+BandwidthLimiter::BandwidthLimiter(uint64_t bytes_per_second)
+    : rate_(std::max<uint64_t>(1, bytes_per_second)),
+      burst_(static_cast<double>(rate_) *
+             std::chrono::duration<double>(kBurst).count()),
+      tokens_(burst_), refilled_(Clock::now()) {}
+
+void BandwidthLimiter::consume(uint64_t bytes) {
+  double wait = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Clock::time_point now = Clock::now();
+    const double elapsed =
+        std::chrono::duration<double>(now - refilled_).count();
+    tokens_ = std::min(burst_, tokens_ + elapsed * static_cast<double>(rate_));
+    refilled_ = now;
+    tokens_ -= static_cast<double>(bytes);
+    if (tokens_ < 0) {
+      wait = -tokens_ / static_cast<double>(rate_);
+    }
+  }
+  if (wait > 0) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+  }
+}
+
+// ============================================
+// ConcurrencyTuner
+// ============================================
+
+ConcurrencyTuner::ConcurrencyTuner(size_t max_workers, size_t initial)
+    : max_(std::max<size_t>(1, max_workers)),
+      current_(initial == 0 ? max_ : std::min(initial, max_)),
+      base_(current_), step_(std::max<size_t>(1, max_ / 4)) {}
+
+size_t ConcurrencyTuner::update(double rate) {
+  if (warmup_) {
+    warmup_ = false;
+    return current_;
+  }
+  if (settled_) {
+    base_rate_ = 0.8 * base_rate_ + 0.2 * rate;
+    if (++settled_windows_ >= kSettledWindows) {
+      settled_ = false;
+      step_ = std::max<size_t>(1, base_ / 4);
+      direction_ = -1;
+      turned_ = false;
+      propose();
+    }
+    return current_;
+  }
+  if (current_ == base_) {
+    // 起点（或重新试探前）的测量
+    base_rate_ = rate;
+  } else if (rate > base_rate_ * (1 + kMinGain)) {
+    base_ = current_;
+    base_rate_ = rate;
+    turned_ = true; // 来的方向已知更差
+  } else if (!turned_) {
+    direction_ = -direction_;
+    turned_ = true;
+  } else {
+    step_ /= 2;
+    turned_ = false;
+  }
+  propose();
+  return current_;
+}
+
+void ConcurrencyTuner::propose() {
+  while (step_ > 0) {
+    const int64_t candidate = static_cast<int64_t>(base_) +
+                              direction_ * static_cast<int64_t>(step_);
+    if (candidate >= 1 && candidate <= static_cast<int64_t>(max_)) {
+      current_ = static_cast<size_t>(candidate);
+      warmup_ = true;
+      return;
+    }
+    if (!turned_) {
+      direction_ = -direction_;
+      turned_ = true;
+    } else {
+      step_ /= 2;
+      turned_ = false;
+    }
+  }
+  warmup_ = current_ != base_;
+  current_ = base_;
+  settled_ = true;
+  settled_windows_ = 0;
+}
+
+// ============================================
+// AdaptiveController
+// ============================================
+
+bool io_bound(const StageTimes &delta) {
+  auto ns = [&](Stage stage) { return delta[static_cast<size_t>(stage)]; };
+  const uint64_t io = ns(Stage::Scan) + ns(Stage::Open) + ns(Stage::Read) +
+                      ns(Stage::Write) + ns(Stage::Mkdir) + ns(Stage::Chmod);
+  const uint64_t compute =
+      ns(Stage::Crc) + ns(Stage::Compress) + ns(Stage::Decompress);
+  return io > compute;
+}
+
+AdaptiveController::AdaptiveController(ThreadPool &pool,
+                                       const std::atomic<uint64_t> &progress,
+                                       MemoryLimiter *limiter,
+                                       size_t max_inflight, size_t min_inflight)
+    : pool_(pool), progress_(progress), limiter_(limiter),
+      max_inflight_(max_inflight), min_inflight_(min_inflight),
+      io_tuner_(pool.size(), initial_workers(pool.size())),
+      cpu_tuner_(initial_workers(pool.size())), tuner_(&cpu_tuner_) {
+  // 瓶颈判断依赖分阶段计数；未经 --stats 启用时在这里启用（不输出）
+  if (!StageStats::instance().enabled()) {
+    StageStats::instance().enable(false);
+  }
+  apply(tuner_->workers());
+  thread_ = std::thread([this] { run(); });
+}
+
+AdaptiveController::~AdaptiveController() { stop(); }
+
+size_t AdaptiveController::initial_workers(size_t max_workers) {
+  return std::max<size_t>(
+      1, std::min<size_t>(max_workers, std::thread::hardware_concurrency()));
+}
+
+size_t AdaptiveController::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+    apply(pool_.size());
+  }
+  return tuner_->best();
+}
+
+void AdaptiveController::apply(size_t workers) {
+  pool_.set_active(workers);
+  if (limiter_ != nullptr) {
+    limiter_->set_limit(
+        std::max(min_inflight_, max_inflight_ * workers / pool_.size()));
+  }
+}
+
+StageTimes AdaptiveController::stage_totals() {
+  StageTimes totals{};
+  for (const auto &thread : StageStats::instance().snapshot()) {
+    for (size_t s = 0; s < kStageCount; ++s) {
+      totals[s] += thread.stages[s].ns;
+    }
+  }
+  return totals;
+}
+
+void AdaptiveController::run() {
+  using Clock = std::chrono::steady_clock;
+  uint64_t last_bytes = progress_.load(std::memory_order_relaxed);
+  Clock::time_point last_time = Clock::now();
+  StageTimes last_stages = stage_totals();
+  unsigned other_windows = 0; // 瓶颈连续指向另一个搜索的窗口数
+  bool transition = false;    // 刚切换搜索，本窗口不计入比较
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cond_.wait_for(lock, kSampleInterval, [this] { return stop_; })) {
+    const uint64_t bytes = progress_.load(std::memory_order_relaxed);
+    const Clock::time_point now = Clock::now();
+    if (bytes - last_bytes < kMinSampleBytes &&
+        now - last_time < kMaxSampleTime) {
+      continue;
+    }
+    const double seconds = std::chrono::duration<double>(now - last_time).count();
+    const double rate = static_cast<double>(bytes - last_bytes) / seconds;
+    last_bytes = bytes;
+    last_time = now;
+
+    const StageTimes stages = stage_totals();
+    StageTimes delta{};
+    uint64_t busy = 0;
+    for (size_t s = 0; s < kStageCount; ++s) {
+      delta[s] = stages[s] - last_stages[s];
+      busy += delta[s];
+    }
+    last_stages = stages;
+    ConcurrencyTuner *wanted = tuner_;
+    if (busy > 0) {
+      wanted = io_bound(delta) ? &io_tuner_ : &cpu_tuner_;
+    }
+    if (wanted != tuner_) {
+      if (++other_windows < kSwitchWindows) {
+        continue;
+      }
+      tuner_ = wanted;
+      other_windows = 0;
+      transition = true;
+      apply(tuner_->workers());
+      continue;
+    }
+    other_windows = 0;
+    if (transition) {
+      transition = false;
+      continue;
+    }
+    const size_t before = tuner_->workers();
+    if (tuner_->update(rate) != before) {
+      apply(tuner_->workers());
+    }
+  }
+}
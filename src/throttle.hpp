@@ -0,0 +1,151 @@
+#pragma once
+
+#include "stage_stats.hpp"
+#include "thread_pool.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// ============================================
+// 限速与自适应并发（--bwlimit / --adaptive）
+//
+// BandwidthLimiter 是多线程共享的令牌桶；AdaptiveController 在后台线程中
+// 定期读取流水线的进度字节数与各阶段的耗时（StageStats），按瓶颈在 I/O
+// 还是计算分别由一个 ConcurrencyTuner 爬山搜索吞吐最高的工作线程数，
+// 在途预算随之按比例缩放。
+// ============================================
+
+// 解析 --bwlimit 参数（MB/s，可带小数），返回字节/秒；非正数抛出 std::invalid_argument
+uint64_t parse_bandwidth_limit(const std::string &text);
+
+// 令牌桶：按 rate 字节/秒补充令牌，至多积累 kBurst 时长的量。
+// consume() 先预支令牌再在锁外休眠到余额回正，
+// 大块请求不会饿死，并发调用者按到达顺序分摊带宽
+class BandwidthLimiter {
+public:
+  static constexpr std::chrono::milliseconds kBurst{100};
+
+  explicit BandwidthLimiter(uint64_t bytes_per_second);
+
+  // 取走 bytes 字节的令牌，不足时阻塞
+  void consume(uint64_t bytes);
+
+  uint64_t rate() const { return rate_; }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  uint64_t rate_;
+  double burst_;  // 令牌上限（字节）
+  double tokens_; // 可为负：已预支、尚未补足的字节数
+  Clock::time_point refilled_;
+  std::mutex mutex_;
+};
+
+// 工作线程数的爬山搜索（纯逻辑，不读时钟）：每个采样窗口报告一次吞吐，
+// 返回下一窗口使用的线程数。
+//
+// 从 initial 起，按步长 max_workers / 4 先向下试探：吞吐提高超过
+// kMinGain 则接受并同向继续，否则退回并换向；两个方向都不更好时步长减半，
+// 步长为 0 即稳定。稳定 kSettledWindows 个窗口后以较小步长重新试探，
+// 跟随工作负载的变化（如从小文件转到大文件）。调整后的第一个窗口含有
+// 过渡期的抖动，不计入比较
+class ConcurrencyTuner {
+public:
+  static constexpr double kMinGain = 0.05;
+  static constexpr unsigned kSettledWindows = 30;
+
+  // initial 为起点（0 取 max_workers），超出 [1, max_workers] 时截断
+  explicit ConcurrencyTuner(size_t max_workers, size_t initial = 0);
+
+  // 下一窗口的线程数
+  size_t workers() const { return current_; }
+
+  // 已接受的最佳线程数
+  size_t best() const { return base_; }
+
+  // 报告刚结束窗口的吞吐（字节/秒），返回下一窗口的线程数
+  size_t update(double rate);
+
+private:
+  size_t max_;
+  size_t current_;
+  size_t base_;          // 已接受的线程数
+  double base_rate_ = 0; // base_ 的吞吐（稳定期为滑动平均）
+  size_t step_;
+  int direction_ = -1;
+  bool turned_ = false;  // 本步长下另一方向已经试过（或已知更差）
+  bool settled_ = false;
+  bool warmup_ = false;  // 下一窗口为调整后的过渡期
+  unsigned settled_windows_ = 0;
+
+  // 从 base_ 出发选下一个候选；步长耗尽时稳定在 base_
+  void propose();
+};
+
+// 各阶段的累计耗时（ns），按 Stage 编号
+using StageTimes = std::array<uint64_t, kStageCount>;
+
+// 一个采样窗口内各阶段的耗时增量是否以 I/O 为主：扫描、打开、读写与
+// 目录 / 元数据操作的耗时多于 CRC 与编解码时返回 true
+bool io_bound(const StageTimes &delta);
+
+// 自适应并发：构造时启动采样线程，析构时停止。每 kSampleInterval 读取
+// progress（流水线已完成的字节数），窗口内不足 kMinSampleBytes 时延长窗口
+// （至多 kMaxSampleTime），避免按分块完成的粗粒度进度造成误判。
+// 窗口结束时由 StageStats 的各阶段耗时增量判断瓶颈（需要时自动启用计数，
+// 不输出），把吞吐交给对应的 ConcurrencyTuner：I/O 受限时在 [1, 线程池大小]
+// 内搜索（多于 CPU 数的线程可掩盖 I/O 延迟），计算受限时至多 CPU 数。
+// 瓶颈连续 kSwitchWindows 个窗口转向另一类才切换，换用的搜索从它上次的
+// 线程数继续。之后经 ThreadPool::set_active() 调整参与取任务的线程数；
+// limiter 非空时把在途预算调为 max_inflight 乘以启用比例（不少于 min_inflight）。
+// 两个搜索都从线程池大小与 CPU 数中较小者开始
+class AdaptiveController {
+public:
+  static constexpr std::chrono::milliseconds kSampleInterval{100};
+  static constexpr uint64_t kMinSampleBytes = 32ull * 1024 * 1024;
+  static constexpr std::chrono::milliseconds kMaxSampleTime{1000};
+  static constexpr unsigned kSwitchWindows = 2;
+
+  AdaptiveController(ThreadPool &pool, const std::atomic<uint64_t> &progress,
+                     MemoryLimiter *limiter = nullptr, size_t max_inflight = 0,
+                     size_t min_inflight = 0);
+  ~AdaptiveController();
+
+  AdaptiveController(const AdaptiveController &) = delete;
+  AdaptiveController &operator=(const AdaptiveController &) = delete;
+
+  // 搜索的起点（线程池大小为 max_workers 时），也供流水线中不受控制器
+  // 调整的部分（如扫描的目录列出线程）取用
+  static size_t initial_workers(size_t max_workers);
+
+  // 停止采样并恢复全部线程与完整预算；返回最后使用的搜索所接受的线程数
+  // （可重复调用）
+  size_t stop();
+
+private:
+  ThreadPool &pool_;
+  const std::atomic<uint64_t> &progress_;
+  MemoryLimiter *limiter_;
+  size_t max_inflight_;
+  size_t min_inflight_;
+  ConcurrencyTuner io_tuner_;  // I/O 受限时的搜索
+  ConcurrencyTuner cpu_tuner_; // 计算受限时的搜索（至多 CPU 数）
+  ConcurrencyTuner *tuner_;    // 当前使用的搜索（只由采样线程切换）
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stop_ = false; // 受 mutex_ 保护
+  std::thread thread_;
+
+  void apply(size_t workers);
+  void run();
+  // 各阶段在全部线程上的累计耗时
+  static StageTimes stage_totals();
+};
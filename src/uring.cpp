@@ -0,0 +1,279 @@
+#include "uring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if KAR_HAVE_IO_URING
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if KAR_HAVE_IO_URING
+
+namespace {
+
+std::string errno_message() { return std::strerror(errno); }
+
+int uring_setup(unsigned entries, io_uring_params *params) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                unsigned flags) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, nullptr, 0));
+}
+
+int uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+  return static_cast<int>(
+      ::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+bool probe() {
+  try {
+    IoUring ring(4);
+    ring.register_sparse_files(1);
+    return true;
+  } catch (const std::exception &) {
+    return false;
+  }
+}
+
+} // namespace
+
+IoUring::IoUring(unsigned entries) {
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  fd_ = uring_setup(entries, &params);
+  if (fd_ < 0) {
+    throw std::runtime_error("io_uring_setup failed: " + errno_message());
+  }
+  sq_entries_ = params.sq_entries;
+
+  // 环形队列映射：内核支持时 SQ 与 CQ 共用一次 mmap
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+  sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    sq_ring_ = nullptr;
+    ::close(fd_);
+    throw std::runtime_error("io_uring mmap failed: " + errno_message());
+  }
+  if (single) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      cq_ring_ = nullptr;
+      unmap();
+      throw std::runtime_error("io_uring mmap failed: " + errno_message());
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    unmap();
+    throw std::runtime_error("io_uring mmap failed: " + errno_message());
+  }
+  sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+  char *sq = static_cast<char *>(sq_ring_);
+  sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  sqe_tail_ = *sq_tail_;
+  char *cq = static_cast<char *>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() { unmap(); }
+
+void IoUring::unmap() {
+  if (sqes_ != nullptr) {
+    ::munmap(sqes_, sqes_size_);
+    sqes_ = nullptr;
+  }
+  if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+    ::munmap(cq_ring_, cq_ring_size_);
+  }
+  cq_ring_ = nullptr;
+  if (sq_ring_ != nullptr) {
+    ::munmap(sq_ring_, sq_ring_size_);
+    sq_ring_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool IoUring::supported() {
+  static const bool result = probe();
+  return result;
+}
+
+void IoUring::register_sparse_files(unsigned count) {
+  // 检查用到的操作码（旧内核可创建 io_uring 但不支持 OPENAT/CLOSE 等）
+  constexpr unsigned kOps = IORING_OP_LAST;
+  char storage[sizeof(io_uring_probe) + kOps * sizeof(io_uring_probe_op)] = {};
+  auto *ops = reinterpret_cast<io_uring_probe *>(storage);
+  if (uring_register(fd_, IORING_REGISTER_PROBE, ops, kOps) < 0) {
+    throw std::runtime_error("io_uring probe failed: " + errno_message());
+  }
+  for (unsigned op : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE,
+                      IORING_OP_WRITE}) {
+    if (op > ops->last_op || !(ops->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      throw std::runtime_error("io_uring operation not supported");
+    }
+  }
+
+  // 全部为 -1 的文件表即空槽位
+  std::string fds(count * sizeof(int), '\xff');
+  if (uring_register(fd_, IORING_REGISTER_FILES, fds.data(), count) < 0) {
+    throw std::runtime_error("io_uring file registration failed: " +
+                             errno_message());
+  }
+}
+
+io_uring_sqe *IoUring::get_sqe() {
+  const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sqe_tail_ - head >= sq_entries_) {
+    return nullptr;
+  }
+  const unsigned index = sqe_tail_ & *sq_mask_;
+  io_uring_sqe *sqe = &sqes_[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  ++sqe_tail_;
+  ++pending_;
+  return sqe;
+}
+
+bool IoUring::queue_read_file(unsigned slot, const char *path, void *buf,
+                              unsigned len, uint64_t tag) {
+  const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sq_entries_ - (sqe_tail_ - head) < 3) {
+    return false;
+  }
+  // 打开失败时取消后续读取与关闭（IO_LINK）；读取失败或不完整时仍关闭（HARDLINK）
+  io_uring_sqe *open = get_sqe();
+  open->opcode = IORING_OP_OPENAT;
+  open->fd = AT_FDCWD;
+  open->addr = reinterpret_cast<uint64_t>(path);
+  open->open_flags = O_RDONLY; // direct descriptor 不接受 O_CLOEXEC
+  open->file_index = slot + 1;
+  open->flags = IOSQE_IO_LINK;
+  open->user_data = (tag << 2) | kOpen;
+
+  io_uring_sqe *read = get_sqe();
+  read->opcode = IORING_OP_READ;
+  read->fd = static_cast<int>(slot);
+  read->addr = reinterpret_cast<uint64_t>(buf);
+  read->len = len;
+  read->off = 0;
+  read->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+  read->user_data = (tag << 2) | kRead;
+
+  io_uring_sqe *close = get_sqe();
+  close->opcode = IORING_OP_CLOSE;
+  close->file_index = slot + 1;
+  close->user_data = (tag << 2) | kClose;
+  return true;
+}
+
+bool IoUring::queue_write(int fd, const void *buf, unsigned len,
+                          uint64_t offset, uint64_t user_data) {
+  io_uring_sqe *sqe = get_sqe();
+  if (sqe == nullptr) {
+    return false;
+  }
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = len;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+  return true;
+}
+
+void IoUring::submit_and_wait(unsigned wait_nr) {
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+  while (pending_ > 0 || wait_nr > 0) {
+    int ret = uring_enter(fd_, pending_, wait_nr,
+                          wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("io_uring_enter failed: " + errno_message());
+    }
+    pending_ -= std::min<unsigned>(pending_, static_cast<unsigned>(ret));
+    wait_nr = 0; // 已满足：内核在返回前等到了 min_complete 个完成事件
+  }
+}
+
+bool IoUring::pop_cqe(io_uring_cqe &cqe) {
+  const unsigned head = *cq_head_;
+  if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  cqe = cqes_[head & *cq_mask_];
+  __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+void IoUring::wait_cqe(io_uring_cqe &cqe) {
+  while (!pop_cqe(cqe)) {
+    submit_and_wait(1);
+  }
+}
+
+#else // !KAR_HAVE_IO_URING
+
+IoUring::IoUring(unsigned) {
+  throw std::runtime_error("io_uring is not available on this platform");
+}
+
+IoUring::~IoUring() = default;
+
+void IoUring::unmap() {}
+
+bool IoUring::supported() { return false; }
+
+void IoUring::register_sparse_files(unsigned) {}
+
+bool IoUring::queue_read_file(unsigned, const char *, void *, unsigned,
+                              uint64_t) {
+  return false;
+}
+
+bool IoUring::queue_write(int, const void *, unsigned, uint64_t, uint64_t) {
+  return false;
+}
+
+io_uring_sqe *IoUring::get_sqe() { return nullptr; }
+
+void IoUring::submit_and_wait(unsigned) {}
+
+bool IoUring::pop_cqe(io_uring_cqe &) { return false; }
+
+void IoUring::wait_cqe(io_uring_cqe &) {}
+
+#endif
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define KAR_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#else
+#define KAR_HAVE_IO_URING 0
+struct io_uring_sqe;
+struct io_uring_cqe {
+  uint64_t user_data;
+  int32_t res;
+  uint32_t flags;
+};
+#endif
+
+// ============================================
+// io_uring：直接使用系统调用的最小封装（不依赖 liburing）
+// 单线程使用；每个工作线程各自持有一个实例
+// ============================================
+class IoUring {
+public:
+  // entries 为提交队列长度；内核不支持或被禁用（seccomp 等）时抛出异常
+  explicit IoUring(unsigned entries);
+  ~IoUring();
+
+  IoUring(const IoUring &) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+
+  // 当前内核能否创建 io_uring，且支持批量读取与异步写入用到的操作
+  // （OPENAT / READ / CLOSE / WRITE 与 direct descriptor）；结果缓存
+  static bool supported();
+
+  // 注册 count 个空的 direct descriptor 槽位（OPENAT 的 file_index 使用）
+  void register_sparse_files(unsigned count);
+
+  // 排入一条链：openat 到 direct descriptor 槽位 slot -> 读取前 len 字节到 buf
+  // -> 关闭槽位。三个完成事件的 user_data 为 (tag << 2) | kOpen/kRead/kClose；
+  // 提交队列空间不足时返回 false
+  enum ReadStep : uint64_t { kOpen = 0, kRead = 1, kClose = 2 };
+  bool queue_read_file(unsigned slot, const char *path, void *buf, unsigned len,
+                       uint64_t tag);
+
+  // 排入一次写入（pwrite 语义，不改变 fd 的文件偏移）；队列已满时返回 false
+  bool queue_write(int fd, const void *buf, unsigned len, uint64_t offset,
+                   uint64_t user_data);
+
+  // 提交全部已填充的 SQE，并等待至少 wait_nr 个完成事件
+  void submit_and_wait(unsigned wait_nr);
+
+  // 取出一个完成事件；没有已完成的事件时返回 false
+  bool pop_cqe(io_uring_cqe &cqe);
+
+  // 取出一个完成事件，必要时阻塞等待
+  void wait_cqe(io_uring_cqe &cqe);
+
+  unsigned entries() const { return sq_entries_; }
+
+private:
+  int fd_ = -1;
+  unsigned sq_entries_ = 0;
+  unsigned pending_ = 0; // 已填充、尚未提交的 SQE 数
+
+  void *sq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  void *cq_ring_ = nullptr;
+  size_t cq_ring_size_ = 0;
+  io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  unsigned *sq_head_ = nullptr;
+  unsigned *sq_tail_ = nullptr;
+  unsigned *sq_mask_ = nullptr;
+  unsigned *sq_array_ = nullptr;
+  unsigned sqe_tail_ = 0; // 本地尾指针，提交时发布
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned *cq_mask_ = nullptr;
+  io_uring_cqe *cqes_ = nullptr;
+
+  // 取一个清零的 SQE；提交队列已满时返回 nullptr
+  io_uring_sqe *get_sqe();
+
+  void unmap();
+};
@@ -3,6 +3,7 @@
 #include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <stdexcept>
 #include <string>
 
 // ============================================
@@ -27,3 +28,39 @@ inline std::string format_size(uint64_t bytes) {
   snprintf(buf, sizeof(buf), "%.2f %s", size, units[unit_idx]);
   return std::string(buf);
 }
+
+// 解析字节数："4096"、"64K"、"100M"、"2G"（后缀不区分大小写，按 1024 进位）
+inline uint64_t parse_size(const std::string &text) {
+  size_t used = 0;
+  uint64_t value = 0;
+  try {
+    value = std::stoull(text, &used);
+  } catch (const std::exception &) {
+    throw std::invalid_argument("Invalid size: " + text);
+  }
+  unsigned shift = 0;
+  if (used + 1 == text.size()) {
+    switch (text[used]) {
+    case 'k':
+    case 'K':
+      shift = 10;
+      break;
+    case 'm':
+    case 'M':
+      shift = 20;
+      break;
+    case 'g':
+    case 'G':
+      shift = 30;
+      break;
+    default:
+      throw std::invalid_argument("Invalid size: " + text);
+    }
+  } else if (used != text.size()) {
+    throw std::invalid_argument("Invalid size: " + text);
+  }
+  if (value > (UINT64_MAX >> shift)) {
+    throw std::invalid_argument("Invalid size: " + text);
+  }
+  return value << shift;
+}
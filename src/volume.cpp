@@ -0,0 +1,524 @@
+#include "volume.hpp"
+#include "crc32.hpp"
+#include "format.hpp"
+#include "stage_stats.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+std::string errno_message() { return std::strerror(errno); }
+
+void pwrite_fully(int fd, const char *data, size_t n, uint64_t offset,
+                  const fs::path &path) {
+  size_t done = 0;
+  while (done < n) {
+    ssize_t w = ::pwrite(fd, data + done, n - done,
+                         static_cast<off_t>(offset + done));
+    if (w < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Failed to write archive volume: " +
+                               path.string() + " (" + errno_message() + ")");
+    }
+    done += static_cast<size_t>(w);
+  }
+}
+
+// 读满 n 字节，EOF 或出错时返回 false
+bool pread_fully(int fd, char *dst, size_t n, uint64_t offset) {
+  size_t done = 0;
+  while (done < n) {
+    ssize_t r = ::pread(fd, dst + done, n - done,
+                        static_cast<off_t>(offset + done));
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    done += static_cast<size_t>(r);
+  }
+  return true;
+}
+
+// 把 [offset, offset + n) 中落在 [start, ...) 的部分复制到 buffer（按需增长），
+// limit 以内的部分才保留
+void overlay(std::vector<char> &buffer, uint64_t start, uint64_t limit,
+             uint64_t offset, const char *data, size_t n) {
+  const uint64_t begin = std::max(offset, start);
+  const uint64_t end = std::min(offset + n, limit);
+  if (begin >= end) {
+    return;
+  }
+  const size_t at = static_cast<size_t>(begin - start);
+  const size_t len = static_cast<size_t>(end - begin);
+  if (buffer.size() < at + len) {
+    buffer.resize(at + len);
+  }
+  std::memcpy(buffer.data() + at, data + (begin - offset), len);
+}
+
+} // namespace
+
+fs::path volume_path(const fs::path &base, uint32_t index) {
+  char suffix[16];
+  std::snprintf(suffix, sizeof(suffix), ".%03u", index + 1);
+  return fs::path(base.string() + suffix);
+}
+
+// ============================================
+// VolumeWriter
+// ============================================
+
+VolumeWriter::VolumeWriter(const fs::path &base, uint64_t volume_size,
+                           size_t max_inflight)
+    : base_(base), volume_size_(volume_size),
+      max_inflight_(std::max<size_t>(max_inflight, 1)) {
+  if (volume_size_ < sizeof(FileHeader)) {
+    throw std::invalid_argument("Volume size is too small");
+  }
+}
+
+VolumeWriter::~VolumeWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error_.empty()) {
+      error_ = "Archive volumes were not finished"; // 在途写入不再写出
+    }
+  }
+  join();
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+}
+
+void VolumeWriter::open_volume(uint32_t volume) {
+  while (fds_.size() <= volume) {
+    const fs::path path = volume_path(base_, count());
+    StageTimer timer(Stage::Open);
+    const int fd =
+        ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("Cannot create archive volume: " +
+                               path.string());
+    }
+    // 写出线程在持锁时读取 fds_
+    std::unique_lock<std::mutex> lock(mutex_);
+    fds_.push_back(fd);
+    if (writers_.size() < kMaxWriters) {
+      writers_.push_back(std::make_unique<Writer>());
+      Writer &writer = *writers_.back();
+      lock.unlock();
+      writer.thread = std::thread([this, &writer] { run(writer); });
+    }
+  }
+}
+
+void VolumeWriter::write(uint64_t offset, const char *data, size_t n) {
+  // 全局头随卷表另存：回填同样更新副本
+  overlay(head_, 0, sizeof(FileHeader), offset, data, n);
+  if (tail_offset_ != UINT64_MAX) {
+    overlay(tail_, tail_offset_, UINT64_MAX, offset, data, n);
+  }
+  while (n > 0) {
+    const uint32_t volume = static_cast<uint32_t>(offset / volume_size_);
+    const uint64_t within = offset % volume_size_;
+    const size_t len =
+        static_cast<size_t>(std::min<uint64_t>(n, volume_size_ - within));
+    open_volume(volume);
+
+    Job job{volume, within, ByteBuffer(data, data + len)};
+    Writer &writer = *writers_[volume % writers_.size()];
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      space_.wait(lock, [&] {
+        return !error_.empty() || inflight_ == 0 ||
+               inflight_ + len <= max_inflight_;
+      });
+      if (!error_.empty()) {
+        throw std::runtime_error(error_);
+      }
+      inflight_ += len;
+      writer.jobs.push_back(std::move(job));
+    }
+    writer.ready.notify_one();
+    offset += len;
+    data += len;
+    n -= len;
+  }
+}
+
+void VolumeWriter::mark_tail(uint64_t offset) {
+  tail_offset_ = offset;
+  tail_.clear();
+}
+
+void VolumeWriter::run(Writer &writer) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    writer.ready.wait(lock, [&] { return stop_ || !writer.jobs.empty(); });
+    if (writer.jobs.empty()) {
+      return;
+    }
+    Job job = std::move(writer.jobs.front());
+    writer.jobs.pop_front();
+    const bool failed = !error_.empty();
+    const int fd = fds_[job.volume];
+    lock.unlock();
+    std::string error;
+    if (!failed) {
+      try {
+        StageTimer timer(Stage::Write, job.data.size());
+        pwrite_fully(fd, job.data.data(), job.data.size(), job.offset,
+                     volume_path(base_, job.volume));
+      } catch (const std::exception &e) {
+        error = e.what();
+      }
+    }
+    lock.lock();
+    if (!error.empty() && error_.empty()) {
+      error_ = error;
+    }
+    inflight_ -= job.data.size();
+    space_.notify_all();
+  }
+}
+
+void VolumeWriter::join() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  for (auto &writer : writers_) {
+    writer->ready.notify_all();
+  }
+  for (auto &writer : writers_) {
+    if (writer->thread.joinable()) {
+      writer->thread.join();
+    }
+  }
+}
+
+void VolumeWriter::finish(uint64_t archive_size) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    space_.wait(lock, [&] { return inflight_ == 0; });
+  }
+  join();
+  if (!error_.empty()) {
+    throw std::runtime_error(error_);
+  }
+  std::string error;
+  for (size_t i = 0; i < fds_.size(); ++i) {
+    const int fd = fds_[i];
+    fds_[i] = -1;
+    if (::close(fd) != 0 && error.empty()) {
+      error = "Failed to close archive volume: " +
+              volume_path(base_, static_cast<uint32_t>(i)).string() + " (" +
+              errno_message() + ")";
+    }
+  }
+  if (!error.empty()) {
+    throw std::runtime_error(error);
+  }
+  write_manifest(archive_size);
+
+  // 上一次打包留下的更多卷会让探测读取者误读，一并删除
+  for (uint32_t i = count();; ++i) {
+    std::error_code ec;
+    if (!fs::remove(volume_path(base_, i), ec)) {
+      break;
+    }
+  }
+}
+
+void VolumeWriter::write_manifest(uint64_t archive_size) {
+  if (head_.size() < sizeof(FileHeader) || tail_offset_ == UINT64_MAX ||
+      tail_offset_ + tail_.size() != archive_size) {
+    throw std::logic_error("Archive volumes are incomplete");
+  }
+  std::vector<char> body;
+  body.reserve(count() * sizeof(VolumeEntry) + head_.size() + tail_.size());
+  for (uint32_t i = 0; i < count(); ++i) {
+    const uint64_t start = static_cast<uint64_t>(i) * volume_size_;
+    VolumeEntry entry{.size = std::min(volume_size_, archive_size - start)};
+    char wire[sizeof(VolumeEntry)];
+    store_wire(wire, entry);
+    body.insert(body.end(), wire, wire + sizeof(wire));
+  }
+  body.insert(body.end(), head_.begin(), head_.end());
+  body.insert(body.end(), tail_.begin(), tail_.end());
+
+  VolumeHeader header{.magic = KAR_VOLUME_MAGIC,
+                      .volume_count = count(),
+                      .volume_size = volume_size_,
+                      .archive_size = archive_size,
+                      .tail_offset = tail_offset_,
+                      .checksum = CRC32().calculate(body)};
+  char wire[sizeof(VolumeHeader)];
+  store_wire(wire, header);
+
+  const int fd =
+      ::open(base_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot create archive file");
+  }
+  try {
+    pwrite_fully(fd, wire, sizeof(wire), 0, base_);
+    pwrite_fully(fd, body.data(), body.size(), sizeof(wire), base_);
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+  if (::close(fd) != 0) {
+    throw std::runtime_error("Failed to close archive: " + errno_message());
+  }
+}
+
+// ============================================
+// VolumeReader
+// ============================================
+
+std::unique_ptr<VolumeReader> VolumeReader::open(const fs::path &path,
+                                                 bool use_mmap) {
+  std::error_code ec;
+  if (fs::is_regular_file(path, ec)) {
+    const std::string name = path.string();
+    const bool first_volume =
+        name.size() > 4 && name.compare(name.size() - 4, 4, ".001") == 0;
+    if (first_volume) {
+      // 直接给出第一卷：有卷表时按卷表读取，否则探测各卷
+      const fs::path base = name.substr(0, name.size() - 4);
+      if (auto reader = open(base, use_mmap)) {
+        return reader;
+      }
+      return from_volumes(base, use_mmap);
+    }
+    return from_manifest(path, use_mmap);
+  }
+  if (fs::is_regular_file(volume_path(path, 0), ec)) {
+    return from_volumes(path, use_mmap);
+  }
+  return nullptr;
+}
+
+std::unique_ptr<VolumeReader> VolumeReader::from_manifest(const fs::path &path,
+                                                          bool use_mmap) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  char wire[sizeof(VolumeHeader)];
+  struct stat st;
+  if (!pread_fully(fd, wire, sizeof(wire), 0) ||
+      load_wire<VolumeHeader>(wire).magic != KAR_VOLUME_MAGIC ||
+      ::fstat(fd, &st) != 0) {
+    ::close(fd);
+    return nullptr; // 普通归档（或无法识别，由 ArchiveReader 报错）
+  }
+  const VolumeHeader header = load_wire<VolumeHeader>(wire);
+  const uint64_t body_size = static_cast<uint64_t>(st.st_size) - sizeof(wire);
+  std::vector<char> body(static_cast<size_t>(body_size));
+  const bool complete = pread_fully(fd, body.data(), body.size(), sizeof(wire));
+  ::close(fd);
+
+  // 卷表自洽：CRC32、各卷大小之和、目录副本长度
+  const uint64_t table_size =
+      static_cast<uint64_t>(header.volume_count) * sizeof(VolumeEntry);
+  if (!complete || header.volume_count == 0 || header.volume_size == 0 ||
+      table_size + sizeof(FileHeader) > body_size ||
+      header.tail_offset > header.archive_size ||
+      header.archive_size - header.tail_offset !=
+          body_size - table_size - sizeof(FileHeader) ||
+      CRC32().calculate(body) != header.checksum) {
+    throw std::runtime_error("Archive volume table is damaged: " +
+                             path.string());
+  }
+
+  std::unique_ptr<VolumeReader> reader(new VolumeReader());
+  reader->count_ = header.volume_count;
+  reader->volume_size_ = header.volume_size;
+  reader->size_ = header.archive_size;
+  reader->use_mmap_ = use_mmap;
+  reader->volumes_ = std::make_unique<Volume[]>(header.volume_count);
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < header.volume_count; ++i) {
+    Volume &volume = reader->volumes_[i];
+    volume.path = volume_path(path, i);
+    volume.size =
+        load_wire<VolumeEntry>(body.data() + i * sizeof(VolumeEntry)).size;
+    if ((i + 1 < header.volume_count && volume.size != header.volume_size) ||
+        volume.size > header.volume_size) {
+      throw std::runtime_error("Archive volume table is damaged: " +
+                               path.string());
+    }
+    total += volume.size;
+  }
+  if (total != header.archive_size) {
+    throw std::runtime_error("Archive volume table is damaged: " +
+                             path.string());
+  }
+  const char *head = body.data() + table_size;
+  reader->head_.assign(head, head + sizeof(FileHeader));
+  reader->tail_.assign(head + sizeof(FileHeader), head + (body.size() - table_size));
+  reader->tail_offset_ = header.tail_offset;
+  return reader;
+}
+
+std::unique_ptr<VolumeReader> VolumeReader::from_volumes(const fs::path &base,
+                                                         bool use_mmap) {
+  // 没有卷表：依次 stat 各卷，拼接后的全部字节都从卷文件读取
+  std::vector<uint64_t> sizes;
+  for (uint32_t i = 0;; ++i) {
+    std::error_code ec;
+    const uint64_t size = fs::file_size(volume_path(base, i), ec);
+    if (ec) {
+      break;
+    }
+    sizes.push_back(size);
+  }
+  if (sizes.empty()) {
+    return nullptr;
+  }
+  std::unique_ptr<VolumeReader> reader(new VolumeReader());
+  reader->count_ = static_cast<uint32_t>(sizes.size());
+  reader->volume_size_ = sizes[0];
+  reader->use_mmap_ = use_mmap;
+  reader->volumes_ = std::make_unique<Volume[]>(sizes.size());
+  for (uint32_t i = 0; i < reader->count_; ++i) {
+    if (sizes[i] == 0 || sizes[i] > reader->volume_size_ ||
+        (i + 1 < reader->count_ && sizes[i] != reader->volume_size_)) {
+      throw std::runtime_error("Archive volume has the wrong size: " +
+                               volume_path(base, i).string());
+    }
+    reader->volumes_[i].path = volume_path(base, i);
+    reader->volumes_[i].size = sizes[i];
+    reader->size_ += sizes[i];
+  }
+  reader->tail_offset_ = reader->size_;
+  return reader;
+}
+
+VolumeReader::~VolumeReader() {
+  for (uint32_t i = 0; i < count_; ++i) {
+    Volume &volume = volumes_[i];
+    if (volume.mapped != nullptr) {
+      ::munmap(volume.mapped, static_cast<size_t>(volume.size));
+    }
+    if (volume.fd >= 0) {
+      ::close(volume.fd);
+    }
+  }
+}
+
+const VolumeReader::Volume &VolumeReader::volume(uint32_t index) const {
+  Volume &volume = volumes_[index];
+  if (volume.ready.load(std::memory_order_acquire)) {
+    return volume;
+  }
+  std::lock_guard<std::mutex> lock(open_mutex_);
+  if (volume.ready.load(std::memory_order_relaxed)) {
+    return volume;
+  }
+  StageTimer timer(Stage::Open);
+  const int fd = ::open(volume.path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Missing archive volume: " + volume.path.string());
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 ||
+      static_cast<uint64_t>(st.st_size) != volume.size) {
+    ::close(fd);
+    throw std::runtime_error("Archive volume has the wrong size: " +
+                             volume.path.string());
+  }
+  volume.fd = fd;
+  if (use_mmap_) {
+    void *addr = ::mmap(nullptr, static_cast<size_t>(volume.size), PROT_READ,
+                        MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      volume.mapped = static_cast<char *>(addr);
+    }
+  }
+  volume.ready.store(true, std::memory_order_release);
+  return volume;
+}
+
+uint64_t VolumeReader::segment_end(uint64_t offset) const {
+  if (offset < head_.size()) {
+    return head_.size();
+  }
+  if (offset >= tail_offset_) {
+    return size_;
+  }
+  return std::min((offset / volume_size_ + 1) * volume_size_, tail_offset_);
+}
+
+bool VolumeReader::read(char *dst, size_t n, uint64_t offset) const {
+  if (offset > size_ || n > size_ - offset) {
+    return false;
+  }
+  StageTimer timer(Stage::Read, n);
+  while (n > 0) {
+    size_t len = n;
+    if (offset < head_.size()) {
+      len = std::min<size_t>(len, static_cast<size_t>(head_.size() - offset));
+      std::memcpy(dst, head_.data() + offset, len);
+    } else if (offset >= tail_offset_) {
+      std::memcpy(dst, tail_.data() + (offset - tail_offset_), len);
+    } else {
+      const uint32_t index = static_cast<uint32_t>(offset / volume_size_);
+      const uint64_t within = offset % volume_size_;
+      len = static_cast<size_t>(std::min<uint64_t>(
+          {len, volume_size_ - within, tail_offset_ - offset}));
+      const Volume &vol = volume(index);
+      if (vol.mapped != nullptr) {
+        std::memcpy(dst, vol.mapped + within, len);
+      } else if (!pread_fully(vol.fd, dst, len, within)) {
+        return false;
+      }
+    }
+    dst += len;
+    offset += len;
+    n -= len;
+  }
+  return true;
+}
+
+const char *VolumeReader::view_at(uint64_t offset, size_t n,
+                                  ByteBuffer &scratch) const {
+  if (offset > size_ || n > size_ - offset) {
+    return nullptr;
+  }
+  if (offset < head_.size() && offset + n <= head_.size()) {
+    return head_.data() + offset;
+  }
+  if (offset >= tail_offset_) {
+    return tail_.data() + (offset - tail_offset_);
+  }
+  const uint64_t within = offset % volume_size_;
+  if (offset >= head_.size() && offset + n <= tail_offset_ &&
+      within + n <= volume_size_) {
+    const Volume &vol = volume(static_cast<uint32_t>(offset / volume_size_));
+    if (vol.mapped != nullptr) {
+      return vol.mapped + within;
+    }
+  }
+  if (scratch.size() < n) {
+    scratch.resize(n);
+  }
+  return read(scratch.data(), n, offset) ? scratch.data() : nullptr;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// ============================================
+// 分卷归档的读写（格式见 format.hpp 中的 VolumeHeader）
+// ============================================
+
+// 第 index 卷（从 0 计）的文件名：<base>.001、<base>.002……
+fs::path volume_path(const fs::path &base, uint32_t index);
+
+// 分卷写出：逻辑字节流按 volume_size 切分到各卷文件
+//
+// 每卷固定交给一个写出线程（卷号对线程数取模），写入方把数据拷贝进
+// 缓冲区池的块，投递给所在卷的线程后立即返回，由该线程按卷内偏移 pwrite；同一卷的写入
+// 保持投递顺序（回填不会被更早的写入覆盖），不同卷的写出与关闭互不等待。
+// 在途数据总量超过 max_inflight 时写入方阻塞。
+class VolumeWriter {
+public:
+  static constexpr unsigned kMaxWriters = 4;
+
+  VolumeWriter(const fs::path &base, uint64_t volume_size, size_t max_inflight);
+  // 未 finish() 时丢弃在途写入并关闭各卷（不抛出）
+  ~VolumeWriter();
+
+  VolumeWriter(const VolumeWriter &) = delete;
+  VolumeWriter &operator=(const VolumeWriter &) = delete;
+
+  // 把 [offset, offset + n) 写入对应的卷（按需创建卷文件）；
+  // 此前的写出失败在这里抛出
+  void write(uint64_t offset, const char *data, size_t n);
+
+  // 标记中央目录起点：此后写出的内容另存一份，finish() 时写入卷表
+  void mark_tail(uint64_t offset);
+
+  // 等待全部写出完成、关闭各卷，再写出卷表 <base>；archive_size 为逻辑总字节数。
+  // 删除上一次打包残留的多余卷文件。失败时抛出异常
+  void finish(uint64_t archive_size);
+
+  uint32_t count() const { return static_cast<uint32_t>(fds_.size()); }
+
+private:
+  struct Job {
+    uint32_t volume;
+    uint64_t offset; // 卷内偏移
+    ByteBuffer data; // 写出后随 Job 析构归还缓冲区池
+  };
+  struct Writer {
+    std::thread thread;
+    std::deque<Job> jobs;
+    std::condition_variable ready;
+  };
+
+  fs::path base_;
+  uint64_t volume_size_;
+  size_t max_inflight_;
+  std::vector<int> fds_; // 已创建的卷（只由写入方追加）
+
+  // 卷表内容：全局头（逻辑偏移 0 起）与 tail_offset_ 起的目录副本
+  std::vector<char> head_;
+  std::vector<char> tail_;
+  uint64_t tail_offset_ = UINT64_MAX;
+
+  std::mutex mutex_;
+  std::condition_variable space_; // 在途字节减少或全部完成
+  std::vector<std::unique_ptr<Writer>> writers_;
+  size_t inflight_ = 0;
+  bool stop_ = false;
+  std::string error_; // 第一个写出错误
+
+  void open_volume(uint32_t volume);
+  void run(Writer &writer);
+  // 停止并回收写出线程
+  void join();
+  void write_manifest(uint64_t archive_size);
+};
+
+// 分卷读取：卷文件在第一次读到时才打开（线程安全），
+// 全局头与中央目录取自卷表，列目录不打开任何卷、提取只打开用到的卷
+class VolumeReader {
+public:
+  // path 为卷表时按卷表读取；path 不存在而 <path>.001 存在时（或 path 本身
+  // 是 .001 且没有卷表）按卷文件依次探测；其余情况（普通归档）返回 nullptr
+  static std::unique_ptr<VolumeReader> open(const fs::path &path,
+                                            bool use_mmap);
+  ~VolumeReader();
+
+  VolumeReader(const VolumeReader &) = delete;
+  VolumeReader &operator=(const VolumeReader &) = delete;
+
+  uint64_t size() const { return size_; }
+  uint32_t count() const { return count_; }
+  uint64_t volume_size() const { return volume_size_; }
+
+  // 读取 [offset, offset + n)（可跨卷）；越界或卷文件不足时返回 false
+  bool read(char *dst, size_t n, uint64_t offset) const;
+
+  // offset 所在连续片段（卷表中的全局头、目录副本，或一卷）的结束偏移
+  uint64_t segment_end(uint64_t offset) const;
+
+  // 同 ArchiveReader::view_at：范围落在卷表副本或单个已映射的卷内时
+  // 返回其地址，否则读入 scratch 并返回其地址；失败时返回 nullptr
+  const char *view_at(uint64_t offset, size_t n, ByteBuffer &scratch) const;
+
+private:
+  struct Volume {
+    fs::path path;
+    uint64_t size = 0; // 卷表记录（或探测得到）的大小
+    std::atomic<bool> ready{false};
+    int fd = -1;
+    char *mapped = nullptr;
+  };
+
+  uint32_t count_ = 0;
+  uint64_t volume_size_ = 0;
+  uint64_t size_ = 0;
+  bool use_mmap_ = false;
+  std::unique_ptr<Volume[]> volumes_;
+  std::vector<char> head_;
+  std::vector<char> tail_;
+  uint64_t tail_offset_ = 0;
+  mutable std::mutex open_mutex_;
+
+  VolumeReader() = default;
+  static std::unique_ptr<VolumeReader> from_manifest(const fs::path &path,
+                                                     bool use_mmap);
+  static std::unique_ptr<VolumeReader> from_volumes(const fs::path &base,
+                                                    bool use_mmap);
+
+  // 第 index 卷，首次访问时打开；卷缺失或大小不符时抛出异常
+  const Volume &volume(uint32_t index) const;
+};
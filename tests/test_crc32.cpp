@@ -16,16 +16,26 @@
  * make test
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <sys/stat.h>
+
 #include "../include/crc32.hpp"
+#include "../include/sha256.hpp"
+#include "../src/throttle.hpp"
 
 namespace fs = std::filesystem;
 
@@ -94,6 +104,16 @@ std::vector<char> read_file_bytes(const fs::path &path) {
   return buffer;
 }
 
+// 读取归档内容并清零文件头的创建时间（偏移 10 起 8 字节，秒级
+// current_timestamp），供比较两次打包的输出
+std::string read_archive_masked(const fs::path &path) {
+  std::string bytes = read_file_string(path);
+  if (bytes.size() >= 18) {
+    std::fill(bytes.begin() + 10, bytes.begin() + 18, '\0');
+  }
+  return bytes;
+}
+
 // 篡改归档文件中的指定字节
 void corrupt_archive_at(const fs::path &archive_path, size_t offset,
                         uint8_t new_byte) {
@@ -107,8 +127,6 @@ void corrupt_archive_at(const fs::path &archive_path, size_t offset,
 // ============================================
 
 void test_crc32_known_values() {
-  CRC32 crc32;
-
   // 测试用例来自 RFC 3309 和其他标准测试向量
   struct TestCase {
     std::string input;
@@ -125,24 +143,115 @@ void test_crc32_known_values() {
       {"hello", 0x3610A686},     // 测试文件内容 (a.txt)
       {"world", 0x3A771143},     // 测试文件内容 (subdir/b.txt)
       {"123456789", 0xCBF43926}, // 标准测试向量
+      {std::string(1000, 'a'), 0x9A38DA03}, // 触发 SIMD 折叠路径
   };
 
-  for (const auto &tc : test_cases) {
-    uint32_t calculated = crc32.calculate(tc.input);
+  // 每个当前 CPU 支持的引擎都必须通过全部测试向量
+  size_t engines_tested = 0;
+  for (CRC32Engine engine : CRC32::all_engines()) {
+    if (!CRC32::is_supported(engine)) {
+      continue;
+    }
+    CRC32 crc32(engine);
+    engines_tested++;
+
+    for (const auto &tc : test_cases) {
+      uint32_t calculated = crc32.calculate(tc.input);
+
+      uint32_t expected = tc.expected_crc;
+
+      if (calculated != expected) {
+        std::cerr << "  Engine: " << CRC32::engine_name(engine) << "\n";
+        std::cerr << "  Input: \"" << tc.input.substr(0, 16) << "\"\n";
+        std::cerr << "  Expected: 0x" << std::hex << expected << std::dec
+                  << "\n";
+        std::cerr << "  Got: 0x" << std::hex << calculated << std::dec << "\n";
+      }
+
+      TEST_ASSERT(calculated == expected,
+                  std::string("CRC32 mismatch (") +
+                      CRC32::engine_name(engine) + ") for input: \"" +
+                      tc.input.substr(0, 16) + "\"");
+    }
+  }
+
+  std::cout << "  ✓ " << test_cases.size() << " test vectors passed on "
+            << engines_tested << " engines (auto: "
+            << CRC32::engine_name(CRC32().engine()) << ")\n";
+}
+
+// ============================================
+// 测试用例 1b: 各引擎在任意长度/对齐下结果一致
+// ============================================
+
+void test_crc32_engines_agree() {
+  std::vector<uint8_t> data(1 << 20);
+  uint32_t seed = 12345;
+  for (auto &byte : data) {
+    seed = seed * 1103515245 + 12345;
+    byte = static_cast<uint8_t>(seed >> 16);
+  }
+
+  CRC32 reference(CRC32Engine::Bytewise);
+  for (CRC32Engine engine : CRC32::all_engines()) {
+    if (!CRC32::is_supported(engine)) {
+      continue;
+    }
+    CRC32 crc32(engine);
+    // 覆盖 SIMD 路径的边界：< 64、非 16 倍数、非对齐起始地址
+    for (size_t offset = 0; offset < 16; ++offset) {
+      for (size_t len = 0; len < 300; ++len) {
+        TEST_ASSERT(crc32.calculate(data.data() + offset, len) ==
+                        reference.calculate(data.data() + offset, len),
+                    std::string("Engine ") + CRC32::engine_name(engine) +
+                        " disagrees at offset " + std::to_string(offset) +
+                        ", len " + std::to_string(len));
+      }
+    }
+    TEST_ASSERT(crc32.calculate(data.data(), data.size()) ==
+                    reference.calculate(data.data(), data.size()),
+                std::string("Engine ") + CRC32::engine_name(engine) +
+                    " disagrees on 1 MB buffer");
+  }
+
+  std::cout << "  ✓ All supported engines agree with bytewise reference\n";
+}
 
-    uint32_t expected = tc.expected_crc;
+// ============================================
+// 测试用例 1c: 流式 update/finalize 与 crc32_combine
+// ============================================
 
-    if (calculated != expected) {
-      std::cerr << "  Input: \"" << tc.input << "\"\n";
-      std::cerr << "  Expected: 0x" << std::hex << expected << std::dec << "\n";
-      std::cerr << "  Got: 0x" << std::hex << calculated << std::dec << "\n";
+void test_crc32_streaming_and_combine() {
+  std::string data;
+  for (int i = 0; i < 100000; ++i) {
+    data.push_back(static_cast<char>((i * 131) ^ (i >> 3)));
+  }
+  const auto *bytes = reinterpret_cast<const uint8_t *>(data.data());
+  CRC32 crc32;
+  const uint32_t expected = crc32.calculate(data);
+
+  // 任意分块方式的流式结果与一次性计算一致
+  const size_t chunk_sizes[] = {1, 7, 64, 4096, 65536};
+  for (size_t chunk : chunk_sizes) {
+    CRC32 stream;
+    for (size_t off = 0; off < data.size(); off += chunk) {
+      stream.update(bytes + off, std::min(chunk, data.size() - off));
     }
+    TEST_ASSERT(stream.finalize() == expected,
+                "Streaming CRC mismatch with chunk size " +
+                    std::to_string(chunk));
+  }
 
-    TEST_ASSERT(calculated == expected,
-                "CRC32 mismatch for input: \"" + tc.input + "\"");
+  // 分段 CRC 合并后与整体 CRC 一致（含空段）
+  const size_t splits[] = {0, 1, 63, 50000, data.size()};
+  for (size_t split : splits) {
+    uint32_t head = crc32.calculate(bytes, split);
+    uint32_t tail = crc32.calculate(bytes + split, data.size() - split);
+    TEST_ASSERT(crc32_combine(head, tail, data.size() - split) == expected,
+                "crc32_combine mismatch at split " + std::to_string(split));
   }
 
-  std::cout << "  ✓ " << test_cases.size() << " test vectors passed\n";
+  std::cout << "  ✓ update/finalize and crc32_combine match one-shot CRC\n";
 }
 
 // ============================================
@@ -345,10 +454,2263 @@ void test_empty_file() {
   fs::remove_all("test_crc_tmp");
 }
 
+// ============================================
+// 测试用例 6: 并行打包与串行打包结果一致
+// ============================================
+
+// 运行命令并返回标准输出
+std::string run_command_output(const std::string &cmd) {
+  FILE *pipe = popen(cmd.c_str(), "r");
+  if (pipe == nullptr) {
+    return "";
+  }
+  char buffer[256];
+  std::string output;
+  while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
+    output += buffer;
+  }
+  pclose(pipe);
+  return output;
+}
+
+void test_parallel_pack_matches_serial() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path serial_archive = "test_crc_tmp/serial.kar";
+  const fs::path parallel_archive = "test_crc_tmp/parallel.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  // 准备较多文件，让工作线程乱序完成
+  setup_test_files(test_dir);
+  for (int i = 0; i < 64; ++i) {
+    std::ofstream f(test_dir / "subdir" / ("file_" + std::to_string(i)));
+    f << std::string(static_cast<size_t>(i) * 997, static_cast<char>('a' + i % 26));
+  }
+
+  std::string serial_cmd = "./kar pack --threads 1 " + test_dir.string() +
+                           " " + serial_archive.string() + " > /dev/null 2>&1";
+  std::string parallel_cmd = "./kar pack --threads 4 " + test_dir.string() +
+                             " " + parallel_archive.string() +
+                             " > /dev/null 2>&1";
+  TEST_ASSERT(std::system(serial_cmd.c_str()) == 0, "Serial pack failed");
+  TEST_ASSERT(std::system(parallel_cmd.c_str()) == 0, "Parallel pack failed");
+
+  TEST_ASSERT(fs::file_size(serial_archive) == fs::file_size(parallel_archive),
+              "Parallel archive size differs from serial archive");
+
+  // 条目顺序与大小一致（除归档名外的 list 输出相同）
+  auto serial_list = run_command_output("./kar list " + serial_archive.string());
+  auto parallel_list =
+      run_command_output("./kar list " + parallel_archive.string());
+  serial_list = serial_list.substr(serial_list.find('\n'));
+  parallel_list = parallel_list.substr(parallel_list.find('\n'));
+  TEST_ASSERT(serial_list == parallel_list,
+              "Parallel archive entry order differs from serial archive");
+
+  // 并行归档可以正常解包
+  fs::create_directories(output_dir);
+  std::string unpack_cmd = "./kar unpack " + parallel_archive.string() + " " +
+                           output_dir.string() + " > /dev/null 2>&1";
+  TEST_ASSERT(std::system(unpack_cmd.c_str()) == 0, "Unpack failed");
+  TEST_ASSERT(read_file_string(output_dir / "subdir" / "file_63") ==
+                  read_file_string(test_dir / "subdir" / "file_63"),
+              "Content mismatch for subdir/file_63");
+
+  std::cout << "  ✓ Parallel archive matches serial layout\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 7: 大文件分块流式打包/解包
+// ============================================
+
+void test_large_file_streaming() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  // 超过流式分块大小（1 MB）且不是分块整数倍的文件
+  fs::remove_all(test_dir);
+  fs::create_directories(test_dir);
+  std::string big;
+  for (size_t i = 0; i < 3 * 1024 * 1024 + 12345; ++i) {
+    big.push_back(static_cast<char>((i * 2654435761u) >> 24));
+  }
+  {
+    std::ofstream f(test_dir / "big.bin", std::ios::binary);
+    f << big;
+  }
+
+  std::string pack_cmd = "./kar pack " + test_dir.string() + " " +
+                         archive_path.string() + " > /dev/null 2>&1";
+  TEST_ASSERT(std::system(pack_cmd.c_str()) == 0, "Pack command failed");
+
+  fs::create_directories(output_dir);
+  std::string unpack_cmd = "./kar unpack " + archive_path.string() + " " +
+                           output_dir.string() + " > /dev/null 2>&1";
+  TEST_ASSERT(std::system(unpack_cmd.c_str()) == 0, "Unpack command failed");
+  TEST_ASSERT(read_file_string(output_dir / "big.bin") == big,
+              "Content mismatch for big.bin");
+
+  std::cout << "  ✓ Multi-chunk file round-tripped\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 8: 各 I/O 后端生成的归档互相兼容
+// ============================================
+
+void test_io_backends_roundtrip() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  // 覆盖读入内存、mmap 映射、分块拷贝三种大小
+  setup_test_files(test_dir);
+  std::string medium(200 * 1024, 'm');
+  std::string large(2 * 1024 * 1024 + 7, 'L');
+  {
+    std::ofstream(test_dir / "medium.bin", std::ios::binary) << medium;
+    std::ofstream(test_dir / "subdir" / "large.bin", std::ios::binary) << large;
+  }
+
+  const std::vector<std::string> backends = {"stream", "mmap", "splice"};
+  for (size_t i = 0; i < backends.size(); ++i) {
+    // 用一种后端打包，另一种后端解包
+    const std::string &pack_io = backends[i];
+    const std::string &unpack_io = backends[(i + 1) % backends.size()];
+    const fs::path archive_path = "test_crc_tmp/" + pack_io + ".kar";
+
+    std::string pack_cmd = "./kar pack --io " + pack_io + " " +
+                           test_dir.string() + " " + archive_path.string() +
+                           " > /dev/null 2>&1";
+    TEST_ASSERT(std::system(pack_cmd.c_str()) == 0,
+                "Pack failed with --io " + pack_io);
+
+    fs::remove_all(output_dir);
+    fs::create_directories(output_dir);
+    std::string unpack_cmd = "./kar unpack --io=" + unpack_io + " " +
+                             archive_path.string() + " " +
+                             output_dir.string() + " > /dev/null 2>&1";
+    TEST_ASSERT(std::system(unpack_cmd.c_str()) == 0,
+                "Unpack failed with --io " + unpack_io);
+
+    TEST_ASSERT(read_file_string(output_dir / "a.txt") == "hello",
+                "Content mismatch for a.txt (" + pack_io + ")");
+    TEST_ASSERT(read_file_string(output_dir / "medium.bin") == medium,
+                "Content mismatch for medium.bin (" + pack_io + ")");
+    TEST_ASSERT(read_file_string(output_dir / "subdir" / "large.bin") == large,
+                "Content mismatch for subdir/large.bin (" + pack_io + ")");
+  }
+
+  std::cout << "  ✓ stream/mmap/splice archives round-trip across backends\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 9: 版本 2 中央目录与版本 1 兼容
+// ============================================
+
+void test_index_and_v1_compat() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+
+  setup_test_files(test_dir);
+  std::string pack_cmd = "./kar pack " + test_dir.string() + " " +
+                         archive_path.string() + " > /dev/null 2>&1";
+  TEST_ASSERT(std::system(pack_cmd.c_str()) == 0, "Pack command failed");
+
+  // 当前版本号为 3（版本 2 起带中央目录），文件末尾是尾部魔数 'KIDX'
+  auto data = read_file_bytes(archive_path);
+  TEST_ASSERT(data.size() > 32 && data[4] == 3, "Archive version is not 3");
+  TEST_ASSERT(std::string(data.end() - 4, data.end()) == "KIDX",
+              "Archive does not end with index trailer");
+
+  auto listed = run_command_output("./kar list " + archive_path.string());
+  TEST_ASSERT(listed.find("a.txt (5.00 B)") != std::string::npos &&
+                  listed.find("b.txt (5.00 B)") != std::string::npos,
+              "list output is missing entries: " + listed);
+
+  // 破坏尾部魔数后回退到顺序跳扫，结果不变
+  corrupt_archive_at(archive_path, data.size() - 1, 'Z');
+  auto fallback = run_command_output("./kar list " + archive_path.string() +
+                                     " 2>/dev/null");
+  TEST_ASSERT(fallback == listed, "Fallback scan output differs from index");
+
+  // 仓库自带的版本 1 归档仍可通过顺序路径读取
+  auto v1 = run_command_output("./kar list backup.kar");
+  TEST_ASSERT(v1.find("Entries: 2") != std::string::npos &&
+                  v1.find("subdir/b.txt") != std::string::npos,
+              "Version 1 archive could not be listed: " + v1);
+
+  std::cout << "  ✓ Central directory, fallback scan and v1 archives listed\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 10: 按路径/通配符选择性解包
+// ============================================
+
+void test_selective_extract() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  setup_test_files(test_dir);
+  {
+    std::ofstream(test_dir / "subdir" / "c.log") << "log";
+    std::ofstream(test_dir / "d.log") << "log";
+  }
+  std::string pack_cmd = "./kar pack " + test_dir.string() + " " +
+                         archive_path.string() + " > /dev/null 2>&1";
+  TEST_ASSERT(std::system(pack_cmd.c_str()) == 0, "Pack command failed");
+
+  // 精确路径 + 通配符
+  std::string extract_cmd = "./kar extract --output " + output_dir.string() +
+                            " " + archive_path.string() +
+                            " a.txt 'subdir/*.log' > /dev/null 2>&1";
+  TEST_ASSERT(std::system(extract_cmd.c_str()) == 0, "Extract command failed");
+  TEST_ASSERT(read_file_string(output_dir / "a.txt") == "hello",
+              "a.txt not extracted");
+  TEST_ASSERT(fs::exists(output_dir / "subdir" / "c.log"),
+              "subdir/c.log not extracted");
+  TEST_ASSERT(!fs::exists(output_dir / "subdir" / "b.txt") &&
+                  !fs::exists(output_dir / "d.log"),
+              "Unmatched entries were extracted");
+
+  // 不存在的路径报错
+  std::string missing_cmd = "./kar extract --output " + output_dir.string() +
+                            " " + archive_path.string() +
+                            " missing.txt > /dev/null 2>&1";
+  TEST_ASSERT(std::system(missing_cmd.c_str()) != 0,
+              "Extract of missing path should fail");
+
+  std::cout << "  ✓ Only matching entries extracted\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 11: 并行解包与 CRC 错误检测
+// ============================================
+
+void test_parallel_unpack() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  setup_test_files(test_dir);
+  for (int i = 0; i < 32; ++i) {
+    fs::path dir = test_dir / ("dir_" + std::to_string(i % 4));
+    fs::create_directories(dir);
+    std::ofstream(dir / ("file_" + std::to_string(i))) << "payload " << i;
+  }
+  std::string pack_cmd = "./kar pack " + test_dir.string() + " " +
+                         archive_path.string() + " > /dev/null 2>&1";
+  TEST_ASSERT(std::system(pack_cmd.c_str()) == 0, "Pack command failed");
+
+  fs::create_directories(output_dir);
+  std::string unpack_cmd = "./kar unpack --threads 4 " + archive_path.string() +
+                           " " + output_dir.string() + " > /dev/null 2>&1";
+  TEST_ASSERT(std::system(unpack_cmd.c_str()) == 0, "Parallel unpack failed");
+  for (int i = 0; i < 32; ++i) {
+    fs::path file = output_dir / ("dir_" + std::to_string(i % 4)) /
+                    ("file_" + std::to_string(i));
+    TEST_ASSERT(read_file_string(file) == "payload " + std::to_string(i),
+                "Content mismatch for " + file.string());
+  }
+  TEST_ASSERT(read_file_string(output_dir / "subdir" / "b.txt") == "world",
+              "Content mismatch for subdir/b.txt");
+
+  // 篡改 "hello" 中的一个字节，并行解包同样报告 CRC 错误
+  auto data = read_file_bytes(archive_path);
+  std::string haystack(data.begin(), data.end());
+  size_t pos = haystack.find("hello");
+  TEST_ASSERT(pos != std::string::npos, "Could not find 'hello' in archive");
+  corrupt_archive_at(archive_path, pos, 'j');
+
+  fs::remove_all(output_dir);
+  fs::create_directories(output_dir);
+  auto output = run_command_output("./kar unpack --threads 4 " +
+                                   archive_path.string() + " " +
+                                   output_dir.string() + " 2>&1");
+  TEST_ASSERT(output.find("CRC32 mismatch") != std::string::npos,
+              "Parallel unpack did not report CRC32 mismatch");
+
+  std::cout << "  ✓ Parallel unpack restores files and detects corruption\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
 // ============================================
 // 主函数
 // ============================================
 
+// ============================================
+// 测试用例 12: 分块压缩编码（lz4）
+// ============================================
+
+void test_codec_roundtrip() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  // 可压缩的日志（超过流式阈值，走写入线程逐块压缩）、小文件与不可压缩数据
+  setup_test_files(test_dir);
+  std::string log;
+  for (int i = 0; log.size() < 3 * 1024 * 1024; ++i) {
+    log += "2026-10-14 INFO request id=" + std::to_string(i * 7919 % 1000) +
+           " status=200\n";
+  }
+  std::ofstream(test_dir / "app.log", std::ios::binary) << log;
+  std::string noise(200000, '\0');
+  uint32_t seed = 12345;
+  for (auto &c : noise) {
+    seed = seed * 1103515245 + 12345;
+    c = static_cast<char>(seed >> 24);
+  }
+  std::ofstream(test_dir / "noise.bin", std::ios::binary) << noise;
+
+  for (const char *options : {"--threads 1 --codec lz4", "--threads 4 --codec lz4",
+                              "--threads 4 --codec=lz4 --level=9"}) {
+    fs::remove_all(output_dir);
+    fs::remove(archive_path);
+    std::string pack_cmd = std::string("./kar pack ") + options + " " +
+                           test_dir.string() + " " + archive_path.string() +
+                           " > /dev/null 2>&1";
+    TEST_ASSERT(std::system(pack_cmd.c_str()) == 0,
+                std::string("Pack failed with ") + options);
+    TEST_ASSERT(fs::file_size(archive_path) < log.size() / 4 + noise.size(),
+                std::string("Archive is not compressed with ") + options);
+
+    std::string unpack_cmd = "./kar unpack " + archive_path.string() + " " +
+                             output_dir.string() + " > /dev/null 2>&1";
+    TEST_ASSERT(std::system(unpack_cmd.c_str()) == 0,
+                std::string("Unpack failed with ") + options);
+    TEST_ASSERT(read_file_string(output_dir / "app.log") == log &&
+                    read_file_string(output_dir / "noise.bin") == noise &&
+                    read_file_string(output_dir / "a.txt") == "hello",
+                std::string("Content mismatch with ") + options);
+  }
+
+  auto listed = run_command_output("./kar list " + archive_path.string());
+  TEST_ASSERT(listed.find("app.log (3.00 MB, lz4") != std::string::npos,
+              "list does not show codec: " + listed);
+
+  // 篡改压缩数据中的一个字节：解包必须失败，不留下损坏的文件
+  auto data = read_file_bytes(archive_path);
+  std::string haystack(data.begin(), data.end());
+  size_t pos = haystack.find("app.log");
+  TEST_ASSERT(pos != std::string::npos, "Could not find app.log in archive");
+  corrupt_archive_at(archive_path, pos + 7 + 12 + 1000,
+                     static_cast<char>(data[pos + 7 + 12 + 1000] ^ 0x20));
+  fs::remove_all(output_dir);
+  auto output = run_command_output("./kar unpack --threads 1 " +
+                                   archive_path.string() + " " +
+                                   output_dir.string() + " 2>&1");
+  TEST_ASSERT(output.find("CRC32 mismatch") != std::string::npos ||
+                  output.find("Corrupted") != std::string::npos,
+              "Corrupted compressed entry was not detected: " + output);
+  TEST_ASSERT(!fs::exists(output_dir / "app.log"),
+              "Corrupted file was left on disk");
+
+  // 未知编码与越界级别被拒绝
+  TEST_ASSERT(std::system(("./kar pack --codec bogus " + test_dir.string() +
+                           " " + archive_path.string() + " > /dev/null 2>&1")
+                              .c_str()) != 0,
+              "Unknown codec was accepted");
+  TEST_ASSERT(std::system(("./kar pack --codec lz4 --level 99 " +
+                           test_dir.string() + " " + archive_path.string() +
+                           " > /dev/null 2>&1")
+                              .c_str()) != 0,
+              "Out-of-range level was accepted");
+
+  std::cout << "  ✓ lz4 entries round-trip, corruption and bad options rejected\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 13: 不可压缩数据预判（魔数 / 熵估计）
+// ============================================
+
+void test_incompressible_detection() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  // PNG 魔数开头（其后内容可压缩）、大于流式阈值的随机数据与普通文本
+  setup_test_files(test_dir);
+  std::string png = std::string("\x89PNG\r\n\x1a\n", 8) + std::string(50000, 'x');
+  std::ofstream(test_dir / "image.png", std::ios::binary) << png;
+  std::string noise(2 * 1024 * 1024 + 100, '\0');
+  uint32_t seed = 987654321;
+  for (auto &c : noise) {
+    seed = seed * 1103515245 + 12345;
+    c = static_cast<char>(seed >> 24);
+  }
+  std::ofstream(test_dir / "blob.bin", std::ios::binary) << noise;
+  std::ofstream(test_dir / "notes.txt") << std::string(20000, 'n');
+
+  std::string pack_cmd = "./kar pack --codec lz4 " + test_dir.string() + " " +
+                         archive_path.string() + " > /dev/null 2>&1";
+  TEST_ASSERT(std::system(pack_cmd.c_str()) == 0, "Pack command failed");
+
+  // 被判定为不可压缩的条目以 none 存储，list 不显示编码
+  auto listed = run_command_output("./kar list " + archive_path.string());
+  TEST_ASSERT(listed.find("image.png (48.84 KB)") != std::string::npos,
+              "PNG was not stored raw: " + listed);
+  TEST_ASSERT(listed.find("blob.bin (2.00 MB)") != std::string::npos,
+              "Random data was not stored raw: " + listed);
+  TEST_ASSERT(listed.find("notes.txt (19.53 KB, lz4") != std::string::npos,
+              "Text was not compressed: " + listed);
+
+  std::string unpack_cmd = "./kar unpack " + archive_path.string() + " " +
+                           output_dir.string() + " > /dev/null 2>&1";
+  TEST_ASSERT(std::system(unpack_cmd.c_str()) == 0, "Unpack command failed");
+  TEST_ASSERT(read_file_string(output_dir / "image.png") == png &&
+                  read_file_string(output_dir / "blob.bin") == noise,
+              "Stored entries do not round-trip");
+
+  std::cout << "  ✓ Compressed formats and random data are stored raw\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 14: 大文件分块条目（并行打包 / 并行解包）
+// ============================================
+
+void test_chunked_entries() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  // 跨越多个 4 MB 分块的可压缩文件与不可压缩文件
+  setup_test_files(test_dir);
+  std::string dump;
+  for (int i = 0; dump.size() < 10 * 1024 * 1024 + 123; ++i) {
+    dump += "INSERT INTO t VALUES (" + std::to_string(i) + ", 'row');\n";
+  }
+  std::ofstream(test_dir / "dump.sql", std::ios::binary) << dump;
+  std::string noise(9 * 1024 * 1024 + 7, '\0');
+  uint32_t seed = 42;
+  for (auto &c : noise) {
+    seed = seed * 1103515245 + 12345;
+    c = static_cast<char>(seed >> 24);
+  }
+  std::ofstream(test_dir / "noise.bin", std::ios::binary) << noise;
+
+  for (const char *codec : {"none", "lz4"}) {
+    fs::remove_all(output_dir);
+    std::string pack_cmd = std::string("./kar pack --threads 4 --codec ") +
+                           codec + " " + test_dir.string() + " " +
+                           archive_path.string() + " > /dev/null 2>&1";
+    TEST_ASSERT(std::system(pack_cmd.c_str()) == 0,
+                std::string("Pack failed with codec ") + codec);
+    for (const char *threads : {"1", "4"}) {
+      fs::remove_all(output_dir);
+      std::string unpack_cmd = std::string("./kar unpack --threads ") + threads +
+                               " " + archive_path.string() + " " +
+                               output_dir.string() + " > /dev/null 2>&1";
+      TEST_ASSERT(std::system(unpack_cmd.c_str()) == 0,
+                  std::string("Unpack failed with codec ") + codec);
+      TEST_ASSERT(read_file_string(output_dir / "dump.sql") == dump &&
+                      read_file_string(output_dir / "noise.bin") == noise,
+                  std::string("Chunked content mismatch with codec ") + codec);
+    }
+  }
+
+  // 篡改 dump.sql payload 中部的一个字节：并行解包报告错误并删除该文件
+  // （条目头最后 8 字节为 stored_size，紧挨着路径）
+  auto data = read_file_bytes(archive_path);
+  std::string haystack(data.begin(), data.end());
+  size_t pos = haystack.find("dump.sql");
+  TEST_ASSERT(pos != std::string::npos && pos >= 8,
+              "Could not find dump.sql in archive");
+  uint64_t stored_size = 0;
+  std::memcpy(&stored_size, data.data() + pos - 8, sizeof(stored_size));
+  size_t target = pos + 8 + static_cast<size_t>(stored_size) / 2;
+  corrupt_archive_at(archive_path, target, static_cast<char>(data[target] ^ 0x01));
+  fs::remove_all(output_dir);
+  auto output = run_command_output("./kar unpack --threads 4 " +
+                                   archive_path.string() + " " +
+                                   output_dir.string() + " 2>&1");
+  TEST_ASSERT(output.find("CRC32 mismatch") != std::string::npos ||
+                  output.find("Corrupted") != std::string::npos,
+              "Corrupted chunk was not detected: " + output);
+  TEST_ASSERT(!fs::exists(output_dir / "dump.sql"),
+              "Corrupted chunked file was left on disk");
+
+  std::cout << "  ✓ Multi-chunk entries round-trip and corrupt chunks are caught\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 15: 增量打包（mtime + 大小判定未变更）
+// ============================================
+
+void test_incremental_pack() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path base_path = "test_crc_tmp/base.kar";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  setup_test_files(test_dir);
+  std::ofstream(test_dir / "c.txt") << "third";
+  std::string pack_base = "./kar pack --codec lz4 " + test_dir.string() + " " +
+                          base_path.string() + " > /dev/null 2>&1";
+  TEST_ASSERT(std::system(pack_base.c_str()) == 0, "Base pack failed");
+
+  // a.txt: 同尺寸改写后恢复 mtime —— 应被视为未变更，沿用基准中的旧内容
+  auto a_mtime = fs::last_write_time(test_dir / "a.txt");
+  std::ofstream(test_dir / "a.txt") << "HELLO";
+  fs::last_write_time(test_dir / "a.txt", a_mtime);
+  // subdir/b.txt: 内容与 mtime 都变化；new.txt: 新增文件
+  std::ofstream(test_dir / "subdir" / "b.txt") << "world, again";
+  fs::last_write_time(test_dir / "subdir" / "b.txt",
+                      a_mtime + std::chrono::seconds(5));
+  std::ofstream(test_dir / "new.txt") << "fresh";
+
+  for (const char *threads : {"1", "4"}) {
+    auto output = run_command_output(
+        std::string("./kar pack --codec lz4 --threads ") + threads +
+        " --incremental " + base_path.string() + " " + test_dir.string() + " " +
+        archive_path.string() + " 2>&1");
+    TEST_ASSERT(output.find("4 files, 2 unchanged from base") !=
+                    std::string::npos,
+                "Unexpected incremental summary: " + output);
+
+    fs::remove_all(output_dir);
+    std::string unpack_cmd = "./kar unpack " + archive_path.string() + " " +
+                             output_dir.string() + " > /dev/null 2>&1";
+    TEST_ASSERT(std::system(unpack_cmd.c_str()) == 0,
+                "Unpack of incremental archive failed");
+    TEST_ASSERT(read_file_string(output_dir / "a.txt") == "hello",
+                "Unchanged entry was not copied from the base archive");
+    TEST_ASSERT(read_file_string(output_dir / "subdir" / "b.txt") ==
+                        "world, again" &&
+                    read_file_string(output_dir / "c.txt") == "third" &&
+                    read_file_string(output_dir / "new.txt") == "fresh",
+                "Changed or new entry content mismatch");
+    TEST_ASSERT(fs::last_write_time(output_dir / "subdir" / "b.txt") ==
+                        fs::last_write_time(test_dir / "subdir" / "b.txt") &&
+                    fs::last_write_time(output_dir / "a.txt") == a_mtime,
+                "Unpack did not restore source mtimes");
+  }
+
+  // 基准与输出为同一文件时拒绝执行
+  std::string same_cmd = "./kar pack --incremental " + base_path.string() +
+                         " " + test_dir.string() + " " + base_path.string() +
+                         " > /dev/null 2>&1";
+  TEST_ASSERT(std::system(same_cmd.c_str()) != 0,
+              "Packing over the incremental base should fail");
+
+  std::cout << "  ✓ Unchanged files are copied from the base, mtimes restored\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 16: 去重打包（内容定义分块 + 整文件重复）
+// ============================================
+
+void test_dedup_pack() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  // SHA-256 各引擎与标准测试向量一致（块寻址依赖它）
+  for (SHA256Engine engine : SHA256::all_engines()) {
+    if (!SHA256::is_supported(engine)) {
+      continue;
+    }
+    SHA256Digest digest = SHA256(engine).calculate("abc", 3);
+    std::ostringstream hex;
+    for (uint8_t byte : digest) {
+      hex << std::hex << std::setw(2) << std::setfill('0') << int(byte);
+    }
+    TEST_ASSERT(hex.str() == "ba7816bf8f01cfea414140de5dae2223"
+                             "b00361a396177a9cb410ff61f20015ad",
+                std::string("SHA-256 mismatch for engine ") +
+                    SHA256::engine_name(engine));
+  }
+
+  // 噪声镜像、中部插入若干字节的副本，以及三份完全相同的文件
+  setup_test_files(test_dir);
+  std::string image(6 * 1024 * 1024, '\0');
+  uint32_t seed = 7;
+  for (auto &c : image) {
+    seed = seed * 1103515245 + 12345;
+    c = static_cast<char>(seed >> 24);
+  }
+  std::string edited = image;
+  edited.insert(3 * 1024 * 1024 + 17, "inserted bytes");
+  std::ofstream(test_dir / "vm.img", std::ios::binary) << image;
+  std::ofstream(test_dir / "vm-edited.img", std::ios::binary) << edited;
+  const std::string copy = image.substr(100, 200 * 1024);
+  for (const char *name : {"copy1.bin", "copy2.bin", "subdir/copy3.bin"}) {
+    std::ofstream(test_dir / name, std::ios::binary) << copy;
+  }
+
+  std::vector<char> first_archive;
+  for (const char *threads : {"1", "4"}) {
+    std::string pack_cmd = std::string("./kar pack --dedup --codec lz4 --threads ") +
+                           threads + " " + test_dir.string() + " " +
+                           archive_path.string() + " > /dev/null 2>&1";
+    TEST_ASSERT(std::system(pack_cmd.c_str()) == 0, "Dedup pack failed");
+    // 两份镜像只是插入了几个字节：只多存插入点附近的块；三份相同文件存一份
+    const auto size = fs::file_size(archive_path);
+    TEST_ASSERT(size < image.size() + 2 * copy.size(),
+                "Dedup archive too large: " + std::to_string(size));
+
+    // 串行与并行的输出除创建时间外完全一致
+    auto data = read_file_bytes(archive_path);
+    if (first_archive.empty()) {
+      first_archive = data;
+    } else {
+      TEST_ASSERT(data.size() == first_archive.size() &&
+                      std::equal(data.begin() + 24, data.end(),
+                                 first_archive.begin() + 24),
+                  "Serial and parallel dedup archives differ");
+    }
+
+    for (const char *unpack_threads : {"1", "4"}) {
+      fs::remove_all(output_dir);
+      std::string unpack_cmd = std::string("./kar unpack --threads ") +
+                               unpack_threads + " " + archive_path.string() +
+                               " " + output_dir.string() + " > /dev/null 2>&1";
+      TEST_ASSERT(std::system(unpack_cmd.c_str()) == 0, "Dedup unpack failed");
+      TEST_ASSERT(read_file_string(output_dir / "vm.img") == image &&
+                      read_file_string(output_dir / "vm-edited.img") == edited &&
+                      read_file_string(output_dir / "copy2.bin") == copy &&
+                      read_file_string(output_dir / "subdir" / "copy3.bin") == copy &&
+                      read_file_string(output_dir / "a.txt") == "hello",
+                  "Dedup content mismatch");
+    }
+  }
+
+  // 只解出引用了其他条目块的文件
+  fs::remove_all(output_dir);
+  std::string extract_cmd = "./kar extract --output " + output_dir.string() +
+                            " " + archive_path.string() +
+                            " subdir/copy3.bin > /dev/null 2>&1";
+  TEST_ASSERT(std::system(extract_cmd.c_str()) == 0 &&
+                  read_file_string(output_dir / "subdir" / "copy3.bin") == copy,
+              "Extracting a deduplicated entry failed");
+
+  std::cout << "  ✓ Duplicate chunks and files are stored once and restored\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 17: 写入合并与进度输出节流
+// ============================================
+
+void test_batched_writes_and_progress() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  // 大量小文件（合并进同一缓冲区）与跨越缓冲区边界的中等文件（聚合写）
+  setup_test_files(test_dir);
+  const int file_count = 3000;
+  for (int i = 0; i < file_count; ++i) {
+    std::ofstream(test_dir / ("f" + std::to_string(i) + ".txt"))
+        << std::string(static_cast<size_t>(i % 97), 'a' + i % 26);
+  }
+  std::string medium(1536 * 1024 + 5, '\0');
+  for (size_t i = 0; i < medium.size(); ++i) {
+    medium[i] = static_cast<char>(i * 31 + i / 4096);
+  }
+  std::ofstream(test_dir / "medium.bin", std::ios::binary) << medium;
+
+  for (const char *io : {"stream", "mmap"}) {
+    // 进度条按时间节流：刷新次数远少于文件数，最后一次为 100%
+    auto output = run_command_output(
+        std::string("./kar pack --threads 1 --stats --io ") + io + " " +
+        test_dir.string() + " " + archive_path.string() + " 2>&1");
+    size_t redraws = static_cast<size_t>(
+        std::count(output.begin(), output.end(), '\r'));
+    TEST_ASSERT(redraws >= 1 && redraws < file_count / 2,
+                "Progress was not throttled: " + std::to_string(redraws) +
+                    " redraws");
+    TEST_ASSERT(output.find("100%") != std::string::npos,
+                "Final progress update missing");
+
+    // 条目合并写出：--stats 统计的归档写调用次数远少于条目数
+    const size_t pos = output.find("\nwrite ");
+    TEST_ASSERT(pos != std::string::npos,
+                "pack --stats printed no write stage: " + output);
+    const size_t writes = std::stoul(output.substr(pos + 7));
+    TEST_ASSERT(writes >= 1 && writes < file_count / 100,
+                "Writes were not batched: " + std::to_string(writes) +
+                    " write calls for " + std::to_string(file_count) +
+                    " entries with io " + io);
+
+    // --quiet：不输出进度，只输出汇总
+    output = run_command_output(std::string("./kar unpack --quiet --io ") + io +
+                                " " + archive_path.string() + " " +
+                                output_dir.string() + " 2>&1");
+    TEST_ASSERT(output.find('\r') == std::string::npos &&
+                    output.find("Extracted to") != std::string::npos,
+                "--quiet still printed progress: " + output);
+    TEST_ASSERT(read_file_string(output_dir / "medium.bin") == medium &&
+                    read_file_string(output_dir / "f2999.txt") ==
+                        std::string(2999 % 97, 'a' + 2999 % 26),
+                std::string("Batched write content mismatch with io ") + io);
+    fs::remove_all(output_dir);
+  }
+
+  std::cout << "  ✓ Small entries are coalesced and progress output is throttled\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 18: 缓冲区池复用 payload 缓冲区
+// ============================================
+
+// 从 --pool-stats 输出中取出系统分配次数
+size_t pool_allocations(const std::string &output) {
+  const std::string prefix = "Buffer pool: ";
+  size_t pos = output.find(prefix);
+  if (pos == std::string::npos) {
+    return SIZE_MAX;
+  }
+  return std::stoul(output.substr(pos + prefix.size()));
+}
+
+void test_buffer_pool_reuse() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  setup_test_files(test_dir);
+  const int file_count = 2000;
+  for (int i = 0; i < file_count; ++i) {
+    std::ofstream(test_dir / ("f" + std::to_string(i) + ".txt"))
+        << std::string(static_cast<size_t>(100 + i % 900), 'a' + i % 26);
+  }
+
+  // 稳定状态下每个条目不再向系统申请缓冲区：分配次数与文件数无关
+  for (const char *codec : {"none", "lz4"}) {
+    auto output = run_command_output(
+        std::string("./kar pack --quiet --pool-stats --threads 1 --codec ") +
+        codec + " " + test_dir.string() + " " + archive_path.string());
+    size_t allocations = pool_allocations(output);
+    TEST_ASSERT(allocations < 64, std::string("Pack with codec ") + codec +
+                                      " allocated per entry: " + output);
+
+    output = run_command_output("./kar unpack --quiet --pool-stats --io stream " +
+                                archive_path.string() + " " + output_dir.string());
+    TEST_ASSERT(pool_allocations(output) < 64,
+                "Unpack allocated per entry: " + output);
+    TEST_ASSERT(read_file_string(output_dir / "f1999.txt") ==
+                    std::string(100 + 1999 % 900, 'a' + 1999 % 26),
+                std::string("Pooled buffer content mismatch with codec ") + codec);
+    fs::remove_all(output_dir);
+  }
+
+  std::cout << "  ✓ Payload buffers are reused across entries\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 19: 并行目录扫描
+// ============================================
+
+void test_parallel_scanner() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path serial_archive = "test_crc_tmp/serial.kar";
+  const fs::path parallel_archive = "test_crc_tmp/parallel.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  // 多层、多分支的目录树，外加符号链接与空目录
+  setup_test_files(test_dir);
+  for (int a = 0; a < 8; ++a) {
+    for (int b = 0; b < 8; ++b) {
+      fs::path dir = test_dir / ("a" + std::to_string(a)) / ("b" + std::to_string(b));
+      fs::create_directories(dir / "deep" / "deeper");
+      std::ofstream(dir / "x.txt") << "x" << a << b;
+      std::ofstream(dir / "deep" / "deeper" / "y.txt") << "y" << a << b;
+    }
+  }
+  fs::create_directories(test_dir / "empty");
+  std::ofstream(test_dir / "run.sh") << "#!/bin/sh\n";
+  fs::permissions(test_dir / "run.sh", fs::perms::owner_all | fs::perms::group_read |
+                                           fs::perms::group_exec);
+  fs::create_symlink("run.sh", test_dir / "link.sh");      // 指向文件：收录
+  fs::create_directory_symlink("a0", test_dir / "loop");   // 指向目录：不进入
+  fs::create_symlink("missing", test_dir / "dangling");    // 悬空：跳过
+
+  run_command_output("./kar pack --quiet --threads 1 " + test_dir.string() + " " +
+                     serial_archive.string());
+  run_command_output("./kar pack --quiet --threads 8 " + test_dir.string() + " " +
+                     parallel_archive.string());
+
+  // 顺序与线程数无关：两份归档的条目列表一致
+  auto serial_list = run_command_output("./kar list " + serial_archive.string());
+  auto parallel_list =
+      run_command_output("./kar list " + parallel_archive.string());
+  TEST_ASSERT(serial_list.substr(serial_list.find('\n')) ==
+                  parallel_list.substr(parallel_list.find('\n')),
+              "Parallel scan changed entry order");
+  TEST_ASSERT(parallel_list.find("Entries: 132") != std::string::npos,
+              "Unexpected entry count: " + parallel_list);
+  TEST_ASSERT(parallel_list.find("loop/") == std::string::npos,
+              "Directory symlink was followed");
+
+  run_command_output("./kar unpack --quiet " + parallel_archive.string() + " " +
+                     output_dir.string());
+  TEST_ASSERT(read_file_string(output_dir / "a7/b3/deep/deeper/y.txt") == "y73" &&
+                  read_file_string(output_dir / "link.sh") == "#!/bin/sh\n",
+              "Scanned content mismatch");
+  // 权限取自扫描时的 st_mode
+  TEST_ASSERT(fs::status(output_dir / "run.sh").permissions() ==
+                  (fs::perms::owner_all | fs::perms::group_read |
+                   fs::perms::group_exec),
+              "Scanned permissions were not preserved");
+
+  std::cout << "  ✓ Parallel scan is deterministic and captures file metadata\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 20: io_uring 批量读取与异步写出
+// ============================================
+
+void test_uring_backend() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path stream_archive = "test_crc_tmp/stream.kar";
+  const fs::path uring_archive = "test_crc_tmp/uring.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  // 多批小文件（含空文件）+ 分块大文件，归档跨越多个写缓冲区
+  setup_test_files(test_dir);
+  for (int i = 0; i < 300; ++i) {
+    std::ofstream(test_dir / ("s" + std::to_string(i) + ".txt"))
+        << std::string(static_cast<size_t>(i * 37 % 5000), 'a' + i % 26);
+  }
+  std::string large(5 * 1024 * 1024 + 3, '\0');
+  for (size_t i = 0; i < large.size(); ++i) {
+    large[i] = static_cast<char>(i * 7 + i / 1000);
+  }
+  std::ofstream(test_dir / "large.bin", std::ios::binary) << large;
+
+  for (const char *opts : {"--threads 1", "--threads 4 --codec lz4"}) {
+    run_command_output(std::string("./kar pack --quiet --io stream ") + opts +
+                       " " + test_dir.string() + " " + stream_archive.string());
+    // 不支持 io_uring 的内核上退回 stream 后端，结果同样应一致
+    run_command_output(std::string("./kar pack --quiet --io uring ") + opts +
+                       " " + test_dir.string() + " " + uring_archive.string() +
+                       " 2>/dev/null");
+    auto stream_list = run_command_output("./kar list " + stream_archive.string());
+    auto uring_list = run_command_output("./kar list " + uring_archive.string());
+    TEST_ASSERT(stream_list.substr(stream_list.find('\n')) ==
+                    uring_list.substr(uring_list.find('\n')),
+                std::string("io_uring archive differs with ") + opts);
+    TEST_ASSERT(fs::file_size(stream_archive) == fs::file_size(uring_archive),
+                std::string("io_uring archive size differs with ") + opts);
+
+    run_command_output("./kar unpack --quiet " + uring_archive.string() + " " +
+                       output_dir.string());
+    TEST_ASSERT(read_file_string(output_dir / "large.bin") == large &&
+                    read_file_string(output_dir / "s299.txt") ==
+                        std::string(299 * 37 % 5000, 'a' + 299 % 26) &&
+                    fs::file_size(output_dir / "s0.txt") == 0,
+                std::string("io_uring content mismatch with ") + opts);
+    fs::remove_all(output_dir);
+  }
+
+  std::cout << "  ✓ io_uring backend produces the same archive as stream\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 21: 经管道流式打包与解包
+// ============================================
+
+void test_streaming_pipe() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path stream_archive = "test_crc_tmp/stream.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  // 小文件 + 分块大文件（条目头无法回填）+ 重复内容（去重引用）
+  setup_test_files(test_dir);
+  std::string large;
+  for (uint64_t i = 0; large.size() < 6 * 1024 * 1024; ++i) {
+    large += "line " + std::to_string(i * 7919 % 100003) + "\n";
+  }
+  std::ofstream(test_dir / "large.txt", std::ios::binary) << large;
+  std::ofstream(test_dir / "subdir" / "large_copy.txt", std::ios::binary)
+      << large;
+
+  for (const char *opts :
+       {"--threads 1", "--threads 4 --codec lz4", "--threads 4 --dedup"}) {
+    // pack 的标准输出只有归档数据：tee 同时保存一份供文件方式读取
+    int rc = std::system(("./kar pack --quiet " + std::string(opts) + " " +
+                          test_dir.string() + " - 2>/dev/null | tee " +
+                          stream_archive.string() +
+                          " | ./kar unpack --quiet - " + output_dir.string() +
+                          " >/dev/null")
+                             .c_str());
+    TEST_ASSERT(rc == 0, std::string("Streaming pipe failed with ") + opts);
+    TEST_ASSERT(read_file_string(output_dir / "large.txt") == large &&
+                    read_file_string(output_dir / "subdir" / "large_copy.txt") ==
+                        large &&
+                    read_file_string(output_dir / "a.txt") == "hello",
+                std::string("Streamed content mismatch with ") + opts);
+    fs::remove_all(output_dir);
+
+    // 流式归档：FileHeader 不记录条目数并带流式标志
+    std::string data = read_file_string(stream_archive);
+    uint32_t entry_count = 0;
+    uint32_t flags = 0;
+    std::memcpy(&entry_count, data.data() + 6, sizeof(entry_count));
+    std::memcpy(&flags, data.data() + 18, sizeof(flags));
+    TEST_ASSERT(entry_count == 0 && (flags & 1), "Stream header is not marked");
+
+    // 保存下来的流式归档同样可按文件方式 list / 并行解包
+    auto listed = run_command_output("./kar list " + stream_archive.string());
+    TEST_ASSERT(listed.find("Entries: 4") != std::string::npos,
+                "Streamed archive entry count not read from trailer");
+    run_command_output("./kar unpack --quiet --threads 4 " +
+                       stream_archive.string() + " " + output_dir.string());
+    TEST_ASSERT(read_file_string(output_dir / "large.txt") == large,
+                std::string("Streamed archive file unpack mismatch with ") +
+                    opts);
+    fs::remove_all(output_dir);
+  }
+
+  // 分块条目的 CRC32 只在末尾目录中：读到目录后才发现损坏，删除该文件并报错
+  run_command_output("./kar pack --quiet --threads 4 " + test_dir.string() +
+                     " - > " + stream_archive.string() + " 2>/dev/null");
+  std::string data = read_file_string(stream_archive);
+  data[data.find("large.txt") + 100000] ^= 0x20; // 首次出现为条目头中的路径
+  std::ofstream(stream_archive, std::ios::binary | std::ios::trunc) << data;
+  int rc = std::system(("./kar unpack --quiet - " + output_dir.string() +
+                        " < " + stream_archive.string() + " >/dev/null 2>&1")
+                           .c_str());
+  TEST_ASSERT(rc != 0 && !fs::exists(output_dir / "large.txt"),
+              "Corrupted deferred entry was not rejected");
+
+  std::cout << "  ✓ pack - | unpack - round trip through a pipe\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 22: 库接口的进度回调与校验级别
+// ============================================
+
+void test_progress_and_verify_level() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  setup_test_files(test_dir);
+  std::string medium(3 * 1024 * 1024, 'm');
+  std::ofstream(test_dir / "medium.bin", std::ios::binary) << medium;
+
+  // 进度由回调驱动：最后一次刷新报告全部条目与字节数（5 + 5 + 3 MB）
+  for (const char *threads : {"1", "4"}) {
+    auto output = run_command_output(std::string("./kar pack --threads ") +
+                                     threads + " " + test_dir.string() + " " +
+                                     archive_path.string() + " 2>&1");
+    TEST_ASSERT(output.find("100% (3/3) 3.00 MB/3.00 MB") != std::string::npos &&
+                    output.find("(3 files)") != std::string::npos,
+                std::string("Progress or summary missing: ") + output);
+  }
+
+  // 破坏 a.txt 的内容：默认校验拒绝，--verify none 照常解出
+  std::string data = read_file_string(archive_path);
+  data[data.find("hello")] = 'j';
+  std::ofstream(archive_path, std::ios::binary | std::ios::trunc) << data;
+  for (const char *threads : {"1", "4"}) {
+    const std::string base = std::string("./kar unpack --quiet --threads ") +
+                             threads + " ";
+    int rc = std::system((base + archive_path.string() + " " +
+                          output_dir.string() + " >/dev/null 2>&1")
+                             .c_str());
+    TEST_ASSERT(rc != 0, "Corrupted entry passed default verification");
+    fs::remove_all(output_dir);
+
+    auto output = run_command_output(base + "--verify none " +
+                                     archive_path.string() + " " +
+                                     output_dir.string() + " 2>&1");
+    TEST_ASSERT(output.find("3 entries") != std::string::npos &&
+                    output.find('\r') == std::string::npos,
+                "--verify none unpack failed: " + output);
+    TEST_ASSERT(read_file_string(output_dir / "a.txt") == "jello" &&
+                    read_file_string(output_dir / "medium.bin") == medium,
+                "--verify none content mismatch");
+    fs::remove_all(output_dir);
+  }
+  int rc = std::system(("./kar unpack --verify bogus " + archive_path.string() +
+                        " " + output_dir.string() + " >/dev/null 2>&1")
+                           .c_str());
+  TEST_ASSERT(rc != 0, "Unknown verify level was accepted");
+
+  std::cout << "  ✓ Progress callbacks report entries and bytes; --verify none"
+               " skips CRC32\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 23: verify 校验全部条目且不写磁盘
+// ============================================
+
+void test_verify_command() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+
+  setup_test_files(test_dir);
+  std::string large;
+  for (uint64_t i = 0; large.size() < 9 * 1024 * 1024; ++i) {
+    large += "row " + std::to_string(i * 7919 % 100003) + "\n";
+  }
+  std::ofstream(test_dir / "large.txt", std::ios::binary) << large;
+
+  for (const char *opts : {"", "--codec lz4", "--dedup"}) {
+    run_command_output(std::string("./kar pack --quiet ") + opts + " " +
+                       test_dir.string() + " " + archive_path.string());
+    auto output = run_command_output("./kar verify --quiet " +
+                                     archive_path.string() + " 2>&1");
+    TEST_ASSERT(output.find("Verified 3 entries") != std::string::npos &&
+                    output.find(" 0 failed") != std::string::npos,
+                std::string("Intact archive failed verify with ") + opts +
+                    ": " + output);
+  }
+
+  // 同时破坏小条目与大条目的一个分段：两者都被列出，不在第一个错误处中止
+  run_command_output("./kar pack --quiet " + test_dir.string() + " " +
+                     archive_path.string());
+  std::string data = read_file_string(archive_path);
+  data[data.find("hello")] ^= 0x01;
+  data[data.find("large.txt") + 6 * 1024 * 1024] ^= 0x01;
+  std::ofstream(archive_path, std::ios::binary | std::ios::trunc) << data;
+  const auto before = fs::last_write_time("test_crc_tmp");
+  for (const char *threads : {"1", "4"}) {
+    auto output =
+        run_command_output(std::string("./kar verify --quiet --threads ") +
+                           threads + " " + archive_path.string() + " 2>&1");
+    TEST_ASSERT(output.find("FAILED: a.txt") != std::string::npos &&
+                    output.find("FAILED: large.txt") != std::string::npos &&
+                    output.find("FAILED: subdir/b.txt") == std::string::npos &&
+                    output.find(" 2 failed") != std::string::npos,
+                std::string("Failures not reported with threads ") + threads +
+                    ": " + output);
+  }
+  int rc = std::system(("./kar verify --quiet " + archive_path.string() +
+                        " >/dev/null 2>&1")
+                           .c_str());
+  TEST_ASSERT(rc != 0, "verify succeeded on a corrupted archive");
+  TEST_ASSERT(fs::last_write_time("test_crc_tmp") == before,
+              "verify wrote to the filesystem");
+
+  std::cout << "  ✓ verify reports every corrupted entry without writing files\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 24: --stats 分阶段计时与 --trace 导出
+// ============================================
+void test_stage_stats() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path extract_dir = "test_crc_tmp/extracted";
+  const fs::path trace_path = "test_crc_tmp/trace.json";
+
+  setup_test_files(test_dir);
+
+  // 每个阶段一行，调用次数紧随阶段名之后
+  auto calls_of = [](const std::string &output, const std::string &stage) {
+    const size_t pos = output.find("\n" + stage + " ");
+    return pos == std::string::npos
+               ? 0ul
+               : std::stoul(output.substr(pos + 1 + stage.size()));
+  };
+
+  auto output = run_command_output(
+      "./kar pack --quiet --stats --io stream --trace " + trace_path.string() +
+      " " + test_dir.string() + " " + archive_path.string() + " 2>&1");
+  TEST_ASSERT(output.find("Stage breakdown") != std::string::npos &&
+                  output.find("Per thread (ms):") != std::string::npos,
+              "pack --stats printed no breakdown: " + output);
+  TEST_ASSERT(calls_of(output, "scan") >= 2, "scan not counted: " + output);
+  TEST_ASSERT(calls_of(output, "open") >= 2, "open not counted: " + output);
+  TEST_ASSERT(calls_of(output, "read") >= 2, "read not counted: " + output);
+  TEST_ASSERT(calls_of(output, "write") >= 1, "write not counted: " + output);
+
+  const std::string trace = read_file_string(trace_path);
+  TEST_ASSERT(trace.find("\"traceEvents\"") != std::string::npos &&
+                  trace.find("\"ph\": \"X\"") != std::string::npos &&
+                  trace.find("\"name\": \"read\"") != std::string::npos,
+              "Trace file is not Chrome trace JSON");
+
+  output = run_command_output("./kar unpack --quiet --stats --threads 4 " +
+                              archive_path.string() + " " +
+                              extract_dir.string() + " 2>&1");
+  TEST_ASSERT(calls_of(output, "write") >= 2 && calls_of(output, "crc") >= 2 &&
+                  calls_of(output, "mkdir") >= 1 &&
+                  calls_of(output, "chmod") >= 2,
+              "unpack --stats missing stages: " + output);
+  TEST_ASSERT(read_file_string(extract_dir / "subdir" / "b.txt") == "world",
+              "Content mismatch after unpack --stats");
+
+  // 未指定 --stats 时不输出
+  output = run_command_output("./kar unpack --quiet " + archive_path.string() +
+                              " " + extract_dir.string() + " 2>&1");
+  TEST_ASSERT(output.find("Stage breakdown") == std::string::npos,
+              "Breakdown printed without --stats");
+
+  std::cout << "  ✓ --stats counts each stage; --trace writes Chrome trace JSON\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 25: 手工按小端字节序写出的版本 1 归档可列出与解包
+// ============================================
+void test_v1_wire_format() {
+  const fs::path archive_path = "test_crc_tmp/v1.kar";
+  const fs::path extract_dir = "test_crc_tmp/extracted";
+  fs::remove_all("test_crc_tmp");
+  fs::create_directories("test_crc_tmp");
+
+  // 逐字节写出小端整数，不依赖主机字节序与结构体布局
+  std::string out;
+  auto put = [&out](uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+      out += static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+  };
+  const uint32_t count = 1500;
+  put(0x5241414B, 4); // magic
+  put(1, 2);          // version
+  put(count, 4);
+  put(1700000000, 8); // created_at
+  put(0, 4);          // flags
+
+  CRC32 crc32;
+  std::vector<std::string> contents(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    // 混入跨越读取缓冲区（1 MB）的大条目，条目头落在缓冲区边界两侧
+    const size_t size = i % 500 == 7 ? 1536 * 1024 + i : i % 97;
+    contents[i].resize(size);
+    for (size_t j = 0; j < size; ++j) {
+      contents[i][j] = static_cast<char>('a' + (i + j) % 26);
+    }
+    const std::string path = "d" + std::to_string(i % 10) + "/f" +
+                             std::to_string(i) + ".txt";
+    put(path.size(), 4);
+    put(size, 8);
+    put(1700000000, 8); // modified_time
+    put(crc32.calculate(contents[i]), 4);
+    put(0644, 2);
+    out += path;
+    out += contents[i];
+  }
+  std::ofstream(archive_path, std::ios::binary) << out;
+
+  auto output = run_command_output("./kar list " + archive_path.string());
+  TEST_ASSERT(output.find("Entries: 1500") != std::string::npos &&
+                  output.find("d9/f1499.txt (") != std::string::npos &&
+                  output.find("d7/f1007.txt (1.50 MB)") != std::string::npos,
+              "Version 1 archive listed incorrectly");
+
+  run_command_output("./kar unpack --quiet " + archive_path.string() + " " +
+                     extract_dir.string());
+  for (uint32_t i : {0u, 7u, 96u, 507u, 1499u}) {
+    const fs::path path = extract_dir / ("d" + std::to_string(i % 10)) /
+                          ("f" + std::to_string(i) + ".txt");
+    TEST_ASSERT(read_file_string(path) == contents[i],
+                "Content mismatch for " + path.string());
+  }
+
+  std::cout << "  ✓ Little-endian v1 headers parsed for list and unpack\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 26: 解包的目录骨架、空文件与经 fd 恢复的权限和修改时间
+// ============================================
+void test_unpack_metadata() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  setup_test_files(test_dir);
+  const fs::path deep = test_dir / "x" / "y" / "z" / "w";
+  fs::create_directories(deep);
+  for (int i = 0; i < 200; ++i) {
+    std::ofstream(deep / ("empty" + std::to_string(i))); // 0 字节
+  }
+  std::ofstream(deep / "ro.txt") << "read only";
+  std::ofstream(test_dir / "x" / "tool") << "#!/bin/sh\n";
+  fs::permissions(deep / "ro.txt", fs::perms::owner_read | fs::perms::group_read);
+  fs::permissions(test_dir / "x" / "tool",
+                  fs::perms::owner_all | fs::perms::group_read |
+                      fs::perms::group_exec);
+  const auto mtime = fs::last_write_time(test_dir / "a.txt") - std::chrono::hours(48);
+  fs::last_write_time(deep / "ro.txt", mtime);
+  fs::last_write_time(deep / "empty7", mtime);
+
+  run_command_output("./kar pack --quiet " + test_dir.string() + " " +
+                     archive_path.string());
+  for (const std::string &unpack :
+       {"./kar unpack --quiet --threads 1 " + archive_path.string(),
+        "./kar unpack --quiet --threads 4 " + archive_path.string(),
+        "./kar unpack --quiet - < " + archive_path.string()}) {
+    fs::remove_all(output_dir);
+    run_command_output(unpack + " " + output_dir.string());
+    const fs::path out_deep = output_dir / "x" / "y" / "z" / "w";
+    TEST_ASSERT(fs::exists(out_deep / "empty199") &&
+                    fs::file_size(out_deep / "empty0") == 0,
+                "Empty files missing after: " + unpack);
+    TEST_ASSERT(read_file_string(out_deep / "ro.txt") == "read only" &&
+                    read_file_string(output_dir / "subdir" / "b.txt") == "world",
+                "Content mismatch after: " + unpack);
+    TEST_ASSERT(fs::status(out_deep / "ro.txt").permissions() ==
+                        (fs::perms::owner_read | fs::perms::group_read) &&
+                    fs::status(output_dir / "x" / "tool").permissions() ==
+                        (fs::perms::owner_all | fs::perms::group_read |
+                         fs::perms::group_exec),
+                "Permissions not restored after: " + unpack);
+    TEST_ASSERT(fs::last_write_time(out_deep / "ro.txt") == mtime &&
+                    fs::last_write_time(out_deep / "empty7") == mtime,
+                "Modification time not restored after: " + unpack);
+  }
+
+  // 解包到已有的目录树中：已存在的目录直接复用
+  auto output = run_command_output("./kar unpack --quiet --threads 4 " +
+                                    archive_path.string() + " " +
+                                    output_dir.string() + " 2>&1");
+  TEST_ASSERT(output.find("Error") == std::string::npos,
+              "Unpack into existing tree failed: " + output);
+
+  std::cout << "  ✓ Directory skeleton, empty files, permissions and mtime restored\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 27: 稀疏文件只打包数据区，解包后仍保留空洞
+// ============================================
+void test_sparse_files() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+  const uint64_t logical_size = 64ull << 20;
+
+  // 64 MB 的稀疏文件：开头、中间与末尾附近各写一段数据，其余为空洞
+  setup_test_files(test_dir);
+  const fs::path image = test_dir / "disk.img";
+  std::ofstream(image, std::ios::binary).close();
+  fs::resize_file(image, logical_size);
+  {
+    std::fstream file(image, std::ios::in | std::ios::out | std::ios::binary);
+    uint32_t state = 12345;
+    std::vector<char> data(300 * 1024);
+    for (uint64_t offset : {uint64_t{0}, uint64_t{20} << 20, logical_size - (1 << 20)}) {
+      for (char &c : data) {
+        state = state * 1103515245u + 12345u;
+        c = offset == 0 ? static_cast<char>('a' + (state >> 16) % 4)
+                        : static_cast<char>(state >> 16);
+      }
+      file.seekp(static_cast<std::streamoff>(offset));
+      file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+  }
+  struct stat st;
+  if (::stat(image.c_str(), &st) != 0 ||
+      static_cast<uint64_t>(st.st_blocks) * 512 >= logical_size / 4) {
+    std::cout << "  - Filesystem does not keep holes, skipped\n";
+    fs::remove_all("test_crc_tmp");
+    return;
+  }
+  const std::vector<char> expected = read_file_bytes(image);
+
+  for (const std::string &pack : {std::string("--threads 1"), std::string("--threads 4"),
+                                  std::string("--threads 4 --codec lz4"),
+                                  std::string("--threads 4 --dedup"),
+                                  std::string("--threads 1 --dedup --codec lz4")}) {
+    run_command_output("./kar pack --quiet " + pack + " " + test_dir.string() +
+                       " " + archive_path.string());
+    TEST_ASSERT(fs::file_size(archive_path) < 2 * 1024 * 1024,
+                "Holes were stored as data with: " + pack);
+    auto listing = run_command_output("./kar list " + archive_path.string());
+    TEST_ASSERT(listing.find("disk.img (64.00 MB") != std::string::npos &&
+                    listing.find("sparse") != std::string::npos,
+                "Sparse entry not listed with: " + pack);
+
+    for (const std::string &unpack :
+         {"./kar unpack --quiet --threads 1 " + archive_path.string(),
+          "./kar unpack --quiet --threads 4 " + archive_path.string(),
+          "./kar unpack --quiet - < " + archive_path.string()}) {
+      fs::remove_all(output_dir);
+      run_command_output(unpack + " " + output_dir.string());
+      const fs::path out_image = output_dir / "disk.img";
+      TEST_ASSERT(read_file_bytes(out_image) == expected,
+                  "Sparse content mismatch after: " + unpack + " (" + pack + ")");
+      TEST_ASSERT(::stat(out_image.c_str(), &st) == 0 &&
+                      static_cast<uint64_t>(st.st_blocks) * 512 < logical_size / 4,
+                  "Holes not preserved after: " + unpack + " (" + pack + ")");
+    }
+    auto verify = run_command_output("./kar verify " + archive_path.string());
+    TEST_ASSERT(verify.find("0 failed") != std::string::npos,
+                "Verify failed for sparse entry: " + verify);
+  }
+
+  // 去重只作用于数据区：同一稀疏文件的第二份只写引用与空洞记录
+  const fs::path copy = test_dir / "disk2.img";
+  std::system(("cp --sparse=always " + image.string() + " " + copy.string()).c_str());
+  run_command_output("./kar pack --quiet --dedup " + test_dir.string() + " " +
+                     archive_path.string());
+  TEST_ASSERT(fs::file_size(archive_path) < 1200 * 1024,
+              "Sparse copy was not deduplicated");
+  fs::remove_all(output_dir);
+  run_command_output("./kar unpack --quiet " + archive_path.string() + " " +
+                     output_dir.string());
+  TEST_ASSERT(read_file_bytes(output_dir / "disk2.img") == expected &&
+                  ::stat((output_dir / "disk2.img").c_str(), &st) == 0 &&
+                  static_cast<uint64_t>(st.st_blocks) * 512 < logical_size / 4,
+              "Deduplicated sparse copy not restored with holes");
+  fs::remove(copy);
+
+  // 全空洞的文件：只有一条空洞记录
+  fs::remove(image);
+  std::ofstream(image, std::ios::binary).close();
+  fs::resize_file(image, 8 << 20);
+  run_command_output("./kar pack --quiet " + test_dir.string() + " " +
+                     archive_path.string());
+  fs::remove_all(output_dir);
+  run_command_output("./kar unpack --quiet " + archive_path.string() + " " +
+                     output_dir.string());
+  const std::vector<char> zeros(8 << 20, 0);
+  TEST_ASSERT(fs::file_size(archive_path) < 64 * 1024 &&
+                  read_file_bytes(output_dir / "disk.img") == zeros,
+              "All-hole file roundtrip failed");
+
+  std::cout << "  ✓ Sparse files pack only their data and unpack with holes\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 28: 工作窃取调度下的倾斜负载（少量大文件 + 大量小文件）与 CPU 绑定
+// ============================================
+void test_work_stealing_scheduler() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+
+  setup_test_files(test_dir);
+  for (int d = 0; d < 10; ++d) {
+    fs::create_directories(test_dir / ("f" + std::to_string(d)));
+  }
+  for (int i = 0; i < 1500; ++i) {
+    std::ofstream(test_dir / ("f" + std::to_string(i % 10)) /
+                  ("n" + std::to_string(i)))
+        << "small " << i;
+  }
+  std::string large;
+  for (uint64_t i = 0; large.size() < 13 * 1024 * 1024; ++i) {
+    large += "line " + std::to_string(i * 104729 % 1000003) + "\n";
+  }
+  std::ofstream(test_dir / "big1.txt", std::ios::binary) << large;
+  std::reverse(large.begin(), large.end());
+  std::ofstream(test_dir / "big2.txt", std::ios::binary) << large;
+
+  for (const char *affinity : {"none", "compact", "scatter"}) {
+    for (const char *opts : {"", "--codec lz4", "--dedup"}) {
+      const std::string common = std::string(" --quiet --threads 8 --affinity ") + affinity;
+      run_command_output("./kar pack" + common + " " + opts + " " +
+                         test_dir.string() + " " + archive_path.string());
+      fs::remove_all(output_dir);
+      run_command_output("./kar unpack" + common + " " + archive_path.string() +
+                         " " + output_dir.string());
+      TEST_ASSERT(read_file_string(output_dir / "big2.txt") == large &&
+                      read_file_string(output_dir / "f9" / "n1499") == "small 1499" &&
+                      read_file_string(output_dir / "a.txt") == "hello",
+                  std::string("Content mismatch with --affinity ") + affinity +
+                      " " + opts);
+      auto verify = run_command_output("./kar verify" + common + " " +
+                                       archive_path.string() + " 2>&1");
+      TEST_ASSERT(verify.find("Verified 1504 entries") != std::string::npos &&
+                      verify.find(" 0 failed") != std::string::npos,
+                  std::string("Verify failed with --affinity ") + affinity +
+                      " " + opts + ": " + verify);
+    }
+  }
+
+  int rc = std::system(("./kar pack --quiet --affinity everywhere " +
+                        test_dir.string() + " " + archive_path.string() +
+                        " >/dev/null 2>&1")
+                           .c_str());
+  TEST_ASSERT(rc != 0, "Unknown affinity was accepted");
+
+  std::cout << "  ✓ Skewed workload packs, unpacks and verifies under every affinity\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 29: 分卷打包，按需读取卷解包 / 提取
+// ============================================
+void test_volume_archives() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path archive_path = "test_crc_tmp/test.kar";
+  const fs::path output_dir = "test_crc_tmp/output";
+  const uint64_t volume_size = 256 * 1024;
+
+  setup_test_files(test_dir);
+  std::string large;
+  for (uint64_t i = 0; large.size() < 3 * 1024 * 1024; ++i) {
+    large += "row " + std::to_string(i * 7919 % 100003) + "\n";
+  }
+  std::ofstream(test_dir / "zz_large.txt", std::ios::binary) << large;
+
+  auto volume = [&](int n) {
+    char suffix[16];
+    std::snprintf(suffix, sizeof(suffix), ".%03d", n);
+    return fs::path(archive_path.string() + suffix);
+  };
+
+  for (const char *opts : {"", "--codec lz4", "--dedup"}) {
+    auto out = run_command_output("./kar pack --quiet --volume-size 256K " +
+                                  std::string(opts) + " " + test_dir.string() +
+                                  " " + archive_path.string());
+    TEST_ASSERT(out.find(" volumes)") != std::string::npos,
+                std::string("Pack did not report volumes: ") + out);
+    TEST_ASSERT(fs::exists(archive_path) && fs::exists(volume(1)) &&
+                    fs::exists(volume(2)),
+                std::string("Volume files missing with ") + opts);
+    int count = 0;
+    uint64_t total = 0;
+    while (fs::exists(volume(count + 1))) {
+      const uint64_t size = fs::file_size(volume(count + 1));
+      ++count;
+      total += size;
+      TEST_ASSERT(size <= volume_size, "Volume exceeds --volume-size");
+      TEST_ASSERT(!fs::exists(volume(count + 1)) || size == volume_size,
+                  "Inner volume is not full");
+    }
+    TEST_ASSERT(fs::file_size(archive_path) < 64 * 1024,
+                "Volume table should only hold the index");
+
+    for (const char *threads : {"1", "4"}) {
+      fs::remove_all(output_dir);
+      run_command_output("./kar unpack --quiet --threads " + std::string(threads) +
+                         " " + archive_path.string() + " " + output_dir.string());
+      TEST_ASSERT(read_file_string(output_dir / "zz_large.txt") == large &&
+                      read_file_string(output_dir / "a.txt") == "hello",
+                  std::string("Content mismatch with ") + opts + " threads " + threads);
+    }
+    auto verify = run_command_output("./kar verify --quiet " +
+                                     archive_path.string() + " 2>&1");
+    TEST_ASSERT(verify.find(" 0 failed") != std::string::npos,
+                std::string("Verify failed with ") + opts + ": " + verify);
+
+    // 拼接各卷即为普通归档
+    {
+      std::ofstream whole("test_crc_tmp/whole.kar", std::ios::binary);
+      for (int i = 1; i <= count; ++i) {
+        whole << read_file_string(volume(i));
+      }
+      TEST_ASSERT(static_cast<uint64_t>(whole.tellp()) == total,
+                  "Concatenated size mismatch");
+    }
+    verify = run_command_output("./kar verify --quiet test_crc_tmp/whole.kar 2>&1");
+    TEST_ASSERT(verify.find(" 0 failed") != std::string::npos,
+                std::string("Concatenated volumes do not form an archive: ") + verify);
+  }
+
+  // 最后一次为 --dedup 打包；移走 a.txt 所在卷以外的全部卷，list 与 a.txt 的提取仍然成功
+  auto list = run_command_output("./kar list " + archive_path.string());
+  const std::string marker = "\na.txt (5.00 B, dedup, volume ";
+  const size_t at = list.find(marker);
+  TEST_ASSERT(list.find("Volumes: ") != std::string::npos && at != std::string::npos,
+              "List does not show volumes: " + list);
+  const int needed = std::atoi(list.c_str() + at + marker.size());
+  fs::create_directories("test_crc_tmp/hidden");
+  for (int i = 1; fs::exists(volume(i)); ++i) {
+    if (i != needed) {
+      fs::rename(volume(i), fs::path("test_crc_tmp/hidden") / volume(i).filename());
+    }
+  }
+  list = run_command_output("./kar list " + archive_path.string() + " 2>&1");
+  TEST_ASSERT(list.find(marker) != std::string::npos,
+              "List needed the volume files: " + list);
+  fs::remove_all(output_dir);
+  int rc = std::system(("./kar extract --quiet --output " + output_dir.string() +
+                        " " + archive_path.string() + " a.txt >/dev/null 2>&1")
+                           .c_str());
+  TEST_ASSERT(rc == 0 && read_file_string(output_dir / "a.txt") == "hello",
+              "Extract needed volumes it should not touch");
+  auto missing = run_command_output("./kar extract --quiet --output " +
+                                    output_dir.string() + " " +
+                                    archive_path.string() + " zz_large.txt 2>&1");
+  TEST_ASSERT(missing.find("Missing archive volume") != std::string::npos,
+              "Missing volume was not reported: " + missing);
+  for (const auto &entry : fs::directory_iterator("test_crc_tmp/hidden")) {
+    fs::rename(entry.path(), archive_path.parent_path() / entry.path().filename());
+  }
+
+  // 没有卷表时按卷文件探测
+  fs::remove(archive_path);
+  fs::remove_all(output_dir);
+  run_command_output("./kar unpack --quiet --threads 4 " + archive_path.string() +
+                     " " + output_dir.string());
+  TEST_ASSERT(read_file_string(output_dir / "zz_large.txt") == large,
+              "Unpack from volume files without the volume table failed");
+
+  // 各卷的写出块取自缓冲区池并循环复用：每卷至少一个写出块，
+  // 池的申请次数不少于卷数，而系统分配次数少于卷数
+  auto pooled = run_command_output(
+      "./kar pack --quiet --threads 1 --pool-stats --volume-size 256K " +
+      test_dir.string() + " " + archive_path.string());
+  size_t volumes = 0;
+  while (fs::exists(volume(static_cast<int>(volumes) + 1))) {
+    ++volumes;
+  }
+  const size_t allocations = pool_allocations(pooled);
+  const size_t reuses_at = pooled.find(" allocations, ");
+  const size_t reuses =
+      reuses_at == std::string::npos ? 0 : std::stoul(pooled.substr(reuses_at + 14));
+  TEST_ASSERT(volumes >= 8 && allocations < volumes &&
+                  allocations + reuses >= volumes,
+              "Volume writes bypassed the buffer pool: " + pooled);
+
+  rc = std::system(("./kar pack --quiet --volume-size 1M " + test_dir.string() +
+                    " - >/dev/null 2>&1")
+                       .c_str());
+  TEST_ASSERT(rc != 0, "Volumes were accepted for stdout");
+
+  std::cout << "  ✓ Volumes split at --volume-size, unpack in parallel and extract reads only needed volumes\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 30: 分组布局（固实块、对齐与原始顺序）
+// ============================================
+void test_grouped_layout() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path output_dir = "test_crc_tmp/output";
+  const std::string grouped = "test_crc_tmp/grouped.kar";
+
+  // 多个目录中交错扩展名的小文件 + 一个不可压缩的大文件
+  setup_test_files(test_dir);
+  const char *exts[] = {".c", ".h", ".md"};
+  std::map<std::string, std::string> expected{{"a.txt", "hello"},
+                                              {"subdir/b.txt", "world"}};
+  for (int d = 0; d < 3; ++d) {
+    const std::string dir = "d" + std::to_string(d);
+    fs::create_directories(test_dir / dir);
+    for (int i = 0; i < 30; ++i) {
+      const std::string rel = dir + "/f" + std::to_string(i) + exts[i % 3];
+      std::string content;
+      for (int line = 0; line <= i % 7; ++line) {
+        content += "static int value_" + std::to_string(i * 31 + line) +
+                   " = compute(" + dir + ", " + std::to_string(line) + ");\n";
+      }
+      std::ofstream(test_dir / rel, std::ios::binary) << content;
+      expected[rel] = content;
+    }
+  }
+  std::string blob(2 * 1024 * 1024 + 100, '\0');
+  uint32_t state = 12345;
+  for (char &c : blob) {
+    state = state * 1103515245 + 12345;
+    c = static_cast<char>(state >> 24);
+  }
+  std::ofstream(test_dir / "d1" / "blob.bin", std::ios::binary) << blob;
+  expected["d1/blob.bin"] = blob;
+
+  auto check_output = [&](const std::string &what) {
+    for (const auto &[rel, content] : expected) {
+      TEST_ASSERT(read_file_string(output_dir / rel) == content,
+                  what + ": content mismatch for " + rel);
+    }
+  };
+
+  // 串行与并行打包的输出一致
+  run_command_output("./kar pack --quiet --threads 1 --codec lz4 --layout grouped " +
+                     test_dir.string() + " " + grouped);
+  run_command_output("./kar pack --quiet --threads 4 --codec lz4 --layout grouped " +
+                     test_dir.string() + " test_crc_tmp/grouped4.kar");
+  const std::string bytes = read_archive_masked(grouped);
+  TEST_ASSERT(!bytes.empty() && bytes == read_archive_masked("test_crc_tmp/grouped4.kar"),
+              "Serial and parallel grouped archives differ");
+
+  for (const char *threads : {"1", "4"}) {
+    fs::remove_all(output_dir);
+    run_command_output("./kar unpack --quiet --threads " + std::string(threads) +
+                       " " + grouped + " " + output_dir.string());
+    check_output(std::string("Unpack with threads ") + threads);
+  }
+  fs::remove_all(output_dir);
+  run_command_output("./kar unpack --quiet - " + output_dir.string() + " < " + grouped);
+  check_output("Unpack from stdin");
+  auto verify = run_command_output("./kar verify --quiet " + grouped + " 2>&1");
+  TEST_ASSERT(verify.find(" 0 failed") != std::string::npos,
+              "Verify failed: " + verify);
+
+  // 单个成员的提取只切出自己的内容
+  fs::remove_all(output_dir);
+  run_command_output("./kar extract --quiet --output " + output_dir.string() + " " +
+                     grouped + " d2/f10.h");
+  TEST_ASSERT(read_file_string(output_dir / "d2/f10.h") == expected["d2/f10.h"] &&
+                  !fs::exists(output_dir / "d2/f11.md"),
+              "Extracting a solid member failed");
+
+  // list 按原始顺序列出，与扫描布局的归档一致
+  run_command_output("./kar pack --quiet --threads 1 --codec lz4 " + test_dir.string() +
+                     " test_crc_tmp/scan.kar");
+  auto names = [](const std::string &list) {
+    std::vector<std::string> result;
+    std::istringstream in(list);
+    std::string line;
+    while (std::getline(in, line)) {
+      const size_t paren = line.find(" (");
+      if (paren != std::string::npos && line.find("Archive") != 0) {
+        result.push_back(line.substr(0, paren));
+      }
+    }
+    return result;
+  };
+  const auto grouped_list = run_command_output("./kar list " + grouped);
+  TEST_ASSERT(grouped_list.find(", solid") != std::string::npos,
+              "Small files were not packed into solid blocks: " + grouped_list);
+  TEST_ASSERT(names(grouped_list) ==
+                  names(run_command_output("./kar list test_crc_tmp/scan.kar")),
+              "List order does not match the original order");
+
+  // 原样存储的大文件 payload 位于页边界
+  const size_t blob_at = bytes.find(blob.substr(0, 64));
+  TEST_ASSERT(blob_at != std::string::npos && blob_at % 4096 == 0,
+              "Large entry is not aligned: offset " + std::to_string(blob_at));
+
+  // 只有小文件时（不计对齐补齐），固实块使归档更小
+  fs::remove(test_dir / "d1" / "blob.bin");
+  for (const char *layout : {"scan", "grouped"}) {
+    run_command_output("./kar pack --quiet --codec lz4 --layout " +
+                       std::string(layout) + " " + test_dir.string() +
+                       " test_crc_tmp/" + layout + ".kar");
+  }
+  TEST_ASSERT(fs::file_size("test_crc_tmp/grouped.kar") <
+                  fs::file_size("test_crc_tmp/scan.kar"),
+              "Solid blocks did not make the archive smaller");
+
+  std::cout << "  ✓ Grouped layout packs solid blocks, aligns large files and keeps the original order\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 31: 直接 I/O 打包（O_DIRECT 写出、对齐与回填）
+// ============================================
+void test_direct_io() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path output_dir = "test_crc_tmp/output";
+  const std::string archive = "test_crc_tmp/direct.kar";
+
+  // 小文件 + 跨多个分块的不可压缩大文件（分块条目头需要回填）
+  setup_test_files(test_dir);
+  std::map<std::string, std::string> expected{{"a.txt", "hello"},
+                                              {"subdir/b.txt", "world"}};
+  std::string blob(9 * 1024 * 1024 + 123, '\0');
+  uint32_t state = 54321;
+  for (char &c : blob) {
+    state = state * 1103515245 + 12345;
+    c = static_cast<char>(state >> 24);
+  }
+  std::ofstream(test_dir / "blob.bin", std::ios::binary) << blob;
+  expected["blob.bin"] = blob;
+  const std::string text(3 * 1024 * 1024, 'k');
+  std::ofstream(test_dir / "text.txt", std::ios::binary) << text;
+  expected["text.txt"] = text;
+
+  // 串行、并行与直接读取源文件的输出一致
+  run_command_output("./kar pack --quiet --threads 1 --direct " + test_dir.string() +
+                     " " + archive);
+  const std::string bytes = read_archive_masked(archive);
+  for (const char *extra : {"--threads 4 --direct", "--threads 4 --direct-sources",
+                            "--threads 1 --direct-sources --io uring"}) {
+    run_command_output("./kar pack --quiet " + std::string(extra) + " " +
+                       test_dir.string() + " test_crc_tmp/direct2.kar");
+    TEST_ASSERT(!bytes.empty() && bytes == read_archive_masked("test_crc_tmp/direct2.kar"),
+                std::string("Direct archive differs with ") + extra);
+  }
+
+  // 原样存储的大文件 payload 位于页边界；归档截断到实际大小
+  const size_t blob_at = bytes.find(blob.substr(0, 64));
+  TEST_ASSERT(blob_at != std::string::npos && blob_at % 4096 == 0,
+              "Large entry is not aligned: offset " + std::to_string(blob_at));
+
+  for (const char *codec : {"none", "lz4"}) {
+    run_command_output("./kar pack --quiet --direct --codec " + std::string(codec) +
+                       " " + test_dir.string() + " " + archive);
+    auto verify = run_command_output("./kar verify --quiet " + archive + " 2>&1");
+    TEST_ASSERT(verify.find(" 0 failed") != std::string::npos,
+                std::string("Verify failed with ") + codec + ": " + verify);
+    fs::remove_all(output_dir);
+    run_command_output("./kar unpack --quiet " + archive + " " + output_dir.string());
+    for (const auto &[rel, content] : expected) {
+      TEST_ASSERT(read_file_string(output_dir / rel) == content,
+                  std::string("Content mismatch with ") + codec + " for " + rel);
+    }
+  }
+
+  // 标准输出与分卷输出不支持直接 I/O
+  TEST_ASSERT(std::system(("./kar pack --quiet --direct " + test_dir.string() +
+                           " - > /dev/null 2>&1").c_str()) != 0,
+              "Direct I/O to standard output should be rejected");
+  TEST_ASSERT(std::system(("./kar pack --quiet --direct --volume-size 1M " +
+                           test_dir.string() + " " + archive + " > /dev/null 2>&1")
+                              .c_str()) != 0,
+              "Direct I/O with volumes should be rejected");
+
+  std::cout << "  ✓ Direct I/O packs aligned, backfilled archives identical across threads\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 32: 扫描缓存（未变目录沿用列表，--trust-dir-mtime）
+// ============================================
+void test_scan_cache() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path output_dir = "test_crc_tmp/output";
+  const std::string cache = "test_crc_tmp/scan.cache";
+
+  setup_test_files(test_dir);
+  for (int d = 0; d < 3; ++d) {
+    const fs::path dir = test_dir / ("d" + std::to_string(d)) / "inner";
+    fs::create_directories(dir);
+    for (int i = 0; i < 5; ++i) {
+      std::ofstream(dir / ("f" + std::to_string(i) + ".txt"))
+          << "file " << d << "/" << i << "\n";
+    }
+  }
+  // 刚改动过的目录（时间戳粒度内）不沿用缓存：等过这段窗口
+  std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+
+  auto pack = [&](const std::string &archive, const std::string &extra) {
+    return run_command_output("./kar pack --quiet --scan-cache " + cache + " " +
+                              extra + " " + test_dir.string() + " " + archive +
+                              " 2>&1");
+  };
+  auto cached_dirs = [](const std::string &output) {
+    const size_t at = output.find(" directories from scan cache");
+    const size_t start = output.rfind(' ', at - 1);
+    return at == std::string::npos ? -1
+                                   : std::stoi(output.substr(start + 1, at - start - 1));
+  };
+  // 源目录、subdir 与 3 × (dN, dN/inner)
+  const int dir_count = 8;
+
+  auto first = pack("test_crc_tmp/a.kar", "");
+  TEST_ASSERT(cached_dirs(first) == 0 && fs::exists(cache),
+              "First pack should create the scan cache: " + first);
+  for (const char *threads : {"1", "4"}) {
+    auto again = pack("test_crc_tmp/b.kar",
+                      std::string("--threads ") + threads +
+                          " --incremental test_crc_tmp/a.kar");
+    TEST_ASSERT(cached_dirs(again) == dir_count &&
+                    again.find("17 unchanged from base") != std::string::npos,
+                std::string("Unchanged tree was not served from the cache (threads ") +
+                    threads + "): " + again);
+  }
+
+  // 就地修改文件不改变目录：默认仍逐个 stat，能发现变化
+  std::ofstream(test_dir / "d1/inner/f2.txt") << "modified in place\n";
+  auto trusted = pack("test_crc_tmp/c.kar",
+                      "--trust-dir-mtime --incremental test_crc_tmp/b.kar");
+  TEST_ASSERT(cached_dirs(trusted) == dir_count &&
+                  trusted.find("17 unchanged from base") != std::string::npos,
+              "Trusted scan should skip file stats: " + trusted);
+  pack("test_crc_tmp/c.kar", "--incremental test_crc_tmp/b.kar");
+  fs::remove_all(output_dir);
+  run_command_output("./kar unpack --quiet test_crc_tmp/c.kar " + output_dir.string());
+  TEST_ASSERT(read_file_string(output_dir / "d1/inner/f2.txt") == "modified in place\n",
+              "In-place modification was missed without --trust-dir-mtime");
+
+  // 新增文件改变目录的 mtime：即使信任目录 mtime 也会重新列出
+  std::ofstream(test_dir / "d2/new.txt") << "new\n";
+  auto added = pack("test_crc_tmp/d.kar",
+                    "--trust-dir-mtime --incremental test_crc_tmp/c.kar");
+  TEST_ASSERT(cached_dirs(added) == dir_count - 1 &&
+                  run_command_output("./kar list test_crc_tmp/d.kar").find("d2/new.txt") !=
+                      std::string::npos,
+              "New file was not picked up: " + added);
+
+  // 损坏的缓存：警告后完整扫描
+  corrupt_archive_at(cache, 40, 0x5A);
+  auto damaged = pack("test_crc_tmp/e.kar", "");
+  TEST_ASSERT(damaged.find("Warning: scan cache") != std::string::npos &&
+                  cached_dirs(damaged) == 0,
+              "Damaged scan cache was not rejected: " + damaged);
+  auto verify = run_command_output("./kar verify --quiet test_crc_tmp/e.kar 2>&1");
+  TEST_ASSERT(verify.find(" 0 failed") != std::string::npos, "Verify failed: " + verify);
+
+  TEST_ASSERT(std::system(("./kar pack --quiet --trust-dir-mtime " + test_dir.string() +
+                           " test_crc_tmp/f.kar > /dev/null 2>&1").c_str()) != 0,
+              "--trust-dir-mtime without a scan cache should be rejected");
+
+  std::cout << "  ✓ Scan cache reuses unchanged directories and detects changes\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 33: 自适应并发与带宽上限（--adaptive / --bwlimit）
+// ============================================
+void test_adaptive_and_bwlimit() {
+  const fs::path test_dir = "test_crc_tmp/source";
+  const fs::path output_dir = "test_crc_tmp/output";
+  const std::string archive = "test_crc_tmp/adaptive.kar";
+
+  // 小文件 + 跨多个分块的大文件，共约 6.3 MB
+  setup_test_files(test_dir);
+  std::map<std::string, std::string> expected{{"a.txt", "hello"},
+                                              {"subdir/b.txt", "world"}};
+  std::string blob(6 * 1024 * 1024, '\0');
+  uint32_t state = 2024;
+  for (char &c : blob) {
+    state = state * 1103515245 + 12345;
+    c = static_cast<char>(state >> 24);
+  }
+  std::ofstream(test_dir / "blob.bin", std::ios::binary) << blob;
+  expected["blob.bin"] = blob;
+  for (int i = 0; i < 40; ++i) {
+    const std::string rel = "small/f" + std::to_string(i) + ".txt";
+    fs::create_directories(test_dir / "small");
+    expected[rel] = std::string(4096 + i * 97, static_cast<char>('a' + i % 26));
+    std::ofstream(test_dir / rel, std::ios::binary) << expected[rel];
+  }
+  auto check_output = [&](const std::string &what) {
+    for (const auto &[rel, content] : expected) {
+      TEST_ASSERT(read_file_string(output_dir / rel) == content,
+                  "Content mismatch after " + what + " for " + rel);
+    }
+  };
+  auto settled_threads = [](const std::string &output) {
+    const size_t at = output.find("settled on ");
+    return at == std::string::npos ? -1 : std::stoi(output.substr(at + 11));
+  };
+
+  // 自适应并发：内容与固定线程数一致，并报告最后采用的线程数（不超过上限）
+  auto packed = run_command_output("./kar pack --quiet --threads 4 --adaptive " +
+                                   test_dir.string() + " " + archive + " 2>&1");
+  const int pack_threads = settled_threads(packed);
+  TEST_ASSERT(pack_threads >= 1 && pack_threads <= 4,
+              "Adaptive pack did not report its thread count: " + packed);
+  fs::remove_all(output_dir);
+  auto unpacked = run_command_output("./kar unpack --quiet --threads 4 --adaptive " +
+                                     archive + " " + output_dir.string() + " 2>&1");
+  const int unpack_threads = settled_threads(unpacked);
+  TEST_ASSERT(unpack_threads >= 1 && unpack_threads <= 4,
+              "Adaptive unpack did not report its thread count: " + unpacked);
+  check_output("adaptive unpack");
+
+  // 带宽上限（串行与并行路径）：8 MB/s 下耗时不少于扣除初始突发量（100 ms 的配额）
+  // 后的理论时间，也不多于同一命令不限速的耗时加上理论时间的 1.3 倍
+  // （限速器休眠过长、或突发之后不再限速都会失败）
+  auto timed = [](const std::string &cmd) {
+    const auto start = std::chrono::steady_clock::now();
+    run_command_output(cmd);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+        .count();
+  };
+  uint64_t content_bytes = 0;
+  for (const auto &[rel, content] : expected) {
+    content_bytes += content.size();
+  }
+  const double rate = 8.0 * 1024 * 1024;
+  const double ideal = static_cast<double>(content_bytes) / rate;
+  const double min_seconds = (ideal - 0.1) * 0.9;
+  const double slack = ideal * 1.3 + 0.15;
+  auto in_range = [&](double seconds, double unthrottled) {
+    return seconds >= min_seconds && seconds <= unthrottled + slack;
+  };
+  auto describe = [&](const std::string &what, double seconds,
+                      double unthrottled) {
+    return "--bwlimit 8 " + what + " took " + std::to_string(seconds) +
+           " s, expected " + std::to_string(min_seconds) + ".." +
+           std::to_string(unthrottled + slack) + " s";
+  };
+  for (const char *threads : {"1", "4"}) {
+    const std::string pack_cmd = "./kar pack --quiet --threads " +
+                                 std::string(threads) + " " + test_dir.string() +
+                                 " " + archive;
+    const double pack_free = timed(pack_cmd);
+    const double pack_seconds = timed(pack_cmd + " --bwlimit 8");
+    TEST_ASSERT(in_range(pack_seconds, pack_free),
+                describe(std::string("pack (threads ") + threads + ")",
+                         pack_seconds, pack_free));
+
+    const std::string unpack_cmd = "./kar unpack --quiet --threads " +
+                                   std::string(threads) + " " + archive + " " +
+                                   output_dir.string();
+    fs::remove_all(output_dir);
+    const double unpack_free = timed(unpack_cmd);
+    fs::remove_all(output_dir);
+    const double unpack_seconds = timed(unpack_cmd + " --bwlimit 8");
+    TEST_ASSERT(in_range(unpack_seconds, unpack_free),
+                describe(std::string("unpack (threads ") + threads + ")",
+                         unpack_seconds, unpack_free));
+    check_output(std::string("throttled unpack with ") + threads + " threads");
+  }
+
+  for (const char *bad : {"0", "-5", "fast"}) {
+    TEST_ASSERT(std::system(("./kar pack --quiet --bwlimit " + std::string(bad) + " " +
+                             test_dir.string() + " " + archive + " > /dev/null 2>&1")
+                                .c_str()) != 0,
+                std::string("Invalid --bwlimit should be rejected: ") + bad);
+  }
+
+  std::cout << "  ✓ Adaptive concurrency round-trips and --bwlimit caps throughput\n";
+
+  // 清理
+  fs::remove_all("test_crc_tmp");
+}
+
+// ============================================
+// 测试用例 34: ConcurrencyTuner 爬山搜索（合成吞吐，确定性）
+// ============================================
+void test_concurrency_tuner() {
+  // 每个窗口按当前线程数查表得到吞吐，记录各窗口使用的线程数
+  auto drive = [](ConcurrencyTuner &tuner, auto rate_of, int windows) {
+    std::vector<size_t> used;
+    for (int i = 0; i < windows; ++i) {
+      used.push_back(tuner.workers());
+      tuner.update(rate_of(tuner.workers()));
+    }
+    return used;
+  };
+
+  // 吞吐随线程数单调提高：一路向上，停在上限
+  {
+    ConcurrencyTuner tuner(16, 4);
+    auto used = drive(tuner, [](size_t w) { return 100.0 * w; }, 20);
+    TEST_ASSERT(tuner.best() == 16 && tuner.workers() == 16,
+                "Tuner did not climb to the best count: " +
+                    std::to_string(tuner.best()));
+    TEST_ASSERT(used[0] == 4 && used[1] == 8 && used[3] == 12 && used[5] == 16,
+                "Tuner did not climb step by step while throughput improved");
+  }
+
+  // 试探后吞吐下降：退回已接受的线程数
+  {
+    ConcurrencyTuner tuner(8, 8);
+    auto rate = [](size_t w) { return w == 8 ? 100.0 : 50.0; };
+    tuner.update(rate(8)); // 起点的测量
+    const size_t probe = tuner.workers();
+    TEST_ASSERT(probe < 8, "Tuner did not probe below the start");
+    tuner.update(rate(probe)); // 调整后的过渡窗口不计入比较
+    TEST_ASSERT(tuner.workers() == probe, "Warm-up window was not skipped");
+    tuner.update(rate(probe)); // 吞吐下降
+    TEST_ASSERT(tuner.best() == 8 && tuner.workers() != probe,
+                "Tuner kept a worker count that regressed");
+    drive(tuner, rate, 10);
+    TEST_ASSERT(tuner.best() == 8 && tuner.workers() == 8,
+                "Tuner did not back off to the best count");
+  }
+
+  // 上下限：任意吞吐序列下线程数都在 [1, max] 内；max 为 1 时不变
+  {
+    for (size_t max : {size_t{1}, size_t{3}, size_t{16}}) {
+      ConcurrencyTuner tuner(max, 0);
+      uint32_t state = 7;
+      for (int i = 0; i < 500; ++i) {
+        state = state * 1103515245 + 12345;
+        const size_t w = tuner.update(static_cast<double>(state >> 8));
+        TEST_ASSERT(w >= 1 && w <= max && tuner.best() >= 1 &&
+                        tuner.best() <= max,
+                    "Tuner left [1, " + std::to_string(max) +
+                        "]: " + std::to_string(w));
+      }
+    }
+    ConcurrencyTuner clamped(4, 9);
+    TEST_ASSERT(clamped.workers() == 4, "Initial count was not clamped");
+  }
+
+  // 单峰吞吐（峰值在 6）：收敛到峰值并保持，只在定期重新试探时短暂离开
+  {
+    ConcurrencyTuner tuner(16, 16);
+    auto rate = [](size_t w) {
+      const double d = static_cast<double>(w) - 6;
+      return 1000 - 20 * d * d;
+    };
+    drive(tuner, rate, 40);
+    TEST_ASSERT(tuner.best() == 6, "Tuner did not settle on the peak: " +
+                                       std::to_string(tuner.best()));
+    auto used = drive(tuner, rate, 200);
+    size_t at_peak = 0;
+    size_t changes = 0;
+    for (size_t i = 0; i < used.size(); ++i) {
+      at_peak += used[i] == 6;
+      changes += i > 0 && used[i] != used[i - 1];
+      TEST_ASSERT(used[i] >= 5 && used[i] <= 7,
+                  "Settled tuner wandered to " + std::to_string(used[i]));
+    }
+    TEST_ASSERT(at_peak >= used.size() * 8 / 10 &&
+                    changes <= used.size() / ConcurrencyTuner::kSettledWindows * 4 + 4,
+                "Tuner oscillated: " + std::to_string(changes) + " changes, " +
+                    std::to_string(at_peak) + " windows at the peak");
+  }
+
+  // 吞吐不随线程数变化（差异不超过 kMinGain）：停在起点
+  {
+    ConcurrencyTuner tuner(16, 8);
+    drive(tuner, [](size_t w) { return 1000.0 + (w % 2); }, 60);
+    TEST_ASSERT(tuner.best() == 8, "Tuner moved on flat throughput to " +
+                                       std::to_string(tuner.best()));
+  }
+
+  std::cout << "  ✓ Tuner climbs, backs off, stays in bounds and settles\n";
+}
+
+// ============================================
+// 测试用例 35: WorkStealingDeque 并发取元素（每个元素恰好被取走一次）
+// ============================================
+void test_work_stealing_deque() {
+  // 计数表：元素是指向 ids 的指针，取走时按下标计数
+  auto all_once = [](const std::vector<std::atomic<int>> &counts) {
+    return std::all_of(counts.begin(), counts.end(),
+                       [](const std::atomic<int> &c) { return c.load() == 1; });
+  };
+
+  // 单线程交错：最后一个元素先被窃取则 pop 失败；所有者 LIFO、窃取者 FIFO；
+  // 从容量 2 扩容后顺序不变、元素不丢
+  {
+    int a = 0, b = 0;
+    WorkStealingDeque<int *> deque(2);
+    int *x = nullptr;
+    deque.push(&a);
+    TEST_ASSERT(deque.steal(x) && x == &a && !deque.pop(x) && deque.empty(),
+                "Pop returned an element that was already stolen");
+    deque.push(&a);
+    TEST_ASSERT(deque.pop(x) && x == &a && !deque.steal(x),
+                "Steal returned an element that was already popped");
+    deque.push(&a);
+    deque.push(&b);
+    TEST_ASSERT(deque.pop(x) && x == &b && deque.steal(x) && x == &a &&
+                    !deque.pop(x) && !deque.steal(x),
+                "Owner should pop LIFO and thieves steal FIFO");
+
+    std::vector<int> ids(10);
+    for (int &id : ids) {
+      deque.push(&id);
+    }
+    bool ordered = deque.steal(x) && x == &ids[0] && deque.steal(x) &&
+                   x == &ids[1];
+    for (int i = 9; i >= 2; --i) {
+      ordered = ordered && deque.pop(x) && x == &ids[i];
+    }
+    TEST_ASSERT(ordered && deque.empty(), "Deque lost order while growing");
+  }
+
+  // 所有者 pop 与窃取者 steal 竞争最后一个元素：每轮只放入一个元素，
+  // 所有者隔一段长短不一的时间后取回，另一线程不停窃取
+  // （压力测试，多核上两者才会真正同时进入竞争窗口）
+  {
+    constexpr int kRounds = 200000;
+    WorkStealingDeque<int *> deque(2);
+    std::vector<int> ids(kRounds);
+    std::vector<std::atomic<int>> counts(kRounds);
+    std::atomic<bool> done{false};
+    std::atomic<int> stolen{0};
+    std::thread thief([&] {
+      int *x = nullptr;
+      while (!done.load(std::memory_order_acquire)) {
+        if (deque.steal(x)) {
+          counts[x - ids.data()].fetch_add(1);
+          stolen.fetch_add(1);
+        }
+      }
+    });
+    int popped = 0;
+    for (int i = 0; i < kRounds; ++i) {
+      deque.push(&ids[i]);
+      for (volatile int spin = 0; spin < i % 32; ++spin) {
+      }
+      int *x = nullptr;
+      if (deque.pop(x)) {
+        counts[x - ids.data()].fetch_add(1);
+        ++popped;
+      }
+    }
+    done.store(true, std::memory_order_release);
+    thief.join();
+    TEST_ASSERT(deque.empty(), "Deque not empty after the last-element race");
+    TEST_ASSERT(popped + stolen.load() == kRounds && all_once(counts),
+                "Last-element race lost or duplicated items: popped " +
+                    std::to_string(popped) + ", stolen " +
+                    std::to_string(stolen.load()));
+  }
+
+  // 初始容量 2，所有者成批 push（反复扩容）并穿插 pop，3 个窃取者同时窃取
+  {
+    constexpr int kItems = 100000;
+    WorkStealingDeque<int *> deque(2);
+    std::vector<int> ids(kItems);
+    std::vector<std::atomic<int>> counts(kItems);
+    std::atomic<bool> done{false};
+    std::vector<std::thread> thieves;
+    for (int t = 0; t < 3; ++t) {
+      thieves.emplace_back([&] {
+        int *x = nullptr;
+        while (!done.load(std::memory_order_acquire) || !deque.empty()) {
+          if (deque.steal(x)) {
+            counts[x - ids.data()].fetch_add(1);
+          }
+        }
+      });
+    }
+    int *x = nullptr;
+    for (int i = 0; i < kItems; ++i) {
+      deque.push(&ids[i]);
+      if (i % 7 == 6 && deque.pop(x)) {
+        counts[x - ids.data()].fetch_add(1);
+      }
+    }
+    while (deque.pop(x)) {
+      counts[x - ids.data()].fetch_add(1);
+    }
+    done.store(true, std::memory_order_release);
+    for (auto &t : thieves) {
+      t.join();
+    }
+    TEST_ASSERT(all_once(counts),
+                "Growing deque lost or duplicated items under steals");
+  }
+
+  std::cout << "  ✓ Every item is taken exactly once under pop/steal races\n";
+}
+
+// ============================================
+// 测试用例 36: ThreadPool 嵌套提交与 set_active（每个任务恰好执行一次）
+// ============================================
+void test_thread_pool_scheduling() {
+  auto all_once = [](const std::vector<std::atomic<int>> &runs) {
+    return std::all_of(runs.begin(), runs.end(),
+                       [](const std::atomic<int> &r) { return r.load() == 1; });
+  };
+
+  // 工作线程内提交子任务（进入该线程自己的队列，可被其他线程窃取），
+  // 子任务再提交一层
+  {
+    constexpr int kOuter = 64, kInner = 8;
+    std::vector<std::atomic<int>> outer(kOuter);
+    std::vector<std::atomic<int>> inner(kOuter * kInner);
+    std::vector<std::atomic<int>> leaf(kOuter * kInner);
+    ThreadPool pool(4);
+    for (int i = 0; i < kOuter; ++i) {
+      pool.submit([&, i] {
+        outer[i].fetch_add(1);
+        for (int j = 0; j < kInner; ++j) {
+          const int k = i * kInner + j;
+          pool.submit([&, k] {
+            inner[k].fetch_add(1);
+            pool.submit([&, k] { leaf[k].fetch_add(1); });
+          });
+        }
+      });
+    }
+    pool.wait_all();
+    TEST_ASSERT(all_once(outer) && all_once(inner) && all_once(leaf),
+                "Nested submits were lost or run twice");
+  }
+
+  // 任务排队时把活动线程数缩到 1（被停用线程自己队列里的子任务仍要执行），
+  // 只有一个活动线程时继续推进，再扩回全部线程
+  {
+    constexpr int kTasks = 400;
+    std::vector<std::atomic<int>> runs(kTasks * 2);
+    std::atomic<int> finished{0};
+    ThreadPool pool(4);
+    auto task = [&](int k) {
+      pool.submit([&, k] {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        runs[k].fetch_add(1);
+        pool.submit([&, k] {
+          runs[kTasks + k].fetch_add(1);
+          finished.fetch_add(1);
+        });
+      });
+    };
+    for (int k = 0; k < kTasks / 2; ++k) {
+      task(k);
+    }
+    pool.set_active(1);
+    TEST_ASSERT(pool.active() == 1, "set_active(1) was not applied");
+    for (int k = kTasks / 2; k < kTasks * 3 / 4; ++k) {
+      task(k);
+    }
+    // 单个活动线程也要继续完成任务
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (finished.load() < kTasks / 4 &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    TEST_ASSERT(finished.load() >= kTasks / 4,
+                "Pool stalled with one active worker: " +
+                    std::to_string(finished.load()) + " tasks finished");
+    pool.set_active(pool.size());
+    TEST_ASSERT(pool.active() == pool.size(), "set_active did not grow back");
+    for (int k = kTasks * 3 / 4; k < kTasks; ++k) {
+      task(k);
+    }
+    pool.wait_all();
+    TEST_ASSERT(all_once(runs) && finished.load() == kTasks,
+                "Tasks lost or run twice across set_active changes");
+  }
+
+  std::cout << "  ✓ Nested submits and set_active changes run each task once\n";
+}
+
 int main() {
   std::cout << "========================================\n";
   std::cout << "  CRC32 功能测试套件\n";
@@ -362,10 +2724,43 @@ int main() {
 
   // 运行所有测试
   RUN_TEST(test_crc32_known_values);
+  RUN_TEST(test_crc32_engines_agree);
+  RUN_TEST(test_crc32_streaming_and_combine);
   RUN_TEST(test_pack_unpack_normal);
   RUN_TEST(test_content_integrity);
   RUN_TEST(test_crc_mismatch_detection);
   RUN_TEST(test_empty_file);
+  RUN_TEST(test_parallel_pack_matches_serial);
+  RUN_TEST(test_large_file_streaming);
+  RUN_TEST(test_io_backends_roundtrip);
+  RUN_TEST(test_index_and_v1_compat);
+  RUN_TEST(test_selective_extract);
+  RUN_TEST(test_parallel_unpack);
+  RUN_TEST(test_codec_roundtrip);
+  RUN_TEST(test_incompressible_detection);
+  RUN_TEST(test_chunked_entries);
+  RUN_TEST(test_incremental_pack);
+  RUN_TEST(test_dedup_pack);
+  RUN_TEST(test_batched_writes_and_progress);
+  RUN_TEST(test_buffer_pool_reuse);
+  RUN_TEST(test_parallel_scanner);
+  RUN_TEST(test_uring_backend);
+  RUN_TEST(test_streaming_pipe);
+  RUN_TEST(test_progress_and_verify_level);
+  RUN_TEST(test_verify_command);
+  RUN_TEST(test_stage_stats);
+  RUN_TEST(test_v1_wire_format);
+  RUN_TEST(test_unpack_metadata);
+  RUN_TEST(test_sparse_files);
+  RUN_TEST(test_work_stealing_scheduler);
+  RUN_TEST(test_volume_archives);
+  RUN_TEST(test_grouped_layout);
+  RUN_TEST(test_direct_io);
+  RUN_TEST(test_scan_cache);
+  RUN_TEST(test_adaptive_and_bwlimit);
+  RUN_TEST(test_concurrency_tuner);
+  RUN_TEST(test_work_stealing_deque);
+  RUN_TEST(test_thread_pool_scheduling);
 
   // 输出总结
   std::cout << "\n========================================\n";